@@ -0,0 +1,148 @@
+#include "arena.hpp"
+
+
+#define ARENA_MAGIC 0xA4E9Au
+
+typedef struct {
+	uint32_t cls;
+	uint32_t magic;
+	uint64_t padding; // keeps the payload 16-byte aligned
+} block_t;
+
+
+Arena::Arena(): chunks(NULL), pos(NULL), end(NULL), next_chunk(min_chunk), used(0), peak(0), sys(0) {
+	memset(freelist, 0, sizeof(freelist));
+}
+
+
+Arena::~Arena() {
+	reset();
+}
+
+
+unsigned Arena::size_class(size_t s, size_t& rounded) {
+	// 32 bytes minimum, then four steps per power of two, i.e. at most 25% slack
+	if (s <= 32) {
+		rounded = 32;
+		return 0;
+	}
+	const unsigned b = 63 - __builtin_clzll(s - 1); // s in (2^b, 2^(b+1)]
+	const size_t step = (size_t)1 << (b - 2);
+	rounded = (s + step - 1) & ~(step - 1);
+	return 1 + (b - 5) * 4 + (unsigned)(rounded >> (b - 2)) - 5;
+}
+
+
+size_t Arena::class_size(unsigned cls) {
+	if (!cls) return 32;
+	cls--;
+	return ((size_t)(cls % 4) + 5) << (cls / 4 + 3);
+}
+
+
+void Arena::check(const void* p) {
+	// in all builds, as a foreign pointer would otherwise silently corrupt the free lists
+	const block_t* b = (const block_t*)p - 1;
+	if (b->magic != ARENA_MAGIC || b->cls >= nclasses) {
+		LOG("invalid arena block %p", p);
+		abort();
+	}
+}
+
+
+void* Arena::carve(size_t len) {
+	if ((size_t)(end - pos) < len) {
+		// large blocks get a chunk on their own, so the current one is not wasted
+		const bool own = len > next_chunk / 2;
+		const size_t size = own? len: next_chunk;
+		Chunk* c = (Chunk*)malloc(sizeof(block_t) + size); // header size keeps the alignment
+		if (!c) {
+			LOG("out of memory");
+			abort();
+		}
+		c->next = chunks;
+		c->size = size;
+		chunks = c;
+		sys += size;
+		char* data = (char*)c + sizeof(block_t);
+		if (own) return data;
+		pos = data;
+		end = data + size;
+		next_chunk = MIN(next_chunk * 2, max_chunk);
+	}
+	void* rv = pos;
+	pos += len;
+	return rv;
+}
+
+
+void* Arena::alloc(size_t len) {
+	size_t rounded;
+	const unsigned cls = size_class(len, rounded);
+	assert(cls < nclasses);
+
+	block_t* b;
+	if (freelist[cls]) {
+		b = (block_t*)freelist[cls] - 1;
+		freelist[cls] = *(void**)freelist[cls];
+	} else {
+		b = (block_t*)carve(((sizeof(block_t) + rounded + 15) / 16) * 16);
+		b->cls = cls;
+		b->magic = ARENA_MAGIC;
+	}
+	used += rounded;
+	peak = MAX(peak, used);
+	return b + 1;
+}
+
+
+void* Arena::calloc(size_t n, size_t size) {
+	return memset(alloc(n * size), 0, n * size);
+}
+
+
+void* Arena::realloc(void* p, size_t len) {
+	if (!p) return alloc(len);
+	check(p);
+	const block_t* b = (const block_t*)p - 1;
+	const size_t have = class_size(b->cls);
+	if (len <= have) return p;
+
+	void* rv = alloc(len);
+	memcpy(rv, p, have);
+	free(p);
+	return rv;
+}
+
+
+void Arena::free(void* p) {
+	if (!p) return;
+	check(p);
+	block_t* b = (block_t*)p - 1;
+	*(void**)p = freelist[b->cls];
+	freelist[b->cls] = p;
+	used -= class_size(b->cls);
+}
+
+
+void Arena::reset() {
+	while (chunks) {
+		Chunk* c = chunks;
+		chunks = c->next;
+		::free(c);
+	}
+	pos = end = NULL;
+	next_chunk = min_chunk;
+	memset(freelist, 0, sizeof(freelist));
+	used = sys = 0;
+}
+
+
+void* Arena::zalloc(void* opaque, unsigned items, unsigned size) {
+	return ((Arena*)opaque)->alloc((size_t)items * size);
+}
+
+
+void Arena::zfree(void* opaque, void* p) {
+	((Arena*)opaque)->free(p);
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "main.hpp"
+
+
+/**
+ * Per-font pool allocator: bump allocation from growing chunks, with freed blocks kept in size class free lists for reuse.
+ * Everything is given back at once by reset() or on destruction, not thread-safe as not shared.
+ */
+class Arena {
+	private:
+		struct Chunk {
+			Chunk* next;
+			size_t size;
+		};
+		static const unsigned nclasses = 192;
+		static const size_t min_chunk = 64*1024;
+		static const size_t max_chunk = 4*1024*1024;
+
+		Chunk* chunks;
+		char* pos; // bump pointer into the current chunk
+		char* end;
+		size_t next_chunk;
+		void* freelist[nclasses];
+		size_t used, peak, sys;
+
+		static unsigned size_class(size_t, size_t&);
+		static size_t class_size(unsigned);
+		static void check(const void*); // aborts unless an arena block, also with NDEBUG
+		void* carve(size_t);
+
+	public:
+		Arena();
+		~Arena();
+
+		void* alloc(size_t); // 16-byte aligned
+		void* calloc(size_t, size_t);
+		void* realloc(void*, size_t);
+		void free(void*);
+		void reset();
+
+		size_t getPeak() const { return peak; }
+		size_t getSystem() const { return sys; }
+
+		// zlib z_stream hooks, with the arena as opaque pointer
+		static void* zalloc(void*, unsigned, unsigned);
+		static void zfree(void*, void*);
+};
+
+
+/**
+ * For STL containers, e.g. std::vector<T, ArenaAllocator<T> >.
+ */
+template <class T> class ArenaAllocator {
+	public:
+		typedef T value_type;
+		Arena* arena;
+
+		ArenaAllocator(Arena& a): arena(&a) {}
+		template <class U> ArenaAllocator(const ArenaAllocator<U>& o): arena(o.arena) {}
+
+		T* allocate(size_t n) { return (T*)arena->alloc(n * sizeof(T)); }
+		void deallocate(T* p, size_t) { arena->free(p); }
+
+		template <class U> bool operator==(const ArenaAllocator<U>& o) const { return arena == o.arena; }
+		template <class U> bool operator!=(const ArenaAllocator<U>& o) const { return arena != o.arena; }
+};
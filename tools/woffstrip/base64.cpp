@@ -0,0 +1,75 @@
+#include "base64.hpp"
+#include "io.hpp"
+#include "simd.hpp"
+
+
+#define BASE64_ZBLOCK (16*1024)
+
+
+Base64Stream::Base64Stream(FILE* out, bool z): f(out), deflating(z), ncarry(0), len(0), zlen(0), ok(true) {
+	block = (char*)arena.alloc(BASE64_BLOCK / 3 * 4);
+	zblock = deflating? (char*)arena.alloc(BASE64_ZBLOCK): NULL;
+	zinit(zs, arena);
+	if (deflating && deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) { // as by web servers, rather than the best one
+		deflating = false;
+		ok = false;
+	}
+}
+
+
+Base64Stream::~Base64Stream() {
+	if (deflating) deflateEnd(&zs);
+}
+
+
+void Base64Stream::emit(const char* s, size_t n, bool last) {
+	if (n && fwrite(s, 1, n, f) != n) ok = false;
+	len += n;
+	if (!deflating) return;
+	zs.next_in = (Bytef*)s;
+	zs.avail_in = n;
+	int rv;
+	do { // output only counted
+		zs.next_out = (Bytef*)zblock;
+		zs.avail_out = BASE64_ZBLOCK;
+		rv = deflate(&zs, last? Z_FINISH: Z_NO_FLUSH);
+		zlen += BASE64_ZBLOCK - zs.avail_out;
+	} while (rv == Z_OK && (zs.avail_in || !zs.avail_out || last));
+	if (rv != Z_OK && rv != Z_BUF_ERROR && !(last && rv == Z_STREAM_END)) ok = false;
+}
+
+
+void Base64Stream::write(const void* buf, size_t n) {
+	const uint8_t* p = (const uint8_t*)buf;
+	while (ncarry && n) { // completing the group of the previous chunk
+		carry[ncarry++] = *p++;
+		--n;
+		if (ncarry == 3) {
+			emit(block, base64_encode(block, carry, 3) / 3 * 4);
+			ncarry = 0;
+		}
+	}
+	while (n >= 3) {
+		const size_t used = base64_encode(block, p, MIN(n, (size_t)BASE64_BLOCK));
+		emit(block, used / 3 * 4);
+		p += used;
+		n -= used;
+	}
+	memcpy(carry + ncarry, p, n);
+	ncarry += n;
+}
+
+
+bool Base64Stream::finish() {
+	if (ncarry) {
+		uint8_t rem[3] = {0, 0, 0};
+		memcpy(rem, carry, ncarry);
+		base64_encode(block, rem, 3);
+		memset(block + ncarry + 1, '=', 3 - ncarry);
+		ncarry = 0;
+		emit(block, 4, true);
+	} else {
+		emit(NULL, 0, true);
+	}
+	return ok;
+}
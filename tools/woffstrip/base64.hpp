@@ -0,0 +1,37 @@
+#pragma once
+#include "main.hpp"
+#include "arena.hpp"
+#include <zlib.h>
+
+
+#define BASE64_BLOCK (48*1024) // input bytes encoded at once, a multiple of 3
+
+
+/**
+ * Base64 encoder for output chunks as they are, e.g. for a data URI, with up to 2 bytes carried over from one chunk to the next.
+ * Optionally also deflates the encoded text on the fly, for its size as it would be served compressed.
+ */
+class Base64Stream {
+	private:
+		Arena arena;
+		FILE* f;
+		z_stream zs;
+		bool deflating;
+		uint8_t carry[3];
+		unsigned ncarry;
+		char* block; // encoded
+		char* zblock; // deflated, only counted
+		size_t len, zlen;
+		bool ok;
+
+		void emit(const char*, size_t, bool=false);
+
+	public:
+		Base64Stream(FILE*, bool); // not owned, whether to deflate as well
+		~Base64Stream();
+
+		void write(const void*, size_t);
+		bool finish(); // with padding, false if anything failed
+		size_t size() const { return len; }
+		size_t deflated() const { return zlen; }
+};
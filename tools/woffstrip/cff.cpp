@@ -0,0 +1,1377 @@
+#include "cff.hpp"
+#include <math.h>
+#include <algorithm>
+
+// https://adobe-type-tools.github.io/font-tech-notes/pdfs/5176.CFF.pdf
+// https://adobe-type-tools.github.io/font-tech-notes/pdfs/5177.Type2.pdf
+// https://docs.microsoft.com/en-us/typography/opentype/spec/cff2
+
+
+// DICT operators, escaped ones as 12 << 8 | b1
+#define OP_CHARSET     15
+#define OP_ENCODING    16
+#define OP_CHARSTRINGS 17
+#define OP_PRIVATE     18
+#define OP_SUBRS       19
+#define OP_VSINDEX     22
+#define OP_VSTORE      24
+#define OP_ROS       0x0c1e
+#define OP_FDARRAY   0x0c24
+#define OP_FDSELECT  0x0c25
+
+// charstring operators
+#define CS_HSTEM      1
+#define CS_VSTEM      3
+#define CS_VMOVETO    4
+#define CS_RLINETO    5
+#define CS_HLINETO    6
+#define CS_VLINETO    7
+#define CS_RRCURVETO  8
+#define CS_CALLSUBR   10
+#define CS_RETURN     11
+#define CS_ENDCHAR    14
+#define CS_VSINDEX    15
+#define CS_BLEND      16
+#define CS_HSTEMHM    18
+#define CS_HINTMASK   19
+#define CS_CNTRMASK   20
+#define CS_RMOVETO    21
+#define CS_HMOVETO    22
+#define CS_VSTEMHM    23
+#define CS_RCURVELINE 24
+#define CS_RLINECURVE 25
+#define CS_VVCURVETO  26
+#define CS_HHCURVETO  27
+#define CS_CALLGSUBR  29
+#define CS_VHCURVETO  30
+#define CS_HVCURVETO  31
+#define CS_DOTSECTION 0x0c00
+#define CS_AND        0x0c03
+#define CS_OR         0x0c04
+#define CS_NOT        0x0c05
+#define CS_ABS        0x0c09
+#define CS_ADD        0x0c0a
+#define CS_SUB        0x0c0b
+#define CS_DIV        0x0c0c
+#define CS_NEG        0x0c0e
+#define CS_EQ         0x0c0f
+#define CS_DROP       0x0c12
+#define CS_IFELSE     0x0c16
+#define CS_MUL        0x0c18
+#define CS_SQRT       0x0c1a
+#define CS_DUP        0x0c1b
+#define CS_EXCH       0x0c1c
+#define CS_INDEX      0x0c1d
+#define CS_ROLL       0x0c1e
+#define CS_HFLEX      0x0c22
+#define CS_FLEX       0x0c23
+#define CS_HFLEX1     0x0c24
+#define CS_FLEX1      0x0c25
+
+#define CHARSTRING_DROPPED 0x01
+#define CHARSTRING_OWNED   0x02 // flattened for alignment
+
+
+// SIDs of the StandardEncoding codes, for the components of seac
+static const uint8_t std_sids[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+	17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32,
+	33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
+	49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64,
+	65, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80,
+	81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 96, 97, 98, 99, 100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110,
+	0, 111, 112, 113, 114, 0, 115, 116, 117, 118, 119, 120, 121, 122, 0, 123,
+	0, 124, 125, 126, 127, 128, 129, 130, 131, 0, 132, 133, 0, 134, 135, 136,
+	137, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 138, 0, 139, 0, 0, 0, 0, 140, 141, 142, 143, 0, 0, 0, 0,
+	0, 144, 0, 0, 0, 145, 0, 0, 146, 147, 148, 149, 0, 0, 0, 0,
+};
+
+
+typedef struct {
+	unsigned op;
+	size_t start, end; // operands and operator
+	unsigned n; // operands
+	int32_t v[4]; // the first ones, reals as 0
+} dict_entry_t;
+
+typedef struct {
+	unsigned op;
+	unsigned n; // operands, as 5-byte integers, 0 to remove the entry
+	int32_t v[2];
+} dict_patch_t;
+
+
+static int subr_bias(unsigned count) {
+	return count < 1240? 107: count < 33900? 1131: 32768;
+}
+
+
+static unsigned offset_size(uint32_t v) {
+	return v < 0x100? 1: v < 0x10000? 2: v < 0x1000000? 3: 4;
+}
+
+
+static uint32_t get_be(const uint8_t* p, unsigned n) {
+	uint32_t v = 0;
+	for (unsigned i=0; i<n; ++i) v = (v << 8) | p[i];
+	return v;
+}
+
+
+static char* put_be(char* o, uint32_t v, unsigned n) {
+	for (unsigned i=0; i<n; ++i) o[i] = (char)(v >> (8 * (n-1-i)));
+	return o + n;
+}
+
+
+static bool dict_next(View d, size_t& pos, dict_entry_t& e) {
+	e.start = pos;
+	e.n = 0;
+	while (true) {
+		const uint8_t* b = d.get<uint8_t>(pos);
+		if (!b) return false;
+		const uint8_t b0 = *b;
+		int32_t v = 0;
+		size_t l = 1;
+		if (b0 <= 24) { // operator, 22-24 in CFF2 only
+			if (b0 == 12) {
+				const uint8_t* b1 = d.get<uint8_t>(pos+1);
+				if (!b1) return false;
+				e.op = 0x0c00 | *b1;
+				pos += 2;
+			} else {
+				e.op = b0;
+				pos += 1;
+			}
+			e.end = pos;
+			return true;
+		} else if (b0 == 28) {
+			const wint16_t* w = d.get<wint16_t>(pos+1);
+			if (!w) return false;
+			v = w2int16(*w);
+			l = 3;
+		} else if (b0 == 29) {
+			const wuint32_t* w = d.get<wuint32_t>(pos+1);
+			if (!w) return false;
+			v = (int32_t)w2uint32(*w);
+			l = 5;
+		} else if (b0 == 30) { // real, nibbles up to 0xf
+			const uint8_t* r;
+			do {
+				if (!(r = d.get<uint8_t>(pos+l))) return false;
+				++l;
+			} while ((*r & 0x0f) != 0x0f && (*r & 0xf0) != 0xf0);
+		} else if (b0 >= 32 && b0 <= 246) {
+			v = b0 - 139;
+		} else if (b0 >= 247 && b0 <= 254) {
+			const uint8_t* b1 = d.get<uint8_t>(pos+1);
+			if (!b1) return false;
+			v = (b0 <= 250)? (b0 - 247) * 256 + *b1 + 108: -(b0 - 251) * 256 - *b1 - 108;
+			l = 2;
+		} else {
+			return false; // reserved
+		}
+		if (e.n < 4) e.v[e.n] = v;
+		e.n++;
+		pos += l;
+	}
+}
+
+
+static size_t write_dict(View d, char* o, const dict_patch_t* patches, unsigned npatches) {
+	// as is, but the patched operators with fixed-size operands, so the size does not depend on their values
+	size_t pos = 0, len = 0;
+	dict_entry_t e;
+	while (pos < d.size() && dict_next(d, pos, e)) {
+		const dict_patch_t* p = NULL;
+		for (unsigned k=0; k<npatches && !p; ++k) {
+			if (patches[k].op == e.op) p = &patches[k];
+		}
+		if (!p) {
+			if (o) memcpy(o + len, d.get<char>(e.start, e.end - e.start), e.end - e.start);
+			len += e.end - e.start;
+			continue;
+		} else if (!p->n) {
+			continue;
+		}
+		for (unsigned j=0; j<p->n; ++j) {
+			if (o) {
+				o[len] = 29;
+				put_be(o + len + 1, (uint32_t)p->v[j], 4);
+			}
+			len += 5;
+		}
+		if (e.op > 0xff) {
+			if (o) o[len] = 12;
+			++len;
+		}
+		if (o) o[len] = (char)(e.op & 0xff);
+		++len;
+	}
+	return len;
+}
+
+
+static size_t index_size(unsigned count, size_t datalen, bool cff2) {
+	const size_t count_size = cff2? 4: 2;
+	if (!count) return count_size;
+	return count_size + 1 + (count+1) * offset_size(datalen+1) + datalen;
+}
+
+
+static char* write_index(char* o, unsigned count, const uint32_t* offsets, const char* data, bool cff2) {
+	o = put_be(o, count, cff2? 4: 2);
+	if (!count) return o;
+	const unsigned size = offset_size(offsets[count]+1);
+	*o++ = (char)size;
+	for (unsigned k=0; k<=count; ++k) {
+		o = put_be(o, offsets[k]+1, size);
+	}
+	memcpy(o, data, offsets[count]);
+	return o + offsets[count];
+}
+
+
+static bool cs_number(const uint8_t* p, const uint8_t* end, float& v, unsigned& l) {
+	const uint8_t b0 = *p;
+	if (b0 == 28) {
+		l = 3;
+		if (end - p < 3) return false;
+		v = (int16_t)get_be(p+1, 2);
+	} else if (b0 == 255) { // 16.16 fixed
+		l = 5;
+		if (end - p < 5) return false;
+		v = (float)(int32_t)get_be(p+1, 4) / 65536.0f;
+	} else if (b0 >= 247) {
+		l = 2;
+		if (end - p < 2) return false;
+		v = (b0 <= 250)? (b0 - 247) * 256 + p[1] + 108: -(b0 - 251) * 256 - p[1] - 108;
+	} else {
+		l = 1;
+		v = (int)b0 - 139;
+	}
+	return true;
+}
+
+
+static unsigned literal_size(uint8_t b0) {
+	return (b0 == 28)? 3: (b0 == 255)? 5: (b0 >= 247)? 2: 1;
+}
+
+
+static unsigned cs_encode(int32_t v, uint8_t* o) {
+	if (v >= -107 && v <= 107) {
+		o[0] = (uint8_t)(v + 139);
+		return 1;
+	} else if (v >= 108 && v <= 1131) {
+		v -= 108;
+		o[0] = (uint8_t)(247 + (v >> 8));
+		o[1] = (uint8_t)(v & 0xff);
+		return 2;
+	} else if (v >= -1131 && v <= -108) {
+		v = -v - 108;
+		o[0] = (uint8_t)(251 + (v >> 8));
+		o[1] = (uint8_t)(v & 0xff);
+		return 2;
+	}
+	o[0] = 28;
+	put_be((char*)o+1, (uint32_t)v, 2);
+	return 3;
+}
+
+
+static bool cs_adjust(const uint8_t* p, int adjust, uint8_t* o, unsigned& l) {
+	// a number literal, moved by an integer amount in the same format
+	if (*p == 255) {
+		const int64_t v = (int64_t)(int32_t)get_be(p+1, 4) + (int64_t)adjust * 65536;
+		if (v < INT32_MIN || v > INT32_MAX) return false;
+		o[0] = 255;
+		put_be((char*)o+1, (uint32_t)v, 4);
+		l = 5;
+		return true;
+	}
+	float f;
+	unsigned n;
+	cs_number(p, p + 5, f, n);
+	const int32_t v = (int32_t)f + adjust;
+	if (v < INT16_MIN || v > INT16_MAX) return false;
+	l = cs_encode(v, o);
+	return true;
+}
+
+
+static void cubic_bounds(float p0, float p1, float p2, float p3, float& lo, float& hi) {
+	// extrema of one coordinate where the derivative is 0 within the segment, unless the control points are inside already
+	lo = MIN(lo, p3);
+	hi = MAX(hi, p3);
+	if (p1 >= lo && p1 <= hi && p2 >= lo && p2 <= hi) return;
+	const float a = p3 - 3*p2 + 3*p1 - p0, b = 2*(p2 - 2*p1 + p0), c = p1 - p0;
+	float t[2];
+	unsigned n = 0;
+	if (fabsf(a) < 1e-6f) {
+		if (fabsf(b) > 1e-6f) t[n++] = -c / b;
+	} else {
+		const float d = b*b - 4*a*c;
+		if (d >= 0) {
+			const float s = sqrtf(d);
+			t[n++] = (-b + s) / (2*a);
+			t[n++] = (-b - s) / (2*a);
+		}
+	}
+	for (unsigned k=0; k<n; ++k) {
+		if (t[k] <= 0 || t[k] >= 1) continue;
+		const float u = 1 - t[k];
+		const float v = u*u*u*p0 + 3*u*u*t[k]*p1 + 3*u*t[k]*t[k]*p2 + t[k]*t[k]*t[k]*p3;
+		lo = MIN(lo, v);
+		hi = MAX(hi, v);
+	}
+}
+
+
+static inline unsigned width_arg(bool& parsed, bool present) {
+	// the advance width is an optional first argument of the first stack-clearing operator, CFF only
+	if (parsed) return 0;
+	parsed = true;
+	return present? 1: 0;
+}
+
+
+Cff::Cff(Arena& a): arena(a), buf(NULL, 0), base(NULL), cff2(false), cid(false), hdr_len(0),
+	names_end(0), strings_start(0), strings_end(0), top_offset(0), top_len(0), gbias(0), gused(NULL),
+	charset(0), charset_len(0), encoding(0), encoding_len(0), fdselect(0), fdselect_len(0), fdarray(0), vstore(0), vstore_len(0),
+	sids(NULL), fonts(NULL), nfonts(0), fdsel(NULL), regions(NULL), nvs(0),
+	cs(NULL), cs_len(NULL), cs_state(NULL), changed(false),
+	out(NULL), out_len(0), out_cap(0), px(0), py(0), have_box(false), nhstems(0), move_op(0), move_pos(0) {
+	memset(&gsubrs, 0, sizeof(gsubrs));
+	memset(&charstrings, 0, sizeof(charstrings));
+}
+
+
+Cff::~Cff() {
+	for (unsigned g=0; cs && g<charstrings.count; ++g) {
+		if (cs_state[g] & CHARSTRING_OWNED) arena.free((void*)cs[g]);
+	}
+	for (unsigned i=0; i<nfonts; ++i) {
+		arena.free(fonts[i].subrs.offsets);
+		arena.free(fonts[i].used);
+	}
+	arena.free(fonts);
+	arena.free(gsubrs.offsets);
+	arena.free(charstrings.offsets);
+	arena.free(gused);
+	arena.free(sids);
+	arena.free(fdsel);
+	arena.free(regions);
+	arena.free(cs);
+	arena.free(cs_len);
+	arena.free(cs_state);
+	arena.free(out);
+}
+
+
+bool Cff::read_index(size_t& pos, objects_t& o) {
+	memset(&o, 0, sizeof(o));
+	size_t count;
+	if (cff2) {
+		const wuint32_t* c = buf.get<wuint32_t>(pos);
+		if (!c) return false;
+		count = w2uint32(*c);
+		pos += sizeof(wuint32_t);
+	} else {
+		const wuint16_t* c = buf.get<wuint16_t>(pos);
+		if (!c) return false;
+		count = w2uint16(*c);
+		pos += sizeof(wuint16_t);
+	}
+	if (!count) {
+		o.offsets = (uint32_t*)arena.calloc(1, sizeof(uint32_t));
+		o.data = base + pos;
+		return true;
+	}
+
+	const uint8_t* size = buf.get<uint8_t>(pos);
+	if (!size || *size < 1 || *size > 4) return false;
+	const uint8_t* p = buf.get<uint8_t>(pos+1, (count+1) * *size);
+	if (!p) return false;
+	pos += 1 + (count+1) * *size;
+	o.offsets = (uint32_t*)arena.alloc((count+1) * sizeof(uint32_t));
+	for (size_t k=0; k<=count; ++k) {
+		const uint32_t v = get_be(p + k * *size, *size); // 1-based
+		if (!v || (k && v-1 < o.offsets[k-1]) || (!k && v != 1)) {
+			arena.free(o.offsets);
+			o.offsets = NULL;
+			return false;
+		}
+		o.offsets[k] = v-1;
+	}
+	if (!buf.get<char>(pos, o.offsets[count])) {
+		arena.free(o.offsets);
+		o.offsets = NULL;
+		return false;
+	}
+	o.count = count;
+	o.data = base + pos;
+	pos += o.offsets[count];
+	return true;
+}
+
+
+void Cff::free_objects(objects_t& o) {
+	arena.free(o.offsets);
+	arena.free((void*)o.data);
+	memset(&o, 0, sizeof(o));
+}
+
+
+bool Cff::parse_font(font_t& f, size_t size, size_t offset) {
+	if (offset > buf.size() || size > buf.size() - offset) return false;
+	f.priv = offset;
+	f.priv_len = size;
+	const View d = buf.sub(offset, size);
+	size_t pos = 0, subrs = 0;
+	dict_entry_t e;
+	while (pos < d.size()) {
+		if (!dict_next(d, pos, e)) return false;
+		if (e.op == OP_SUBRS && e.n == 1) {
+			f.has_subrs = true;
+			subrs = e.v[0];
+		} else if (e.op == OP_VSINDEX && e.n == 1 && cff2) {
+			f.vsindex = e.v[0];
+		}
+	}
+	if (f.has_subrs) {
+		size_t p = offset + subrs;
+		if (!read_index(p, f.subrs)) return false;
+	} else {
+		f.subrs.offsets = (uint32_t*)arena.calloc(1, sizeof(uint32_t));
+	}
+	f.bias = subr_bias(f.subrs.count);
+	f.used = (uint8_t*)arena.calloc(MAX(f.subrs.count, 1), sizeof(uint8_t));
+	return true;
+}
+
+
+bool Cff::parse_charset() {
+	// SIDs by glyph, or CIDs that are not needed, only the size then
+	const unsigned n = charstrings.count;
+	if (charset <= 2) {
+		if (!cid && charset == 0) { // ISOAdobe
+			sids = (uint16_t*)arena.alloc(n * sizeof(uint16_t));
+			for (unsigned g=0; g<n; ++g) sids[g] = g;
+		}
+		return true;
+	}
+	const uint8_t* format = buf.get<uint8_t>(charset);
+	if (!format) return false;
+	sids = (uint16_t*)arena.calloc(n, sizeof(uint16_t)); // .notdef first
+	size_t pos = charset + 1;
+	if (*format == 0) {
+		const wuint16_t* v = buf.get<wuint16_t>(pos, n-1);
+		if (!v) return false;
+		for (unsigned g=1; g<n; ++g) sids[g] = w2uint16(v[g-1]);
+		pos += (n-1) * sizeof(wuint16_t);
+	} else if (*format == 1 || *format == 2) {
+		const size_t range = (*format == 1)? 3: 4;
+		for (unsigned g=1; g<n; pos+=range) {
+			const uint8_t* r = buf.get<uint8_t>(pos, range);
+			if (!r) return false;
+			const unsigned first = get_be(r, 2), left = get_be(r+2, range-2);
+			for (unsigned k=0; k<=left && g<n; ++k) sids[g++] = first + k;
+		}
+	} else {
+		return false;
+	}
+	charset_len = pos - charset;
+	if (cid) {
+		arena.free(sids);
+		sids = NULL;
+	}
+	return true;
+}
+
+
+bool Cff::parse_encoding() {
+	// only the size, as seac uses the standard encoding anyways
+	if (encoding <= 1) return true;
+	const uint8_t* format = buf.get<uint8_t>(encoding, 2);
+	if (!format) return false;
+	size_t pos = encoding + 2;
+	if ((format[0] & 0x7f) == 0) {
+		pos += format[1];
+	} else if ((format[0] & 0x7f) == 1) {
+		pos += 2 * format[1];
+	} else {
+		return false;
+	}
+	if (format[0] & 0x80) { // supplements
+		const uint8_t* n = buf.get<uint8_t>(pos);
+		if (!n) return false;
+		pos += 1 + 3 * *n;
+	}
+	if (pos > buf.size()) return false;
+	encoding_len = pos - encoding;
+	return true;
+}
+
+
+bool Cff::parse_fdselect() {
+	const unsigned n = charstrings.count;
+	const uint8_t* format = buf.get<uint8_t>(fdselect);
+	if (!format) return false;
+	fdsel = (uint16_t*)arena.calloc(n, sizeof(uint16_t));
+	size_t pos = fdselect + 1;
+	if (*format == 0) {
+		const uint8_t* v = buf.get<uint8_t>(pos, n);
+		if (!v) return false;
+		for (unsigned g=0; g<n; ++g) fdsel[g] = v[g];
+		pos += n;
+	} else if (*format == 3 || *format == 4) {
+		const unsigned size = (*format == 3)? 2: 4; // of the glyph numbers, fonts have one byte less
+		const uint8_t* c = buf.get<uint8_t>(pos, size);
+		if (!c) return false;
+		const unsigned nranges = get_be(c, size);
+		const uint8_t* r = buf.get<uint8_t>(pos + size, (size_t)nranges * (2*size-1) + size);
+		if (!r || !nranges) return false;
+		for (unsigned k=0; k<nranges; ++k) {
+			const uint8_t* p = r + k * (2*size-1);
+			const uint32_t first = get_be(p, size), next = get_be(p + 2*size-1, size);
+			const unsigned fd = get_be(p + size, size-1);
+			if (first > next || next > n || (!k && first)) return false;
+			for (uint32_t g=first; g<next; ++g) fdsel[g] = fd;
+		}
+		pos += size + (size_t)nranges * (2*size-1) + size;
+	} else {
+		return false;
+	}
+	for (unsigned g=0; g<n; ++g) {
+		if (fdsel[g] >= nfonts) return false;
+	}
+	fdselect_len = pos - fdselect;
+	return true;
+}
+
+
+bool Cff::parse_vstore() {
+	// regions by ItemVariationData, as operands of blend
+	const wuint16_t* l = buf.get<wuint16_t>(vstore);
+	if (!l) return false;
+	vstore_len = sizeof(wuint16_t) + w2uint16(*l);
+	const View v = buf.sub(vstore + sizeof(wuint16_t), w2uint16(*l));
+	const wuint16_t* count = v.get<wuint16_t>(6);
+	if (!count) return false;
+	nvs = w2uint16(*count);
+	const wuint32_t* offsets = v.get<wuint32_t>(8, nvs);
+	if (!offsets) return false;
+	regions = (uint16_t*)arena.alloc(MAX(nvs, 1) * sizeof(uint16_t));
+	for (unsigned k=0; k<nvs; ++k) {
+		const wuint16_t* d = v.get<wuint16_t>(w2uint32(offsets[k]), 3); // itemCount, wordDeltaCount, regionIndexCount
+		if (!d) return false;
+		regions[k] = w2uint16(d[2]);
+	}
+	return true;
+}
+
+
+bool Cff::parse(const char* data, size_t len, bool is_cff2) {
+	buf = View(data, len);
+	base = data;
+	cff2 = is_cff2;
+	const uint8_t* h = buf.get<uint8_t>(0, cff2? 5: 4);
+	if (!h || h[0] != (cff2? 2: 1) || h[2] < (cff2? 5: 4)) {
+		LOG("unsupported CFF version");
+		return false;
+	}
+	hdr_len = h[2];
+	size_t pos = hdr_len;
+	if (cff2) {
+		top_offset = hdr_len;
+		top_len = get_be(h+3, 2);
+		pos += top_len;
+		if (pos > len) return false;
+	} else {
+		objects_t names, top, strings;
+		memset(&top, 0, sizeof(top));
+		memset(&strings, 0, sizeof(strings));
+		bool ok = read_index(pos, names);
+		names_end = pos;
+		ok = ok && read_index(pos, top);
+		strings_start = pos;
+		ok = ok && read_index(pos, strings);
+		arena.free(names.offsets);
+		arena.free(strings.offsets);
+		if (!ok || names.count != 1 || top.count != 1) {
+			arena.free(top.offsets);
+			LOG("CFF font sets are not supported");
+			return false;
+		}
+		top_offset = top.data - base;
+		top_len = top.offsets[1];
+		arena.free(top.offsets);
+		strings_end = pos;
+	}
+	if (!read_index(pos, gsubrs)) return false;
+	gbias = subr_bias(gsubrs.count);
+	gused = (uint8_t*)arena.calloc(MAX(gsubrs.count, 1), sizeof(uint8_t));
+
+	// Top DICT
+	const View td = buf.sub(top_offset, top_len);
+	size_t cs_offset = 0, priv_len = 0, priv = 0;
+	bool has_priv = false;
+	dict_entry_t e;
+	for (pos=0; pos<td.size(); ) {
+		if (!dict_next(td, pos, e)) {
+			LOG("invalid Top DICT");
+			return false;
+		}
+		if (e.op == OP_CHARSTRINGS && e.n == 1) cs_offset = e.v[0];
+		else if (e.op == OP_CHARSET && e.n == 1 && !cff2) charset = e.v[0];
+		else if (e.op == OP_ENCODING && e.n == 1 && !cff2) encoding = e.v[0];
+		else if (e.op == OP_PRIVATE && e.n == 2 && !cff2) {
+			has_priv = true;
+			priv_len = e.v[0];
+			priv = e.v[1];
+		}
+		else if (e.op == OP_FDARRAY && e.n == 1) fdarray = e.v[0];
+		else if (e.op == OP_FDSELECT && e.n == 1) fdselect = e.v[0];
+		else if (e.op == OP_VSTORE && e.n == 1 && cff2) vstore = e.v[0];
+		else if (e.op == OP_ROS) cid = true;
+	}
+	pos = cs_offset;
+	if (!cs_offset || !read_index(pos, charstrings) || !charstrings.count || charstrings.count > 0xffff) {
+		LOG("invalid CharStrings");
+		return false;
+	}
+	const unsigned n = charstrings.count;
+
+	// Font DICTs with their Private DICT each, or the only one of the Top DICT
+	if (fdarray) {
+		objects_t fds;
+		pos = fdarray;
+		if (!read_index(pos, fds) || !fds.count) {
+			arena.free(fds.offsets);
+			LOG("invalid FDArray");
+			return false;
+		}
+		nfonts = fds.count;
+		fonts = (font_t*)arena.calloc(nfonts, sizeof(font_t));
+		bool ok = true;
+		for (unsigned i=0; i<nfonts && ok; ++i) {
+			fonts[i].dict = fds.data - base + fds.offsets[i];
+			fonts[i].dict_len = fds.offsets[i+1] - fds.offsets[i];
+			const View fd = buf.sub(fonts[i].dict, fonts[i].dict_len);
+			size_t fpriv_len = 0, fpriv = 0;
+			for (size_t p=0; p<fd.size() && ok; ) {
+				if (!(ok = dict_next(fd, p, e))) break;
+				if (e.op == OP_PRIVATE && e.n == 2) {
+					fpriv_len = e.v[0];
+					fpriv = e.v[1];
+				}
+			}
+			ok = ok && parse_font(fonts[i], fpriv_len, fpriv);
+		}
+		arena.free(fds.offsets);
+		if (!ok) {
+			LOG("invalid Font DICT");
+			return false;
+		}
+		if (fdselect) {
+			if (!parse_fdselect()) {
+				LOG("invalid FDSelect");
+				return false;
+			}
+		} else if (nfonts > 1) {
+			LOG("missing FDSelect");
+			return false;
+		}
+	} else if (cff2 || cid) {
+		LOG("missing FDArray");
+		return false;
+	} else {
+		nfonts = 1;
+		fonts = (font_t*)arena.calloc(1, sizeof(font_t));
+		if (!parse_font(fonts[0], has_priv? priv_len: 0, has_priv? priv: 0)) {
+			LOG("invalid Private DICT");
+			return false;
+		}
+	}
+	if (vstore && !parse_vstore()) {
+		LOG("invalid VariationStore");
+		return false;
+	}
+	if (!cff2 && (!parse_charset() || !parse_encoding())) {
+		LOG("invalid charset or encoding");
+		return false;
+	}
+
+	cs = (const char**)arena.alloc(n * sizeof(const char*));
+	cs_len = (uint32_t*)arena.alloc(n * sizeof(uint32_t));
+	cs_state = (uint8_t*)arena.calloc(n, sizeof(uint8_t));
+	for (unsigned g=0; g<n; ++g) {
+		cs[g] = charstrings.data + charstrings.offsets[g];
+		cs_len[g] = charstrings.offsets[g+1] - charstrings.offsets[g];
+	}
+	LOG_INFO("parsed %s with %u charstrings, %u global subroutines, %u fonts", cff2? "CFF2": "CFF", n, gsubrs.count, nfonts);
+	return true;
+}
+
+
+void Cff::emit(const uint8_t* p, size_t l) {
+	if (out_len + l > out_cap) {
+		out_cap = MAX(out_cap * 2, out_len + l + 256);
+		out = (char*)arena.realloc(out, out_cap);
+	}
+	memcpy(out + out_len, p, l);
+	out_len += l;
+}
+
+
+void Cff::point() {
+	if (!have_box) {
+		box[0] = box[2] = px;
+		box[1] = box[3] = py;
+		have_box = true;
+		return;
+	}
+	box[0] = MIN(box[0], px);
+	box[1] = MIN(box[1], py);
+	box[2] = MAX(box[2], px);
+	box[3] = MAX(box[3], py);
+}
+
+
+void Cff::line(float dx, float dy) {
+	px += dx;
+	py += dy;
+	point();
+}
+
+
+void Cff::curve(float dx1, float dy1, float dx2, float dy2, float dx3, float dy3) {
+	const float x0 = px, y0 = py;
+	const float x1 = x0 + dx1, y1 = y0 + dy1;
+	const float x2 = x1 + dx2, y2 = y1 + dy2;
+	px = x2 + dx3;
+	py = y2 + dy3;
+	point();
+	cubic_bounds(x0, x1, x2, px, box[0], box[2]);
+	cubic_bounds(y0, y1, y2, py, box[1], box[3]);
+}
+
+
+bool Cff::run(index_t g, bool flatten) {
+	const font_t& f = fonts[fdsel? fdsel[g]: 0];
+	const unsigned max_args = cff2? CFF2_MAX_ARGS: CFF_MAX_ARGS;
+	unsigned depth = 0, sp = 0, nstems = 0, vsindex = f.vsindex;
+	bool width = cff2; // parsed already, none in CFF2
+	px = py = 0;
+	have_box = false;
+	seac[0] = seac[1] = -1;
+	nhstems = 0;
+	move_op = 0;
+	out_len = 0;
+	frames[0].p = (const uint8_t*)cs[g];
+	frames[0].end = frames[0].p + cs_len[g];
+
+	while (true) {
+		frame_t& fr = frames[depth];
+		if (fr.p >= fr.end) {
+			if (!depth) return true; // CFF2, or without endchar
+			--depth; // CFF2 subroutines end without return
+			continue;
+		}
+		const uint8_t* const start = fr.p;
+		const uint8_t b0 = *fr.p;
+		if (b0 == 28 || b0 >= 32) {
+			unsigned l;
+			if (sp >= max_args || !cs_number(fr.p, fr.end, args[sp].v, l)) return false;
+			args[sp].pos = out_len;
+			args[sp].literal = true;
+			++sp;
+			fr.p += l;
+			if (flatten) emit(start, l);
+			continue;
+		}
+		unsigned op = b0;
+		++fr.p;
+		if (b0 == 12) {
+			if (fr.p >= fr.end) return false;
+			op = 0x0c00 | *fr.p++;
+		}
+
+		unsigned base = 0; // first argument, after the width
+		bool clear = true; // the stack, as by most operators
+		switch (op) {
+			case CS_HSTEM:
+			case CS_HSTEMHM:
+			case CS_VSTEM:
+			case CS_VSTEMHM:
+				base = width_arg(width, sp % 2);
+				if ((op == CS_HSTEM || op == CS_HSTEMHM) && sp > base) {
+					if (nhstems < CFF_MAX_HSTEMS) hstems[nhstems] = args[base];
+					++nhstems;
+				}
+				nstems += (sp - base) / 2;
+				break;
+			case CS_HINTMASK:
+			case CS_CNTRMASK: {
+				base = width_arg(width, sp % 2);
+				nstems += (sp - base) / 2; // implicit vstem
+				const size_t l = (nstems + 7) / 8;
+				if ((size_t)(fr.end - fr.p) < l) return false;
+				fr.p += l;
+				break;
+			}
+			case CS_RMOVETO:
+				base = width_arg(width, sp > 2);
+				if (sp < base + 2) return false;
+				if (!move_op) {
+					move_op = op;
+					move_pos = out_len;
+					move_dy = args[base+1];
+				}
+				line(args[base].v, args[base+1].v);
+				break;
+			case CS_HMOVETO:
+			case CS_VMOVETO:
+				base = width_arg(width, sp > 1);
+				if (sp < base + 1) return false;
+				if (!move_op) {
+					move_op = op;
+					move_pos = out_len;
+					move_dy = args[base];
+				}
+				if (op == CS_HMOVETO) line(args[base].v, 0);
+				else line(0, args[base].v);
+				break;
+			case CS_RLINETO:
+				for (unsigned i=0; i+2<=sp; i+=2) line(args[i].v, args[i+1].v);
+				break;
+			case CS_HLINETO:
+			case CS_VLINETO: {
+				bool h = (op == CS_HLINETO);
+				for (unsigned i=0; i<sp; ++i, h=!h) {
+					if (h) line(args[i].v, 0);
+					else line(0, args[i].v);
+				}
+				break;
+			}
+			case CS_RRCURVETO:
+				for (unsigned i=0; i+6<=sp; i+=6) curve(args[i].v, args[i+1].v, args[i+2].v, args[i+3].v, args[i+4].v, args[i+5].v);
+				break;
+			case CS_RCURVELINE: {
+				if (sp < 2) return false;
+				unsigned i = 0;
+				for (; i+6<=sp-2; i+=6) curve(args[i].v, args[i+1].v, args[i+2].v, args[i+3].v, args[i+4].v, args[i+5].v);
+				line(args[i].v, args[i+1].v);
+				break;
+			}
+			case CS_RLINECURVE: {
+				if (sp < 6) return false;
+				unsigned i = 0;
+				for (; i+2<=sp-6; i+=2) line(args[i].v, args[i+1].v);
+				curve(args[i].v, args[i+1].v, args[i+2].v, args[i+3].v, args[i+4].v, args[i+5].v);
+				break;
+			}
+			case CS_VVCURVETO:
+			case CS_HHCURVETO: {
+				unsigned i = sp % 2;
+				float d1 = i? args[0].v: 0; // across the first tangent
+				for (; i+4<=sp; i+=4, d1=0) {
+					if (op == CS_VVCURVETO) curve(d1, args[i].v, args[i+1].v, args[i+2].v, 0, args[i+3].v);
+					else curve(args[i].v, d1, args[i+1].v, args[i+2].v, args[i+3].v, 0);
+				}
+				break;
+			}
+			case CS_HVCURVETO:
+			case CS_VHCURVETO: {
+				bool h = (op == CS_HVCURVETO);
+				for (unsigned i=0; i+4<=sp; i+=4, h=!h) {
+					const float last = (sp - i == 5)? args[i+4].v: 0;
+					if (h) curve(args[i].v, 0, args[i+1].v, args[i+2].v, last, args[i+3].v);
+					else curve(0, args[i].v, args[i+1].v, args[i+2].v, args[i+3].v, last);
+				}
+				break;
+			}
+			case CS_FLEX:
+				if (sp < 13) return false;
+				curve(args[0].v, args[1].v, args[2].v, args[3].v, args[4].v, args[5].v);
+				curve(args[6].v, args[7].v, args[8].v, args[9].v, args[10].v, args[11].v);
+				break;
+			case CS_HFLEX:
+				if (sp < 7) return false;
+				curve(args[0].v, 0, args[1].v, args[2].v, args[3].v, 0);
+				curve(args[4].v, 0, args[5].v, -args[2].v, args[6].v, 0);
+				break;
+			case CS_HFLEX1:
+				if (sp < 9) return false;
+				curve(args[0].v, args[1].v, args[2].v, args[3].v, args[4].v, 0);
+				curve(args[5].v, 0, args[6].v, args[7].v, args[8].v, -(args[1].v + args[3].v + args[7].v));
+				break;
+			case CS_FLEX1: {
+				if (sp < 11) return false;
+				const float dx = args[0].v + args[2].v + args[4].v + args[6].v + args[8].v;
+				const float dy = args[1].v + args[3].v + args[5].v + args[7].v + args[9].v;
+				curve(args[0].v, args[1].v, args[2].v, args[3].v, args[4].v, args[5].v);
+				if (fabsf(dx) > fabsf(dy)) curve(args[6].v, args[7].v, args[8].v, args[9].v, args[10].v, -dy);
+				else curve(args[6].v, args[7].v, args[8].v, args[9].v, -dx, args[10].v);
+				break;
+			}
+			case CS_ENDCHAR:
+				if (cff2) return false;
+				base = width_arg(width, sp == 1 || sp == 5);
+				if (sp == base + 4) { // adx ady bchar achar
+					seac[0] = (int)args[base+2].v;
+					seac[1] = (int)args[base+3].v;
+				}
+				if (flatten) emit(start, fr.p - start);
+				return true; // also from within a subroutine
+			case CS_CALLSUBR:
+			case CS_CALLGSUBR: {
+				if (!sp || depth >= CFF_MAX_CALLS) return false;
+				const arg_t& a = args[--sp];
+				const objects_t& subrs = (op == CS_CALLSUBR)? f.subrs: gsubrs;
+				const int i = (int)a.v + ((op == CS_CALLSUBR)? f.bias: gbias);
+				if (i < 0 || (unsigned)i >= subrs.count) return false;
+				((op == CS_CALLSUBR)? f.used: gused)[i] = 1;
+				if (flatten) { // without the subroutine number, as the operator is not written
+					if (!a.literal || a.pos + literal_size(out[a.pos]) != out_len) return false;
+					out_len = a.pos;
+				}
+				frame_t& next = frames[++depth];
+				next.p = (const uint8_t*)subrs.data + subrs.offsets[i];
+				next.end = (const uint8_t*)subrs.data + subrs.offsets[i+1];
+				continue; // arguments are kept
+			}
+			case CS_RETURN:
+				if (cff2 || !depth) return false;
+				--depth;
+				continue;
+			case CS_VSINDEX:
+				if (!cff2 || !sp) return false;
+				vsindex = (unsigned)args[sp-1].v;
+				break;
+			case CS_BLEND: {
+				// the default values are left, followed by as many deltas for each region
+				if (!cff2 || !sp || vsindex >= nvs) return false;
+				const unsigned k = (unsigned)args[sp-1].v;
+				if ((size_t)k * (regions[vsindex] + 1) + 1 > sp) return false;
+				sp -= 1 + k * regions[vsindex];
+				for (unsigned i=sp-k; i<sp; ++i) args[i].literal = false;
+				clear = false;
+				break;
+			}
+			case CS_DOTSECTION:
+				break;
+			case CS_ABS:
+			case CS_NEG:
+			case CS_NOT:
+			case CS_SQRT: {
+				if (!sp) return false;
+				arg_t& a = args[sp-1];
+				a.v = (op == CS_ABS)? fabsf(a.v): (op == CS_NEG)? -a.v: (op == CS_NOT)? (a.v == 0): sqrtf(fabsf(a.v));
+				a.literal = false;
+				clear = false;
+				break;
+			}
+			case CS_ADD:
+			case CS_SUB:
+			case CS_MUL:
+			case CS_DIV:
+			case CS_AND:
+			case CS_OR:
+			case CS_EQ: {
+				if (sp < 2) return false;
+				const float b = args[--sp].v;
+				arg_t& a = args[sp-1];
+				switch (op) {
+					case CS_ADD: a.v += b; break;
+					case CS_SUB: a.v -= b; break;
+					case CS_MUL: a.v *= b; break;
+					case CS_DIV: a.v = b? a.v / b: 0; break;
+					case CS_AND: a.v = (a.v != 0 && b != 0); break;
+					case CS_OR: a.v = (a.v != 0 || b != 0); break;
+					default: a.v = (a.v == b); break;
+				}
+				a.literal = false;
+				clear = false;
+				break;
+			}
+			case CS_DROP:
+				if (!sp) return false;
+				--sp;
+				clear = false;
+				break;
+			case CS_DUP:
+				if (!sp || sp >= max_args) return false;
+				args[sp] = args[sp-1];
+				args[sp++].literal = false;
+				clear = false;
+				break;
+			case CS_EXCH:
+				if (sp < 2) return false;
+				std::swap(args[sp-2], args[sp-1]);
+				clear = false;
+				break;
+			case CS_INDEX: {
+				if (!sp) return false;
+				const int i = MAX((int)args[sp-1].v, 0);
+				if ((unsigned)i + 1 >= sp) return false;
+				args[sp-1] = args[sp-2-i];
+				args[sp-1].literal = false;
+				clear = false;
+				break;
+			}
+			case CS_ROLL: {
+				if (sp < 2) return false;
+				const int j = (int)args[sp-1].v, k = (int)args[sp-2].v;
+				sp -= 2;
+				if (k < 0 || (unsigned)k > sp) return false;
+				if (k) std::rotate(args + sp - k, args + sp - (((j % k) + k) % k), args + sp); // upwards by j
+				clear = false;
+				break;
+			}
+			case CS_IFELSE:
+				if (sp < 4) return false;
+				sp -= 3;
+				if (args[sp+1].v > args[sp+2].v) args[sp-1] = args[sp];
+				args[sp-1].literal = false;
+				clear = false;
+				break;
+			default: // random, put, get and reserved ones
+				return false;
+		}
+		if (flatten) emit(start, fr.p - start);
+		if (clear) sp = 0;
+	}
+}
+
+
+bool Cff::components(index_t g, index_t* c, unsigned& n) {
+	n = 0;
+	if (cff2 || cid) return true; // in Type 1-style fonts only
+	if (!run(g, false)) return false;
+	if (seac[0] < 0) return true;
+	for (unsigned k=0; k<2; ++k) {
+		const unsigned sid = (seac[k] >= 0 && seac[k] < 256)? std_sids[seac[k]]: 0;
+		index_t i = 0;
+		for (i=0; sid && sids && i<charstrings.count && sids[i] != sid; ++i);
+		if (!sid || !sids || i == charstrings.count) {
+			LOG("unresolved accent component %d of glyph #%u", seac[k], g);
+			continue;
+		}
+		c[n++] = i;
+	}
+	return true;
+}
+
+
+bool Cff::bounds(index_t g, int16_t* bbox) {
+	if ((cs_state[g] & CHARSTRING_DROPPED) || !run(g, false) || !have_box) return false;
+	bbox[0] = (int16_t)MAX(INT16_MIN, floorf(box[0]));
+	bbox[1] = (int16_t)MAX(INT16_MIN, floorf(box[1]));
+	bbox[2] = (int16_t)MIN(INT16_MAX, ceilf(box[2]));
+	bbox[3] = (int16_t)MIN(INT16_MAX, ceilf(box[3]));
+	return true;
+}
+
+
+bool Cff::drop(index_t g) {
+	if (g >= charstrings.count || (cs_state[g] & CHARSTRING_DROPPED)) return false;
+	cs_state[g] |= CHARSTRING_DROPPED;
+	changed = true;
+	return true;
+}
+
+
+int Cff::align(index_t g, int setTo) {
+	// the whole outline moves with the first moveto as everything is relative, the first edge of horizontal hints along
+	if (cs_state[g] & CHARSTRING_DROPPED) {
+		return 0;
+	} else if (!run(g, true)) {
+		LOG("cannot run charstring of glyph #%u", g);
+		return -1;
+	} else if (seac[0] >= 0) {
+		return -1; // accented composite
+	} else if (!have_box || floorf(box[1]) <= setTo) {
+		return 0;
+	}
+	const int adjust = setTo - (int)floorf(box[1]);
+
+	uint8_t lit[6];
+	unsigned l;
+	if (!move_op || (move_op != CS_HMOVETO && (!move_dy.literal || !cs_adjust((const uint8_t*)out + move_dy.pos, adjust, lit, l)))) {
+		LOG("cannot adjust charstring of glyph #%u, going on anyways..", g);
+		return 0;
+	}
+	char* o = (char*)arena.alloc(out_len + (CFF_MAX_HSTEMS + 1) * sizeof(lit));
+	size_t src = 0, dst = 0;
+	for (unsigned k=0; k<MIN(nhstems, CFF_MAX_HSTEMS); ++k) {
+		const arg_t& a = hstems[k];
+		if (!a.literal || a.pos < src || !cs_adjust((const uint8_t*)out + a.pos, adjust, lit, l)) {
+			LOG_INFO("kept hint of glyph #%u", g);
+			continue;
+		}
+		memcpy(o + dst, out + src, a.pos - src);
+		dst += a.pos - src;
+		memcpy(o + dst, lit, l);
+		dst += l;
+		src = a.pos + literal_size(out[a.pos]);
+	}
+	if ((move_op == CS_HMOVETO? move_pos: move_dy.pos) < src) {
+		LOG("cannot adjust charstring of glyph #%u, going on anyways..", g);
+		arena.free(o);
+		return 0;
+	}
+	if (move_op == CS_HMOVETO) { // dx dy rmoveto
+		l = cs_encode(adjust, lit);
+		lit[l++] = CS_RMOVETO;
+		memcpy(o + dst, out + src, move_pos - src);
+		dst += move_pos - src;
+		memcpy(o + dst, lit, l);
+		dst += l;
+		src = move_pos + 1;
+	} else {
+		cs_adjust((const uint8_t*)out + move_dy.pos, adjust, lit, l);
+		memcpy(o + dst, out + src, move_dy.pos - src);
+		dst += move_dy.pos - src;
+		memcpy(o + dst, lit, l);
+		dst += l;
+		src = move_dy.pos + literal_size(out[move_dy.pos]);
+	}
+	memcpy(o + dst, out + src, out_len - src);
+	dst += out_len - src;
+
+	if (cs_state[g] & CHARSTRING_OWNED) arena.free((void*)cs[g]);
+	cs[g] = o;
+	cs_len[g] = dst;
+	cs_state[g] |= CHARSTRING_OWNED;
+	changed = true;
+	LOG_DUMP("  aligned charstring #%u by %d", g, adjust);
+	return setTo;
+}
+
+
+void Cff::build_subrs(const objects_t& in, const uint8_t* used, objects_t& o) {
+	// unused ones as stubs, trailing ones left out as long as the bias stays
+	unsigned n = in.count;
+	while (n && !used[n-1] && subr_bias(n-1) == subr_bias(in.count)) --n;
+	const uint32_t stub = cff2? 0: 1;
+	size_t len = 0;
+	for (unsigned k=0; k<n; ++k) {
+		len += used[k]? in.offsets[k+1] - in.offsets[k]: stub;
+	}
+	char* data = (char*)arena.alloc(MAX(len, 1));
+	o.count = n;
+	o.data = data;
+	o.offsets = (uint32_t*)arena.alloc((n+1) * sizeof(uint32_t));
+	o.offsets[0] = 0;
+	for (unsigned k=0; k<n; ++k) {
+		if (used[k]) {
+			memcpy(data + o.offsets[k], in.data + in.offsets[k], in.offsets[k+1] - in.offsets[k]);
+			o.offsets[k+1] = o.offsets[k] + in.offsets[k+1] - in.offsets[k];
+		} else {
+			if (stub) data[o.offsets[k]] = CS_RETURN;
+			o.offsets[k+1] = o.offsets[k] + stub;
+		}
+	}
+}
+
+
+char* Cff::encode(size_t& len, bool desubroutinize) {
+	const unsigned n = charstrings.count;
+
+	// charstrings, with the subroutines in use by the remaining ones
+	memset(gused, 0, MAX(gsubrs.count, 1));
+	for (unsigned i=0; i<nfonts; ++i) {
+		memset(fonts[i].used, 0, MAX(fonts[i].subrs.count, 1));
+	}
+	objects_t cso;
+	cso.count = n;
+	cso.offsets = (uint32_t*)arena.alloc((n+1) * sizeof(uint32_t));
+	size_t cap = charstrings.offsets[n] + 256;
+	char* csdata = (char*)arena.alloc(cap);
+	static const uint8_t endchar = CS_ENDCHAR;
+	cso.offsets[0] = 0;
+	unsigned dropped = 0;
+	for (unsigned g=0; g<n; ++g) {
+		const char* p = cs[g];
+		size_t l = cs_len[g];
+		if (cs_state[g] & CHARSTRING_DROPPED) {
+			p = (const char*)&endchar;
+			l = cff2? 0: 1;
+			++dropped;
+		} else if (!run(g, desubroutinize)) {
+			LOG("cannot run charstring of glyph #%u", g);
+			arena.free(cso.offsets);
+			arena.free(csdata);
+			return NULL;
+		} else if (desubroutinize) {
+			p = out;
+			l = out_len;
+		}
+		if (cso.offsets[g] + l > cap) {
+			cap = MAX(cap * 2, cso.offsets[g] + l);
+			csdata = (char*)arena.realloc(csdata, cap);
+		}
+		memcpy(csdata + cso.offsets[g], p, l);
+		cso.offsets[g+1] = cso.offsets[g] + l;
+	}
+	cso.data = csdata;
+
+	objects_t gso;
+	objects_t* subrso = (objects_t*)arena.calloc(nfonts, sizeof(objects_t));
+	memset(&gso, 0, sizeof(gso));
+	if (desubroutinize) {
+		gso.offsets = (uint32_t*)arena.calloc(1, sizeof(uint32_t));
+		gso.data = (char*)arena.alloc(1);
+	} else {
+		build_subrs(gsubrs, gused, gso);
+		for (unsigned i=0; i<nfonts; ++i) {
+			if (fonts[i].has_subrs) build_subrs(fonts[i].subrs, fonts[i].used, subrso[i]);
+		}
+	}
+
+	// DICTs are sized with placeholders first, offsets are known then
+	dict_patch_t top[8];
+	unsigned ntop = 0;
+	if (!cff2 && charset > 2) top[ntop++] = (dict_patch_t){OP_CHARSET, 1, {0}};
+	if (!cff2 && encoding > 1) top[ntop++] = (dict_patch_t){OP_ENCODING, 1, {0}};
+	top[ntop++] = (dict_patch_t){OP_CHARSTRINGS, 1, {0}};
+	if (!fdarray) top[ntop++] = (dict_patch_t){OP_PRIVATE, 2, {0}};
+	if (fdarray) top[ntop++] = (dict_patch_t){OP_FDARRAY, 1, {0}};
+	if (fdselect) top[ntop++] = (dict_patch_t){OP_FDSELECT, 1, {0}};
+	if (vstore) top[ntop++] = (dict_patch_t){OP_VSTORE, 1, {0}};
+	const View td = buf.sub(top_offset, top_len);
+	const size_t toplen = write_dict(td, NULL, top, ntop);
+
+	size_t* privlen = (size_t*)arena.alloc(nfonts * sizeof(size_t));
+	size_t* privpos = (size_t*)arena.alloc(nfonts * sizeof(size_t));
+	uint32_t* fdoffsets = (uint32_t*)arena.alloc((nfonts+1) * sizeof(uint32_t));
+	dict_patch_t subrs_patch = {OP_SUBRS, desubroutinize? 0u: 1u, {0}};
+	dict_patch_t priv_patch = {OP_PRIVATE, 2, {0}};
+	fdoffsets[0] = 0;
+	for (unsigned i=0; i<nfonts; ++i) {
+		privlen[i] = write_dict(buf.sub(fonts[i].priv, fonts[i].priv_len), NULL, &subrs_patch, 1);
+		fdoffsets[i+1] = fdoffsets[i] + (fdarray? write_dict(buf.sub(fonts[i].dict, fonts[i].dict_len), NULL, &priv_patch, 1): 0);
+	}
+
+	// layout
+	size_t pos = hdr_len, csoff, charsetoff = 0, encodingoff = 0, fdselectoff = 0, fdarrayoff = 0, vstoreoff = 0;
+	if (cff2) {
+		pos += toplen;
+	} else {
+		pos += names_end - hdr_len + index_size(1, toplen, false) + strings_end - strings_start;
+	}
+	pos += index_size(gso.count, gso.offsets[gso.count], cff2);
+	if (!cff2 && charset > 2) {
+		charsetoff = pos;
+		pos += charset_len;
+	}
+	if (!cff2 && encoding > 1) {
+		encodingoff = pos;
+		pos += encoding_len;
+	}
+	csoff = pos;
+	pos += index_size(n, cso.offsets[n], cff2);
+	if (fdselect) {
+		fdselectoff = pos;
+		pos += fdselect_len;
+	}
+	if (fdarray) {
+		fdarrayoff = pos;
+		pos += index_size(nfonts, fdoffsets[nfonts], cff2);
+	}
+	if (vstore) {
+		vstoreoff = pos;
+		pos += vstore_len;
+	}
+	for (unsigned i=0; i<nfonts; ++i) {
+		privpos[i] = pos;
+		pos += privlen[i];
+		if (fonts[i].has_subrs && !desubroutinize) pos += index_size(subrso[i].count, subrso[i].offsets[subrso[i].count], cff2);
+	}
+	len = pos;
+
+	// and the data
+	for (unsigned k=0; k<ntop; ++k) {
+		switch (top[k].op) {
+			case OP_CHARSET: top[k].v[0] = charsetoff; break;
+			case OP_ENCODING: top[k].v[0] = encodingoff; break;
+			case OP_CHARSTRINGS: top[k].v[0] = csoff; break;
+			case OP_PRIVATE: top[k].v[0] = privlen[0]; top[k].v[1] = privpos[0]; break;
+			case OP_FDARRAY: top[k].v[0] = fdarrayoff; break;
+			case OP_FDSELECT: top[k].v[0] = fdselectoff; break;
+			case OP_VSTORE: top[k].v[0] = vstoreoff; break;
+		}
+	}
+	char* rv = (char*)arena.calloc(1, PAD4(len) + 4);
+	char* o = (char*)memcpy(rv, base, hdr_len) + hdr_len;
+	if (cff2) {
+		put_be(rv + 3, toplen, 2);
+		o += write_dict(td, o, top, ntop);
+	} else {
+		memcpy(o, base + hdr_len, names_end - hdr_len);
+		o += names_end - hdr_len;
+		const uint32_t topoffsets[2] = {0, (uint32_t)toplen};
+		char* topdata = (char*)arena.alloc(MAX(toplen, 1));
+		write_dict(td, topdata, top, ntop);
+		o = write_index(o, 1, topoffsets, topdata, false);
+		arena.free(topdata);
+		memcpy(o, base + strings_start, strings_end - strings_start);
+		o += strings_end - strings_start;
+	}
+	o = write_index(o, gso.count, gso.offsets, gso.data, cff2);
+	if (charsetoff) o = (char*)memcpy(o, base + charset, charset_len) + charset_len;
+	if (encodingoff) o = (char*)memcpy(o, base + encoding, encoding_len) + encoding_len;
+	o = write_index(o, n, cso.offsets, cso.data, cff2);
+	if (fdselect) o = (char*)memcpy(o, base + fdselect, fdselect_len) + fdselect_len;
+	if (fdarray) {
+		char* fddata = (char*)arena.alloc(MAX(fdoffsets[nfonts], 1));
+		for (unsigned i=0; i<nfonts; ++i) {
+			priv_patch.v[0] = privlen[i];
+			priv_patch.v[1] = privpos[i];
+			write_dict(buf.sub(fonts[i].dict, fonts[i].dict_len), fddata + fdoffsets[i], &priv_patch, 1);
+		}
+		o = write_index(o, nfonts, fdoffsets, fddata, cff2);
+		arena.free(fddata);
+	}
+	if (vstore) o = (char*)memcpy(o, base + vstore, vstore_len) + vstore_len;
+	for (unsigned i=0; i<nfonts; ++i) {
+		assert((size_t)(o - rv) == privpos[i]);
+		subrs_patch.v[0] = privlen[i]; // right after
+		o += write_dict(buf.sub(fonts[i].priv, fonts[i].priv_len), o, &subrs_patch, 1);
+		if (fonts[i].has_subrs && !desubroutinize) o = write_index(o, subrso[i].count, subrso[i].offsets, subrso[i].data, cff2);
+	}
+	assert((size_t)(o - rv) == len);
+
+	LOG_INFO("encoded %s: %zu -> %zu bytes, %u of %u charstrings dropped%s", cff2? "CFF2": "CFF", buf.size(), len, dropped, n, desubroutinize? ", without subroutines": "");
+	free_objects(cso);
+	free_objects(gso);
+	for (unsigned i=0; i<nfonts; ++i) {
+		if (subrso[i].offsets) free_objects(subrso[i]);
+	}
+	arena.free(subrso);
+	arena.free(privlen);
+	arena.free(privpos);
+	arena.free(fdoffsets);
+
+	if (config.paranoid) { // everything readable again
+		Cff check(arena);
+		bool ok = check.parse(rv, len, cff2) && check.glyphs() == n;
+		for (unsigned g=0; ok && g<n; ++g) {
+			ok = check.run(g, false);
+		}
+		if (!ok) {
+			LOG("encoded %s cannot be read again", cff2? "CFF2": "CFF");
+			arena.free(rv);
+			return NULL;
+		}
+	}
+	return rv;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include "main.hpp"
+#include "types.hpp"
+#include "arena.hpp"
+
+
+#define CFF_MAX_ARGS  48  // Type 2 charstring argument stack
+#define CFF2_MAX_ARGS 513
+#define CFF_MAX_CALLS 10  // subroutine nesting
+#define CFF_MAX_HSTEMS 8  // hstem operators whose first edge is moved when aligning
+
+
+/**
+ * CFF or CFF2 outlines, as a table borrowed from the font: charstrings of deleted glyphs and unused subroutines are stubbed, so glyph and subroutine numbers stay.
+ * Charstrings are run by a single interpreter with fixed-size stacks, for the subroutines and bounds in use, standard accent composites, or into a flattened copy without subroutine calls.
+ */
+class Cff {
+	private:
+		typedef struct {
+			unsigned count;
+			const char* data; // of the first object
+			uint32_t* offsets; // count+1, relative to data
+		} objects_t;
+		typedef struct {
+			size_t dict, dict_len; // Font DICT, none for a CFF without FDArray
+			size_t priv, priv_len; // Private DICT
+			bool has_subrs;
+			objects_t subrs;
+			int bias;
+			unsigned vsindex; // default, CFF2 only
+			uint8_t* used; // subrs, by the last encode()
+		} font_t;
+		typedef struct {
+			float v;
+			size_t pos; // of its encoding in the flattened output
+			bool literal; // as encoded, not computed
+		} arg_t;
+		typedef struct {
+			const uint8_t* p;
+			const uint8_t* end;
+		} frame_t;
+
+		Arena& arena;
+		View buf;
+		const char* base;
+		bool cff2, cid;
+		size_t hdr_len;
+		size_t names_end, strings_start, strings_end; // CFF only, copied as is
+		size_t top_offset, top_len; // Top DICT
+		objects_t gsubrs, charstrings;
+		int gbias;
+		uint8_t* gused;
+		size_t charset, charset_len, encoding, encoding_len, fdselect, fdselect_len, fdarray, vstore, vstore_len; // offsets, 0 if none, charset and encoding may be predefined
+		uint16_t* sids; // by glyph for CFF without FDArray, NULL if predefined otherwise
+		font_t* fonts;
+		unsigned nfonts;
+		uint16_t* fdsel; // font by glyph, NULL for a single one
+		uint16_t* regions; // by vsindex
+		unsigned nvs;
+
+		const char** cs; // charstrings as changed
+		uint32_t* cs_len;
+		uint8_t* cs_state;
+		bool changed;
+
+		// interpreter state, reused by all runs
+		arg_t args[CFF2_MAX_ARGS];
+		frame_t frames[CFF_MAX_CALLS+1];
+		char* out; // flattened charstring
+		size_t out_len, out_cap;
+		float px, py; // current point
+		float box[4];
+		bool have_box;
+		int seac[2]; // standard codes of base and accent, -1 unless an accented composite
+		arg_t hstems[CFF_MAX_HSTEMS]; // first argument of each
+		unsigned nhstems;
+		unsigned move_op; // first moveto, with its position and dy in the flattened output
+		size_t move_pos;
+		arg_t move_dy;
+
+		bool read_index(size_t&, objects_t&);
+		bool parse_font(font_t&, size_t, size_t);
+		bool parse_charset();
+		bool parse_encoding();
+		bool parse_fdselect();
+		bool parse_vstore();
+		void free_objects(objects_t&);
+		void build_subrs(const objects_t&, const uint8_t*, objects_t&);
+
+		void emit(const uint8_t*, size_t);
+		void point();
+		void line(float, float);
+		void curve(float, float, float, float, float, float);
+		bool run(index_t, bool); // optionally flattened into out
+
+	public:
+		Cff(Arena&);
+		~Cff();
+
+		bool parse(const char*, size_t, bool); // CFF or CFF2
+		unsigned glyphs() const { return charstrings.count; }
+		const char* charstringData(const uint32_t*& o) const { o = charstrings.offsets; return charstrings.data; } // as parsed, with glyphs()+1 offsets
+		bool isCff2() const { return cff2; }
+		bool isChanged() const { return changed; }
+		bool components(index_t, index_t*, unsigned&); // of an accented composite (seac), base and accent glyph
+		bool bounds(index_t, int16_t*); // as in glyf, false for an empty or unreadable one
+		bool drop(index_t); // false if already dropped
+		int align(index_t, int); // as Woff::align_glyph()
+		char* encode(size_t&, bool); // owned by the caller, optionally flattened without any subroutines
+};
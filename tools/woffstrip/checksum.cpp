@@ -0,0 +1,115 @@
+#include "checksum.hpp"
+
+
+static void lanes(const uint8_t* p, size_t len, size_t off, uint32_t* lane) {
+	for (size_t k=0; k<len; ++k) {
+		lane[(off+k) & 3] += p[k];
+	}
+}
+
+
+SpanChecksum::SpanChecksum(Arena& a): arena(a), nodes(NULL), n(0), size(0) {
+}
+
+
+SpanChecksum::~SpanChecksum() {
+	clear();
+}
+
+
+void SpanChecksum::clear() {
+	arena.free(nodes);
+	nodes = NULL;
+	n = size = 0;
+}
+
+
+void SpanChecksum::build(const char* data, const size_t* bounds, unsigned spans) {
+	clear();
+	n = spans;
+	for (size = 1; size < n; size <<= 1);
+	nodes = (node_t*)arena.calloc(2 * size, sizeof(node_t));
+	for (unsigned s=0; s<n; ++s) {
+		assert(bounds[s] <= bounds[s+1]);
+		lanes((const uint8_t*)data + bounds[s], bounds[s+1] - bounds[s], bounds[s], nodes[size+s].lane);
+	}
+	for (unsigned i=size-1; i>0; --i) {
+		pull(i);
+	}
+}
+
+
+void SpanChecksum::apply(unsigned i, unsigned r) {
+	uint32_t l[4];
+	memcpy(l, nodes[i].lane, sizeof(l));
+	for (unsigned j=0; j<4; ++j) {
+		nodes[i].lane[(j+r) & 3] = l[j];
+	}
+	nodes[i].rot = (nodes[i].rot + r) & 3;
+}
+
+
+void SpanChecksum::push(unsigned i) {
+	if (!nodes[i].rot) return;
+	apply(2*i, nodes[i].rot);
+	apply(2*i+1, nodes[i].rot);
+	nodes[i].rot = 0;
+}
+
+
+void SpanChecksum::pull(unsigned i) {
+	for (unsigned j=0; j<4; ++j) {
+		nodes[i].lane[j] = nodes[2*i].lane[j] + nodes[2*i+1].lane[j];
+	}
+}
+
+
+void SpanChecksum::rotate(unsigned i, unsigned lo, unsigned hi, unsigned from, unsigned r) {
+	// node i covers the spans [lo, hi)
+	if (hi <= from) return;
+	if (lo >= from) {
+		apply(i, r);
+		return;
+	}
+	push(i);
+	const unsigned mid = (lo + hi) / 2;
+	rotate(2*i, lo, mid, from, r);
+	rotate(2*i+1, mid, hi, from, r);
+	pull(i);
+}
+
+
+void SpanChecksum::set(unsigned s, const char* data, size_t len, size_t off) {
+	assert(nodes && s < n);
+	unsigned i = 1, lo = 0, hi = size;
+	while (i < size) { // pending rotations on the path first, as the leaf is replaced
+		push(i);
+		const unsigned mid = (lo + hi) / 2;
+		if (s < mid) {
+			i = 2*i;
+			hi = mid;
+		} else {
+			i = 2*i+1;
+			lo = mid;
+		}
+	}
+	memset(&nodes[i], 0, sizeof(node_t));
+	lanes((const uint8_t*)data, len, off, nodes[i].lane);
+	for (i /= 2; i; i /= 2) {
+		pull(i);
+	}
+}
+
+
+void SpanChecksum::shift(unsigned from, ssize_t delta) {
+	assert(nodes);
+	const unsigned r = (size_t)delta & 3; // modulo 4 also if negative
+	if (r && from < n) rotate(1, 0, size, from, r);
+}
+
+
+uint32_t SpanChecksum::sum() const {
+	assert(nodes);
+	const uint32_t* l = nodes[1].lane;
+	return (l[0] << 24) + (l[1] << 16) + (l[2] << 8) + l[3];
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "main.hpp"
+#include "arena.hpp"
+
+
+/**
+ * Table checksum over consecutive spans, e.g. glyphs by loca, kept up to date as single spans change or all following ones move.
+ * As the sum is linear, nodes keep the byte sums by offset modulo 4, so moving by a non-multiple of 4 only rotates them, lazily for a whole subtree.
+ */
+class SpanChecksum {
+	private:
+		typedef struct {
+			uint32_t lane[4]; // sums of the bytes at table offsets 0..3 mod 4
+			unsigned rot; // pending for the children
+		} node_t;
+		Arena& arena;
+		node_t* nodes; // implicit tree, leaves from size on
+		unsigned n, size;
+
+		void apply(unsigned, unsigned);
+		void push(unsigned);
+		void pull(unsigned);
+		void rotate(unsigned, unsigned, unsigned, unsigned, unsigned);
+
+	public:
+		SpanChecksum(Arena&);
+		~SpanChecksum();
+
+		void build(const char*, const size_t*, unsigned); // given n+1 span boundaries, a single pass
+		void clear();
+		bool empty() const { return !nodes; }
+		void set(unsigned, const char*, size_t, size_t); // new content of a span at its table offset
+		void shift(unsigned, ssize_t); // all spans from this one moved by a delta
+		uint32_t sum() const;
+};
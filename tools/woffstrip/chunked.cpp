@@ -0,0 +1,144 @@
+#include "chunked.hpp"
+#include "hash.hpp"
+#include <pthread.h>
+#include <zlib.h>
+
+
+#define DEFLATE_WINDOW 32768u
+
+typedef struct {
+	const char* src;
+	const size_t* bounds;
+	size_t last;
+	const size_t* todo; // chunk indices
+	size_t ntodo;
+	size_t next; // atomic
+	bool failed;
+	char** data;
+	size_t* len;
+} deflate_job_t;
+
+
+static bool deflate_chunk(const char* src, size_t start, size_t end, bool last, char*& out, size_t& outlen) {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs)); // with malloc, as not in the arena
+	if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false; // raw, otherwise as by docompress
+	const size_t dict = start - MIN(start, (size_t)DEFLATE_WINDOW);
+	if (start > dict && deflateSetDictionary(&zs, (const Bytef*)src + dict, start - dict) != Z_OK) {
+		deflateEnd(&zs);
+		return false;
+	}
+
+	const size_t bound = deflateBound(&zs, end - start) + 16; // flush markers
+	out = (char*)malloc(bound);
+	zs.next_in = (Bytef*)src + start;
+	zs.avail_in = end - start;
+	zs.next_out = (Bytef*)out;
+	zs.avail_out = bound;
+	const int rv = deflate(&zs, last? Z_FINISH: Z_FULL_FLUSH); // output is large enough for a single call
+	outlen = zs.total_out;
+	deflateEnd(&zs);
+	if (last? (rv != Z_STREAM_END): (rv != Z_OK || zs.avail_in || !zs.avail_out)) {
+		free(out);
+		out = NULL;
+		return false;
+	}
+	return true;
+}
+
+
+static void* deflate_worker(void* arg) {
+	deflate_job_t* job = (deflate_job_t*)arg;
+	size_t t;
+	while ((t = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->ntodo) {
+		const size_t i = job->todo[t];
+		if (!deflate_chunk(job->src, job->bounds[i], job->bounds[i+1], i == job->last, job->data[t], job->len[t])) {
+			__atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+		}
+	}
+	return NULL;
+}
+
+
+ChunkedDeflate::~ChunkedDeflate() {
+	for (std::vector<chunk_t>::iterator it=cache.begin(); it!=cache.end(); ++it) {
+		free(it->data);
+	}
+}
+
+
+bool ChunkedDeflate::compress(const char* src, const size_t* bounds, size_t n, char*& dst, size_t& dstlen, Arena& arena, unsigned threads) {
+	assert(n && bounds[0] == 0);
+	const size_t srclen = bounds[n];
+	if (cache.size() != n) {
+		for (std::vector<chunk_t>::iterator it=cache.begin(); it!=cache.end(); ++it) free(it->data);
+		cache.assign(n, (chunk_t){0, 0, 0, NULL});
+	}
+
+	// changed chunks, a change also invalidates the next one as using it as dictionary
+	size_t* todo = (size_t*)arena.alloc(n * sizeof(size_t));
+	size_t ntodo = 0;
+	for (size_t i=0; i<n; ++i) {
+		const size_t dict = bounds[i] - MIN(bounds[i], (size_t)DEFLATE_WINDOW);
+		const uint64_t h = hash64(src + dict, bounds[i+1] - dict, (bounds[i] - dict) * 2 + (i == n-1));
+		if (cache[i].data && cache[i].hash == h) continue;
+		free(cache[i].data);
+		cache[i].data = NULL;
+		cache[i].hash = h;
+		cache[i].adler = adler32(adler32(0, NULL, 0), (const Bytef*)src + bounds[i], bounds[i+1] - bounds[i]);
+		todo[ntodo++] = i;
+	}
+
+	deflate_job_t job = {src, bounds, n-1, todo, ntodo, 0, false, (char**)arena.calloc(MAX(ntodo, 1), sizeof(char*)), (size_t*)arena.calloc(MAX(ntodo, 1), sizeof(size_t))};
+	threads = MAX(1, MIN(threads, ntodo));
+	pthread_t* tids = (pthread_t*)arena.alloc(threads * sizeof(pthread_t));
+	unsigned nthreads = 0;
+	for (; ntodo > 1 && nthreads < threads-1; ++nthreads) { // the current one works as well
+		if (pthread_create(&tids[nthreads], NULL, deflate_worker, &job) != 0) break;
+	}
+	deflate_worker(&job);
+	for (unsigned t=0; t<nthreads; ++t) {
+		pthread_join(tids[t], NULL);
+	}
+	for (size_t t=0; t<ntodo; ++t) {
+		cache[todo[t]].data = job.data[t];
+		cache[todo[t]].len = job.len[t];
+	}
+	arena.free(tids);
+	arena.free(job.data);
+	arena.free(job.len);
+	LOG_INFO("deflated %zu of %zu chunks with %u threads", ntodo, n, nthreads+1);
+	arena.free(todo);
+	if (job.failed) {
+		LOG("cannot compress chunk");
+		for (std::vector<chunk_t>::iterator it=cache.begin(); it!=cache.end(); ++it) free(it->data);
+		cache.clear();
+		return false;
+	}
+
+	// https://www.rfc-editor.org/rfc/rfc1950 header for the maximum level, the raw chunks, and the combined checksum
+	dstlen = 2 + 4;
+	uint32_t adler = adler32(0, NULL, 0);
+	for (size_t i=0; i<n; ++i) {
+		dstlen += cache[i].len;
+		adler = adler32_combine(adler, cache[i].adler, bounds[i+1] - bounds[i]);
+	}
+	if (dstlen >= srclen) { // stored uncompressed instead
+		dstlen = srclen;
+		dst = (char*)memcpy(arena.calloc(1, PAD4(srclen)), src, srclen);
+		return true;
+	}
+	dst = (char*)arena.calloc(1, PAD4(dstlen));
+	char* p = dst;
+	*p++ = 0x78;
+	*p++ = 0xDA;
+	for (size_t i=0; i<n; ++i) {
+		memcpy(p, cache[i].data, cache[i].len);
+		p += cache[i].len;
+	}
+	*p++ = adler >> 24;
+	*p++ = adler >> 16;
+	*p++ = adler >> 8;
+	*p++ = adler;
+	return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "main.hpp"
+#include "arena.hpp"
+#include <vector>
+
+
+/**
+ * Deflates a table as chunks that are compressed independently and in parallel, then stitched into a single zlib stream.
+ * Each chunk is primed with the preceding 32 KiB as dictionary and ends with a full flush, as the stream would continue anyways.
+ * Chunks are cached by content and position, so only changed ones get deflated again on subsequent calls.
+ */
+class ChunkedDeflate {
+	private:
+		typedef struct {
+			uint64_t hash; // of the dictionary, the data, and whether it is the last one
+			uint32_t adler; // of the data only
+			size_t len;
+			char* data; // raw deflate, malloc'd as from worker threads
+		} chunk_t;
+		std::vector<chunk_t> cache; // by index
+
+	public:
+		~ChunkedDeflate();
+		bool compress(const char*, const size_t*, size_t, char*&, size_t&, Arena&, unsigned); // given n+1 chunk boundaries, output as docompress
+};
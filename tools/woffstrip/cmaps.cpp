@@ -1,53 +1,124 @@
 #include "cmaps.hpp"
+#include "simd.hpp"
+#include <algorithm>
 
 
-bool Cmaps::parse0(const char* b, size_t l, std::map<char_t, index_t>& map) {
-	if (l < sizeof(WoffCmap0)) return false;
-	const WoffCmap0* cmap = (const WoffCmap0*)b;
+static bool run_extend(cmap_run_t& last, char_t from, char_t to, index_t glyph, uint32_t flags) {
+	if (from != last.to+1) return false;
+	if (!(flags & CMAP_RUN_CONSTANT) && !(last.flags & CMAP_RUN_CONSTANT) && glyph == last.glyph + (from - last.from)) {
+		last.to = to;
+		return true;
+	}
+	if ((from == to || (flags & CMAP_RUN_CONSTANT)) && (last.from == last.to || (last.flags & CMAP_RUN_CONSTANT)) && glyph == last.glyph) {
+		last.to = to;
+		last.flags = CMAP_RUN_CONSTANT;
+		return true;
+	}
+	return false;
+}
+
+
+void Cmaps::add_run(cmap_runs_t& v, char_t from, char_t to, index_t glyph, uint32_t flags) {
+	assert(from <= to);
+	if (!glyph) { // missing glyph, not mapped
+		if (from == to || (flags & CMAP_RUN_CONSTANT)) return;
+		++from;
+		glyph = 1;
+	}
+	if (from == to) flags = 0;
+	if (!v.empty() && run_extend(v.back(), from, to, glyph, flags)) return;
+	v.push_back((cmap_run_t){from, to, glyph, flags});
+}
+
+
+static uint32_t get24(const uint8_t* p) {
+	return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+
+static uint32_t get32(const uint8_t* p) {
+	return (get24(p) << 8) | p[3];
+}
+
+
+static void put24(uint8_t* p, uint32_t v) {
+	p[0] = v >> 16;
+	p[1] = v >> 8;
+	p[2] = v;
+}
+
+
+static void put32(uint8_t* p, uint32_t v) {
+	put24(p, v >> 8);
+	p[3] = v;
+}
+
+
+static bool cmap_run_cmp(const cmap_run_t& a, const cmap_run_t& b) {
+	return a.from < b.from;
+}
+
+
+static bool cmap_uvs_cmp(const cmap_uvs_t& a, const cmap_uvs_t& b) {
+	return a.selector < b.selector || (a.selector == b.selector && a.from < b.from);
+}
+
+
+bool Cmaps::parse0(const char* b, size_t l, cmap_runs_t& v) {
+	const WoffCmap0* cmap = View(b, l).get<WoffCmap0>();
+	if (!cmap) return false;
 	cmap->print("  ", "charmap 0");
 
-	assert(map.empty());
 	for (char_t i=0; i<sizeof(cmap->glyphIndexArray); ++i) {
-		if (cmap->glyphIndexArray[i] != 0) {
-			map.insert(std::pair<char_t, index_t>(i, cmap->glyphIndexArray[i]));
-		}
+		add_run(v, i, i, cmap->glyphIndexArray[i]);
 	}
 	return true;
 }
 
 
-bool Cmaps::parse4(const char* b, size_t l, std::map<char_t, index_t>& map) {
-	if (l < sizeof(WoffCmap4)) return false;
-	WoffCmap4* cmap = (WoffCmap4*)b;
+bool Cmaps::parse4(const char* b, size_t l, cmap_runs_t& v) {
+	const View view(b, l);
+	const WoffCmap4* cmap = view.get<WoffCmap4>();
+	if (!cmap) return false;
 	cmap->print("  ", "charmap 4");
 
-	uint16_t segCount = w2uint16(cmap->segCountX2)/2;
-	if (l < sizeof(WoffCmap4) + (segCount * sizeof(wuint16_t) * 4) + sizeof(wuint16_t)) return false;
-	wuint16_t* endCode = (wuint16_t*)(cmap + 1);
-	wuint16_t* startCode = (wuint16_t*)((char*)endCode + segCount*sizeof(wuint16_t) + sizeof(wuint16_t));
-	wuint16_t* idDelta = (wuint16_t*)((char*)startCode + segCount*sizeof(wuint16_t));
-	wuint16_t* idRangeOffset = (wuint16_t*)((char*)idDelta + segCount*sizeof(wuint16_t));
-	//wuint16_t* glyphIndexArray = (wuint16_t*)((char*)idRangeOffset + segCount*sizeof(wuint16_t));
+	const uint16_t segCount = w2uint16(cmap->segCountX2)/2;
+	if (!view.get<wuint16_t>(sizeof(WoffCmap4), 4*segCount + 1)) return false;
+	const size_t rangeOff = sizeof(WoffCmap4) + (3*segCount + 1) * sizeof(wuint16_t);
+	const size_t nrange = (l - rangeOff) / sizeof(wuint16_t);
+	const wuint16_t* idRangeOffset = view.get<wuint16_t>(rangeOff, nrange); // followed by glyphIndexArray
+
+	// segment arrays in host order at once: endCode, reservedPad, startCode, idDelta, idRangeOffset
+	std::vector<uint16_t, ArenaAllocator<uint16_t> > segs(4*segCount + 1, 0, ArenaAllocator<uint16_t>(*v.get_allocator().arena));
+	be16_to_host(&segs[0], cmap + 1, segs.size());
+	const uint16_t* endCode = &segs[0];
+	const uint16_t* startCode = endCode + segCount + 1;
+	const uint16_t* idDelta = startCode + segCount;
+	const uint16_t* rangeOffset = idDelta + segCount;
 
 	for (uint16_t s=0; s<segCount; ++s) {
-		LOG_DUMP("    %04x-%04x (@ %u+%u)", w2uint16(startCode[s]), w2uint16(endCode[s]), w2uint16(idDelta[s]), w2uint16(idRangeOffset[s]));
-		if (w2uint16(startCode[s]) > w2uint16(endCode[s])) return false;
-		for (char_t c=(char_t)w2uint16(startCode[s]); c<=(char_t)w2uint16(endCode[s]); ++c) {
-			index_t index;
-			if (w2uint16(idRangeOffset[s]) == 0) {
-				index = c;
+		LOG_DUMP("    %04x-%04x (@ %u+%u)", startCode[s], endCode[s], idDelta[s], rangeOffset[s]);
+		const char_t start = startCode[s];
+		const char_t end = endCode[s];
+		const uint16_t delta = idDelta[s];
+		if (start > end) return false;
+		if (rangeOffset[s] == 0) {
+			const char_t wrap = 65536u - delta; // first char that maps to 0, splits the segment
+			if (wrap > start && wrap <= end) {
+				add_run(v, start, wrap-1, (start + delta) % 65536u);
+				if (wrap < end) add_run(v, wrap+1, end, 1);
 			} else {
-				uint16_t off = (c - w2uint16(startCode[s])); // * sizeof(uint16_t) but is already pointer arithmetic
-				off += w2uint16(idRangeOffset[s]) / 2;
-				if (s + off > l - ((const char*)idRangeOffset - b)) return false;
-				index = w2uint16(idRangeOffset[s + off]);
+				add_run(v, start, end, (start + delta) % 65536u);
+			}
+		} else {
+			for (char_t c=start; c<=end; ++c) {
+				size_t off = (c - start); // * sizeof(uint16_t) but is already pointer arithmetic
+				off += rangeOffset[s] / 2;
+				if (s + off >= nrange) return false;
+				index_t index = w2uint16(idRangeOffset[s + off]);
+				if (index) index = (index + delta) % 65536u;
+				add_run(v, c, c, index);
 			}
-			index = (index + w2uint16(idDelta[s])) % 65536u;
-			if (!index) continue;
-
-			LOG_DUMP("      %04x: %u", c, index);
-			if (map.find(c) != map.end()) return false;
-			map.insert(std::pair<char_t, index_t>(c, index));
 		}
 	}
 
@@ -55,110 +126,641 @@ bool Cmaps::parse4(const char* b, size_t l, std::map<char_t, index_t>& map) {
 }
 
 
-bool Cmaps::parse12(const char* b, size_t l, std::map<char_t, index_t>& map) {
-	if (l < sizeof(WoffCmap12)) return false;
-	WoffCmap12* cmap = (WoffCmap12*)b;
-	cmap->print("  ", "charmap 12");
+bool Cmaps::parse6(const char* b, size_t l, cmap_runs_t& v) {
+	const View view(b, l);
+	const WoffCmap6* cmap = view.get<WoffCmap6>();
+	if (!cmap) return false;
+	cmap->print("  ", "charmap 6");
 
-	if (l < sizeof(WoffCmap12) + w2uint32(cmap->nGroups) * sizeof(WoffCmap12Group)) return false;
-	for (uint32_t g=0; g<w2uint32(cmap->nGroups); ++g) {
-		WoffCmap12Group* group = ((WoffCmap12Group*)(cmap+1)) + g;
-		group->print("    ");
+	const char_t first = w2uint16(cmap->firstCode);
+	const unsigned count = w2uint16(cmap->entryCount);
+	const wuint16_t* glyphIndexArray = view.get<wuint16_t>(sizeof(WoffCmap6), count);
+	if (!glyphIndexArray || first + count > 0x10000u) return false;
+	for (unsigned i=0; i<count; ++i) {
+		add_run(v, first+i, first+i, w2uint16(glyphIndexArray[i])); // coalesces into runs
+	}
+	return true;
+}
 
-		if (w2uint32(group->startCharCode) > w2uint32(group->endCharCode)) return false;
-		for (char_t c=w2uint32(group->startCharCode); c<=w2uint32(group->endCharCode); ++c) {
-			index_t i = w2uint32(group->startGlyphCode) + (c - w2uint32(group->startCharCode));
-			if (map.find(c) != map.end()) return false;
-			map.insert(std::pair<char_t, index_t>(c, i));
-		}
+
+bool Cmaps::parse10(const char* b, size_t l, cmap_runs_t& v) {
+	const View view(b, l);
+	const WoffCmap10* cmap = view.get<WoffCmap10>();
+	if (!cmap) return false;
+	cmap->print("  ", "charmap 10");
+
+	const char_t first = w2uint32(cmap->startCharCode);
+	const uint32_t count = w2uint32(cmap->numChars);
+	const wuint16_t* glyphs = view.get<wuint16_t>(sizeof(WoffCmap10), count);
+	if (!glyphs || first > 0x10FFFFu || count > 0x110000u - first) return false;
+	for (uint32_t i=0; i<count; ++i) {
+		add_run(v, first+i, first+i, w2uint16(glyphs[i]));
 	}
 	return true;
 }
 
 
-bool Cmaps::parse(const char* buf, size_t len) {
-	charmap.clear();
+bool Cmaps::parse12(const char* b, size_t l, cmap_runs_t& v, bool constant) {
+	const View view(b, l);
+	const WoffCmap12* cmap = view.get<WoffCmap12>();
+	if (!cmap) return false;
+	cmap->print("  ", constant? "charmap 13": "charmap 12");
 
-	if (len < sizeof(WoffCmapIndex)) return false;
-	const WoffCmapIndex* index = (WoffCmapIndex*)buf;
-	index->print("  ", "character map index");
+	const uint32_t nGroups = w2uint32(cmap->nGroups);
+	const WoffCmap12Group* groups = view.get<WoffCmap12Group>(sizeof(WoffCmap12), nGroups);
+	if (!groups) return false;
 
-	if (len < sizeof(WoffCmapIndex) + w2uint16(index->numberSubtables) * sizeof(WoffCmapSubtable)) return false;
-	const WoffCmapSubtable* subtable = (WoffCmapSubtable*)(index+1);
-	for (unsigned si=0; si<w2uint16(index->numberSubtables); ++si) {
-		subtable[si].print("  ", "character map subtable");
+	// all groups in host order at once: startCharCode, endCharCode, startGlyphCode each
+	std::vector<uint32_t, ArenaAllocator<uint32_t> > host(3*(size_t)nGroups, 0, ArenaAllocator<uint32_t>(*v.get_allocator().arena));
+	if (nGroups) be32_to_host(&host[0], groups, host.size());
+	const uint32_t flags = constant? CMAP_RUN_CONSTANT: 0;
+	for (uint32_t g=0; g<nGroups; ++g) {
+		groups[g].print("    ");
+		const uint32_t* group = &host[3*(size_t)g];
+		if (group[0] > group[1]) return false;
+		add_run(v, group[0], group[1], group[2], flags);
+	}
+	return true;
+}
 
-		if (w2uint32(subtable[si].offset) + sizeof(uint16_t) >= len) return false;
-		unsigned format = w2uint16(*((uint16_t*)(buf + w2uint32(subtable[si].offset)))); // peek into format
 
-		std::map<char_t, index_t> submap;
-		size_t cmaplen = len - w2uint32(subtable[si].offset); // not ordered: ((si == w2uint16(index->numberSubtables)-1)? (uint32_t)len: w2uint32(subtable[si+1].offset)) - w2uint32(subtable[si].offset);
-		if (format == 0) {
-			if (!parse0(buf + w2uint32(subtable[si].offset), cmaplen, submap)) {
-				return false;
-			}
-		} else if (format == 4) {
-			if (!parse4(buf + w2uint32(subtable[si].offset), cmaplen, submap)) {
-				return false;
+bool Cmaps::parse14(const char* b, size_t l, cmap_uvs_list_t& v) {
+	if (l < sizeof(WoffCmap14)) return false;
+	const WoffCmap14* cmap = (const WoffCmap14*)b;
+	cmap->print("  ", "charmap 14");
+
+	l = MIN(l, (size_t)w2uint32(cmap->length));
+	const uint32_t nrecords = w2uint32(cmap->numVarSelectorRecords);
+	if (l < sizeof(WoffCmap14) || (l - sizeof(WoffCmap14)) / 11 < nrecords) return false;
+	const size_t first = v.size();
+	const uint8_t* record = (const uint8_t*)(cmap + 1);
+	for (uint32_t r=0; r<nrecords; ++r, record+=11) {
+		const char_t selector = get24(record);
+		const uint32_t defaultOffset = get32(record + 3);
+		const uint32_t nonDefaultOffset = get32(record + 7);
+		LOG_DUMP("    selector %04x (@ %u/%u)", selector, defaultOffset, nonDefaultOffset);
+
+		if (defaultOffset) { // ranges of base characters with their main mapping
+			if (defaultOffset > l - 4) return false;
+			const uint8_t* p = (const uint8_t*)b + defaultOffset;
+			const uint32_t n = get32(p);
+			if ((l - defaultOffset - 4) / 4 < n) return false;
+			for (p+=4; p<(const uint8_t*)b+defaultOffset+4+4*n; p+=4) {
+				v.push_back((cmap_uvs_t){selector, get24(p), get24(p) + p[3], 0});
 			}
-		} else if (format == 12) {
-			if (!parse12(buf + w2uint32(subtable[si].offset), cmaplen, submap)) {
-				return false;
+		}
+		if (nonDefaultOffset) { // single base characters with their own glyph
+			if (nonDefaultOffset > l - 4) return false;
+			const uint8_t* p = (const uint8_t*)b + nonDefaultOffset;
+			const uint32_t n = get32(p);
+			if ((l - nonDefaultOffset - 4) / 5 < n) return false;
+			for (p+=4; p<(const uint8_t*)b+nonDefaultOffset+4+5*n; p+=5) {
+				const index_t glyph = ((index_t)p[3] << 8) | p[4];
+				if (glyph) v.push_back((cmap_uvs_t){selector, get24(p), get24(p), glyph});
 			}
-		} else {
+		}
+	}
+
+	std::stable_sort(v.begin() + first, v.end(), cmap_uvs_cmp);
+	return true;
+}
+
+
+static bool unicode_record(const WoffCmapSubtable& s) {
+	// Unicode platform, or Windows symbol, BMP and full repertoire
+	const unsigned platform = w2uint16(s.platformID), encoding = w2uint16(s.platformSpecificID);
+	return platform == 0 || (platform == 3 && (encoding == 0 || encoding == 1 || encoding == 10));
+}
+
+
+bool Cmaps::parse_subtable(unsigned format, const char* b, size_t l, cmap_runs_t& v, cmap_uvs_list_t& u) {
+	switch (format) {
+		case 0: return parse0(b, l, v);
+		case 4: return parse4(b, l, v);
+		case 6: return parse6(b, l, v);
+		case 10: return parse10(b, l, v);
+		case 12: return parse12(b, l, v, false);
+		case 13: return parse12(b, l, v, true);
+		case 14: return parse14(b, l, u);
+		default:
 			LOG("unsupported cmap format %u", format);
 			return false;
+	}
+}
+
+
+bool Cmaps::parse(const char* buf, size_t len) {
+	runs.clear();
+	data = NULL;
+	nruns = nchars = 0;
+	uvs.clear();
+	uvsdata = NULL;
+	nuvs = 0;
+
+	const View view(buf, len);
+	const WoffCmapIndex* index = view.get<WoffCmapIndex>();
+	if (!index) return false;
+	index->print("  ", "character map index");
+
+	const unsigned nsubtables = w2uint16(index->numberSubtables);
+	const WoffCmapSubtable* subtable = view.get<WoffCmapSubtable>(sizeof(WoffCmapIndex), nsubtables);
+	if (!subtable) return false;
+	cmap_runs_t all((ArenaAllocator<cmap_run_t>(arena)));
+	for (unsigned si=0; si<nsubtables; ++si) {
+		subtable[si].print("  ", "character map subtable");
+		if (!unicode_record(subtable[si])) continue; // e.g. Mac Roman codes, which would conflict, and are not encoded again anyways
+
+		const wuint16_t* peek = view.get<wuint16_t>(w2uint32(subtable[si].offset));
+		if (!peek) return false;
+		const unsigned format = w2uint16(*peek);
+
+		bool shared = false; // by several encodings, parsed already
+		for (unsigned sj=0; sj<si && !shared; ++sj) {
+			shared = subtable[sj].offset == subtable[si].offset && unicode_record(subtable[sj]);
 		}
+		if (shared) continue;
+
+		size_t cmaplen = len - w2uint32(subtable[si].offset); // not ordered, so till the end
+		if (!parse_subtable(format, (const char*)peek, cmaplen, all, uvs)) return false;
+	}
 
-		for (std::map<char_t, index_t>::iterator it=submap.begin(); it!=submap.end(); ++it) {
-			assert(it->second != 0);
-			std::map<char_t, index_t>::iterator c = charmap.find(it->first);
-			if (c == charmap.end()) {
-				charmap.insert(std::pair<char_t, index_t>(it->first, it->second));
-			} else if (c->second != it->second) {
+	// merge the subtables, overlapping runs have to agree
+	std::stable_sort(all.begin(), all.end(), cmap_run_cmp);
+	for (cmap_runs_t::const_iterator it=all.begin(); it!=all.end(); ++it) {
+		if (!runs.empty() && it->from <= runs.back().to) {
+			const cmap_run_t& last = runs.back();
+			const bool multiple = MIN(last.to, it->to) > it->from;
+			if (cmap_run_glyph(last, it->from) != cmap_run_glyph(*it, it->from) || (multiple && (last.flags & CMAP_RUN_CONSTANT) != (it->flags & CMAP_RUN_CONSTANT))) {
 				LOG("char index conflict");
 				return false;
 			}
+			if (it->to > last.to) {
+				add_run(runs, last.to+1, it->to, cmap_run_glyph(*it, last.to+1), it->flags);
+			}
+			continue;
 		}
+		add_run(runs, it->from, it->to, it->glyph, it->flags);
 	}
 
+	data = runs.empty()? NULL: &runs[0];
+	nruns = runs.size();
 	LOG_DUMP("charmap");
-	for (std::map<char_t, index_t>::const_iterator it=charmap.begin(); it!=charmap.end(); ++it) {
-		LOG_DUMP("  %04x @ %u", it->first, it->second);
+	for (size_t r=0; r<nruns; ++r) {
+		nchars += data[r].to - data[r].from + 1;
+		LOG_DUMP("  %04x-%04x @ %u%s", data[r].from, data[r].to, data[r].glyph, (data[r].flags & CMAP_RUN_CONSTANT)? " (constant)": "");
 	}
+	uvsdata = uvs.empty()? NULL: &uvs[0];
+	nuvs = uvs.size();
+	if (nuvs) LOG_DUMP("  %zu variation sequence ranges", nuvs);
 	return true;
 }
 
 
+void Cmaps::assign(const cmap_run_t* r, size_t n, const cmap_uvs_t* u, size_t nu) {
+	runs.clear();
+	data = r;
+	nruns = n;
+	nchars = 0;
+	for (size_t i=0; i<nruns; ++i) {
+		nchars += data[i].to - data[i].from + 1;
+	}
+	uvs.clear();
+	uvsdata = u;
+	nuvs = nu;
+}
+
+
 index_t Cmaps::find(char_t c) const {
-	std::map<char_t, index_t>::const_iterator cit = charmap.find(c);
-	if (cit == charmap.end()) {
-		return 0;
+	size_t lo = 0, hi = nruns;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (c < data[mid].from) {
+			hi = mid;
+		} else if (c > data[mid].to) {
+			lo = mid + 1;
+		} else {
+			assert(cmap_run_glyph(data[mid], c) != 0);
+			return cmap_run_glyph(data[mid], c);
+		}
+	}
+	return 0;
+}
+
+
+static bool char_range_before(const char_range_t& r, char_t c) {
+	return r.to < c;
+}
+
+
+void Cmaps::insert(const cmap_run_t* r, size_t n) {
+	cmap_runs_t rv((ArenaAllocator<cmap_run_t>(arena)));
+	size_t i = 0, j = 0;
+	while (i < nruns || j < n) {
+		const cmap_run_t& e = (j == n || (i < nruns && data[i].from < r[j].from))? data[i++]: r[j++];
+		add_run(rv, e.from, e.to, e.glyph, e.flags);
+	}
+
+	runs.swap(rv);
+	data = runs.empty()? NULL: &runs[0];
+	nruns = runs.size();
+	nchars = 0;
+	for (size_t k=0; k<nruns; ++k) {
+		nchars += data[k].to - data[k].from + 1;
+	}
+}
+
+
+void Cmaps::remove(const std::vector<char_range_t>& v) {
+	cmap_runs_t rv((ArenaAllocator<cmap_run_t>(arena)));
+	std::vector<char_range_t>::const_iterator vit = v.begin();
+	for (size_t r=0; r<nruns; ++r) {
+		char_t c = data[r].from;
+		while (c <= data[r].to) {
+			while (vit != v.end() && vit->to < c) ++vit;
+			if (vit != v.end() && vit->from <= c) {
+				if (vit->to >= data[r].to) break;
+				c = vit->to+1;
+			} else {
+				const char_t e = (vit != v.end())? MIN(data[r].to, vit->from-1): data[r].to;
+				add_run(rv, c, e, cmap_run_glyph(data[r], c), data[r].flags);
+				c = e+1;
+			}
+		}
+	}
+
+	runs.swap(rv);
+	data = runs.empty()? NULL: &runs[0];
+	nruns = runs.size();
+	nchars = 0;
+	for (size_t r=0; r<nruns; ++r) {
+		nchars += data[r].to - data[r].from + 1;
+	}
+
+	// variation sequences for the deleted base characters, sorted by selector first
+	cmap_uvs_list_t rvu((ArenaAllocator<cmap_uvs_t>(arena)));
+	for (size_t u=0; u<nuvs; ++u) {
+		const cmap_uvs_t& e = uvsdata[u];
+		std::vector<char_range_t>::const_iterator it = std::lower_bound(v.begin(), v.end(), e.from, char_range_before);
+		char_t c = e.from;
+		while (c <= e.to) {
+			if (it != v.end() && it->from <= c) {
+				if (it->to >= e.to) break;
+				c = it->to+1;
+				++it;
+			} else {
+				const char_t to = (it != v.end())? MIN(e.to, it->from-1): e.to;
+				rvu.push_back((cmap_uvs_t){e.selector, c, to, e.glyph});
+				c = to+1;
+			}
+		}
+	}
+	uvs.swap(rvu);
+	uvsdata = uvs.empty()? NULL: &uvs[0];
+	nuvs = uvs.size();
+}
+
+
+typedef struct {
+	char_t start, end;
+	uint16_t delta;
+	size_t run; // first one covered, for glyph index arrays
+	bool array;
+} cmap_seg_t;
+
+
+bool Cmaps::encode4(const cmap_run_t* r, size_t n, cmap_bytes_t& out) {
+	while (n && r[n-1].from > 0xFFFFu) --n; // BMP only, the last run might still reach beyond
+
+	// Each run either gets a segment on its own with a constant delta (8 bytes), or consecutive runs share one with a glyph index array,
+	// which also has to cover their gaps (8 bytes plus 2 per char). The cost of the latter for runs j..i is cost[j] - 2*from[j] + 8 + 2*(to[i]+1),
+	// so keeping the minimum of the first two terms finds the optimal segmentation in a single pass. Constant runs can only be in the latter.
+	std::vector<int64_t, ArenaAllocator<int64_t> > cost(n+1, 0, ArenaAllocator<int64_t>(*out.get_allocator().arena));
+	std::vector<size_t, ArenaAllocator<size_t> > first(n+1, 0, ArenaAllocator<size_t>(*out.get_allocator().arena)); // of an array segment, or n for delta
+	int64_t min_open = INT64_MAX;
+	size_t min_first = 0;
+	for (size_t i=0; i<n; ++i) {
+		const int64_t open = cost[i] - 2*(int64_t)r[i].from;
+		if (open < min_open) {
+			min_open = open;
+			min_first = i;
+		}
+		const int64_t delta = cost[i] + 8;
+		const int64_t array = min_open + 8 + 2*((int64_t)MIN(r[i].to, 0xFFFFu) + 1);
+		if (array < delta || (r[i].flags & CMAP_RUN_CONSTANT)) {
+			cost[i+1] = array;
+			first[i+1] = min_first;
+		} else {
+			cost[i+1] = delta;
+			first[i+1] = n;
+		}
+	}
+
+	std::vector<cmap_seg_t, ArenaAllocator<cmap_seg_t> > segs((ArenaAllocator<cmap_seg_t>(*out.get_allocator().arena)));
+	size_t narray = 0;
+	for (size_t i=n; i>0;) {
+		cmap_seg_t seg;
+		seg.end = MIN(r[i-1].to, 0xFFFFu);
+		if (first[i] < n) {
+			seg.start = r[first[i]].from;
+			seg.delta = 0;
+			seg.run = first[i];
+			seg.array = true;
+			narray += seg.end - seg.start + 1;
+			i = first[i];
+		} else {
+			seg.start = r[i-1].from;
+			seg.delta = (r[i-1].glyph - r[i-1].from) & 0xFFFFu;
+			seg.run = i-1;
+			seg.array = false;
+			--i;
+		}
+		segs.push_back(seg);
+	}
+	std::reverse(segs.begin(), segs.end());
+	if (segs.empty() || segs.back().end != 0xFFFFu) {
+		segs.push_back((cmap_seg_t){0xFFFFu, 0xFFFFu, 1, n, false}); // mandatory end marker, maps to glyph 0
+	}
+
+	const size_t segCount = segs.size();
+	const size_t len = sizeof(WoffCmap4) + sizeof(wuint16_t) * (4*segCount + 1 + narray);
+	if (len > 0xFFFFu) {
+		LOG_INFO("charmap 4 would need %zu bytes", len);
+		return false;
+	}
+	out.assign(len, 0);
+
+	WoffCmap4* cmap = (WoffCmap4*)&out[0];
+	unsigned log2 = 0;
+	while ((2u << log2) <= segCount) ++log2;
+	cmap->format = uint2w16(4);
+	cmap->length = uint2w16(len);
+	cmap->language = uint2w16(0);
+	cmap->segCountX2 = uint2w16(2*segCount);
+	cmap->searchRange = uint2w16(2u << log2);
+	cmap->entrySelector = uint2w16(log2);
+	cmap->rangeShift = uint2w16(2*segCount - (2u << log2));
+
+	wuint16_t* endCode = (wuint16_t*)(cmap + 1);
+	wuint16_t* startCode = endCode + segCount + 1; // after reservedPad
+	wuint16_t* idDelta = startCode + segCount;
+	wuint16_t* idRangeOffset = idDelta + segCount;
+	wuint16_t* glyphIndexArray = idRangeOffset + segCount;
+	size_t pos = 0;
+	for (size_t s=0; s<segCount; ++s) {
+		const cmap_seg_t& seg = segs[s];
+		endCode[s] = uint2w16(seg.end);
+		startCode[s] = uint2w16(seg.start);
+		idDelta[s] = uint2w16(seg.delta);
+		if (!seg.array) continue;
+
+		idRangeOffset[s] = uint2w16((segCount - s + pos) * sizeof(wuint16_t)); // from this very entry
+		for (size_t k=seg.run; k<n && r[k].from<=seg.end; ++k) { // gaps stay 0
+			const char_t to = MIN(r[k].to, seg.end);
+			for (char_t c=r[k].from; c<=to; ++c) {
+				glyphIndexArray[pos + c - seg.start] = uint2w16(cmap_run_glyph(r[k], c));
+			}
+		}
+		pos += seg.end - seg.start + 1;
+	}
+	assert(pos == narray);
+	LOG_INFO("charmap 4: %zu segments, %zu glyph index array entries", segCount, narray);
+	return true;
+}
+
+
+void Cmaps::encode12(const cmap_run_t* r, size_t n, cmap_bytes_t& out) {
+	// sequential groups (format 12) need one per character of constant runs and vice versa (format 13), whichever is smaller
+	size_t n12 = 0, n13 = 0;
+	for (size_t i=0; i<n; ++i) {
+		const size_t len = r[i].to - r[i].from + 1;
+		if (r[i].flags & CMAP_RUN_CONSTANT) {
+			n12 += len;
+			++n13;
+		} else {
+			++n12;
+			n13 += len;
+		}
+	}
+	const uint32_t flags = (n13 < n12)? CMAP_RUN_CONSTANT: 0;
+	const size_t ngroups = MIN(n12, n13);
+	const size_t len = sizeof(WoffCmap12) + ngroups * sizeof(WoffCmap12Group);
+	out.assign(len, 0);
+
+	WoffCmap12* cmap = (WoffCmap12*)&out[0];
+	cmap->format = uint2w16(flags? 13: 12);
+	cmap->length = uint2w32(len);
+	cmap->language = uint2w32(0);
+	cmap->nGroups = uint2w32(ngroups);
+	WoffCmap12Group* group = (WoffCmap12Group*)(cmap + 1);
+	for (size_t i=0; i<n; ++i) {
+		if ((r[i].flags & CMAP_RUN_CONSTANT) == flags || r[i].from == r[i].to) {
+			group->startCharCode = uint2w32(r[i].from);
+			group->endCharCode = uint2w32(r[i].to);
+			group->startGlyphCode = uint2w32(r[i].glyph);
+			++group;
+			continue;
+		}
+		for (char_t c=r[i].from; c<=r[i].to; ++c, ++group) {
+			group->startCharCode = uint2w32(c);
+			group->endCharCode = uint2w32(c);
+			group->startGlyphCode = uint2w32(cmap_run_glyph(r[i], c));
+		}
+	}
+	assert(group == (WoffCmap12Group*)(cmap + 1) + ngroups);
+	LOG_INFO("charmap %u: %zu groups", flags? 13: 12, ngroups);
+}
+
+
+void Cmaps::encode14(const cmap_uvs_t* u, size_t n, cmap_bytes_t& out) {
+	// sizes first, default ranges can only cover 256 characters each
+	size_t nrecords = 0;
+	size_t len = sizeof(WoffCmap14);
+	for (size_t a=0, b; a<n; a=b) {
+		size_t ndefault = 0, nmappings = 0;
+		for (b=a; b<n && u[b].selector==u[a].selector; ++b) {
+			if (u[b].glyph) {
+				++nmappings;
+			} else {
+				ndefault += (u[b].to - u[b].from) / 256 + 1;
+			}
+		}
+		++nrecords;
+		len += 11;
+		if (ndefault) len += 4 + 4*ndefault;
+		if (nmappings) len += 4 + 5*nmappings;
+	}
+	out.assign(len, 0);
+
+	WoffCmap14* cmap = (WoffCmap14*)&out[0];
+	cmap->format = uint2w16(14);
+	cmap->length = uint2w32(len);
+	cmap->numVarSelectorRecords = uint2w32(nrecords);
+	uint8_t* record = (uint8_t*)(cmap + 1);
+	size_t off = sizeof(WoffCmap14) + 11*nrecords;
+	for (size_t a=0, b; a<n; a=b, record+=11) {
+		put24(record, u[a].selector);
+		uint8_t* ranges = (uint8_t*)&out[off];
+		uint32_t nranges = 0;
+		for (b=a; b<n && u[b].selector==u[a].selector; ++b) {
+			if (u[b].glyph) continue;
+			for (char_t c=u[b].from; ; c+=256) {
+				const char_t to = MIN(u[b].to, c+255);
+				put24(ranges + 4 + 4*nranges, c);
+				ranges[4 + 4*nranges + 3] = to - c;
+				++nranges;
+				if (to == u[b].to) break;
+			}
+		}
+		if (nranges) {
+			put32(ranges, nranges);
+			put32(record + 3, off);
+			off += 4 + 4*nranges;
+		}
+
+		uint8_t* mappings = (uint8_t*)&out[off];
+		uint32_t nmappings = 0;
+		for (b=a; b<n && u[b].selector==u[a].selector; ++b) {
+			if (!u[b].glyph) continue;
+			put24(mappings + 4 + 5*nmappings, u[b].from);
+			mappings[4 + 5*nmappings + 3] = u[b].glyph >> 8;
+			mappings[4 + 5*nmappings + 4] = u[b].glyph;
+			++nmappings;
+		}
+		if (nmappings) {
+			put32(mappings, nmappings);
+			put32(record + 7, off);
+			off += 4 + 5*nmappings;
+		}
+	}
+	assert(off == len);
+	LOG_INFO("charmap 14: %zu variation selectors", nrecords);
+}
+
+
+char* Cmaps::encode(const char* orig, size_t origlen, size_t& len) const {
+	// keep the kind of encoding records, i.e. whether Unicode platform ones and a symbol instead of a Unicode BMP one for Windows
+	bool unicode = false, symbol = false;
+	if (origlen < sizeof(WoffCmapIndex)) return NULL;
+	const WoffCmapIndex* index = (const WoffCmapIndex*)orig;
+	if (origlen < sizeof(WoffCmapIndex) + w2uint16(index->numberSubtables) * sizeof(WoffCmapSubtable)) return NULL;
+	const WoffCmapSubtable* subtable = (const WoffCmapSubtable*)(index+1);
+	for (unsigned si=0; si<w2uint16(index->numberSubtables); ++si) {
+		if (w2uint16(subtable[si].platformID) == 0) {
+			unicode = true;
+		} else if (w2uint16(subtable[si].platformID) == 3 && w2uint16(subtable[si].platformSpecificID) == 0) {
+			symbol = true;
+		}
+	}
+
+	const bool astral = nruns && data[nruns-1].to > 0xFFFFu;
+	cmap_bytes_t bmp((ArenaAllocator<char>(arena)));
+	cmap_bytes_t full((ArenaAllocator<char>(arena)));
+	cmap_bytes_t variations((ArenaAllocator<char>(arena)));
+	if (!encode4(data, nruns, bmp)) return NULL;
+	if (astral) encode12(data, nruns, full);
+	if (nuvs) encode14(uvsdata, nuvs, variations);
+
+	// subtables are shared, sorted by platform and encoding
+	struct {
+		uint16_t platformID, platformSpecificID;
+		const cmap_bytes_t* table;
+	} records[5];
+	unsigned nrecords = 0;
+	#define CMAP_RECORD(p, e, t) do { records[nrecords].platformID = p; records[nrecords].platformSpecificID = e; records[nrecords++].table = &t; } while (0)
+	if (unicode) CMAP_RECORD(0, 3, bmp); // Unicode 2.0 BMP
+	if (unicode && astral) CMAP_RECORD(0, 4, full); // Unicode 2.0 full
+	if (nuvs) CMAP_RECORD(0, 5, variations); // Unicode variation sequences
+	CMAP_RECORD(3, symbol? 0: 1, bmp);
+	if (astral) CMAP_RECORD(3, 10, full); // Unicode full repertoire
+	#undef CMAP_RECORD
+
+	const size_t bmpoff = PAD4(sizeof(WoffCmapIndex) + nrecords * sizeof(WoffCmapSubtable));
+	const size_t fulloff = bmpoff + PAD4(bmp.size());
+	const size_t variationsoff = fulloff + PAD4(full.size());
+	len = variationsoff + variations.size();
+	char* buf = (char*)arena.calloc(1, PAD4(len));
+
+	WoffCmapIndex* h = (WoffCmapIndex*)buf;
+	h->version = uint2w16(0);
+	h->numberSubtables = uint2w16(nrecords);
+	WoffCmapSubtable* s = (WoffCmapSubtable*)(h+1);
+	for (unsigned i=0; i<nrecords; ++i) {
+		s[i].platformID = uint2w16(records[i].platformID);
+		s[i].platformSpecificID = uint2w16(records[i].platformSpecificID);
+		s[i].offset = uint2w32((records[i].table == &bmp)? bmpoff: (records[i].table == &full)? fulloff: variationsoff);
+	}
+	memcpy(buf + bmpoff, &bmp[0], bmp.size());
+	if (!full.empty()) memcpy(buf + fulloff, &full[0], full.size());
+	if (!variations.empty()) memcpy(buf + variationsoff, &variations[0], variations.size());
+	return buf;
+}
+
+
+static bool char_range_cmp(const char_range_t& a, const char_range_t& b) {
+	return a.from < b.from;
+}
+
+
+static void push_range(std::vector<char_range_t>& v, char_t from, char_t to) {
+	if (!v.empty() && v.back().to+1 == from) {
+		v.back().to = to;
 	} else {
-		assert(cit->second != 0);
-		return cit->second;
+		v.push_back((char_range_t){from, to});
 	}
 }
 
 
+void Cmaps::normalize(std::vector<char_range_t>& v) {
+	std::sort(v.begin(), v.end(), char_range_cmp);
+	std::vector<char_range_t> rv;
+	for (std::vector<char_range_t>::const_iterator it=v.begin(); it!=v.end(); ++it) {
+		assert(it->from <= it->to);
+		if (!rv.empty() && it->from <= rv.back().to+1) {
+			rv.back().to = MAX(rv.back().to, it->to);
+		} else {
+			rv.push_back(*it);
+		}
+	}
+	v.swap(rv);
+}
+
+
+size_t Cmaps::count(const std::vector<char_range_t>& v) {
+	size_t rv = 0;
+	for (std::vector<char_range_t>::const_iterator it=v.begin(); it!=v.end(); ++it) {
+		rv += it->to - it->from + 1;
+	}
+	return rv;
+}
+
+
+bool Cmaps::contains(const std::vector<char_range_t>& v, char_t c) {
+	std::vector<char_range_t>::const_iterator it = std::lower_bound(v.begin(), v.end(), c, char_range_before);
+	return it != v.end() && it->from <= c;
+}
+
+
 void Cmaps::set_op(std::vector<char_range_t>& v, std::vector<char_range_t>& rem, bool get_given) const {
 	assert(rem.empty());
+	normalize(v);
 	std::vector<char_range_t> rv;
-	for (std::map<char_t, index_t>::const_iterator it=charmap.begin(); it!=charmap.end(); ++it) {
-		const char_t& c = it->first;
-		bool given = false;
-		for (std::vector<char_range_t>::iterator vit=v.begin(); vit!=v.end(); ++vit) {
-			assert(vit->from <= vit->to);
-			if (c >= vit->from && c <= vit->to) {
+	std::vector<char_range_t>::const_iterator vit = v.begin();
+	for (size_t r=0; r<nruns; ++r) {
+		char_t c = data[r].from;
+		while (true) {
+			while (vit != v.end() && vit->to < c) ++vit;
+			char_t e;
+			bool given;
+			if (vit != v.end() && vit->from <= c) {
+				e = MIN(data[r].to, vit->to);
 				given = true;
-				if (vit->from == vit->to) v.erase(vit);
-				break;
+			} else {
+				e = (vit != v.end())? MIN(data[r].to, vit->from-1): data[r].to;
+				given = false;
 			}
-		}
-		if (given == get_given) {
-			rv.push_back((char_range_t){c, c});
-		} else {
-			rem.push_back((char_range_t){c, c});
+			push_range((given == get_given)? rv: rem, c, e);
+			if (e == data[r].to) break;
+			c = e+1;
 		}
 	}
 	v.swap(rv);
@@ -176,24 +778,65 @@ void Cmaps::set_substract(std::vector<char_range_t>& v, std::vector<char_range_t
 
 
 void Cmaps::intersect(const std::vector<char_range_t>& v, std::vector<char_range_t>& r) {
+	std::vector<char_range_t> given(v);
+	normalize(given);
+	normalize(r);
 	std::vector<char_range_t> rv;
-	for (std::vector<char_range_t>::iterator rit=r.begin(); rit!=r.end(); ++rit) {
-		assert(rit->from <= rit->to);
-		for (char_t c=rit->from; c<=rit->to; ++c) {
-			for (std::vector<char_range_t>::const_iterator vit=v.begin(); vit!=v.end(); ++vit) {
-				assert(vit->from <= vit->to);
-				if (c >= vit->from && c <= vit->to) {
-					bool found = false;
-					for (std::vector<char_range_t>::const_iterator it=rv.begin(); it!=rv.end(); ++it) {
-						if (c >= it->from && c <= it->to) found = true;
-					}
-					if (!found) {
-						rv.push_back((char_range_t){c, c});
-					}
-					break;
-				}
-			}
+	std::vector<char_range_t>::const_iterator git = given.begin();
+	for (std::vector<char_range_t>::const_iterator rit=r.begin(); rit!=r.end(); ++rit) {
+		while (git != given.end() && git->to < rit->from) ++git;
+		for (std::vector<char_range_t>::const_iterator it=git; it!=given.end() && it->from <= rit->to; ++it) {
+			push_range(rv, MAX(it->from, rit->from), MIN(it->to, rit->to));
 		}
 	}
 	r.swap(rv);
 }
+
+
+bool Cmaps::dump(const char* buf, size_t len, Dump& out) {
+	const View view(buf, len);
+	const WoffCmapIndex* index = view.get<WoffCmapIndex>();
+	if (!index) return false;
+	const unsigned nsubtables = w2uint16(index->numberSubtables);
+	const WoffCmapSubtable* subtable = view.get<WoffCmapSubtable>(sizeof(WoffCmapIndex), nsubtables);
+	if (!subtable) return false;
+
+	for (unsigned si=0; si<nsubtables; ++si) {
+		const size_t off = w2uint32(subtable[si].offset);
+		const wuint16_t* peek = view.get<wuint16_t>(off);
+		if (!peek) return false;
+		const unsigned format = w2uint16(*peek);
+
+		out.begin("cmap_subtable");
+		out.num("index", si);
+		out.num("platformID", w2uint16(subtable[si].platformID));
+		out.num("encodingID", w2uint16(subtable[si].platformSpecificID));
+		out.num("offset", off);
+		out.num("format", format);
+		out.end();
+
+		Arena a; // per subtable, as parsed but not merged
+		cmap_runs_t runs((ArenaAllocator<cmap_run_t>(a)));
+		cmap_uvs_list_t uvs((ArenaAllocator<cmap_uvs_t>(a)));
+		if (!parse_subtable(format, (const char*)peek, len - off, runs, uvs)) return false;
+		for (cmap_runs_t::const_iterator it=runs.begin(); it!=runs.end(); ++it) {
+			out.begin("cmap_range");
+			out.num("subtable", si);
+			out.hex("from", it->from);
+			out.hex("to", it->to);
+			out.num("glyph", it->glyph);
+			if (it->flags & CMAP_RUN_CONSTANT) out.num("constant", 1);
+			out.end();
+		}
+		for (cmap_uvs_list_t::const_iterator it=uvs.begin(); it!=uvs.end(); ++it) {
+			out.begin("cmap_variation");
+			out.num("subtable", si);
+			out.hex("selector", it->selector);
+			out.hex("from", it->from);
+			out.hex("to", it->to);
+			if (it->glyph) out.num("glyph", it->glyph);
+			out.end();
+		}
+	}
+	return true;
+}
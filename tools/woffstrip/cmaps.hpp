@@ -1,24 +1,80 @@
 #pragma once
 #include "main.hpp"
 #include "types.hpp"
-#include <map>
+#include "dump.hpp"
+#include "arena.hpp"
 #include <vector>
 
 
+#define CMAP_RUN_CONSTANT 0x01u // all characters map to the same glyph, as from format 13
+
+typedef struct {
+	char_t from, to;
+	index_t glyph; // of the first character, subsequent ones are mapped to sequential glyphs
+	uint32_t flags; // only for runs of more than one character
+} cmap_run_t;
+typedef std::vector<cmap_run_t, ArenaAllocator<cmap_run_t> > cmap_runs_t;
+typedef std::vector<char, ArenaAllocator<char> > cmap_bytes_t;
+
+inline index_t cmap_run_glyph(const cmap_run_t& r, char_t c) {
+	return (r.flags & CMAP_RUN_CONSTANT)? r.glyph: r.glyph + (c - r.from);
+}
+
+typedef struct {
+	char_t selector; // variation selector
+	char_t from, to; // base characters
+	index_t glyph; // 0 for default ones, i.e. as by the main mapping, otherwise only single characters
+} cmap_uvs_t;
+typedef std::vector<cmap_uvs_t, ArenaAllocator<cmap_uvs_t> > cmap_uvs_list_t;
+
+
+/**
+ * Merged character to glyph mapping of all subtables, as sorted and disjoint runs instead of per character.
+ * Unicode variation sequences (format 14) are kept aside, sorted by selector and base character.
+ */
 class Cmaps {
 	private:
-		static bool parse0(const char*, size_t, std::map<char_t, index_t>&);
-		static bool parse4(const char*, size_t, std::map<char_t, index_t>&);
-		static bool parse12(const char*, size_t, std::map<char_t, index_t>&);
+		static bool parse0(const char*, size_t, cmap_runs_t&);
+		static bool parse4(const char*, size_t, cmap_runs_t&);
+		static bool parse6(const char*, size_t, cmap_runs_t&);
+		static bool parse10(const char*, size_t, cmap_runs_t&);
+		static bool parse12(const char*, size_t, cmap_runs_t&, bool);
+		static bool parse14(const char*, size_t, cmap_uvs_list_t&);
+		static bool parse_subtable(unsigned, const char*, size_t, cmap_runs_t&, cmap_uvs_list_t&); // by format
+		static void add_run(cmap_runs_t&, char_t, char_t, index_t, uint32_t=0);
+		static bool encode4(const cmap_run_t*, size_t, cmap_bytes_t&);
+		static void encode12(const cmap_run_t*, size_t, cmap_bytes_t&);
+		static void encode14(const cmap_uvs_t*, size_t, cmap_bytes_t&);
 		void set_op(std::vector<char_range_t>&, std::vector<char_range_t>&, bool) const;
-		std::map<char_t, index_t> charmap;
+
+		Arena& arena;
+		cmap_runs_t runs;
+		const cmap_run_t* data; // either the above or borrowed
+		size_t nruns;
+		size_t nchars;
+		cmap_uvs_list_t uvs;
+		const cmap_uvs_t* uvsdata; // likewise
+		size_t nuvs;
 
 	public:
+		Cmaps(Arena& a): arena(a), runs(ArenaAllocator<cmap_run_t>(a)), data(NULL), nruns(0), nchars(0), uvs(ArenaAllocator<cmap_uvs_t>(a)), uvsdata(NULL), nuvs(0) {}
+
 		bool parse(const char*, size_t);
+		void assign(const cmap_run_t*, size_t, const cmap_uvs_t*, size_t); // borrowed, e.g. from an index
 		index_t find(char_t) const;
-		size_t size() const { return charmap.size(); }
+		size_t size() const { return nchars; }
+		const cmap_run_t* getRuns(size_t& n) const { n = nruns; return data; }
+		const cmap_uvs_t* getVariations(size_t& n) const { n = nuvs; return uvsdata; }
+		void remove(const std::vector<char_range_t>&); // sorted and disjoint, e.g. from set_intersect
+		void insert(const cmap_run_t*, size_t); // sorted, for chars not mapped yet
+		char* encode(const char*, size_t, size_t&) const; // minimal table for the current mapping, given the original one
 
 		void set_intersect(std::vector<char_range_t>&, std::vector<char_range_t>&) const; // returns those found here and given, and the remainders
 		void set_substract(std::vector<char_range_t>&, std::vector<char_range_t>&) const; // returns those found here but not given, and the remainders
 		static void intersect(const std::vector<char_range_t>&, std::vector<char_range_t>&); // deletes those not found in first argument
+		static void normalize(std::vector<char_range_t>&); // sorts and merges
+		static size_t count(const std::vector<char_range_t>&);
+		static bool contains(const std::vector<char_range_t>&, char_t); // sorted and disjoint
+
+		static bool dump(const char*, size_t, Dump&); // subtables as parsed, before merging them into a map
 };
@@ -0,0 +1,180 @@
+#include "dump.hpp"
+
+
+static const struct {
+	const char* name;
+	unsigned section;
+} sections[] = {
+	{"header", DUMP_HEADER},
+	{"tables", DUMP_TABLES},
+	{"head", DUMP_HEAD},
+	{"cmap", DUMP_CMAP},
+	{"loca", DUMP_LOCA},
+	{"all", DUMP_ALL},
+};
+
+
+unsigned dump_sections(const char* s) {
+	unsigned rv = 0;
+	while (*s) {
+		const char* e = strchrnul(s, ',');
+		bool found = false;
+		for (size_t i=0; i<sizeof(sections)/sizeof(*sections); ++i) {
+			if (strlen(sections[i].name) == (size_t)(e-s) && strncmp(sections[i].name, s, e-s) == 0) {
+				rv |= sections[i].section;
+				found = true;
+				break;
+			}
+		}
+		if (!found) return 0;
+		if (!*e) break;
+		s = e+1;
+	}
+	return rv;
+}
+
+
+Dump::Dump(int f, size_t s): fd(f), size(s), buf((char*)malloc(s)), len(0), failed(false), first(true) {
+}
+
+
+Dump::~Dump() {
+	flush();
+	free(buf);
+}
+
+
+bool Dump::flush() {
+	size_t off = 0;
+	while (!failed && off < len) {
+		ssize_t rv = write(fd, buf+off, len-off);
+		if (rv < 0) {
+			if (errno == EINTR) continue;
+			LOG_ERRNO("write()");
+			failed = true;
+		} else {
+			off += rv;
+		}
+	}
+	len = 0;
+	return !failed;
+}
+
+
+void Dump::put(const char* s, size_t l) {
+	if (len + l > size) {
+		flush();
+		if (l > size) { // would not fit anyways
+			while (!failed && l) {
+				ssize_t rv = write(fd, s, l);
+				if (rv < 0) {
+					if (errno == EINTR) continue;
+					LOG_ERRNO("write()");
+					failed = true;
+				} else {
+					s += rv;
+					l -= rv;
+				}
+			}
+			return;
+		}
+	}
+	memcpy(buf+len, s, l);
+	len += l;
+}
+
+
+void Dump::put_uint(uint64_t v) {
+	char tmp[20];
+	size_t i = sizeof(tmp);
+	do {
+		tmp[--i] = '0' + (v % 10);
+		v /= 10;
+	} while (v);
+	put(tmp+i, sizeof(tmp)-i);
+}
+
+
+void Dump::put_key(const char* k) {
+	if (!first) put(',');
+	first = false;
+	put('"');
+	put(k, strlen(k));
+	put("\":", 2);
+}
+
+
+void Dump::begin(const char* type) {
+	first = true;
+	put('{');
+	str("type", type);
+}
+
+
+void Dump::end() {
+	put("}\n", 2);
+	first = true;
+}
+
+
+void Dump::num(const char* k, uint64_t v) {
+	put_key(k);
+	put_uint(v);
+}
+
+
+void Dump::inum(const char* k, int64_t v) {
+	put_key(k);
+	if (v < 0) {
+		put('-');
+		put_uint(-(uint64_t)v);
+	} else {
+		put_uint(v);
+	}
+}
+
+
+void Dump::hex(const char* k, uint32_t v, unsigned width) {
+	static const char digits[] = "0123456789abcdef";
+	char tmp[8];
+	size_t i = sizeof(tmp);
+	do {
+		tmp[--i] = digits[v & 0x0f];
+		v >>= 4;
+	} while (v || sizeof(tmp)-i < width);
+	put_key(k);
+	put('"');
+	put(tmp+i, sizeof(tmp)-i);
+	put('"');
+}
+
+
+void Dump::str(const char* k, const char* s) {
+	put_key(k);
+	put('"');
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\') put('\\');
+		put(*s);
+	}
+	put('"');
+}
+
+
+void Dump::array(const char* k) {
+	put_key(k);
+	put('[');
+	first = true;
+}
+
+
+void Dump::elem(uint64_t v) {
+	if (!first) put(',');
+	first = false;
+	put_uint(v);
+}
+
+
+void Dump::array_end() {
+	put(']');
+	first = false;
+}
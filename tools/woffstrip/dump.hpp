@@ -0,0 +1,48 @@
+#pragma once
+#include "main.hpp"
+
+
+// sections for the structured inspection dump, only the tables needed by the requested ones get decoded
+#define DUMP_HEADER (1u<<0)
+#define DUMP_TABLES (1u<<1)
+#define DUMP_HEAD   (1u<<2)
+#define DUMP_CMAP   (1u<<3)
+#define DUMP_LOCA   (1u<<4)
+#define DUMP_ALL    (DUMP_HEADER|DUMP_TABLES|DUMP_HEAD|DUMP_CMAP|DUMP_LOCA)
+
+unsigned dump_sections(const char*); // comma separated list of section names, 0 on error
+
+
+/**
+ * Streams one JSON object per line through a large buffer, without any stdio or printf per field.
+ */
+class Dump {
+	private:
+		const int fd;
+		const size_t size;
+		char* buf;
+		size_t len;
+		bool failed;
+		bool first; // within the current object or array
+
+		void put(char c) { if (len == size) flush(); buf[len++] = c; }
+		void put(const char*, size_t);
+		void put_uint(uint64_t);
+		void put_key(const char*);
+
+	public:
+		Dump(int fd=STDOUT_FILENO, size_t size=1<<20);
+		~Dump();
+		bool flush();
+
+		void begin(const char* type); // {"type":"..."
+		void end(); // }\n
+		void num(const char*, uint64_t);
+		void inum(const char*, int64_t);
+		void hex(const char*, uint32_t, unsigned=4); // as zero-padded hex string
+		void str(const char*, const char*);
+
+		void array(const char*);
+		void elem(uint64_t);
+		void array_end();
+};
@@ -0,0 +1,135 @@
+#include "estimate.hpp"
+#include "io.hpp"
+
+
+Estimate::Estimate(): cmaps(NULL), nglyphs(0), depidx(NULL), deps(NULL), cost(NULL), seen(NULL), mapped(NULL), nmapped(0), kept(0), gen(0), base(0), sum(0) {
+	memset(layout, 0, sizeof(layout));
+}
+
+
+bool Estimate::build(const Cmaps& c, const char* data, size_t len, const uint32_t* offsets, unsigned n, size_t stub, const uint32_t* di, const uint32_t* d, size_t fixed, size_t rest, bool deflated) {
+	assert(!cost && offsets && di && d);
+	cmaps = &c;
+	nglyphs = n;
+	depidx = di;
+	deps = d;
+	cost = (uint32_t*)arena.calloc(MAX(n, 1), sizeof(uint32_t));
+	seen = (uint32_t*)arena.calloc(MAX(n, 1), sizeof(uint32_t));
+	gen = 1;
+
+	// neighborhoods of consecutive glyphs, as chunked for compression
+	std::vector<index_t> spans(1, 0);
+	for (index_t i=1; i<=n; ++i) {
+		if (offsets[i] < offsets[i-1] || offsets[i] > len) return false;
+		if (i < n && offsets[i] - offsets[spans.back()] >= ESTIMATE_SPAN) spans.push_back(i);
+	}
+	spans.push_back(n);
+	const size_t nspans = spans.size() - 1;
+	const size_t step = MAX(1, (nspans + ESTIMATE_SAMPLES-1) / ESTIMATE_SAMPLES);
+
+	uint64_t total = 0, raw = 0, packed = 0;
+	uint32_t ratio = ESTIMATE_SCALE; // compressed bytes per byte
+	for (size_t s=0; s<nspans; ++s) {
+		const uint32_t from = offsets[spans[s]], to = offsets[spans[s+1]];
+		if (deflated && s % step == 0 && to > from) {
+			char* z;
+			size_t zlen;
+			if (!docompress(data + from, to - from, z, &zlen, arena)) return false;
+			arena.free(z);
+			ratio = (uint32_t)((zlen * ESTIMATE_SCALE + (to - from) / 2) / (to - from));
+			raw += to - from;
+			packed += zlen;
+		}
+		for (index_t i=spans[s]; i<spans[s+1]; ++i) {
+			cost[i] = (offsets[i+1] - offsets[i]) * ratio;
+			total += cost[i];
+		}
+	}
+	const uint64_t mean = raw? (packed * ESTIMATE_SCALE + raw / 2) / raw: ESTIMATE_SCALE;
+	base = (uint64_t)fixed * ESTIMATE_SCALE + rest * mean + total;
+
+	// only glyphs of chars are dropped, but for a stub, the rest counts when added
+	mapped = (uint8_t*)arena.calloc(MAX(n, 1), sizeof(uint8_t));
+	size_t nruns;
+	const cmap_run_t* runs = c.getRuns(nruns);
+	for (size_t r=0; r<nruns; ++r) {
+		if (runs[r].glyph >= n) continue;
+		const size_t count = (runs[r].flags & CMAP_RUN_CONSTANT)? 1: MIN((size_t)(runs[r].to - runs[r].from) + 1, n - runs[r].glyph);
+		memset(&mapped[runs[r].glyph], 1, count);
+	}
+	if (n) mapped[0] = 0; // never deleted
+	for (index_t i=0; i<n; ++i) {
+		nmapped += mapped[i];
+		const uint32_t len = offsets[i+1] - offsets[i];
+		if (mapped[i] && len > stub) {
+			cost[i] -= (uint32_t)((uint64_t)cost[i] * stub / len);
+			base -= cost[i];
+		} else {
+			cost[i] = 0;
+		}
+	}
+	sum = base;
+	LOG_INFO("estimated %zu bytes without any chars and layout tables, glyph data deflated by %.3f", size(), (double)mean / ESTIMATE_SCALE);
+	return true;
+}
+
+
+void Estimate::setLayout(size_t none, size_t half, size_t all) {
+	// through the three samples
+	layout[0] = none;
+	layout[1] = 4.0*half - 3.0*none - all;
+	layout[2] = 2.0*all + 2.0*none - 4.0*half;
+	LOG_INFO("estimated layout tables of %zu, %zu and %zu bytes for none, half and all glyphs of chars", none, half, all);
+}
+
+
+size_t Estimate::size() const {
+	const double x = nmapped? (double)kept / nmapped: 0;
+	const double l = layout[0] + layout[1] * x + layout[2] * x * x;
+	return (size_t)((sum + ESTIMATE_SCALE-1) / ESTIMATE_SCALE) + (size_t)MAX(0.0, l + 0.5);
+}
+
+
+void Estimate::reset() {
+	if (++gen == 0) { // wrapped
+		memset(seen, 0, MAX(nglyphs, 1) * sizeof(uint32_t));
+		gen = 1;
+	}
+	sum = base;
+	kept = 0;
+}
+
+
+size_t Estimate::add(char_t c) {
+	assert(cost);
+	const index_t g = cmaps->find(c);
+	if (!g || g >= nglyphs || seen[g] == gen) return size();
+
+	// with its composite glyph components, as kept by Woff::selectGlyphs()
+	stack.assign(1, g);
+	seen[g] = gen;
+	while (!stack.empty()) {
+		const index_t i = stack.back();
+		stack.pop_back();
+		sum += cost[i];
+		kept += mapped[i];
+		for (uint32_t k=depidx[i]; k<depidx[i+1]; ++k) {
+			if (deps[k] < nglyphs && seen[deps[k]] != gen) {
+				seen[deps[k]] = gen;
+				stack.push_back(deps[k]);
+			}
+		}
+	}
+	return size();
+}
+
+
+size_t Estimate::estimate(const std::vector<char_range_t>& chars) {
+	reset();
+	for (std::vector<char_range_t>::const_iterator it=chars.begin(); it!=chars.end(); ++it) {
+		for (char_t c=it->from; c<=it->to; ++c) {
+			add(c);
+		}
+	}
+	return size();
+}
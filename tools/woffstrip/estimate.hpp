@@ -0,0 +1,46 @@
+#pragma once
+#include "main.hpp"
+#include "types.hpp"
+#include "cmaps.hpp"
+#include "arena.hpp"
+#include <vector>
+
+
+#define ESTIMATE_SPAN (32*1024) // glyph neighborhoods deflated as a sample, as the window of the actual compression
+#define ESTIMATE_SAMPLES 64 // at most, others take the ratio of the preceding sample
+#define ESTIMATE_SCALE 256 // fixed point of the costs
+
+
+/**
+ * Expected output size for a set of chars, by a compressed cost per glyph that is sampled once per font from deflating glyph neighborhoods.
+ * Glyphs of chars that are not kept are dropped unless they are components of kept ones, anything else counts as in the input.
+ * Chars are added one by one, each in about the time of a cmap lookup, e.g. to find how many of them fit into a budget.
+ * Layout tables are pruned along with the glyphs, their size follows the share of mapped glyphs kept, as sampled by pruning for none, half and all of them.
+ */
+class Estimate {
+	private:
+		Arena arena;
+		const Cmaps* cmaps; // borrowed, as parsed
+		unsigned nglyphs;
+		const uint32_t* depidx; // composite glyph components, borrowed
+		const uint32_t* deps;
+		uint32_t* cost; // by glyph, 0 for those never dropped, in 1/ESTIMATE_SCALE bytes
+		uint32_t* seen; // by glyph, the generation that counted it
+		uint8_t* mapped; // by glyph, whether it is of a char
+		uint32_t nmapped, kept; // of those, as of the chars added
+		double layout[3]; // quadratic in the share of mapped glyphs kept, in bytes
+		uint32_t gen;
+		uint64_t base, sum; // without any char, and as of the chars added
+		std::vector<index_t> stack;
+
+	public:
+		Estimate();
+
+		bool build(const Cmaps&, const char*, size_t, const uint32_t*, unsigned, size_t, const uint32_t*, const uint32_t*, size_t, size_t, bool); // glyph data and nglyphs+1 offsets into it, bytes left of a dropped glyph, components, size of anything else, and of the rest of the glyph data table
+		void setLayout(size_t, size_t, size_t); // sizes with none, every other one and all of the mapped glyphs kept
+		bool isMapped(index_t i) const { return i < nglyphs && mapped[i]; }
+		void reset(); // back to no chars
+		size_t add(char_t); // including this char as well
+		size_t estimate(const std::vector<char_range_t>&); // for these chars only
+		size_t size() const;
+};
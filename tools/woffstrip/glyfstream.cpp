@@ -0,0 +1,167 @@
+#include "glyfstream.hpp"
+#include "io.hpp"
+#include "simd.hpp"
+
+
+#define WRITER_MIN_OUT (64*1024)
+
+
+GlyfReader::GlyfReader(Arena& a, size_t s): arena(a), inflating(false), src(NULL), srclen(0), srcpos(0), total(0), win(NULL), size(MAX(s, (size_t)4096)), start(0), len(0) {
+	zinit(zs, arena);
+}
+
+
+GlyfReader::~GlyfReader() {
+	if (inflating) inflateEnd(&zs);
+	arena.free(win);
+}
+
+
+bool GlyfReader::open(const char* s, size_t l, size_t origlen) {
+	assert(!win);
+	if (l > origlen) return false;
+	src = s;
+	srclen = l;
+	total = origlen;
+	if (l < origlen) { // as by decompress(), same length means stored uncompressed
+		if (inflateInit(&zs) != Z_OK) return false;
+		inflating = true;
+		zs.next_in = (Bytef*)src;
+		zs.avail_in = srclen;
+	}
+	win = (char*)arena.alloc(size);
+	return true;
+}
+
+
+bool GlyfReader::fill(size_t to) {
+	while (start + len < to) {
+		char* p = win + len;
+		const size_t avail = MIN(size - len, total - (start + len));
+		if (!avail) return false;
+		if (!inflating) {
+			if (avail > srclen - srcpos) return false;
+			memcpy(p, src + srcpos, avail);
+			srcpos += avail;
+			len += avail;
+			continue;
+		}
+		zs.next_out = (Bytef*)p;
+		zs.avail_out = avail;
+		const int rv = inflate(&zs, Z_NO_FLUSH);
+		len += avail - zs.avail_out;
+		if (rv == Z_STREAM_END) {
+			return start + len >= to;
+		} else if (rv != Z_OK) {
+			LOG("cannot uncompress: %i", rv);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+const char* GlyfReader::get(size_t from, size_t to) {
+	if (!win || from < start || from > to || to > total) return NULL;
+	if (to > start + len) {
+		while (start + len < from) { // skipped, a window at a time
+			start += len;
+			len = 0;
+			if (!fill(MIN(from, start + size))) return NULL;
+		}
+		const size_t skip = from - start; // not needed anymore
+		memmove(win, win + skip, len - skip);
+		start = from;
+		len -= skip;
+		if (to - start > size) {
+			size = to - start;
+			win = (char*)arena.realloc(win, size);
+		}
+		if (!fill(to)) return NULL;
+	}
+	return win + (from - start);
+}
+
+
+TableWriter::TableWriter(Arena& a): arena(a), ok(false), out(NULL), outsize(0), len(0), sum(0) {
+	zinit(zs, arena);
+	ok = deflateInit(&zs, Z_BEST_COMPRESSION) == Z_OK; // as by docompress()
+}
+
+
+TableWriter::~TableWriter() {
+	if (ok) deflateEnd(&zs);
+	arena.free(out);
+}
+
+
+bool TableWriter::drain(int flush) {
+	while (true) {
+		if (outsize - zs.total_out < WRITER_MIN_OUT / 4) {
+			outsize = MAX((size_t)WRITER_MIN_OUT, 2 * outsize);
+			out = (char*)arena.realloc(out, outsize);
+		}
+		zs.next_out = (Bytef*)out + zs.total_out;
+		zs.avail_out = outsize - zs.total_out;
+		const int rv = deflate(&zs, flush);
+		if (rv == Z_STREAM_END) {
+			return true;
+		} else if (rv != Z_OK && rv != Z_BUF_ERROR) {
+			LOG("cannot compress: %i", rv);
+			return false;
+		}
+		if (flush != Z_FINISH && !zs.avail_in && zs.avail_out) return true;
+	}
+}
+
+
+bool TableWriter::write(const char* p, size_t l) {
+	if (!ok) return false;
+	const char* const e = p + l;
+
+	// checksum by big-endian words relative to the table start, regardless of how it is appended
+	const char* q = p;
+	for (; q < e && (len + (q - p)) % 4; ++q) {
+		word[(len + (q - p)) % 4] = *q;
+		if ((len + (q - p)) % 4 == 3) sum += ((uint32_t)word[0] << 24) | ((uint32_t)word[1] << 16) | ((uint32_t)word[2] << 8) | word[3];
+	}
+	const size_t words = (e - q) / 4 * 4;
+	if (words) sum += be32_sum(q, words);
+	for (q += words; q < e; ++q) {
+		word[(len + (q - p)) % 4] = *q;
+	}
+	len += l;
+
+	zs.next_in = (Bytef*)p;
+	zs.avail_in = l;
+	return ok = drain(Z_NO_FLUSH);
+}
+
+
+bool TableWriter::finish(char*& dst, size_t& dstlen) {
+	if (!ok) return false;
+	zs.next_in = NULL;
+	zs.avail_in = 0;
+	if (!(ok = drain(Z_FINISH))) return false;
+	if (zs.total_out >= len) {
+		LOG("cannot compress table smaller when streaming");
+		return false;
+	}
+	dstlen = zs.total_out;
+	dst = out;
+	out = NULL;
+	outsize = 0;
+	return true;
+}
+
+
+uint32_t TableWriter::checksum() const {
+	uint32_t rv = sum;
+	const size_t rem = len % 4;
+	if (rem) {
+		uint8_t w[4] = {};
+		memcpy(w, word, rem);
+		rv += ((uint32_t)w[0] << 24) | ((uint32_t)w[1] << 16) | ((uint32_t)w[2] << 8) | w[3];
+	}
+	return rv;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "main.hpp"
+#include "arena.hpp"
+#include <zlib.h>
+
+
+/**
+ * Ranges of a compressed table in ascending order, as glyphs by loca, inflated through a bounded window instead of as a whole.
+ * A single range larger than the window grows it.
+ */
+class GlyfReader {
+	private:
+		Arena& arena;
+		z_stream zs;
+		bool inflating; // otherwise stored uncompressed
+		const char* src;
+		size_t srclen, srcpos;
+		size_t total; // uncompressed length
+		char* win;
+		size_t size; // of the window
+		size_t start; // table offset of the window
+		size_t len; // valid bytes in the window
+
+		bool fill(size_t);
+
+	public:
+		GlyfReader(Arena&, size_t);
+		~GlyfReader();
+
+		bool open(const char*, size_t, size_t); // compressed data and length, uncompressed length
+		const char* get(size_t, size_t); // from/to table offsets, valid until the next call, NULL on error or if not ascending
+};
+
+
+/**
+ * Deflates a table as it is appended, keeping track of its length and checksum.
+ */
+class TableWriter {
+	private:
+		Arena& arena;
+		z_stream zs;
+		bool ok;
+		char* out;
+		size_t outsize;
+		size_t len; // uncompressed
+		uint32_t sum; // of complete words
+		uint8_t word[4]; // the incomplete one
+
+		bool drain(int);
+
+	public:
+		TableWriter(Arena&);
+		~TableWriter();
+
+		bool write(const char*, size_t);
+		bool finish(char*&, size_t&); // compressed data, owned by the arena, fails if not smaller
+		size_t size() const { return len; }
+		uint32_t checksum() const; // with a zero-padded remainder
+};
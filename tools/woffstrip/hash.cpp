@@ -0,0 +1,74 @@
+#include "hash.hpp"
+
+
+static inline uint64_t rotl64(uint64_t x, unsigned r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+
+static inline uint64_t fmix64(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+
+#define HASH_K1 0x87c37b91114253d5ull
+#define HASH_K2 0x4cf5ad432745937full
+
+
+static inline uint64_t load64(const uint8_t* p, unsigned len) {
+	uint64_t w = 0;
+	for (unsigned i=0; i<len; ++i) w |= (uint64_t)p[i] << (8*i); // explicitly little endian, compiles to a load
+	return w;
+}
+
+
+uint64_t hash64(const void* data, size_t len, uint64_t seed) {
+	const uint8_t* p = (const uint8_t*)data;
+	uint64_t h = seed ^ (len * HASH_K1);
+
+	for (; len >= 8; len -= 8, p += 8) {
+		h ^= rotl64(load64(p, 8) * HASH_K1, 31) * HASH_K2;
+		h = rotl64(h, 27) * 5 + 0x52dce729;
+	}
+	h ^= rotl64(load64(p, len) * HASH_K1, 31) * HASH_K2;
+
+	return fmix64(h);
+}
+
+
+Hash64::Hash64(size_t len, uint64_t seed): h(seed ^ (len * HASH_K1)), ncarry(0) {
+}
+
+
+void Hash64::block(const uint8_t* p) {
+	h ^= rotl64(load64(p, 8) * HASH_K1, 31) * HASH_K2;
+	h = rotl64(h, 27) * 5 + 0x52dce729;
+}
+
+
+void Hash64::update(const void* data, size_t len) {
+	const uint8_t* p = (const uint8_t*)data;
+	if (ncarry) {
+		const size_t n = MIN(len, (size_t)(8 - ncarry));
+		memcpy(carry + ncarry, p, n);
+		ncarry += n;
+		p += n;
+		len -= n;
+		if (ncarry < 8) return;
+		block(carry);
+		ncarry = 0;
+	}
+	for (; len >= 8; len -= 8, p += 8) block(p);
+	memcpy(carry, p, len);
+	ncarry = len;
+}
+
+
+uint64_t Hash64::final() const {
+	return fmix64(h ^ (rotl64(load64(carry, ncarry) * HASH_K1, 31) * HASH_K2));
+}
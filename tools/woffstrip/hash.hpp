@@ -0,0 +1,25 @@
+#pragma once
+#include "main.hpp"
+
+
+uint64_t hash64(const void*, size_t, uint64_t=0); // stable across hosts, not cryptographic
+
+
+/**
+ * hash64() over data given in pieces, e.g. iovecs, with up to 7 bytes carried over from one piece to the next.
+ * The total length is part of the initial state, so it has to be known upfront, the result is as for the contiguous data.
+ */
+class Hash64 {
+	private:
+		uint64_t h;
+		uint8_t carry[8];
+		unsigned ncarry;
+
+		void block(const uint8_t*);
+
+	public:
+		Hash64(size_t, uint64_t=0); // total length, seed
+
+		void update(const void*, size_t);
+		uint64_t final() const;
+};
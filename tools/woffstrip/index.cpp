@@ -0,0 +1,86 @@
+#include "index.hpp"
+#include "io.hpp"
+
+
+#define PAD8(l) (((l + 7) / 8) * 8)
+
+
+FontIndex::~FontIndex() {
+	if (buf) file_unmap(buf, len);
+}
+
+
+static bool section_valid(uint64_t off, uint64_t n, size_t size, size_t len) {
+	return off % 8 == 0 && off <= len && n <= (len - off) / size;
+}
+
+
+bool FontIndex::load(const char* fn, const FontIndexHeader& src) {
+	assert(!buf);
+	if (access(fn, F_OK) != 0) return false;
+	if (!file_map(fn, buf, len)) return false;
+	header = (const FontIndexHeader*)buf;
+
+	const char* err = NULL;
+	if (len < sizeof(FontIndexHeader) || memcmp(header->magic, FONT_INDEX_MAGIC, sizeof(header->magic)) != 0) {
+		err = "not an index";
+	} else if (header->version != FONT_INDEX_VERSION || header->byteorder != FONT_INDEX_BYTEORDER) {
+		err = "incompatible index version";
+	} else if (header->sourceLength != src.sourceLength || header->sourceMtime != src.sourceMtime || header->directoryHash != src.directoryHash) {
+		err = "index is outdated";
+	} else if (
+		!section_valid(header->tablesOffset, header->ntables, sizeof(FontIndexTable), len) ||
+		!section_valid(header->runsOffset, header->nruns, sizeof(cmap_run_t), len) ||
+		!section_valid(header->locaOffset, (uint64_t)header->nloca+1, sizeof(uint32_t), len) ||
+		!section_valid(header->depIndexOffset, (uint64_t)header->nloca+1, sizeof(uint32_t), len) ||
+		!section_valid(header->depsOffset, header->ndeps, sizeof(uint32_t), len) ||
+		!section_valid(header->uvsOffset, header->nuvs, sizeof(cmap_uvs_t), len) ||
+		getDepIndex()[header->nloca] != header->ndeps
+	) {
+		err = "truncated index";
+	}
+
+	if (err) {
+		LOG("%s: %s, ignoring", fn, err);
+		file_unmap(buf, len);
+		buf = NULL;
+		len = 0;
+		header = NULL;
+		return false;
+	}
+	return true;
+}
+
+
+bool FontIndex::write(const char* fn, FontIndexHeader& hdr, const FontIndexTable* tables, const cmap_run_t* runs, const uint32_t* loca, const uint32_t* depidx, const uint32_t* deps, const cmap_uvs_t* uvs) {
+	memcpy(hdr.magic, FONT_INDEX_MAGIC, sizeof(hdr.magic));
+	hdr.version = FONT_INDEX_VERSION;
+	hdr.byteorder = FONT_INDEX_BYTEORDER;
+
+	size_t l = PAD8(sizeof(FontIndexHeader));
+	hdr.tablesOffset = l;
+	l += PAD8(hdr.ntables * sizeof(FontIndexTable));
+	hdr.runsOffset = l;
+	l += PAD8(hdr.nruns * sizeof(cmap_run_t));
+	hdr.locaOffset = l;
+	l += PAD8((hdr.nloca+1) * sizeof(uint32_t));
+	hdr.depIndexOffset = l;
+	l += PAD8((hdr.nloca+1) * sizeof(uint32_t));
+	hdr.depsOffset = l;
+	l += PAD8(hdr.ndeps * sizeof(uint32_t));
+	hdr.uvsOffset = l;
+	l += PAD8(hdr.nuvs * sizeof(cmap_uvs_t));
+
+	char* b = (char*)calloc(1, l);
+	memcpy(b, &hdr, sizeof(hdr));
+	memcpy(b + hdr.tablesOffset, tables, hdr.ntables * sizeof(FontIndexTable));
+	if (hdr.nruns) memcpy(b + hdr.runsOffset, runs, hdr.nruns * sizeof(cmap_run_t));
+	memcpy(b + hdr.locaOffset, loca, (hdr.nloca+1) * sizeof(uint32_t));
+	memcpy(b + hdr.depIndexOffset, depidx, (hdr.nloca+1) * sizeof(uint32_t));
+	if (hdr.ndeps) memcpy(b + hdr.depsOffset, deps, hdr.ndeps * sizeof(uint32_t));
+	if (hdr.nuvs) memcpy(b + hdr.uvsOffset, uvs, hdr.nuvs * sizeof(cmap_uvs_t));
+
+	bool rv = file_write(fn, b, l);
+	free(b);
+	return rv;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "main.hpp"
+#include "types.hpp"
+#include "cmaps.hpp"
+
+
+#define FONT_INDEX_MAGIC "wsINDEX" // including termination
+#define FONT_INDEX_VERSION 3
+#define FONT_INDEX_BYTEORDER 0x01020304u
+
+
+/**
+ * Sidecar index with everything parsed from a font, in host byte order and usable directly from a private mapping.
+ * All sections are 8-byte aligned, offsets are from the beginning of the file.
+ * Checked against the source by its length, modification time and directory, the whole file is hashed only by -P or without a time.
+ */
+struct FontIndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;        // FONT_INDEX_BYTEORDER in host order
+	uint64_t sourceHash;       // hash64() of the whole source font file
+	uint64_t sourceLength;
+	uint64_t sourceMtime;      // in nanoseconds, 0 if unknown
+	uint64_t directoryHash;    // hash64() of the source header and table directory, including the table checksums
+	uint32_t indexToLocFormat;
+	uint32_t ntables;
+	uint32_t nruns;            // merged cmap runs
+	uint32_t nloca;            // number of glyphs, the loca and dependency index arrays have one more
+	uint32_t ndeps;            // composite glyph components
+	uint32_t nuvs;             // cmap variation sequence ranges
+	uint64_t tablesOffset;     // FontIndexTable[ntables]
+	uint64_t runsOffset;       // cmap_run_t[nruns]
+	uint64_t locaOffset;       // uint32_t[nloca+1] glyph offsets into the decompressed glyf table
+	uint64_t depIndexOffset;   // uint32_t[nloca+1] start of the components of each glyph
+	uint64_t depsOffset;       // uint32_t[ndeps] component glyph indices
+	uint64_t uvsOffset;        // cmap_uvs_t[nuvs]
+};
+
+struct FontIndexTable {
+	wuint32_t tag;
+	uint32_t origLength;
+	uint32_t origChecksum;
+	uint32_t sfntOffset;       // of the decompressed table within the sfnt layout
+};
+
+
+class FontIndex {
+	private:
+		char* buf;
+		size_t len;
+		const FontIndexHeader* header;
+
+		template<class T> T* section(uint64_t off) const { return (T*)(buf + off); }
+
+	public:
+		FontIndex(): buf(NULL), len(0), header(NULL) {}
+		~FontIndex();
+
+		bool load(const char*, const FontIndexHeader&); // checks against the source length, time and directory hash as given
+		static bool write(const char*, FontIndexHeader&, const FontIndexTable*, const cmap_run_t*, const uint32_t*, const uint32_t*, const uint32_t*, const cmap_uvs_t*);
+
+		const FontIndexHeader* getHeader() const { return header; }
+		const FontIndexTable* getTables() const { return section<const FontIndexTable>(header->tablesOffset); }
+		const cmap_run_t* getRuns() const { return section<const cmap_run_t>(header->runsOffset); }
+		uint32_t* getLoca() const { return section<uint32_t>(header->locaOffset); } // copy-on-write
+		const uint32_t* getDepIndex() const { return section<const uint32_t>(header->depIndexOffset); }
+		const uint32_t* getDeps() const { return section<const uint32_t>(header->depsOffset); }
+		const cmap_uvs_t* getVariations() const { return section<const cmap_uvs_t>(header->uvsOffset); }
+};
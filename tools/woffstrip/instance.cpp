@@ -0,0 +1,778 @@
+#include "instance.hpp"
+#include "simd.hpp"
+#include <math.h>
+#include <algorithm>
+
+// https://docs.microsoft.com/en-us/typography/opentype/spec/otvaroverview
+// https://docs.microsoft.com/en-us/typography/opentype/spec/gvar
+
+
+#define FVAR_AXIS_SIZE 20
+
+#define GVAR_SHARED_POINT_NUMBERS 0x8000
+#define GVAR_COUNT_MASK 0x0FFF
+#define TUPLE_EMBEDDED_PEAK 0x8000
+#define TUPLE_INTERMEDIATE_REGION 0x4000
+#define TUPLE_PRIVATE_POINT_NUMBERS 0x2000
+#define TUPLE_INDEX_MASK 0x0FFF
+#define POINTS_ARE_WORDS 0x80
+#define DELTAS_ARE_ZERO 0x80
+#define DELTAS_ARE_WORDS 0x40
+#define IVS_LONG_WORDS 0x8000
+#define IVS_WORD_COUNT_MASK 0x7FFF
+
+
+static inline int16_t to_f2dot14(float v) {
+	return (int16_t)MAX(-32768.0f, MIN(32767.0f, floorf(v * 16384.0f + 0.5f)));
+}
+
+
+static inline float fixed(const wuint32_t* w) {
+	return (float)(int32_t)w2uint32(*w) / 65536.0f;
+}
+
+
+static inline float iup(int32_t c, int32_t c1, int32_t c2, float d1, float d2) {
+	// by the untouched point coordinate between the touched ones, on each axis separately
+	if (c1 == c2) return (d1 == d2)? d1: 0.0f;
+	if (c1 > c2) {
+		std::swap(c1, c2);
+		std::swap(d1, d2);
+	}
+	if (c <= c1) return d1;
+	if (c >= c2) return d2;
+	return d1 + (float)(c - c1) * (d2 - d1) / (float)(c2 - c1);
+}
+
+
+Instancer::Instancer(Arena& a): arena(a), naxes(0), coords(NULL), gvar(NULL, 0), nshared(0), nglyphs(0), shared_offset(0), data_offset(0), long_offsets(false),
+	cap(0), points(NULL), shared_points(NULL), touched(NULL), tx(NULL), ty(NULL), ex(NULL), ey(NULL) {
+}
+
+
+Instancer::~Instancer() {
+	arena.free(coords);
+	arena.free(points);
+	arena.free(shared_points);
+	arena.free(touched);
+	arena.free(tx);
+	arena.free(ty);
+	arena.free(ex);
+	arena.free(ey);
+}
+
+
+void Instancer::reserve(unsigned n) {
+	if (n <= cap) return;
+	cap = MAX(n, 2*cap);
+	points = (uint16_t*)arena.realloc(points, cap * sizeof(uint16_t));
+	shared_points = (uint16_t*)arena.realloc(shared_points, cap * sizeof(uint16_t));
+	touched = (uint8_t*)arena.realloc(touched, cap * sizeof(uint8_t));
+	tx = (float*)arena.realloc(tx, cap * sizeof(float));
+	ty = (float*)arena.realloc(ty, cap * sizeof(float));
+	ex = (float*)arena.realloc(ex, cap * sizeof(float));
+	ey = (float*)arena.realloc(ey, cap * sizeof(float));
+}
+
+
+bool Instancer::normalize(View fvar, View avar, const std::vector<axis_pin_t>& pins) {
+	const wuint16_t* h = fvar.get<wuint16_t>(0, 8);
+	if (!h || w2uint16(h[0]) != 1) {
+		LOG("unsupported 'fvar'");
+		return false;
+	}
+	const size_t axes = w2uint16(h[2]);
+	naxes = w2uint16(h[4]);
+	const size_t axis_size = w2uint16(h[5]);
+	if (!naxes || axis_size < FVAR_AXIS_SIZE || !fvar.get<char>(axes, naxes * axis_size)) {
+		LOG("invalid 'fvar'");
+		return false;
+	}
+
+	std::vector<bool> found(pins.size(), false);
+	coords = (int16_t*)arena.calloc(naxes, sizeof(int16_t));
+	const wuint16_t* a = avar.get<wuint16_t>(0, 4);
+	size_t map = 8; // segment maps follow each other
+	if (a && (w2uint16(a[0]) != 1 || w2uint16(a[3]) != naxes)) {
+		LOG("unsupported 'avar', ignored");
+		a = NULL;
+	}
+
+	for (unsigned i=0; i<naxes; ++i) {
+		const size_t off = axes + i * axis_size;
+		const wuint32_t* tag = fvar.get<wuint32_t>(off);
+		const float min = fixed(fvar.get<wuint32_t>(off + 4)), def = fixed(fvar.get<wuint32_t>(off + 8)), max = fixed(fvar.get<wuint32_t>(off + 12));
+		float v = def;
+		for (size_t p=0; p<pins.size(); ++p) {
+			if (pins[p].tag == w2uint32(*tag)) {
+				v = pins[p].value;
+				found[p] = true;
+			}
+		}
+		v = MAX(min, MIN(max, v));
+
+		float n = 0.0f;
+		if (v < def && def > min) {
+			n = (v - def) / (def - min);
+		} else if (v > def && max > def) {
+			n = (v - def) / (max - def);
+		}
+		if (a) { // piecewise linear, beyond the map as by fontTools
+			const wuint16_t* count = avar.get<wuint16_t>(map);
+			const wint16_t* m = count? avar.get<wint16_t>(map + 2, 2 * w2uint16(*count)): NULL;
+			if (!m) {
+				LOG("invalid 'avar'");
+				return false;
+			}
+			const unsigned k = w2uint16(*count);
+			map += 2 + 4 * k;
+			if (k) {
+				unsigned j = 0;
+				while (j < k && F2DOT14(w2int16(m[2*j])) < n) ++j;
+				if (j < k && F2DOT14(w2int16(m[2*j])) == n) {
+					n = F2DOT14(w2int16(m[2*j+1]));
+				} else if (j == 0) {
+					n += F2DOT14(w2int16(m[1])) - F2DOT14(w2int16(m[0]));
+				} else if (j == k) {
+					n += F2DOT14(w2int16(m[2*k-1])) - F2DOT14(w2int16(m[2*k-2]));
+				} else {
+					const float f0 = F2DOT14(w2int16(m[2*j-2])), t0 = F2DOT14(w2int16(m[2*j-1]));
+					const float f1 = F2DOT14(w2int16(m[2*j])), t1 = F2DOT14(w2int16(m[2*j+1]));
+					n = t0 + (t1 - t0) * (n - f0) / (f1 - f0);
+				}
+			}
+		}
+		const int16_t c = to_f2dot14(n);
+		coords[i] = c;
+		LOG_INFO("axis '%s' at %g, normalized %g", w2str32(*tag), v, F2DOT14(c));
+	}
+
+	for (size_t p=0; p<pins.size(); ++p) {
+		if (!found[p]) {
+			LOG("axis '%s' not found", w2str32(uint2w32(pins[p].tag)));
+			return false;
+		}
+	}
+	return true;
+}
+
+
+bool Instancer::init(View fvar, View avar, View g, const std::vector<axis_pin_t>& pins) {
+	if (!normalize(fvar, avar, pins)) return false;
+
+	gvar = g;
+	const wuint16_t* h = gvar.get<wuint16_t>(0, 10);
+	if (!h || w2uint16(h[0]) != 1 || w2uint16(h[2]) != naxes) {
+		LOG("unsupported 'gvar'");
+		return false;
+	}
+	nshared = w2uint16(h[3]);
+	shared_offset = w2uint32(*gvar.get<wuint32_t>(8));
+	nglyphs = w2uint16(h[6]);
+	long_offsets = w2uint16(h[7]) & 0x0001;
+	data_offset = w2uint32(*gvar.get<wuint32_t>(16));
+	if (!gvar.get<wint16_t>(shared_offset, nshared * naxes) || !gvar.get<char>(20, (nglyphs+1) * (long_offsets? 4: 2))) {
+		LOG("invalid 'gvar'");
+		return false;
+	}
+	return true;
+}
+
+
+float Instancer::scalar(const wint16_t* peak, const wint16_t* start, const wint16_t* end, unsigned stride) const {
+	float s = 1.0f;
+	for (unsigned i=0; i<naxes && s != 0.0f; ++i) {
+		const int p = w2int16(peak[i*stride]);
+		if (!p) continue;
+		const int lo = start? w2int16(start[i*stride]): MIN(p, 0);
+		const int hi = end? w2int16(end[i*stride]): MAX(p, 0);
+		if (lo > p || p > hi || (lo < 0 && hi > 0)) continue; // invalid region, the axis is ignored
+		const int v = coords[i];
+		if (v == p) continue;
+		if (v <= lo || v >= hi) return 0.0f;
+		s *= (v < p)? (float)(v - lo) / (float)(p - lo): (float)(hi - v) / (float)(hi - p);
+	}
+	return s;
+}
+
+
+bool Instancer::unpack_points(View t, size_t& pos, uint16_t*& out, unsigned& count, bool& all) {
+	const uint8_t* b = t.get<uint8_t>(pos++);
+	if (!b) return false;
+	all = !*b;
+	count = *b;
+	if (count & 0x80) {
+		if (!(b = t.get<uint8_t>(pos++))) return false;
+		count = ((count & 0x7F) << 8) | *b;
+	}
+	reserve(count);
+
+	uint16_t last = 0;
+	for (unsigned read=0; read<count; ) {
+		if (!(b = t.get<uint8_t>(pos++))) return false;
+		const unsigned run = (*b & 0x7F) + 1;
+		if (read + run > count) return false;
+		for (unsigned k=0; k<run; ++k) {
+			if (*b & POINTS_ARE_WORDS) {
+				const wuint16_t* w = t.get<wuint16_t>(pos);
+				if (!w) return false;
+				last += w2uint16(*w);
+				pos += 2;
+			} else {
+				const uint8_t* u = t.get<uint8_t>(pos++);
+				if (!u) return false;
+				last += *u;
+			}
+			out[read++] = last;
+		}
+	}
+	return true;
+}
+
+
+static bool unpack_deltas(View t, size_t& pos, float* out, unsigned count) {
+	for (unsigned read=0; read<count; ) {
+		const uint8_t* b = t.get<uint8_t>(pos++);
+		if (!b) return false;
+		const unsigned run = (*b & 0x3F) + 1;
+		if (read + run > count) return false;
+		switch (*b & (DELTAS_ARE_ZERO|DELTAS_ARE_WORDS)) {
+			case DELTAS_ARE_ZERO:
+				memset(out + read, 0, run * sizeof(float));
+				break;
+			case DELTAS_ARE_WORDS: {
+				const wint16_t* w = t.get<wint16_t>(pos, run);
+				if (!w) return false;
+				for (unsigned k=0; k<run; ++k) out[read+k] = w2int16(w[k]);
+				pos += 2 * run;
+				break;
+			}
+			case DELTAS_ARE_ZERO|DELTAS_ARE_WORDS: { // as longs
+				const be_t<int32_t>* l = t.get<be_t<int32_t> >(pos, run);
+				if (!l) return false;
+				for (unsigned k=0; k<run; ++k) out[read+k] = l[k].get();
+				pos += 4 * run;
+				break;
+			}
+			default: {
+				const int8_t* s = t.get<int8_t>(pos, run);
+				if (!s) return false;
+				for (unsigned k=0; k<run; ++k) out[read+k] = s[k];
+				pos += run;
+				break;
+			}
+		}
+		read += run;
+	}
+	return true;
+}
+
+
+void Instancer::infer(unsigned n, const int32_t* x, const int32_t* y, const uint16_t* ends, unsigned ncontours) {
+	// untouched points by their touched neighbours in the same contour, phantom points are not part of any
+	unsigned start = 0;
+	for (unsigned c=0; c<ncontours; ++c) {
+		const unsigned end = ends[c];
+		if (end < start || end >= n) break;
+		unsigned first = start;
+		while (first <= end && !touched[first]) ++first;
+		if (first > end) { // none, so no deltas
+			start = end + 1;
+			continue;
+		}
+		unsigned i = first;
+		do {
+			unsigned j = (i == end)? start: i + 1;
+			while (!touched[j]) j = (j == end)? start: j + 1;
+			if (j == i) { // a single one, all shifted by it
+				for (unsigned k=start; k<=end; ++k) {
+					tx[k] = tx[i];
+					ty[k] = ty[i];
+				}
+				break;
+			}
+			for (unsigned k=(i == end)? start: i + 1; k!=j; k=(k == end)? start: k + 1) {
+				tx[k] = iup(x[k], x[i], x[j], tx[i], tx[j]);
+				ty[k] = iup(y[k], y[i], y[j], ty[i], ty[j]);
+			}
+			i = j;
+		} while (i != first);
+		start = end + 1;
+	}
+}
+
+
+bool Instancer::tuples(View d, size_t hdr, View shared, unsigned n, const int32_t* x, const int32_t* y, const uint16_t* ends, unsigned ncontours, float* dx, float* dy) {
+	// the tuple variation headers at hdr, with their data offset from the start
+	memset(dx, 0, n * sizeof(float));
+	if (dy) memset(dy, 0, n * sizeof(float));
+	const wuint16_t* h = d.get<wuint16_t>(hdr, 2);
+	if (!h) return false;
+	const unsigned ntuples = w2uint16(h[0]) & GVAR_COUNT_MASK;
+	const View data = d.sub(w2uint16(h[1]));
+	size_t pos = 0;
+	reserve(n);
+
+	unsigned nshared_points = 0;
+	bool shared_all = true;
+	if ((w2uint16(h[0]) & GVAR_SHARED_POINT_NUMBERS) && !unpack_points(data, pos, shared_points, nshared_points, shared_all)) return false;
+
+	size_t hp = hdr + 4;
+	for (unsigned t=0; t<ntuples; ++t) {
+		const wuint16_t* th = d.get<wuint16_t>(hp, 2);
+		if (!th) return false;
+		const size_t size = w2uint16(th[0]);
+		const unsigned index = w2uint16(th[1]);
+		hp += 4;
+		const wint16_t* peak;
+		if (index & TUPLE_EMBEDDED_PEAK) {
+			peak = d.get<wint16_t>(hp, naxes);
+			hp += 2 * naxes;
+		} else {
+			peak = shared.get<wint16_t>(2 * naxes * (index & TUPLE_INDEX_MASK), naxes);
+		}
+		const wint16_t* start = NULL;
+		const wint16_t* end = NULL;
+		if (index & TUPLE_INTERMEDIATE_REGION) {
+			start = d.get<wint16_t>(hp, naxes);
+			end = d.get<wint16_t>(hp + 2 * naxes, naxes);
+			hp += 4 * naxes;
+			if (!start || !end) return false;
+		}
+		if (!peak) return false;
+		const View tuple = data.sub(pos, size);
+		pos += size;
+		const float s = scalar(peak, start, end);
+		if (s == 0.0f) continue;
+
+		size_t tp = 0;
+		unsigned count = nshared_points;
+		bool all = shared_all;
+		const uint16_t* pts = shared_points;
+		if (index & TUPLE_PRIVATE_POINT_NUMBERS) {
+			if (!unpack_points(tuple, tp, points, count, all)) return false;
+			pts = points;
+		}
+		if (all) {
+			if (!unpack_deltas(tuple, tp, tx, n) || (dy && !unpack_deltas(tuple, tp, ty, n))) return false;
+		} else {
+			if (!unpack_deltas(tuple, tp, ex, count) || (dy && !unpack_deltas(tuple, tp, ey, count))) return false;
+			memset(tx, 0, n * sizeof(float));
+			memset(ty, 0, n * sizeof(float));
+			memset(touched, 0, n * sizeof(uint8_t));
+			for (unsigned k=0; k<count; ++k) {
+				if (pts[k] >= n) continue;
+				tx[pts[k]] = ex[k];
+				ty[pts[k]] = dy? ey[k]: 0.0f;
+				touched[pts[k]] = 1;
+			}
+			if (ends) infer(n, x, y, ends, ncontours);
+		}
+		f32_axpy(dx, tx, s, n);
+		if (dy) f32_axpy(dy, ty, s, n);
+	}
+	return true;
+}
+
+
+bool Instancer::apply(index_t g, unsigned n, const int32_t* x, const int32_t* y, const uint16_t* ends, unsigned ncontours, float* dx, float* dy) {
+	memset(dx, 0, n * sizeof(float));
+	memset(dy, 0, n * sizeof(float));
+	if (g >= nglyphs) return true;
+	size_t from, to;
+	if (long_offsets) {
+		from = w2uint32(*gvar.get<wuint32_t>(20 + 4*g));
+		to = w2uint32(*gvar.get<wuint32_t>(20 + 4*(g+1)));
+	} else {
+		from = 2 * w2uint16(*gvar.get<wuint16_t>(20 + 2*g));
+		to = 2 * w2uint16(*gvar.get<wuint16_t>(20 + 2*(g+1)));
+	}
+	if (to <= from) return true; // no variations
+	return tuples(gvar.sub(data_offset + from, to - from), 0, gvar.sub(shared_offset, 2 * naxes * nshared), n, x, y, ends, ncontours, dx, dy);
+}
+
+
+bool Instancer::apply_cvt(View cvar, unsigned n, float* d) {
+	// https://docs.microsoft.com/en-us/typography/opentype/spec/cvar, no shared peaks and no inferred deltas
+	const wuint16_t* h = cvar.get<wuint16_t>(0, 2);
+	if (!h || w2uint16(h[0]) != 1) {
+		LOG("unsupported 'cvar'");
+		return false;
+	}
+	return tuples(cvar, 4, View(NULL, 0), n, NULL, NULL, NULL, 0, d, NULL);
+}
+
+
+bool Instancer::item_delta(View store, unsigned outer, unsigned inner, float& d) const {
+	// https://docs.microsoft.com/en-us/typography/opentype/spec/otvarcommonformats#item-variation-store
+	d = 0.0f;
+	const wuint16_t* h = store.get<wuint16_t>(0, 4);
+	if (!h || w2uint16(h[0]) != 1 || outer >= w2uint16(h[3])) return false;
+	const View list = store.sub(w2uint32(*store.get<wuint32_t>(2)));
+	const wuint16_t* lh = list.get<wuint16_t>(0, 2);
+	const wuint32_t* off = store.get<wuint32_t>(8 + 4*outer);
+	if (!lh || !off || w2uint16(lh[0]) != naxes) return false;
+	const unsigned nregions = w2uint16(lh[1]);
+
+	const View data = store.sub(w2uint32(*off));
+	const wuint16_t* dh = data.get<wuint16_t>(0, 3);
+	if (!dh) return false;
+	if (inner >= w2uint16(dh[0])) return true; // beyond the deltas, as by fontTools
+	const bool longs = w2uint16(dh[1]) & IVS_LONG_WORDS;
+	const unsigned nwords = w2uint16(dh[1]) & IVS_WORD_COUNT_MASK;
+	const unsigned nidx = w2uint16(dh[2]);
+	const wuint16_t* idx = data.get<wuint16_t>(6, nidx);
+	if (!idx || nwords > nidx) return false;
+	const size_t row = (longs? 4: 2) * nwords + (longs? 2: 1) * (nidx - nwords);
+	const View r = data.sub(6 + 2*nidx + row*inner, row);
+	if (r.size() != row) return false;
+
+	size_t pos = 0;
+	for (unsigned k=0; k<nidx; ++k) {
+		int32_t v;
+		if (longs && k < nwords) {
+			v = r.get<be_t<int32_t> >(pos)->get();
+			pos += 4;
+		} else if (longs || k < nwords) {
+			v = w2int16(*r.get<wint16_t>(pos));
+			pos += 2;
+		} else {
+			v = *r.get<int8_t>(pos);
+			pos += 1;
+		}
+		if (!v) continue;
+		const unsigned ri = w2uint16(idx[k]);
+		const wint16_t* region = list.get<wint16_t>(4 + 6*naxes*ri, 3*naxes); // start, peak, end per axis
+		if (ri >= nregions || !region) return false;
+		d += scalar(region + 1, region, region + 2, 3) * (float)v;
+	}
+	return true;
+}
+
+
+#define FLAG_ON_CURVE 0x01
+#define FLAG_X_SHORT 0x02
+#define FLAG_Y_SHORT 0x04
+#define FLAG_REPEAT 0x08
+#define FLAG_X_SAME_OR_POSITIVE 0x10
+#define FLAG_Y_SAME_OR_POSITIVE 0x20
+#define FLAG_OVERLAP_SIMPLE 0x40
+
+#define ARG_1_AND_2_ARE_WORDS 0x0001
+#define ARGS_ARE_XY_VALUES 0x0002
+#define WE_HAVE_A_SCALE 0x0008
+#define MORE_COMPONENTS 0x0020
+#define WE_HAVE_AN_X_AND_Y_SCALE 0x0040
+#define WE_HAVE_A_TWO_BY_TWO 0x0080
+#define WE_HAVE_INSTRUCTIONS 0x0100
+#define OVERLAP_COMPOUND 0x0400
+
+
+static inline unsigned transform_size(uint16_t flags) {
+	if (flags & WE_HAVE_A_SCALE) return 2;
+	if (flags & WE_HAVE_AN_X_AND_Y_SCALE) return 4;
+	if (flags & WE_HAVE_A_TWO_BY_TWO) return 8;
+	return 0;
+}
+
+
+GlyphOutline::GlyphOutline(Arena& a): arena(a), cap(0), instructions(NULL), ninstructions(0), cflags(NULL), cglyph(NULL), ctransform(NULL),
+	ncontours(0), n(0), ends(NULL), flags(NULL), x(NULL), y(NULL) {
+	memset(bbox, 0, sizeof(bbox));
+}
+
+
+GlyphOutline::~GlyphOutline() {
+	arena.free(cflags);
+	arena.free(cglyph);
+	arena.free(ctransform);
+	arena.free(ends);
+	arena.free(flags);
+	arena.free(x);
+	arena.free(y);
+}
+
+
+void GlyphOutline::reserve(unsigned c) {
+	if (c <= cap) return;
+	cap = MAX(c, 2*cap);
+	cflags = (uint16_t*)arena.realloc(cflags, cap * sizeof(uint16_t));
+	cglyph = (uint16_t*)arena.realloc(cglyph, cap * sizeof(uint16_t));
+	ctransform = (const char**)arena.realloc(ctransform, cap * sizeof(const char*));
+	ends = (uint16_t*)arena.realloc(ends, cap * sizeof(uint16_t));
+	flags = (uint8_t*)arena.realloc(flags, cap * sizeof(uint8_t));
+	x = (int32_t*)arena.realloc(x, cap * sizeof(int32_t));
+	y = (int32_t*)arena.realloc(y, cap * sizeof(int32_t));
+}
+
+
+bool GlyphOutline::decode(const char* buf, size_t len) {
+	// https://docs.microsoft.com/en-us/typography/opentype/spec/glyf
+	const View v(buf, len);
+	n = 0;
+	ninstructions = 0;
+	instructions = NULL;
+	reserve(4);
+	const WoffGlyph* g = v.get<WoffGlyph>();
+	if (!g) {
+		ncontours = 0;
+		memset(bbox, 0, sizeof(bbox));
+		return len == 0;
+	}
+	ncontours = (int16_t)w2uint16(g->numberOfContours);
+	bbox[0] = w2int16(g->xMin);
+	bbox[1] = w2int16(g->yMin);
+	bbox[2] = w2int16(g->xMax);
+	bbox[3] = w2int16(g->yMax);
+	size_t pos = sizeof(WoffGlyph);
+
+	if (ncontours < 0) {
+		uint16_t f;
+		do {
+			const wuint16_t* h = v.get<wuint16_t>(pos, 2);
+			if (!h) return false;
+			f = w2uint16(h[0]);
+			reserve(n + 1 + 4);
+			cflags[n] = f;
+			cglyph[n] = w2uint16(h[1]);
+			pos += 4;
+			if (f & ARG_1_AND_2_ARE_WORDS) {
+				const wuint16_t* a = v.get<wuint16_t>(pos, 2);
+				if (!a) return false;
+				x[n] = (f & ARGS_ARE_XY_VALUES)? (int16_t)w2uint16(a[0]): w2uint16(a[0]);
+				y[n] = (f & ARGS_ARE_XY_VALUES)? (int16_t)w2uint16(a[1]): w2uint16(a[1]);
+				pos += 4;
+			} else {
+				const uint8_t* a = v.get<uint8_t>(pos, 2);
+				if (!a) return false;
+				x[n] = (f & ARGS_ARE_XY_VALUES)? (int8_t)a[0]: a[0];
+				y[n] = (f & ARGS_ARE_XY_VALUES)? (int8_t)a[1]: a[1];
+				pos += 2;
+			}
+			ctransform[n] = buf + pos;
+			pos += transform_size(f);
+			if (pos > len) return false;
+			++n;
+		} while (f & MORE_COMPONENTS);
+		for (unsigned k=0; k<n; ++k) {
+			if (!(cflags[k] & WE_HAVE_INSTRUCTIONS)) continue;
+			const wuint16_t* il = v.get<wuint16_t>(pos);
+			if (!il || !v.get<char>(pos + 2, w2uint16(*il))) return false;
+			ninstructions = w2uint16(*il);
+			instructions = buf + pos + 2;
+			break;
+		}
+		return true;
+	}
+	if (ncontours == 0) return true;
+
+	const wuint16_t* e = v.get<wuint16_t>(pos, ncontours);
+	if (!e) return false;
+	reserve(ncontours);
+	for (int c=0; c<ncontours; ++c) {
+		ends[c] = w2uint16(e[c]);
+		if (c && ends[c] < ends[c-1]) return false;
+	}
+	pos += 2 * ncontours;
+	n = ends[ncontours-1] + 1;
+	reserve(n + 4);
+	const wuint16_t* il = v.get<wuint16_t>(pos);
+	if (!il || !v.get<char>(pos + 2, w2uint16(*il))) return false;
+	ninstructions = w2uint16(*il);
+	instructions = buf + pos + 2;
+	pos += 2 + ninstructions;
+
+	for (unsigned i=0; i<n; ) {
+		const uint8_t* f = v.get<uint8_t>(pos++);
+		if (!f) return false;
+		unsigned r = 1;
+		if (*f & FLAG_REPEAT) {
+			const uint8_t* rep = v.get<uint8_t>(pos++);
+			if (!rep) return false;
+			r += *rep;
+		}
+		if (i + r > n) return false;
+		memset(flags + i, *f, r);
+		i += r;
+	}
+	const uint8_t bits[2][2] = {{FLAG_X_SHORT, FLAG_X_SAME_OR_POSITIVE}, {FLAG_Y_SHORT, FLAG_Y_SAME_OR_POSITIVE}};
+	int32_t* const out[2] = {x, y};
+	for (unsigned a=0; a<2; ++a) {
+		int32_t c = 0;
+		for (unsigned i=0; i<n; ++i) {
+			if (flags[i] & bits[a][0]) {
+				const uint8_t* b = v.get<uint8_t>(pos++);
+				if (!b) return false;
+				c += (flags[i] & bits[a][1])? *b: -(int32_t)*b;
+			} else if (!(flags[i] & bits[a][1])) {
+				const wint16_t* w = v.get<wint16_t>(pos);
+				if (!w) return false;
+				c += w2int16(*w);
+				pos += 2;
+			}
+			out[a][i] = c;
+		}
+	}
+	for (unsigned i=0; i<n; ++i) {
+		flags[i] &= i? FLAG_ON_CURVE: (FLAG_ON_CURVE|FLAG_OVERLAP_SIMPLE);
+	}
+	return true;
+}
+
+
+void GlyphOutline::transform(unsigned k, float& px, float& py) const {
+	const wint16_t* t = (const wint16_t*)ctransform[k];
+	const float ox = px, oy = py;
+	if (cflags[k] & WE_HAVE_A_SCALE) {
+		px = ox * F2DOT14(w2int16(t[0]));
+		py = oy * F2DOT14(w2int16(t[0]));
+	} else if (cflags[k] & WE_HAVE_AN_X_AND_Y_SCALE) {
+		px = ox * F2DOT14(w2int16(t[0]));
+		py = oy * F2DOT14(w2int16(t[1]));
+	} else if (cflags[k] & WE_HAVE_A_TWO_BY_TWO) {
+		px = ox * F2DOT14(w2int16(t[0])) + oy * F2DOT14(w2int16(t[2]));
+		py = ox * F2DOT14(w2int16(t[1])) + oy * F2DOT14(w2int16(t[3]));
+	}
+}
+
+
+void GlyphOutline::set_overlap() {
+	if (ncontours < 0 && n) {
+		cflags[0] |= OVERLAP_COMPOUND;
+	} else if (ncontours > 0 && n) {
+		flags[0] |= FLAG_OVERLAP_SIMPLE;
+	}
+}
+
+
+void GlyphOutline::drop_instructions() {
+	ninstructions = 0;
+	if (ncontours >= 0) return;
+	for (unsigned k=0; k<n; ++k) {
+		cflags[k] &= ~WE_HAVE_INSTRUCTIONS;
+	}
+}
+
+
+void GlyphOutline::scale(float s) {
+	for (unsigned k=0; k<n; ++k) {
+		if (ncontours < 0 && !is_offset(k)) continue; // point numbers
+		x[k] = (int32_t)floorf(x[k] * s + 0.5f);
+		y[k] = (int32_t)floorf(y[k] * s + 0.5f);
+	}
+	for (unsigned k=0; k<4; ++k) {
+		bbox[k] = (int16_t)MAX(-32768.0f, MIN(32767.0f, floorf(bbox[k] * s + 0.5f)));
+	}
+}
+
+
+void GlyphOutline::bounds(int16_t* b) const {
+	assert(ncontours >= 0);
+	if (!n) {
+		memset(b, 0, 4 * sizeof(int16_t));
+		return;
+	}
+	int32_t r[4] = {x[0], y[0], x[0], y[0]};
+	for (unsigned i=1; i<n; ++i) {
+		r[0] = MIN(r[0], x[i]);
+		r[1] = MIN(r[1], y[i]);
+		r[2] = MAX(r[2], x[i]);
+		r[3] = MAX(r[3], y[i]);
+	}
+	for (unsigned k=0; k<4; ++k) {
+		b[k] = (int16_t)MAX(INT16_MIN, MIN(INT16_MAX, r[k]));
+	}
+}
+
+
+size_t GlyphOutline::max_size() const {
+	if (ncontours < 0) return sizeof(WoffGlyph) + n * (4 + 4 + 8) + 2 + ninstructions;
+	return sizeof(WoffGlyph) + 2 * MAX(ncontours, 0) + 2 + ninstructions + n * (1 + 2 + 2);
+}
+
+
+static inline uint8_t* put16(uint8_t* p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v;
+	return p + 2;
+}
+
+
+size_t GlyphOutline::encode(char* out, const int16_t* b) const {
+	uint8_t* p = (uint8_t*)out;
+	p = put16(p, (uint16_t)ncontours);
+	for (unsigned k=0; k<4; ++k) p = put16(p, (uint16_t)b[k]);
+
+	if (ncontours < 0) {
+		bool instr = false;
+		for (unsigned k=0; k<n; ++k) {
+			uint16_t f = cflags[k];
+			if (f & ARGS_ARE_XY_VALUES) { // the smallest that fits, point numbers are left as they were
+				f &= ~ARG_1_AND_2_ARE_WORDS;
+				if (x[k] < INT8_MIN || x[k] > INT8_MAX || y[k] < INT8_MIN || y[k] > INT8_MAX) f |= ARG_1_AND_2_ARE_WORDS;
+			}
+			instr |= f & WE_HAVE_INSTRUCTIONS;
+			p = put16(p, f);
+			p = put16(p, cglyph[k]);
+			if (f & ARG_1_AND_2_ARE_WORDS) {
+				p = put16(p, (uint16_t)x[k]);
+				p = put16(p, (uint16_t)y[k]);
+			} else {
+				*p++ = (uint8_t)x[k];
+				*p++ = (uint8_t)y[k];
+			}
+			memcpy(p, ctransform[k], transform_size(f));
+			p += transform_size(f);
+		}
+		if (instr) {
+			p = put16(p, ninstructions);
+			memcpy(p, instructions, ninstructions);
+			p += ninstructions;
+		}
+		return p - (uint8_t*)out;
+	}
+	if (ncontours == 0) return p - (uint8_t*)out;
+
+	for (int c=0; c<ncontours; ++c) p = put16(p, ends[c]);
+	p = put16(p, ninstructions);
+	memcpy(p, instructions, ninstructions);
+	p += ninstructions;
+
+	// flags with repeats as by fontTools, the coordinates as deltas in the shortest form
+	uint8_t* const fstart = p;
+	uint8_t last = 0;
+	unsigned repeat = 0;
+	for (unsigned i=0; i<n; ++i) {
+		const int32_t dx = x[i] - (i? x[i-1]: 0), dy = y[i] - (i? y[i-1]: 0);
+		uint8_t f = flags[i];
+		if (!dx) f |= FLAG_X_SAME_OR_POSITIVE;
+		else if (dx >= -255 && dx <= 255) f |= FLAG_X_SHORT | ((dx > 0)? FLAG_X_SAME_OR_POSITIVE: 0);
+		if (!dy) f |= FLAG_Y_SAME_OR_POSITIVE;
+		else if (dy >= -255 && dy <= 255) f |= FLAG_Y_SHORT | ((dy > 0)? FLAG_Y_SAME_OR_POSITIVE: 0);
+		if (p > fstart && f == last && repeat < 255) {
+			if (++repeat == 1) {
+				*p++ = f;
+			} else {
+				p[-2] = f | FLAG_REPEAT;
+				p[-1] = repeat;
+			}
+		} else {
+			*p++ = f;
+			repeat = 0;
+		}
+		last = f;
+	}
+	const int32_t* const in[2] = {x, y};
+	for (unsigned a=0; a<2; ++a) {
+		for (unsigned i=0; i<n; ++i) {
+			const int32_t d = in[a][i] - (i? in[a][i-1]: 0);
+			if (!d) continue;
+			if (d >= -255 && d <= 255) {
+				*p++ = (uint8_t)abs(d);
+			} else {
+				p = put16(p, (uint16_t)(int16_t)d);
+			}
+		}
+	}
+	return p - (uint8_t*)out;
+}
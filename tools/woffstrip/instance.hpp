@@ -0,0 +1,99 @@
+#pragma once
+#include "main.hpp"
+#include "types.hpp"
+#include "arena.hpp"
+#include <vector>
+
+
+#define F2DOT14(v) ((float)(v) / 16384.0f)
+
+typedef struct {
+	uint32_t tag; // as in fvar, e.g. 'wght'
+	float value; // user coordinate
+} axis_pin_t;
+
+
+/**
+ * Glyph variations of a variable font at a single location in its design space, given in user coordinates per axis, others at their default.
+ * Deltas of a glyph are summed up as floats over all its points at once, including inferred ones and the 4 trailing phantom points for the metrics.
+ * Also the cvt deltas by cvar, and single items of an ItemVariationStore for the font-wide metrics by MVAR.
+ */
+class Instancer {
+	private:
+		Arena& arena;
+		unsigned naxes;
+		int16_t* coords; // normalized per axis, as F2DOT14
+		View gvar;
+		unsigned nshared, nglyphs;
+		size_t shared_offset, data_offset;
+		bool long_offsets;
+
+		unsigned cap; // of the buffers below, in points
+		uint16_t* points; // of the current tuple
+		uint16_t* shared_points; // of the current glyph
+		uint8_t* touched;
+		float* tx; // deltas of the current tuple by point
+		float* ty;
+		float* ex; // as listed
+		float* ey;
+
+		bool normalize(View, View, const std::vector<axis_pin_t>&);
+		float scalar(const wint16_t*, const wint16_t*, const wint16_t*, unsigned=1) const; // by axis, for interleaved regions with a stride
+		void reserve(unsigned);
+		bool unpack_points(View, size_t&, uint16_t*&, unsigned&, bool&);
+		void infer(unsigned, const int32_t*, const int32_t*, const uint16_t*, unsigned);
+		bool tuples(View, size_t, View, unsigned, const int32_t*, const int32_t*, const uint16_t*, unsigned, float*, float*); // a tuple variation store, shared peaks, without y for a single dimension
+
+	public:
+		Instancer(Arena&);
+		~Instancer();
+
+		bool init(View, View, View, const std::vector<axis_pin_t>&); // fvar, avar (possibly empty), gvar
+		bool apply(index_t, unsigned, const int32_t*, const int32_t*, const uint16_t*, unsigned, float*, float*); // glyph with n points incl. phantom ones, x/y, contour end points (none for composites), deltas out
+		bool apply_cvt(View, unsigned, float*); // cvar for n cvt values, deltas out
+		bool item_delta(View, unsigned, unsigned, float&) const; // of an ItemVariationStore by outer and inner index, e.g. for MVAR
+};
+
+
+/**
+ * A glyph decoded into absolute point coordinates, or component offsets for composites, and encoded again as compact as possible once changed.
+ * The buffers have room for the 4 phantom points after them.
+ */
+class GlyphOutline {
+	private:
+		Arena& arena;
+		unsigned cap;
+		const char* instructions; // borrowed from the input, as the transformations below
+		unsigned ninstructions;
+		uint16_t* cflags;
+		uint16_t* cglyph;
+		const char** ctransform;
+
+		void reserve(unsigned);
+
+	public:
+		int ncontours; // negative for composites
+		unsigned n; // points or components
+		uint16_t* ends;
+		uint8_t* flags; // on-curve and overlap only
+		int32_t* x;
+		int32_t* y;
+		int16_t bbox[4]; // as decoded
+
+		GlyphOutline(Arena&);
+		~GlyphOutline();
+
+		bool decode(const char*, size_t);
+		bool is_offset(unsigned k) const { return cflags[k] & 0x0002; } // ARGS_ARE_XY_VALUES, otherwise point numbers
+		uint16_t component(unsigned k) const { return cglyph[k]; }
+		void set_component(unsigned k, uint16_t g) { cglyph[k] = g; }
+		bool is_transformed(unsigned k) const { return cflags[k] & (0x0008|0x0040|0x0080); }
+		bool is_scaled_offset(unsigned k) const { return cflags[k] & 0x0800; } // SCALED_COMPONENT_OFFSET, unscaled by default
+		void transform(unsigned, float&, float&) const; // by the 2x2 matrix of a component
+		void set_overlap(); // as instances may rely on overlapping contours
+		void drop_instructions();
+		void scale(float); // points, component offsets and the bounding box, e.g. to another unitsPerEm
+		void bounds(int16_t*) const; // of the points of a simple glyph
+		size_t max_size() const;
+		size_t encode(char*, const int16_t*) const; // with the given bounding box
+};
@@ -1,10 +1,12 @@
 #include "io.hpp"
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <zlib.h> // link with -lz
 
 
-static bool file_read(int fd, char*& buf, size_t& len) {
+static bool file_read(int fd, char*& buf, size_t& len, uint64_t* mtime) {
 	struct stat ss;
 	if (fstat(fd, &ss) == -1) {
 		LOG_ERRNO("fstat()");
@@ -12,6 +14,7 @@ static bool file_read(int fd, char*& buf, size_t& len) {
 		return false;
 	}
 	len = ss.st_size;
+	if (mtime) *mtime = (uint64_t)ss.st_mtim.tv_sec * 1000000000u + ss.st_mtim.tv_nsec;
 
 	buf = (char*)malloc(len + 1);
 	if (read(fd, buf, len) != (ssize_t)len) {
@@ -25,48 +28,150 @@ static bool file_read(int fd, char*& buf, size_t& len) {
 	return true;
 }
 
-bool file_read(const char* fn, char*& buf, size_t& len) {
+bool file_read(const char* fn, char*& buf, size_t& len, uint64_t* mtime) {
 	int fd = open(fn, O_RDONLY);
 	if (fd == -1) {
 		LOG_ERRNO("open(%s)", fn);
 		return false;
 	}
-	bool rv = file_read(fd, buf, len);
+	bool rv = file_read(fd, buf, len, mtime);
 	close(fd);
 	return rv;
 }
 
 bool file_write(const char* fn, const char* buf, size_t len) {
-	int fd = open(fn, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	struct iovec iov = {(void*)buf, len}; // const-cast
+	return file_writev(fn, &iov, 1);
+}
+
+static mode_t get_umask() {
+	const mode_t mask = umask(0);
+	umask(mask);
+	return mask;
+}
+
+bool file_writev(const char* fn, const struct iovec* iov, size_t n) {
+	// via a temporary file in the same directory, so the target is either the old or the complete new one
+	const size_t fnlen = strlen(fn);
+	char* tmp = (char*)malloc(fnlen + 8);
+	memcpy(tmp, fn, fnlen);
+	memcpy(tmp + fnlen, ".XXXXXX", 8);
+	int fd = mkstemp(tmp);
+	if (fd == -1) {
+		LOG_ERRNO("mkstemp(%s)", tmp);
+		free(tmp);
+		return false;
+	}
+	static const mode_t mask = get_umask(); // once, as not thread-safe
+	struct stat st;
+	const mode_t mode = (stat(fn, &st) == 0)? (st.st_mode & 07777): (0664 & ~mask); // as kept or by open() instead of 0600
+	if (fchmod(fd, mode) == -1) {
+		LOG_ERRNO("fchmod(%s)", tmp);
+	}
+
+	bool rv = true;
+	struct iovec* v = (struct iovec*)memcpy(malloc(n * sizeof(struct iovec)), iov, n * sizeof(struct iovec)); // advanced on partial writes
+	size_t i = 0;
+	while (i < n) {
+		ssize_t l = writev(fd, v+i, (int)MIN(n-i, (size_t)IOV_MAX));
+		if (l < 0) {
+			if (errno == EINTR) continue;
+			LOG_ERRNO("writev(%s)", tmp);
+			rv = false;
+			break;
+		}
+		for (; i < n && (size_t)l >= v[i].iov_len; ++i) {
+			l -= v[i].iov_len;
+		}
+		if (l) {
+			v[i].iov_base = (char*)v[i].iov_base + l;
+			v[i].iov_len -= l;
+		}
+	}
+	free(v);
+
+	if (rv && fsync(fd) == -1) { // before the rename, so a crash cannot leave an empty target
+		LOG_ERRNO("fsync(%s)", tmp);
+		rv = false;
+	}
+	if (close(fd) == -1 && rv) {
+		LOG_ERRNO("close(%s)", tmp);
+		rv = false;
+	}
+	if (rv && rename(tmp, fn) == -1) {
+		LOG_ERRNO("rename(%s)", fn);
+		rv = false;
+	}
+	if (!rv) unlink(tmp);
+	free(tmp);
+	return rv;
+}
+
+bool file_map(const char* fn, char*& buf, size_t& len) {
+	int fd = open(fn, O_RDONLY);
 	if (fd == -1) {
 		LOG_ERRNO("open(%s)", fn);
 		return false;
 	}
-	errno = 0;
-	if (write(fd, buf, len) != (ssize_t)len) {
-		LOG_ERRNO("write(%s)", fn);
+	struct stat ss;
+	if (fstat(fd, &ss) == -1) {
+		LOG_ERRNO("fstat(%s)", fn);
 		close(fd);
 		return false;
 	}
+	len = ss.st_size;
+	if (!len) {
+		LOG("%s: empty file", fn);
+		close(fd);
+		return false;
+	}
+	void* m = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
 	close(fd);
+	if (m == MAP_FAILED) {
+		LOG_ERRNO("mmap(%s)", fn);
+		return false;
+	}
+	buf = (char*)m;
 	return true;
 }
 
-bool docompress(const char* src, size_t srclen, char*& dst, size_t* dstlen) {
+void file_unmap(char* buf, size_t len) {
+	munmap(buf, len);
+}
+
+void zinit(z_stream& zs, Arena& arena) {
+	memset(&zs, 0, sizeof(zs));
+	zs.zalloc = Arena::zalloc;
+	zs.zfree = Arena::zfree;
+	zs.opaque = &arena;
+}
+
+bool docompress(const char* src, size_t srclen, char*& dst, size_t* dstlen, Arena& arena, bool stored) {
 	assert(srclen);
 	*dstlen = PAD4(MAX(srclen, compressBound(srclen)));
-	dst = (char*)calloc(1, *dstlen);
+	dst = (char*)arena.calloc(1, *dstlen);
 
+	z_stream zs;
+	zinit(zs, arena);
 	int rv;
-	if ((rv = compress2((unsigned char*)dst, (unsigned long*)dstlen, (unsigned char*)src, srclen, Z_BEST_COMPRESSION)) != Z_OK) {
+	if ((rv = deflateInit(&zs, Z_BEST_COMPRESSION)) == Z_OK) {
+		zs.next_in = (Bytef*)src;
+		zs.avail_in = srclen;
+		zs.next_out = (Bytef*)dst;
+		zs.avail_out = *dstlen;
+		rv = deflate(&zs, Z_FINISH); // output is large enough for a single call
+		*dstlen = zs.total_out;
+		deflateEnd(&zs);
+	}
+	if (rv != Z_STREAM_END) {
 		LOG("cannot compress: %i", rv);
-		free(dst);
+		arena.free(dst);
 		dst = NULL;
 		*dstlen = 0;
 		return false;
 	}
 
-	if (*dstlen >= srclen) {
+	if (stored && *dstlen >= srclen) {
 		memset(dst, 0, *dstlen);
 		memcpy(dst, src, srclen);
 		*dstlen = srclen;
@@ -75,34 +180,50 @@ bool docompress(const char* src, size_t srclen, char*& dst, size_t* dstlen) {
 	return true;
 }
 
-bool decompress(const char* src, size_t srclen, char*& dst, size_t dstlen) {
+bool decompress(const char* src, size_t srclen, char*& dst, size_t dstlen, Arena& arena, bool stored) {
 	assert(!dst);
-	dst = (char*)calloc(1, PAD4(dstlen));
+	dst = (char*)arena.calloc(1, PAD4(dstlen));
 
-	if (dstlen < srclen) {
+	if (stored && dstlen < srclen) {
+		arena.free(dst);
+		dst = NULL;
 		return false;
-	} else if (dstlen == srclen) {
+	} else if (stored && dstlen == srclen) {
 		memcpy(dst, src, dstlen);
 	} else {
-		// https://www.zlib.net/manual.html#Utility
+		// https://www.zlib.net/manual.html#Basic
+		void* bup = config.paranoid? memcpy(arena.alloc(srclen), src, srclen): NULL; // input must not be touched
+		z_stream zs;
+		zinit(zs, arena);
 		int rv;
-		long unsigned int l = dstlen;
-		#ifndef NDEBUG
-			void* bup = memcpy(malloc(srclen), src, srclen);
-		#endif
-		if ((rv = uncompress((unsigned char*)dst, &l, (unsigned char*)src, srclen)) != Z_OK) {
+		if ((rv = inflateInit(&zs)) == Z_OK) {
+			zs.next_in = (Bytef*)src;
+			zs.avail_in = srclen;
+			zs.next_out = (Bytef*)dst;
+			zs.avail_out = dstlen;
+			rv = inflate(&zs, Z_FINISH);
+			inflateEnd(&zs);
+		}
+		if (rv != Z_STREAM_END) {
 			LOG("cannot uncompress: %i", rv);
-			free(dst);
+			arena.free(bup);
+			arena.free(dst);
 			dst = NULL;
 			return false;
 		};
-		#ifndef NDEBUG
-			assert(memcmp(bup, src, srclen) == 0);
-			free(bup);
-		#endif
-		if (l != dstlen) {
-			LOG("expected %zu bytes, got %lu", dstlen, l);
-			free(dst);
+		if (bup) {
+			const bool same = memcmp(bup, src, srclen) == 0;
+			arena.free(bup);
+			if (!same) {
+				LOG("compressed input has been changed");
+				arena.free(dst);
+				dst = NULL;
+				return false;
+			}
+		}
+		if (zs.total_out != dstlen) {
+			LOG("expected %zu bytes, got %lu", dstlen, zs.total_out);
+			arena.free(dst);
 			dst = NULL;
 			return false;
 		}
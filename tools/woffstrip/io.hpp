@@ -1,8 +1,14 @@
 #pragma once
 #include "main.hpp"
+#include "arena.hpp"
+#include <sys/uio.h>
 
 
-bool file_read(const char*, char*&, size_t&);
+bool file_read(const char*, char*&, size_t&, uint64_t* =NULL); // optionally with the modification time in nanoseconds
 bool file_write(const char*, const char*, size_t);
-bool docompress(const char* src, size_t, char*& dst, size_t*);
-bool decompress(const char* src, size_t, char*& dst, size_t);
+bool file_writev(const char*, const struct iovec*, size_t); // atomically replaces the file
+bool file_map(const char*, char*&, size_t&); // private and writable, changes are not written back
+void file_unmap(char*, size_t);
+bool docompress(const char* src, size_t, char*& dst, size_t*, Arena&, bool stored=true); // stored uncompressed if not smaller
+bool decompress(const char* src, size_t, char*& dst, size_t, Arena&, bool stored=true); // same length means stored uncompressed
+void zinit(struct z_stream_s&, Arena&); // zlib stream allocating from the arena
@@ -0,0 +1,172 @@
+#include "keepset.hpp"
+#include "io.hpp"
+#include <ctype.h>
+
+
+#define CHAR_MAX_CODE 0x10FFFFu
+
+
+static bool parse_codepoint(const char*& p, char_t& c) {
+	if ((p[0] == 'U' || p[0] == 'u') && p[1] == '+') p += 2;
+	char* e;
+	unsigned long v = strtoul(p, &e, 16);
+	if (e == p || v > CHAR_MAX_CODE) return false;
+	c = (char_t)v;
+	p = e;
+	return true;
+}
+
+
+bool keepset_codepoints(const char* fn, std::vector<char_range_t>& v) {
+	char* buf;
+	size_t len;
+	if (!file_read(fn, buf, len)) return false;
+
+	unsigned lineno = 0;
+	bool rv = true;
+	for (char* line=buf; rv && line; ) {
+		char* next = strchr(line, '\n');
+		if (next) *next++ = '\0';
+		++lineno;
+		char* p = strchr(line, '#');
+		if (p) *p = '\0';
+		if ((p = strchr(line, '(')) != NULL) { // annotated, only the code in parentheses
+			char* e = strchr(++p, ')');
+			if (e) *e = '\0';
+		} else {
+			p = line;
+		}
+
+		const char* s = p;
+		while (*s) {
+			if (isspace((unsigned char)*s) || *s == ',') {
+				++s;
+				continue;
+			}
+			char_range_t r;
+			if (!parse_codepoint(s, r.from)) {
+				rv = false;
+				break;
+			}
+			r.to = r.from;
+			if (*s == '-' && (!parse_codepoint(++s, r.to) || r.to < r.from)) {
+				rv = false;
+				break;
+			}
+			v.push_back(r);
+		}
+		if (!rv) LOG("%s:%u: invalid codepoint", fn, lineno);
+		line = next;
+	}
+
+	free(buf);
+	return rv;
+}
+
+
+size_t keepset_utf8(const char* p, const char* e, char_t& c) {
+	// https://en.wikipedia.org/wiki/UTF-8#Encoding
+	const unsigned char b = *p;
+	size_t n;
+	if (b < 0x80) {
+		c = b;
+		return 1;
+	} else if ((b & 0xE0) == 0xC0) {
+		n = 1;
+		c = b & 0x1F;
+	} else if ((b & 0xF0) == 0xE0) {
+		n = 2;
+		c = b & 0x0F;
+	} else if ((b & 0xF8) == 0xF0) {
+		n = 3;
+		c = b & 0x07;
+	} else {
+		return 0;
+	}
+	size_t i = 1;
+	for (; i<=n && p+i < e && (p[i] & 0xC0) == 0x80; ++i) {
+		c = (c << 6) | (p[i] & 0x3F);
+	}
+	return (i > n && c <= CHAR_MAX_CODE)? i: 0;
+}
+
+
+static size_t hex_escape(const char* p, const char* e, unsigned maxlen, char_t& c) {
+	size_t n = 0;
+	c = 0;
+	while (p+n < e && n < maxlen && isxdigit((unsigned char)p[n])) {
+		c = (c << 4) | (isdigit((unsigned char)p[n])? p[n]-'0': (tolower((unsigned char)p[n])-'a'+10));
+		++n;
+	}
+	return n;
+}
+
+
+static size_t js_escape(const char* p, const char* e, char_t& c) {
+	// after the "\\u", either {hex} or exactly 4 hex digits, which might be the first of a surrogate pair
+	size_t n;
+	if (p < e && *p == '{') {
+		n = hex_escape(p+1, e, 6, c);
+		return (n && p+1+n < e && p[1+n] == '}')? n+2: 0;
+	}
+	if (hex_escape(p, e, 4, c) != 4) return 0;
+	if (c < 0xD800 || c > 0xDFFF) return 4;
+	char_t lo;
+	if (c > 0xDBFF || p+6 > e || p[4] != '\\' || p[5] != 'u' || hex_escape(p+6, e, 4, lo) != 4 || lo < 0xDC00 || lo > 0xDFFF) return 0; // lone surrogate
+	c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+	return 10;
+}
+
+
+bool keepset_content(const char* fn, std::vector<char_range_t>& v) {
+	char* buf;
+	size_t len;
+	if (!file_read(fn, buf, len)) return false;
+
+	std::vector<bool> used(CHAR_MAX_CODE+1, false); // instead of a range per occurrence
+	const char* p = buf;
+	const char* const e = buf + len;
+	while (p < e) {
+		const unsigned char b = *p;
+		char_t c;
+		if (b < 0x80) {
+			size_t n;
+			if (b == '&' && p+2 < e && p[1] == '#') { // numeric character reference
+				if (p[2] == 'x' || p[2] == 'X') {
+					n = hex_escape(p+3, e, 6, c);
+					if (n && p+3+n < e && p[3+n] == ';' && c <= CHAR_MAX_CODE) used[c] = true;
+				} else {
+					for (n=0, c=0; p+2+n < e && n < 7 && isdigit((unsigned char)p[2+n]); ++n) c = c*10 + (p[2+n]-'0');
+					if (n && p+2+n < e && p[2+n] == ';' && c <= CHAR_MAX_CODE) used[c] = true;
+				}
+			} else if (b == '\\' && p+1 < e && p[1] == 'u') { // JS escape
+				if (js_escape(p+2, e, c) && c <= CHAR_MAX_CODE) used[c] = true;
+			} else if (b == '\\' && (n = hex_escape(p+1, e, 6, c)) != 0 && c <= CHAR_MAX_CODE) { // CSS escape
+				used[c] = true;
+			}
+			used[b] = true;
+			++p;
+			continue;
+		}
+
+		const size_t n = keepset_utf8(p, e, c);
+		if (n) {
+			used[c] = true;
+			p += n;
+		} else {
+			++p; // invalid or stray continuation byte
+		}
+	}
+	free(buf);
+
+	const size_t first = v.size();
+	for (char_t c=0; c<=CHAR_MAX_CODE; ++c) {
+		if (!used[c]) continue;
+		if (v.size() > first && v.back().to+1 == c) {
+			v.back().to = c;
+		} else {
+			v.push_back((char_range_t){c, c});
+		}
+	}
+	return true;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include "main.hpp"
+#include "types.hpp"
+#include <vector>
+
+
+// Sources for the characters to keep, appended as ranges, not normalized.
+
+bool keepset_codepoints(const char*, std::vector<char_range_t>&); // hex codes or ranges, e.g. "f3c5", "U+F3C5", "20-7e", or in parentheses "UTF8: ef 8f 85 (f3c5)"
+bool keepset_content(const char*, std::vector<char_range_t>&); // all UTF-8 chars as used by HTML/CSS/JS, including &#x..; entities and \.. escapes
+size_t keepset_utf8(const char*, const char*, char_t&); // length of the char at the first, 0 if invalid
@@ -0,0 +1,1583 @@
+#include "layout.hpp"
+#include <algorithm>
+
+// https://docs.microsoft.com/en-us/typography/opentype/spec/chapter2
+// https://docs.microsoft.com/en-us/typography/opentype/spec/gsub
+// https://docs.microsoft.com/en-us/typography/opentype/spec/gpos
+// https://docs.microsoft.com/en-us/typography/opentype/spec/gdef
+// https://docs.microsoft.com/en-us/typography/opentype/spec/kern
+
+
+// object kinds, opaque ones are blobs of a given size
+#define OBJ_HEADER        1
+#define OBJ_SCRIPTS       2
+#define OBJ_SCRIPT        3
+#define OBJ_LANGSYS       4
+#define OBJ_FEATURES      5
+#define OBJ_FEATURE       6
+#define OBJ_VARIATIONS    7
+#define OBJ_CONDITIONS    8
+#define OBJ_SUBSTITUTIONS 9
+#define OBJ_LOOKUPS      10
+#define OBJ_LOOKUP       11
+#define OBJ_EXTENSION    12
+#define OBJ_SUBTABLE     13
+#define OBJ_COVERAGE     14
+#define OBJ_CLASSDEF     15
+#define OBJ_ANCHOR       16
+#define OBJ_SEQUENCE     17
+#define OBJ_LIGSET       18
+#define OBJ_LIGATURE     19
+#define OBJ_RULESET      20
+#define OBJ_RULE         21
+#define OBJ_PAIRSET      22
+#define OBJ_MARKARRAY    23
+#define OBJ_ANCHORARRAY  24
+#define OBJ_LIGARRAY     25
+#define OBJ_LIGATTACH    26
+#define OBJ_GLYPHLIST    27
+#define OBJ_LIGGLYPH     28
+#define OBJ_CARET        29
+#define OBJ_MARKSETS     30
+#define OBJ_VARSTORE     31
+#define OBJ_BLOB         32
+
+#define RULES_CHAINED 0x01
+#define RULES_CLASSES 0x02 // class values instead of glyphs
+
+#define LOOKUP_USE_MARK_FILTERING_SET 0x0010
+#define GSUB_EXTENSION 7
+#define GPOS_EXTENSION 9
+#define VALUE_DEVICES 0x00f0 // of the ValueRecord fields, the others are plain values
+
+#define TAG(a, b, c, d) ((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | (uint32_t)(c) << 8 | (uint32_t)(d))
+
+
+struct Layout::Out {
+	std::vector<uint8_t> b;
+	std::vector<link_t> l;
+
+	void u16(unsigned v) {
+		b.push_back((uint8_t)(v >> 8));
+		b.push_back((uint8_t)v);
+	}
+	void u32(uint32_t v) {
+		u16(v >> 16);
+		u16(v & 0xffff);
+	}
+	void words(const wuint16_t* p, size_t n) {
+		b.insert(b.end(), (const uint8_t*)p, (const uint8_t*)(p + n));
+	}
+	void offset(uint32_t target, unsigned size=2, uint32_t base=LAYOUT_NONE) { // null for none, relative to the object itself by default
+		if (target != LAYOUT_NONE) {
+			const link_t k = {target, base, (uint32_t)b.size(), (uint8_t)size};
+			l.push_back(k);
+		}
+		if (size == 4) u32(0); else u16(0);
+	}
+	void records(const wuint16_t* r, unsigned n) { // SequenceLookupRecords
+		for (unsigned i=0; i<n; ++i) {
+			u16(w2uint16(r[2*i]));
+			const link_t k = {w2uint16(r[2*i+1]), LAYOUT_NONE, (uint32_t)b.size(), 0};
+			l.push_back(k);
+			u16(0);
+		}
+	}
+};
+
+
+static inline unsigned value_size(unsigned format) {
+	return 2 * __builtin_popcount(format & 0xff);
+}
+
+
+Layout::Layout(Arena& a, const uint8_t* d, unsigned n): arena(a), dropped(d), nglyphs(n), buf(NULL, 0), gsub(false),
+	objat(NULL), work(NULL), work_len(0), work_cap(0) {
+}
+
+
+Layout::~Layout() {
+	arena.free(objat);
+	arena.free(work);
+}
+
+
+bool Layout::open(uint32_t off, unsigned kind, uint64_t param, uint32_t& id, bool& fresh) {
+	// the object at this offset, new to be filled in by the caller, or shared
+	if (off >= buf.size()) return false;
+	if (objat[off]) {
+		id = objat[off] - 1;
+		fresh = false;
+		const object_t& o = objects[id];
+		return o.done && o.kind == kind && o.param == param; // overlapping or cyclic otherwise
+	}
+	object_t o = {};
+	o.start = off;
+	o.kind = kind;
+	o.param = param;
+	o.pos = LAYOUT_NONE;
+	o.fork = LAYOUT_NONE;
+	id = objects.size();
+	objects.push_back(o);
+	objat[off] = id + 1;
+	fresh = true;
+	return true;
+}
+
+
+bool Layout::commit(uint32_t id, Out& out, uint32_t end, bool empty) {
+	object_t& o = objects[id];
+	if (end > buf.size() || end <= o.start) return false;
+	if (work_len + out.b.size() > work_cap) {
+		work_cap = MAX(work_cap * 2, work_len + out.b.size() + 4096);
+		work = (char*)arena.realloc(work, work_cap);
+	}
+	if (!out.b.empty()) memcpy(work + work_len, &out.b[0], out.b.size());
+	o.data = work_len;
+	o.len = out.b.size();
+	work_len += o.len;
+	o.links = links.size();
+	o.nlinks = out.l.size();
+	for (std::vector<link_t>::iterator it=out.l.begin(); it!=out.l.end(); ++it) {
+		if (!it->size) {
+			if (it->target >= nested.size()) return false;
+		} else if (it->base == LAYOUT_NONE) {
+			it->base = id;
+		}
+		links.push_back(*it);
+	}
+	o.end = end;
+	o.empty = empty;
+	o.done = true;
+	return true;
+}
+
+
+bool Layout::same(uint32_t id, const Out& out) const {
+	// for objects pruned by their parent, which must do so alike when shared
+	const object_t& o = objects[id];
+	if (o.len != out.b.size() || o.nlinks != out.l.size()) return false;
+	if (o.len && memcmp(work + o.data, &out.b[0], o.len)) return false;
+	for (uint32_t i=0; i<o.nlinks; ++i) {
+		const link_t& a = links[o.links + i];
+		const link_t& b = out.l[i];
+		if (a.target != b.target || a.at != b.at || a.size != b.size || (b.size && a.base != (b.base == LAYOUT_NONE? id: b.base))) return false;
+	}
+	return true;
+}
+
+
+bool Layout::variant(uint32_t& id, bool fresh, Out& out, uint32_t end, bool empty) {
+	// for objects pruned by their parent, copied once more if shared by parents that differ
+	if (!fresh) {
+		for (;;) {
+			if (same(id, out)) return true;
+			if (objects[id].fork == LAYOUT_NONE) break;
+			id = objects[id].fork;
+		}
+		object_t o = objects[id];
+		o.done = false;
+		const uint32_t fork = objects.size();
+		objects.push_back(o);
+		objects[id].fork = fork;
+		id = fork;
+	}
+	return commit(id, out, end, empty);
+}
+
+
+bool Layout::read_coverage(uint32_t off, std::vector<uint16_t>& glyphs) const {
+	// as listed, by coverage index
+	glyphs.clear();
+	const wuint16_t* h = words(off, 2);
+	if (!h) return false;
+	const unsigned n = w2uint16(h[1]);
+	if (w2uint16(h[0]) == 1) {
+		const wuint16_t* g = words(off + 4, n);
+		if (!g) return false;
+		glyphs.reserve(n);
+		for (unsigned i=0; i<n; ++i) glyphs.push_back(w2uint16(g[i]));
+		return true;
+	}
+	const wuint16_t* r = words(off + 4, 3 * n);
+	if (w2uint16(h[0]) != 2 || !r) return false;
+	for (unsigned i=0; i<n; ++i) {
+		const unsigned from = w2uint16(r[3*i]), to = w2uint16(r[3*i+1]);
+		if (to < from || w2uint16(r[3*i+2]) != glyphs.size()) return false;
+		for (unsigned g=from; g<=to; ++g) glyphs.push_back(g);
+	}
+	return true;
+}
+
+
+void Layout::alive(const std::vector<uint16_t>& glyphs, std::vector<uint8_t>& kept) const {
+	kept.resize(glyphs.size());
+	for (size_t i=0; i<glyphs.size(); ++i) kept[i] = !gone(glyphs[i]);
+}
+
+
+bool Layout::coverage(uint32_t off, const std::vector<uint16_t>& glyphs, const std::vector<uint8_t>& kept, uint32_t& id) {
+	// with the kept glyphs of the given coverage, in the smaller format
+	bool fresh;
+	if (!open(off, OBJ_COVERAGE, 0, id, fresh)) return false;
+	const wuint16_t* h = words(off, 2);
+	const unsigned format = w2uint16(h[0]);
+	std::vector<uint16_t> g;
+	unsigned nranges = 0;
+	for (size_t i=0; i<glyphs.size(); ++i) {
+		if (!kept[i]) continue;
+		if (g.empty() || glyphs[i] != g.back() + 1) ++nranges;
+		g.push_back(glyphs[i]);
+	}
+	Out out;
+	if (3 * nranges < g.size() || (3 * nranges == g.size() && format == 2)) {
+		out.u16(2);
+		out.u16(nranges);
+		for (size_t i=0, j; i<g.size(); i=j) {
+			for (j=i+1; j<g.size() && g[j] == g[j-1] + 1; ++j);
+			out.u16(g[i]);
+			out.u16(g[j-1]);
+			out.u16(i);
+		}
+	} else {
+		out.u16(1);
+		out.u16(g.size());
+		for (size_t i=0; i<g.size(); ++i) out.u16(g[i]);
+	}
+	const uint32_t end = off + 4 + (format == 1? 2: 6) * w2uint16(h[1]);
+	return variant(id, fresh, out, end, g.empty());
+}
+
+
+bool Layout::pruned_coverage(uint32_t off, uint32_t& id) {
+	std::vector<uint16_t> glyphs;
+	std::vector<uint8_t> kept;
+	if (!read_coverage(off, glyphs)) return false;
+	alive(glyphs, kept);
+	return coverage(off, glyphs, kept, id);
+}
+
+
+bool Layout::class_def(uint32_t off, uint32_t& id) {
+	// without dropped glyphs at the ends of ranges, and without explicit class 0
+	bool fresh;
+	if (!open(off, OBJ_CLASSDEF, 0, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 2);
+	if (!h) return false;
+	Out out;
+	uint32_t end;
+	if (w2uint16(h[0]) == 1) {
+		if (!(h = words(off, 3))) return false;
+		const unsigned first = w2uint16(h[1]), n = w2uint16(h[2]);
+		const wuint16_t* c = words(off + 6, n);
+		if (!c || first + n > 0x10000) return false;
+		unsigned from = 0, to = n;
+		while (from < to && (!w2uint16(c[from]) || gone(first + from))) ++from;
+		while (to > from && (!w2uint16(c[to-1]) || gone(first + to-1))) --to;
+		out.u16(1);
+		out.u16(from < to? first + from: 0);
+		out.u16(to - from);
+		for (unsigned i=from; i<to; ++i) out.u16(gone(first + i)? 0: w2uint16(c[i]));
+		end = off + 6 + 2 * n;
+	} else {
+		const unsigned n = w2uint16(h[1]);
+		const wuint16_t* r = words(off + 4, 3 * n);
+		if (w2uint16(h[0]) != 2 || !r) return false;
+		std::vector<uint16_t> v;
+		for (unsigned i=0; i<n; ++i) {
+			unsigned from = w2uint16(r[3*i]), to = w2uint16(r[3*i+1]);
+			const unsigned c = w2uint16(r[3*i+2]);
+			if (!c) continue;
+			while (from <= to && gone(from)) ++from;
+			while (to >= from && gone(to)) --to;
+			if (from > to) continue;
+			v.push_back(from);
+			v.push_back(to);
+			v.push_back(c);
+		}
+		out.u16(2);
+		out.u16(v.size() / 3);
+		for (size_t i=0; i<v.size(); ++i) out.u16(v[i]);
+		end = off + 4 + 6 * n;
+	}
+	return commit(id, out, end);
+}
+
+
+bool Layout::blob(uint32_t off, size_t len, uint32_t& id) {
+	// copied as is, without any offsets
+	bool fresh;
+	if (!open(off, OBJ_BLOB, len, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* p = words(off, len / 2);
+	if (!p || len % 2) return false;
+	Out out;
+	out.words(p, len / 2);
+	return commit(id, out, off + len);
+}
+
+
+bool Layout::device(uint32_t off, uint32_t& id) {
+	const wuint16_t* h = words(off, 3);
+	if (!h) return false;
+	const unsigned from = w2uint16(h[0]), to = w2uint16(h[1]), format = w2uint16(h[2]);
+	if (format == 0x8000) return blob(off, 6, id); // VariationIndex
+	if (format < 1 || format > 3 || to < from) return false;
+	return blob(off, 6 + 2 * (((to - from + 1) << format) + 15) / 16, id); // deltas of 2, 4 or 8 bits by size
+}
+
+
+bool Layout::anchor(uint32_t off, uint32_t& id) {
+	const wuint16_t* h = words(off, 1);
+	const unsigned format = h? w2uint16(h[0]): 0;
+	if (format == 1 || format == 2) return blob(off, format == 1? 6: 8, id);
+	bool fresh;
+	if (format != 3 || !(h = words(off, 5)) || !open(off, OBJ_ANCHOR, 0, id, fresh)) return false;
+	if (!fresh) return true;
+	uint32_t dev[2] = {LAYOUT_NONE, LAYOUT_NONE};
+	for (unsigned k=0; k<2; ++k) {
+		if (w2uint16(h[3+k]) && !device(off + w2uint16(h[3+k]), dev[k])) return false;
+	}
+	Out out;
+	out.words(h, 3);
+	out.offset(dev[0]);
+	out.offset(dev[1]);
+	return commit(id, out, off + 10);
+}
+
+
+bool Layout::value_devices(uint32_t at, unsigned format, uint32_t base, std::vector<uint32_t>& ids) {
+	// of a ValueRecord, relative to the given subtable
+	const wuint16_t* v = words(at, value_size(format) / 2);
+	if (!v || (format & ~0xffu)) return false;
+	for (unsigned bit=0, k=0; bit<8; ++bit) {
+		if (!(format & (1u << bit))) continue;
+		if (VALUE_DEVICES & (1u << bit)) {
+			uint32_t d = LAYOUT_NONE;
+			if (w2uint16(v[k]) && !device(objects[base].start + w2uint16(v[k]), d)) return false;
+			ids.push_back(d);
+		}
+		++k;
+	}
+	return true;
+}
+
+
+void Layout::put_value(Out& out, uint32_t at, unsigned format, const uint32_t*& ids, uint32_t base) {
+	const wuint16_t* v = words(at, value_size(format) / 2);
+	for (unsigned bit=0, k=0; bit<8; ++bit) {
+		if (!(format & (1u << bit))) continue;
+		if (VALUE_DEVICES & (1u << bit)) {
+			out.offset(*ids++, 2, base);
+		} else {
+			out.u16(w2uint16(v[k]));
+		}
+		++k;
+	}
+}
+
+
+bool Layout::sequence(uint32_t off, unsigned type, uint32_t& id) {
+	// of a multiple substitution, unusable with any dropped glyph, or alternates without them
+	bool fresh;
+	if (!open(off, OBJ_SEQUENCE, type, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 1);
+	const unsigned n = h? w2uint16(h[0]): 0;
+	const wuint16_t* g = h? words(off + 2, n): NULL;
+	if (!g) return false;
+	Out out;
+	bool empty = false;
+	if (type == 2) {
+		for (unsigned i=0; i<n; ++i) empty |= gone(w2uint16(g[i]));
+		out.u16(n);
+		out.words(g, n);
+	} else {
+		std::vector<uint16_t> v;
+		for (unsigned i=0; i<n; ++i) {
+			if (!gone(w2uint16(g[i]))) v.push_back(w2uint16(g[i]));
+		}
+		out.u16(v.size());
+		for (size_t i=0; i<v.size(); ++i) out.u16(v[i]);
+		empty = v.empty();
+	}
+	return commit(id, out, off + 2 + 2 * n, empty);
+}
+
+
+bool Layout::ligature(uint32_t off, uint32_t& id) {
+	bool fresh;
+	if (!open(off, OBJ_LIGATURE, 0, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 2);
+	const unsigned n = h? w2uint16(h[1]): 0;
+	const wuint16_t* c = n? words(off + 4, n - 1): NULL;
+	if (!c) return false;
+	bool empty = gone(w2uint16(h[0]));
+	for (unsigned i=0; i<n-1; ++i) empty |= gone(w2uint16(c[i]));
+	Out out;
+	out.words(h, 2 + n-1);
+	return commit(id, out, off + 4 + 2 * (n-1), empty);
+}
+
+
+bool Layout::ligature_set(uint32_t off, uint32_t& id) {
+	bool fresh;
+	if (!open(off, OBJ_LIGSET, 0, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 1);
+	const unsigned n = h? w2uint16(h[0]): 0;
+	const wuint16_t* s = h? words(off + 2, n): NULL;
+	if (!s) return false;
+	std::vector<uint32_t> ids;
+	for (unsigned i=0; i<n; ++i) {
+		uint32_t l;
+		if (!w2uint16(s[i]) || !ligature(off + w2uint16(s[i]), l)) return false;
+		if (!is_empty(l)) ids.push_back(l);
+	}
+	Out out;
+	out.u16(ids.size());
+	for (size_t i=0; i<ids.size(); ++i) out.offset(ids[i]);
+	return commit(id, out, off + 2 + 2 * n, ids.empty());
+}
+
+
+bool Layout::rule(uint32_t off, unsigned flags, uint32_t& id) {
+	// unusable with any dropped glyph in its sequences, class values are kept as is
+	bool fresh;
+	if (!open(off, OBJ_RULE, flags, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* seq[3] = {NULL, NULL, NULL}; // backtrack, input, lookahead
+	unsigned len[3] = {0, 0, 0};
+	const wuint16_t* r;
+	unsigned nrecords;
+	uint32_t p = off;
+	const wuint16_t* h;
+	if (flags & RULES_CHAINED) {
+		for (unsigned k=0; k<3; ++k) {
+			if (!(h = words(p, 1)) || (k == 1 && !w2uint16(h[0]))) return false;
+			len[k] = w2uint16(h[0]) - (k == 1); // the first input glyph is covered already
+			if (!(seq[k] = words(p + 2, len[k]))) return false;
+			p += 2 + 2 * len[k];
+		}
+		if (!(h = words(p, 1))) return false;
+		nrecords = w2uint16(h[0]);
+		p += 2;
+	} else {
+		if (!(h = words(p, 2)) || !w2uint16(h[0])) return false;
+		len[1] = w2uint16(h[0]) - 1;
+		nrecords = w2uint16(h[1]);
+		if (!(seq[1] = words(p + 4, len[1]))) return false;
+		p += 4 + 2 * len[1];
+	}
+	if (!(r = words(p, 2 * nrecords))) return false;
+
+	bool empty = false;
+	for (unsigned k=0; k<3 && !(flags & RULES_CLASSES); ++k) {
+		for (unsigned i=0; i<len[k]; ++i) empty |= gone(w2uint16(seq[k][i]));
+	}
+	Out out;
+	out.words(words(off, (p - off) / 2), (p - off) / 2);
+	out.records(r, nrecords);
+	return commit(id, out, p + 4 * nrecords, empty);
+}
+
+
+bool Layout::rule_set(uint32_t off, unsigned flags, uint32_t& id) {
+	bool fresh;
+	if (!open(off, OBJ_RULESET, flags, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 1);
+	const unsigned n = h? w2uint16(h[0]): 0;
+	const wuint16_t* s = h? words(off + 2, n): NULL;
+	if (!s) return false;
+	std::vector<uint32_t> ids;
+	for (unsigned i=0; i<n; ++i) {
+		uint32_t r;
+		if (!w2uint16(s[i]) || !rule(off + w2uint16(s[i]), flags, r)) return false;
+		if (!is_empty(r)) ids.push_back(r);
+	}
+	Out out;
+	out.u16(ids.size());
+	for (size_t i=0; i<ids.size(); ++i) out.offset(ids[i]);
+	return commit(id, out, off + 2 + 2 * n, ids.empty());
+}
+
+
+bool Layout::context(uint32_t off, bool chained, uint32_t& id) {
+	// (chained) contextual substitution or positioning, with nested lookups that are renumbered later
+	bool fresh;
+	if (!open(off, OBJ_SUBTABLE, chained? 0x100: 0x200, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 1);
+	if (!h) return false;
+	const unsigned format = w2uint16(h[0]);
+	Out out;
+	if (format == 1 || format == 2) {
+		const unsigned nclassdefs = (format == 1)? 0: chained? 3: 1;
+		if (!(h = words(off, 3 + nclassdefs))) return false;
+		const unsigned n = w2uint16(h[2 + nclassdefs]);
+		const wuint16_t* s = words(off + 6 + 2 * nclassdefs, n);
+		std::vector<uint16_t> glyphs;
+		std::vector<uint8_t> kept;
+		if (!s || !read_coverage(off + w2uint16(h[1]), glyphs) || (format == 1 && n != glyphs.size())) return false;
+		alive(glyphs, kept);
+		uint32_t cov, classdefs[3] = {LAYOUT_NONE, LAYOUT_NONE, LAYOUT_NONE};
+		for (unsigned k=0; k<nclassdefs; ++k) {
+			if (w2uint16(h[2+k]) && !class_def(off + w2uint16(h[2+k]), classdefs[k])) return false;
+		}
+		std::vector<uint32_t> sets(n, LAYOUT_NONE);
+		const unsigned flags = (chained? RULES_CHAINED: 0) | (format == 2? RULES_CLASSES: 0);
+		for (unsigned i=0; i<n; ++i) {
+			if (format == 1 && !kept[i]) continue; // by coverage index, otherwise by class
+			if (w2uint16(s[i]) && !rule_set(off + w2uint16(s[i]), flags, sets[i])) return false;
+			if (format == 1) kept[i] = !is_empty(sets[i]);
+		}
+		if (!coverage(off + w2uint16(h[1]), glyphs, kept, cov)) return false;
+
+		out.u16(format);
+		out.offset(cov);
+		for (unsigned k=0; k<nclassdefs; ++k) out.offset(classdefs[k]);
+		unsigned m = 0;
+		for (unsigned i=0; i<n; ++i) m += (format == 2 || kept[i]);
+		out.u16(m);
+		for (unsigned i=0; i<n; ++i) {
+			if (format == 2 || kept[i]) out.offset(sets[i]);
+		}
+		return commit(id, out, off + 6 + 2 * nclassdefs + 2 * n, is_empty(cov));
+	}
+	if (format != 3) return false;
+
+	// coverages by position, unusable once any is empty
+	std::vector<uint32_t> covs;
+	unsigned counts[3] = {0, 0, 0};
+	uint32_t p = off + 2;
+	unsigned nrecords;
+	if (chained) {
+		for (unsigned k=0; k<3; ++k) {
+			if (!(h = words(p, 1))) return false;
+			counts[k] = w2uint16(h[0]);
+			const wuint16_t* c = words(p + 2, counts[k]);
+			if (!c) return false;
+			for (unsigned i=0; i<counts[k]; ++i) covs.push_back(w2uint16(c[i]));
+			p += 2 + 2 * counts[k];
+		}
+		if (!(h = words(p, 1))) return false;
+		nrecords = w2uint16(h[0]);
+		p += 2;
+	} else {
+		if (!(h = words(p, 2))) return false;
+		counts[1] = w2uint16(h[0]);
+		nrecords = w2uint16(h[1]);
+		const wuint16_t* c = words(p + 4, counts[1]);
+		if (!c) return false;
+		for (unsigned i=0; i<counts[1]; ++i) covs.push_back(w2uint16(c[i]));
+		p += 4 + 2 * counts[1];
+	}
+	const wuint16_t* r = words(p, 2 * nrecords);
+	if (!r) return false;
+	bool empty = false;
+	for (size_t i=0; i<covs.size(); ++i) {
+		if (!covs[i] || !pruned_coverage(off + covs[i], covs[i])) return false;
+		empty |= is_empty(covs[i]);
+	}
+	out.u16(3);
+	if (chained) {
+		for (unsigned k=0, i=0; k<3; ++k) {
+			out.u16(counts[k]);
+			for (unsigned j=0; j<counts[k]; ++j) out.offset(covs[i++]);
+		}
+		out.u16(nrecords);
+	} else {
+		out.u16(counts[1]);
+		out.u16(nrecords);
+		for (unsigned i=0; i<counts[1]; ++i) out.offset(covs[i]);
+	}
+	out.records(r, nrecords);
+	return commit(id, out, p + 4 * nrecords, empty);
+}
+
+
+bool Layout::substitution(uint32_t off, unsigned type, uint32_t& id) {
+	if (type == 5 || type == 6) return context(off, type == 6, id);
+	bool fresh;
+	if (!open(off, OBJ_SUBTABLE, type, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 3);
+	if (!h) return false;
+	const unsigned format = w2uint16(h[0]);
+	const uint32_t cov_off = off + w2uint16(h[1]);
+	std::vector<uint16_t> glyphs;
+	std::vector<uint8_t> kept;
+	if (!w2uint16(h[1]) || !read_coverage(cov_off, glyphs)) return false;
+	alive(glyphs, kept);
+	uint32_t cov;
+	Out out;
+
+	if (type == 1 && format == 1) { // by delta
+		const unsigned delta = w2uint16(h[2]);
+		for (size_t i=0; i<glyphs.size(); ++i) kept[i] &= !gone((glyphs[i] + delta) & 0xffff);
+		if (!coverage(cov_off, glyphs, kept, cov)) return false;
+		out.u16(1);
+		out.offset(cov);
+		out.u16(delta);
+		return commit(id, out, off + 6, is_empty(cov));
+	}
+	if (type == 8 && format == 1) { // reverse chaining single substitution, with the backtrack and lookahead coverages in between
+		std::vector<uint32_t> covs;
+		unsigned counts[2];
+		uint32_t p = off + 4;
+		for (unsigned k=0; k<2; ++k) {
+			const wuint16_t* c = words(p, 1);
+			if (!c) return false;
+			counts[k] = w2uint16(c[0]);
+			if (!(c = words(p + 2, counts[k]))) return false;
+			for (unsigned i=0; i<counts[k]; ++i) covs.push_back(w2uint16(c[i]));
+			p += 2 + 2 * counts[k];
+		}
+		const wuint16_t* c = words(p, 1);
+		const unsigned m = c? w2uint16(c[0]): 0;
+		const wuint16_t* subst = c? words(p + 2, m): NULL;
+		if (!subst || m != glyphs.size()) return false;
+		bool empty = false;
+		for (size_t i=0; i<covs.size(); ++i) {
+			if (!covs[i] || !pruned_coverage(off + covs[i], covs[i])) return false;
+			empty |= is_empty(covs[i]);
+		}
+		for (unsigned i=0; i<m; ++i) kept[i] &= !gone(w2uint16(subst[i]));
+		if (!coverage(cov_off, glyphs, kept, cov)) return false;
+		out.u16(1);
+		out.offset(cov);
+		for (unsigned k=0, i=0; k<2; ++k) {
+			out.u16(counts[k]);
+			for (unsigned j=0; j<counts[k]; ++j) out.offset(covs[i++]);
+		}
+		out.u16(std::count(kept.begin(), kept.end(), 1));
+		for (unsigned i=0; i<m; ++i) {
+			if (kept[i]) out.u16(w2uint16(subst[i]));
+		}
+		return commit(id, out, p + 2 + 2 * m, empty || is_empty(cov));
+	}
+	const unsigned n = w2uint16(h[2]);
+	const wuint16_t* s = words(off + 6, n);
+	if (format != 1 + (type == 1) || !s || n != glyphs.size()) return false;
+
+	if (type == 1) { // by glyph
+		for (unsigned i=0; i<n; ++i) kept[i] &= !gone(w2uint16(s[i]));
+		if (!coverage(cov_off, glyphs, kept, cov)) return false;
+		out.u16(2);
+		out.offset(cov);
+		out.u16(std::count(kept.begin(), kept.end(), 1));
+		for (unsigned i=0; i<n; ++i) {
+			if (kept[i]) out.u16(w2uint16(s[i]));
+		}
+		return commit(id, out, off + 6 + 2 * n, is_empty(cov));
+	}
+	if (type == 2 || type == 3 || type == 4) { // sequences, alternates, or ligatures by first glyph
+		std::vector<uint32_t> ids(n, LAYOUT_NONE);
+		for (unsigned i=0; i<n; ++i) {
+			if (!kept[i]) continue;
+			if (!w2uint16(s[i])) return false;
+			if (type == 4) {
+				if (!ligature_set(off + w2uint16(s[i]), ids[i])) return false;
+			} else {
+				if (!sequence(off + w2uint16(s[i]), type, ids[i])) return false;
+			}
+			kept[i] = !is_empty(ids[i]);
+		}
+		if (!coverage(cov_off, glyphs, kept, cov)) return false;
+		out.u16(1);
+		out.offset(cov);
+		out.u16(std::count(kept.begin(), kept.end(), 1));
+		for (unsigned i=0; i<n; ++i) {
+			if (kept[i]) out.offset(ids[i]);
+		}
+		return commit(id, out, off + 6 + 2 * n, is_empty(cov));
+	}
+	return false;
+}
+
+
+bool Layout::pair_set(uint32_t off, unsigned format1, unsigned format2, uint32_t base, uint32_t& id) {
+	// with devices relative to the pair positioning subtable
+	bool fresh;
+	const uint64_t param = (uint64_t)((format1 | format2) & VALUE_DEVICES? base: 0) << 32 | format2 << 16 | format1;
+	if (!open(off, OBJ_PAIRSET, param, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 1);
+	if (!h) return false;
+	const unsigned n = w2uint16(h[0]);
+	const unsigned size1 = value_size(format1), size = 2 + size1 + value_size(format2);
+	if (!words(off + 2, n * size / 2)) return false;
+	std::vector<uint32_t> devs;
+	unsigned m = 0;
+	for (unsigned i=0; i<n; ++i) {
+		const uint32_t at = off + 2 + i * size;
+		if (gone(w2uint16(*words(at, 1)))) continue;
+		if (!value_devices(at + 2, format1, base, devs) || !value_devices(at + 2 + size1, format2, base, devs)) return false;
+		++m;
+	}
+	Out out;
+	out.u16(m);
+	const uint32_t* d = devs.empty()? NULL: &devs[0];
+	for (unsigned i=0; i<n; ++i) {
+		const uint32_t at = off + 2 + i * size;
+		const unsigned second = w2uint16(*words(at, 1));
+		if (gone(second)) continue;
+		out.u16(second);
+		put_value(out, at + 2, format1, d, base);
+		put_value(out, at + 2 + size1, format2, d, base);
+	}
+	return commit(id, out, off + 2 + n * size, !m);
+}
+
+
+bool Layout::mark_array(uint32_t off, const std::vector<uint8_t>& kept, uint32_t& id) {
+	// by mark coverage index
+	bool fresh;
+	if (!open(off, OBJ_MARKARRAY, 0, id, fresh)) return false;
+	const wuint16_t* h = words(off, 1);
+	const unsigned n = h? w2uint16(h[0]): 0;
+	const wuint16_t* r = h? words(off + 2, 2 * n): NULL;
+	if (!r || n != kept.size()) return false;
+	std::vector<uint32_t> anchors(n, LAYOUT_NONE);
+	for (unsigned i=0; i<n; ++i) {
+		if (kept[i] && (!w2uint16(r[2*i+1]) || !anchor(off + w2uint16(r[2*i+1]), anchors[i]))) return false;
+	}
+	Out out;
+	out.u16(std::count(kept.begin(), kept.end(), 1));
+	for (unsigned i=0; i<n; ++i) {
+		if (!kept[i]) continue;
+		out.u16(w2uint16(r[2*i]));
+		out.offset(anchors[i]);
+	}
+	return variant(id, fresh, out, off + 2 + 4 * n);
+}
+
+
+bool Layout::anchor_array(uint32_t off, const std::vector<uint8_t>& kept, unsigned nclasses, uint32_t& id) {
+	// base or mark2 anchors by coverage index and mark class, possibly null
+	bool fresh;
+	if (!open(off, OBJ_ANCHORARRAY, nclasses, id, fresh)) return false;
+	const wuint16_t* h = words(off, 1);
+	const unsigned n = h? w2uint16(h[0]): 0;
+	const wuint16_t* r = h? words(off + 2, n * nclasses): NULL;
+	if (!r || n != kept.size()) return false;
+	std::vector<uint32_t> anchors(n * nclasses, LAYOUT_NONE);
+	for (unsigned i=0; i<n * nclasses; ++i) {
+		if (kept[i / nclasses] && w2uint16(r[i]) && !anchor(off + w2uint16(r[i]), anchors[i])) return false;
+	}
+	Out out;
+	out.u16(std::count(kept.begin(), kept.end(), 1));
+	for (unsigned i=0; i<n * nclasses; ++i) {
+		if (kept[i / nclasses]) out.offset(anchors[i]);
+	}
+	return variant(id, fresh, out, off + 2 + 2 * n * nclasses);
+}
+
+
+bool Layout::ligature_array(uint32_t off, const std::vector<uint8_t>& kept, unsigned nclasses, uint32_t& id) {
+	// by ligature coverage index, each with anchors by component and mark class
+	bool fresh;
+	if (!open(off, OBJ_LIGARRAY, nclasses, id, fresh)) return false;
+	const wuint16_t* h = words(off, 1);
+	const unsigned n = h? w2uint16(h[0]): 0;
+	const wuint16_t* s = h? words(off + 2, n): NULL;
+	if (!s || n != kept.size()) return false;
+	std::vector<uint32_t> attach(n, LAYOUT_NONE);
+	for (unsigned i=0; i<n; ++i) {
+		if (!kept[i]) continue;
+		if (!w2uint16(s[i])) return false;
+		const uint32_t a = off + w2uint16(s[i]);
+		bool afresh;
+		if (!open(a, OBJ_LIGATTACH, nclasses, attach[i], afresh)) return false;
+		if (!afresh) continue;
+		const wuint16_t* c = words(a, 1);
+		const unsigned m = c? w2uint16(c[0]) * nclasses: 0;
+		const wuint16_t* r = c? words(a + 2, m): NULL;
+		if (!r) return false;
+		std::vector<uint32_t> anchors(m, LAYOUT_NONE);
+		for (unsigned j=0; j<m; ++j) {
+			if (w2uint16(r[j]) && !anchor(a + w2uint16(r[j]), anchors[j])) return false;
+		}
+		Out ao;
+		ao.u16(w2uint16(c[0]));
+		for (unsigned j=0; j<m; ++j) ao.offset(anchors[j]);
+		if (!commit(attach[i], ao, a + 2 + 2 * m)) return false;
+	}
+	Out out;
+	out.u16(std::count(kept.begin(), kept.end(), 1));
+	for (unsigned i=0; i<n; ++i) {
+		if (kept[i]) out.offset(attach[i]);
+	}
+	return variant(id, fresh, out, off + 2 + 2 * n);
+}
+
+
+bool Layout::positioning(uint32_t off, unsigned type, uint32_t& id) {
+	if (type == 7 || type == 8) return context(off, type == 8, id);
+	bool fresh;
+	if (!open(off, OBJ_SUBTABLE, type, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 3);
+	if (!h) return false;
+	const unsigned format = w2uint16(h[0]);
+	const uint32_t cov_off = off + w2uint16(h[1]);
+	std::vector<uint16_t> glyphs;
+	std::vector<uint8_t> kept;
+	if (!w2uint16(h[1]) || !read_coverage(cov_off, glyphs)) return false;
+	alive(glyphs, kept);
+	uint32_t cov;
+	std::vector<uint32_t> devs;
+	Out out;
+
+	if (type == 1 && format == 1) { // a single value for all
+		const unsigned vf = w2uint16(h[2]);
+		if (!value_devices(off + 6, vf, id, devs) || !coverage(cov_off, glyphs, kept, cov)) return false;
+		const uint32_t* d = devs.empty()? NULL: &devs[0];
+		out.u16(1);
+		out.offset(cov);
+		out.u16(vf);
+		put_value(out, off + 6, vf, d, id);
+		return commit(id, out, off + 6 + value_size(vf), is_empty(cov));
+	}
+	if (type == 1 && format == 2) { // by coverage index
+		const wuint16_t* p = words(off, 4);
+		const unsigned vf = w2uint16(h[2]), n = p? w2uint16(p[3]): 0, size = value_size(vf);
+		if (!p || n != glyphs.size() || !words(off + 8, n * size / 2)) return false;
+		for (unsigned i=0; i<n; ++i) {
+			if (kept[i] && !value_devices(off + 8 + i * size, vf, id, devs)) return false;
+		}
+		if (!coverage(cov_off, glyphs, kept, cov)) return false;
+		const uint32_t* d = devs.empty()? NULL: &devs[0];
+		out.u16(2);
+		out.offset(cov);
+		out.u16(vf);
+		out.u16(std::count(kept.begin(), kept.end(), 1));
+		for (unsigned i=0; i<n; ++i) {
+			if (kept[i]) put_value(out, off + 8 + i * size, vf, d, id);
+		}
+		return commit(id, out, off + 8 + n * size, is_empty(cov));
+	}
+	if (type == 2 && format == 1) { // pair sets by first glyph
+		const wuint16_t* p = words(off, 5);
+		const unsigned vf1 = p? w2uint16(p[2]): 0, vf2 = p? w2uint16(p[3]): 0, n = p? w2uint16(p[4]): 0;
+		const wuint16_t* s = p? words(off + 10, n): NULL;
+		if (!s || n != glyphs.size()) return false;
+		std::vector<uint32_t> sets(n, LAYOUT_NONE);
+		for (unsigned i=0; i<n; ++i) {
+			if (!kept[i]) continue;
+			if (!w2uint16(s[i]) || !pair_set(off + w2uint16(s[i]), vf1, vf2, id, sets[i])) return false;
+			kept[i] = !is_empty(sets[i]);
+		}
+		if (!coverage(cov_off, glyphs, kept, cov)) return false;
+		out.u16(1);
+		out.offset(cov);
+		out.u16(vf1);
+		out.u16(vf2);
+		out.u16(std::count(kept.begin(), kept.end(), 1));
+		for (unsigned i=0; i<n; ++i) {
+			if (kept[i]) out.offset(sets[i]);
+		}
+		return commit(id, out, off + 10 + 2 * n, is_empty(cov));
+	}
+	if (type == 2 && format == 2) { // class pairs, the matrix is kept
+		const wuint16_t* p = words(off, 8);
+		if (!p) return false;
+		const unsigned vf1 = w2uint16(p[2]), vf2 = w2uint16(p[3]), n1 = w2uint16(p[6]), n2 = w2uint16(p[7]);
+		const unsigned size1 = value_size(vf1), size = size1 + value_size(vf2);
+		if (!words(off + 16, (size_t)n1 * n2 * size / 2)) return false;
+		uint32_t classdefs[2] = {LAYOUT_NONE, LAYOUT_NONE};
+		for (unsigned k=0; k<2; ++k) {
+			if (w2uint16(p[4+k]) && !class_def(off + w2uint16(p[4+k]), classdefs[k])) return false;
+		}
+		for (size_t i=0; i<(size_t)n1 * n2; ++i) {
+			if (!value_devices(off + 16 + i * size, vf1, id, devs) || !value_devices(off + 16 + i * size + size1, vf2, id, devs)) return false;
+		}
+		if (!coverage(cov_off, glyphs, kept, cov)) return false;
+		const uint32_t* d = devs.empty()? NULL: &devs[0];
+		out.u16(2);
+		out.offset(cov);
+		out.u16(vf1);
+		out.u16(vf2);
+		out.offset(classdefs[0]);
+		out.offset(classdefs[1]);
+		out.u16(n1);
+		out.u16(n2);
+		for (size_t i=0; i<(size_t)n1 * n2; ++i) {
+			put_value(out, off + 16 + i * size, vf1, d, id);
+			put_value(out, off + 16 + i * size + size1, vf2, d, id);
+		}
+		return commit(id, out, off + 16 + (size_t)n1 * n2 * size, is_empty(cov));
+	}
+	if (type == 3 && format == 1) { // entry and exit anchors by coverage index
+		const unsigned n = w2uint16(h[2]);
+		const wuint16_t* r = words(off + 6, 2 * n);
+		if (!r || n != glyphs.size()) return false;
+		std::vector<uint32_t> anchors(2 * n, LAYOUT_NONE);
+		for (unsigned i=0; i<2*n; ++i) {
+			if (kept[i/2] && w2uint16(r[i]) && !anchor(off + w2uint16(r[i]), anchors[i])) return false;
+		}
+		if (!coverage(cov_off, glyphs, kept, cov)) return false;
+		out.u16(1);
+		out.offset(cov);
+		out.u16(std::count(kept.begin(), kept.end(), 1));
+		for (unsigned i=0; i<2*n; ++i) {
+			if (kept[i/2]) out.offset(anchors[i]);
+		}
+		return commit(id, out, off + 6 + 4 * n, is_empty(cov));
+	}
+	if (type >= 4 && type <= 6 && format == 1) { // marks to bases, ligatures or other marks
+		const wuint16_t* p = words(off, 6);
+		const unsigned nclasses = p? w2uint16(p[3]): 0;
+		std::vector<uint16_t> glyphs2;
+		std::vector<uint8_t> kept2;
+		if (!nclasses || !w2uint16(p[2]) || !w2uint16(p[4]) || !w2uint16(p[5]) || !read_coverage(off + w2uint16(p[2]), glyphs2)) return false;
+		alive(glyphs2, kept2);
+		uint32_t cov2, marks, bases;
+		if (!coverage(cov_off, glyphs, kept, cov) || !coverage(off + w2uint16(p[2]), glyphs2, kept2, cov2)) return false;
+		if (!mark_array(off + w2uint16(p[4]), kept, marks)) return false;
+		if (type == 5) {
+			if (!ligature_array(off + w2uint16(p[5]), kept2, nclasses, bases)) return false;
+		} else {
+			if (!anchor_array(off + w2uint16(p[5]), kept2, nclasses, bases)) return false;
+		}
+		out.u16(1);
+		out.offset(cov);
+		out.offset(cov2);
+		out.u16(nclasses);
+		out.offset(marks);
+		out.offset(bases);
+		return commit(id, out, off + 12, is_empty(cov) || is_empty(cov2));
+	}
+	return false;
+}
+
+
+bool Layout::subtable(uint32_t off, unsigned type, uint32_t& id) {
+	if (type != (gsub? GSUB_EXTENSION: GPOS_EXTENSION)) {
+		return gsub? substitution(off, type, id): positioning(off, type, id);
+	}
+	bool fresh;
+	if (!open(off, OBJ_EXTENSION, 0, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 4);
+	if (!h || w2uint16(h[0]) != 1 || w2uint16(h[1]) == type) return false;
+	const uint32_t rel = w2uint32(*buf.get<wuint32_t>(off + 4));
+	uint32_t sub;
+	if (!rel || rel >= buf.size() - off || !subtable(off + rel, w2uint16(h[1]), sub)) return false;
+	Out out;
+	out.u16(1);
+	out.u16(w2uint16(h[1]));
+	out.offset(sub, 4);
+	return commit(id, out, off + 8, is_empty(sub));
+}
+
+
+bool Layout::lookup(uint32_t off, uint32_t& id) {
+	// without empty subtables
+	bool fresh;
+	if (!open(off, OBJ_LOOKUP, 0, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 3);
+	if (!h) return false;
+	const unsigned type = w2uint16(h[0]), flag = w2uint16(h[1]), n = w2uint16(h[2]);
+	const unsigned mfs = (flag & LOOKUP_USE_MARK_FILTERING_SET)? 1: 0;
+	const wuint16_t* s = words(off + 6, n + mfs);
+	if (!s) return false;
+	std::vector<uint32_t> ids;
+	for (unsigned i=0; i<n; ++i) {
+		uint32_t sub;
+		if (!w2uint16(s[i]) || !subtable(off + w2uint16(s[i]), type, sub)) return false;
+		if (!is_empty(sub)) ids.push_back(sub);
+	}
+	Out out;
+	out.u16(type);
+	out.u16(flag);
+	out.u16(ids.size());
+	for (size_t i=0; i<ids.size(); ++i) out.offset(ids[i]);
+	if (mfs) out.u16(w2uint16(s[n]));
+	return commit(id, out, off + 6 + 2 * (n + mfs), ids.empty());
+}
+
+
+bool Layout::lookup_list(uint32_t off, uint32_t& id) {
+	// empty lookups are removed unless nested, the others renumbered
+	bool fresh;
+	if (!open(off, OBJ_LOOKUPS, 0, id, fresh) || !fresh) return false;
+	const wuint16_t* h = words(off, 1);
+	const unsigned n = h? w2uint16(h[0]): 0;
+	const wuint16_t* s = h? words(off + 2, n): NULL;
+	if (!s) return false;
+	nested.assign(n, 0);
+	lookup_map.assign(n, LAYOUT_NONE);
+	std::vector<uint32_t> ids(n);
+	for (unsigned i=0; i<n; ++i) {
+		if (!w2uint16(s[i]) || !lookup(off + w2uint16(s[i]), ids[i])) return false;
+	}
+	// nested as called by the rules that are left, from the lookups that are kept
+	std::vector<uint8_t> seen(objects.size(), 0);
+	std::vector<uint32_t> stack;
+	for (unsigned i=0; i<n; ++i) {
+		if (!is_empty(ids[i]) && !seen[ids[i]]) {
+			seen[ids[i]] = 1;
+			stack.push_back(ids[i]);
+		}
+	}
+	while (!stack.empty()) {
+		const object_t& o = objects[stack.back()];
+		stack.pop_back();
+		for (uint32_t k=o.links; k<o.links+o.nlinks; ++k) {
+			const uint32_t t = links[k].size? links[k].target: ids[links[k].target];
+			if (!links[k].size) nested[links[k].target] = 1;
+			if (!seen[t]) {
+				seen[t] = 1;
+				stack.push_back(t);
+			}
+		}
+	}
+	Out out;
+	unsigned m = 0;
+	for (unsigned i=0; i<n; ++i) {
+		if (!is_empty(ids[i]) || nested[i]) lookup_map[i] = m++;
+	}
+	out.u16(m);
+	for (unsigned i=0; i<n; ++i) {
+		if (lookup_map[i] != LAYOUT_NONE) out.offset(ids[i]);
+	}
+	return commit(id, out, off + 2 + 2 * n);
+}
+
+
+bool Layout::feature(uint32_t off, uint32_t tag, uint32_t& id) {
+	// with renumbered lookups, and feature parameters as known by tag
+	bool fresh;
+	if (!open(off, OBJ_FEATURE, 0, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 2);
+	const unsigned n = h? w2uint16(h[1]): 0;
+	const wuint16_t* s = h? words(off + 4, n): NULL;
+	if (!s) return false;
+	uint32_t params = LAYOUT_NONE;
+	if (w2uint16(h[0])) {
+		const uint32_t p = off + w2uint16(h[0]);
+		const wuint16_t* v = words(p, 7);
+		size_t len;
+		if (tag == TAG('s','i','z','e')) {
+			len = 10;
+		} else if ((tag >> 16) == ('s' << 8 | 's')) {
+			len = 4; // stylistic set name
+		} else if ((tag >> 16) == ('c' << 8 | 'v') && v) {
+			len = 14 + 3 * w2uint16(v[6]); // character variant names and characters
+		} else {
+			return false;
+		}
+		if (!blob(p, len, params)) return false;
+	}
+	Out out;
+	out.offset(params);
+	std::vector<uint16_t> v;
+	for (unsigned i=0; i<n; ++i) {
+		const unsigned l = w2uint16(s[i]);
+		if (l >= lookup_map.size()) return false;
+		if (lookup_map[l] != LAYOUT_NONE) v.push_back(lookup_map[l]);
+	}
+	out.u16(v.size());
+	for (size_t i=0; i<v.size(); ++i) out.u16(v[i]);
+	return commit(id, out, off + 4 + 2 * n, v.empty() && params == LAYOUT_NONE);
+}
+
+
+bool Layout::feature_list(uint32_t off, bool keep_all, uint32_t& id) {
+	// empty features are removed, unless referenced by index from elsewhere
+	bool fresh;
+	if (!open(off, OBJ_FEATURES, 0, id, fresh) || !fresh) return false;
+	const wuint16_t* h = words(off, 1);
+	const unsigned n = h? w2uint16(h[0]): 0;
+	const wuint16_t* r = h? words(off + 2, 3 * n): NULL;
+	if (!r) return false;
+	feature_map.assign(n, LAYOUT_NONE);
+	feature_tags.assign(n, 0);
+	std::vector<uint32_t> ids(n);
+	unsigned m = 0;
+	for (unsigned i=0; i<n; ++i) {
+		feature_tags[i] = w2uint32(*(const wuint32_t*)(r + 3*i));
+		if (!w2uint16(r[3*i+2]) || !feature(off + w2uint16(r[3*i+2]), feature_tags[i], ids[i])) return false;
+		if (keep_all || !is_empty(ids[i])) feature_map[i] = m++;
+	}
+	Out out;
+	out.u16(m);
+	for (unsigned i=0; i<n; ++i) {
+		if (feature_map[i] == LAYOUT_NONE) continue;
+		out.u32(feature_tags[i]);
+		out.offset(ids[i]);
+	}
+	return commit(id, out, off + 2 + 6 * n);
+}
+
+
+bool Layout::feature_variations(uint32_t off, uint32_t& id) {
+	// condition sets with alternate features by index, which are all kept then
+	bool fresh;
+	if (!open(off, OBJ_VARIATIONS, 0, id, fresh) || !fresh) return false;
+	const wuint16_t* h = words(off, 4);
+	const uint32_t n = h? w2uint32(*(const wuint32_t*)(h + 2)): 0;
+	const wuint32_t* r = h? buf.get<wuint32_t>(off + 8, 2 * (size_t)n): NULL;
+	if (!r) return false;
+	std::vector<uint32_t> ids(2 * (size_t)n, LAYOUT_NONE);
+	for (size_t i=0; i<2*(size_t)n; ++i) {
+		const uint32_t rel = w2uint32(r[i]);
+		if (!rel) continue; // universal condition
+		if (rel >= buf.size() - off) return false;
+		const uint32_t p = off + rel;
+		bool sfresh;
+		if (!open(p, i % 2? OBJ_SUBSTITUTIONS: OBJ_CONDITIONS, 0, ids[i], sfresh)) return false;
+		if (!sfresh) continue;
+		Out out;
+		uint32_t end;
+		if (i % 2 == 0) { // conditions by axis range
+			const wuint16_t* c = words(p, 1);
+			const unsigned m = c? w2uint16(c[0]): 0;
+			const wuint32_t* o = c? buf.get<wuint32_t>(p + 2, m): NULL;
+			if (!o) return false;
+			out.u16(m);
+			for (unsigned j=0; j<m; ++j) {
+				const uint32_t q = p + w2uint32(o[j]);
+				const wuint16_t* f = words(q, 1);
+				uint32_t cond;
+				if (!w2uint32(o[j]) || !f || w2uint16(f[0]) != 1 || !blob(q, 8, cond)) return false;
+				out.offset(cond, 4);
+			}
+			end = p + 2 + 4 * m;
+		} else { // alternate features by index
+			const wuint16_t* c = words(p, 3);
+			const unsigned m = c? w2uint16(c[2]): 0;
+			const wuint16_t* s = c? words(p + 6, 3 * m): NULL;
+			if (!s) return false;
+			std::vector<uint32_t> alt(m);
+			for (unsigned j=0; j<m; ++j) {
+				const unsigned index = w2uint16(s[3*j]);
+				const uint32_t rel = w2uint32(*(const wuint32_t*)(s + 3*j+1));
+				if (index >= feature_tags.size() || !rel || rel >= buf.size() - p || !feature(p + rel, feature_tags[index], alt[j])) return false;
+			}
+			out.words(c, 2);
+			out.u16(m);
+			for (unsigned j=0; j<m; ++j) {
+				out.u16(w2uint16(s[3*j]));
+				out.offset(alt[j], 4);
+			}
+			end = p + 6 + 6 * m;
+		}
+		if (!commit(ids[i], out, end)) return false;
+	}
+	Out out;
+	out.words(h, 2);
+	out.u32(n);
+	for (size_t i=0; i<2*(size_t)n; ++i) out.offset(ids[i], 4);
+	return commit(id, out, off + 8 + 8 * n);
+}
+
+
+bool Layout::lang_sys(uint32_t off, uint32_t& id) {
+	bool fresh;
+	if (!open(off, OBJ_LANGSYS, 0, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 3);
+	const unsigned n = h? w2uint16(h[2]): 0;
+	const wuint16_t* s = h? words(off + 6, n): NULL;
+	if (!s) return false;
+	unsigned required = w2uint16(h[1]);
+	if (required != 0xffff) {
+		if (required >= feature_map.size()) return false;
+		required = (feature_map[required] == LAYOUT_NONE)? 0xffff: feature_map[required];
+	}
+	std::vector<uint16_t> v;
+	for (unsigned i=0; i<n; ++i) {
+		const unsigned f = w2uint16(s[i]);
+		if (f >= feature_map.size()) return false;
+		if (feature_map[f] != LAYOUT_NONE) v.push_back(feature_map[f]);
+	}
+	Out out;
+	out.u16(w2uint16(h[0]));
+	out.u16(required);
+	out.u16(v.size());
+	for (size_t i=0; i<v.size(); ++i) out.u16(v[i]);
+	return commit(id, out, off + 6 + 2 * n);
+}
+
+
+bool Layout::script(uint32_t off, uint32_t& id) {
+	bool fresh;
+	if (!open(off, OBJ_SCRIPT, 0, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 2);
+	const unsigned n = h? w2uint16(h[1]): 0;
+	const wuint16_t* r = h? words(off + 4, 3 * n): NULL;
+	if (!r) return false;
+	uint32_t def = LAYOUT_NONE;
+	if (w2uint16(h[0]) && !lang_sys(off + w2uint16(h[0]), def)) return false;
+	std::vector<uint32_t> ids(n);
+	for (unsigned i=0; i<n; ++i) {
+		if (!w2uint16(r[3*i+2]) || !lang_sys(off + w2uint16(r[3*i+2]), ids[i])) return false;
+	}
+	Out out;
+	out.offset(def);
+	out.u16(n);
+	for (unsigned i=0; i<n; ++i) {
+		out.words(r + 3*i, 2);
+		out.offset(ids[i]);
+	}
+	return commit(id, out, off + 4 + 6 * n);
+}
+
+
+bool Layout::script_list(uint32_t off, uint32_t& id) {
+	bool fresh;
+	if (!open(off, OBJ_SCRIPTS, 0, id, fresh) || !fresh) return false;
+	const wuint16_t* h = words(off, 1);
+	const unsigned n = h? w2uint16(h[0]): 0;
+	const wuint16_t* r = h? words(off + 2, 3 * n): NULL;
+	if (!r) return false;
+	std::vector<uint32_t> ids(n);
+	for (unsigned i=0; i<n; ++i) {
+		if (!w2uint16(r[3*i+2]) || !script(off + w2uint16(r[3*i+2]), ids[i])) return false;
+	}
+	Out out;
+	out.u16(n);
+	for (unsigned i=0; i<n; ++i) {
+		out.words(r + 3*i, 2);
+		out.offset(ids[i]);
+	}
+	return commit(id, out, off + 2 + 6 * n);
+}
+
+
+bool Layout::gsub_gpos(uint32_t& id) {
+	// lookups first, for the features that refer to them, and these for the scripts
+	bool fresh;
+	const wuint16_t* h = words(0, 5);
+	if (!h || w2uint16(h[0]) != 1 || w2uint16(h[1]) > 1 || !open(0, OBJ_HEADER, 0, id, fresh)) return false;
+	const bool variations = w2uint16(h[1]) == 1;
+	const wuint32_t* v = variations? buf.get<wuint32_t>(10): NULL;
+	if (variations && !v) return false;
+	uint32_t scripts, features, lookups, fv = LAYOUT_NONE;
+	if (!w2uint16(h[2]) || !w2uint16(h[3]) || !w2uint16(h[4])) return false;
+	if (!lookup_list(w2uint16(h[4]), lookups)) return false;
+	if (!feature_list(w2uint16(h[3]), v && w2uint32(*v), features)) return false;
+	if (v && w2uint32(*v) && !feature_variations(w2uint32(*v), fv)) return false;
+	if (!script_list(w2uint16(h[2]), scripts)) return false;
+	Out out;
+	out.words(h, 2);
+	out.offset(scripts);
+	out.offset(features);
+	out.offset(lookups);
+	if (variations) out.offset(fv, 4);
+	return commit(id, out, variations? 14: 10);
+}
+
+
+bool Layout::glyph_list(uint32_t off, bool carets, uint32_t& id) {
+	// attachment points or ligature carets by coverage index
+	bool fresh;
+	if (!open(off, OBJ_GLYPHLIST, carets, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 2);
+	const unsigned n = h? w2uint16(h[1]): 0;
+	const wuint16_t* s = h? words(off + 4, n): NULL;
+	std::vector<uint16_t> glyphs;
+	std::vector<uint8_t> kept;
+	if (!s || !w2uint16(h[0]) || !read_coverage(off + w2uint16(h[0]), glyphs) || n != glyphs.size()) return false;
+	alive(glyphs, kept);
+	std::vector<uint32_t> ids(n, LAYOUT_NONE);
+	for (unsigned i=0; i<n; ++i) {
+		if (!kept[i]) continue;
+		const uint32_t p = off + w2uint16(s[i]);
+		const wuint16_t* c = words(p, 1);
+		if (!w2uint16(s[i]) || !c) return false;
+		if (carets) {
+			if (!lig_glyph(p, ids[i])) return false;
+		} else {
+			if (!blob(p, 2 + 2 * w2uint16(c[0]), ids[i])) return false;
+		}
+	}
+	uint32_t cov;
+	if (!coverage(off + w2uint16(h[0]), glyphs, kept, cov)) return false;
+	Out out;
+	out.offset(cov);
+	out.u16(std::count(kept.begin(), kept.end(), 1));
+	for (unsigned i=0; i<n; ++i) {
+		if (kept[i]) out.offset(ids[i]);
+	}
+	return commit(id, out, off + 4 + 2 * n);
+}
+
+
+bool Layout::lig_glyph(uint32_t off, uint32_t& id) {
+	bool fresh;
+	if (!open(off, OBJ_LIGGLYPH, 0, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 1);
+	const unsigned n = h? w2uint16(h[0]): 0;
+	const wuint16_t* s = h? words(off + 2, n): NULL;
+	if (!s) return false;
+	std::vector<uint32_t> ids(n);
+	for (unsigned i=0; i<n; ++i) {
+		const uint32_t p = off + w2uint16(s[i]);
+		const wuint16_t* c = words(p, 3);
+		if (!w2uint16(s[i]) || !c) return false;
+		const unsigned format = w2uint16(c[0]);
+		if (format == 1 || format == 2) {
+			if (!blob(p, 4, ids[i])) return false;
+			continue;
+		}
+		bool cfresh;
+		if (format != 3 || !open(p, OBJ_CARET, 0, ids[i], cfresh)) return false;
+		if (!cfresh) continue;
+		uint32_t dev = LAYOUT_NONE;
+		if (w2uint16(c[2]) && !device(p + w2uint16(c[2]), dev)) return false;
+		Out co;
+		co.words(c, 2);
+		co.offset(dev);
+		if (!commit(ids[i], co, p + 6)) return false;
+	}
+	Out out;
+	out.u16(n);
+	for (unsigned i=0; i<n; ++i) out.offset(ids[i]);
+	return commit(id, out, off + 2 + 2 * n);
+}
+
+
+bool Layout::mark_sets(uint32_t off, uint32_t& id) {
+	// referenced by index from lookups, so only the coverages are pruned
+	bool fresh;
+	if (!open(off, OBJ_MARKSETS, 0, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 2);
+	const unsigned n = h? w2uint16(h[1]): 0;
+	const wuint32_t* s = h? buf.get<wuint32_t>(off + 4, n): NULL;
+	if (!s || w2uint16(h[0]) != 1) return false;
+	std::vector<uint32_t> ids(n);
+	for (unsigned i=0; i<n; ++i) {
+		const uint32_t rel = w2uint32(s[i]);
+		if (!rel || rel >= buf.size() - off || !pruned_coverage(off + rel, ids[i])) return false;
+	}
+	Out out;
+	out.words(h, 2);
+	for (unsigned i=0; i<n; ++i) out.offset(ids[i], 4);
+	return commit(id, out, off + 4 + 4 * n);
+}
+
+
+bool Layout::var_store(uint32_t off, uint32_t& id) {
+	// kept as is, for the variation indices of devices
+	bool fresh;
+	if (!open(off, OBJ_VARSTORE, 0, id, fresh)) return false;
+	if (!fresh) return true;
+	const wuint16_t* h = words(off, 4);
+	const unsigned n = h? w2uint16(h[3]): 0;
+	const wuint32_t* s = h? buf.get<wuint32_t>(off + 8, n): NULL;
+	const uint32_t regions = h? w2uint32(*(const wuint32_t*)(h + 1)): 0;
+	if (!s || w2uint16(h[0]) != 1 || !regions || regions >= buf.size() - off) return false;
+	const wuint16_t* r = words(off + regions, 2);
+	uint32_t rid;
+	if (!r || !blob(off + regions, 4 + 6 * (size_t)w2uint16(r[0]) * w2uint16(r[1]), rid)) return false;
+	std::vector<uint32_t> ids(n);
+	for (unsigned i=0; i<n; ++i) {
+		const uint32_t rel = w2uint32(s[i]);
+		const wuint16_t* d = (rel && rel < buf.size() - off)? words(off + rel, 3): NULL;
+		if (!d) return false;
+		const unsigned items = w2uint16(d[0]), nwords = w2uint16(d[1]) & 0x7fff, nregions = w2uint16(d[2]);
+		const unsigned width = (w2uint16(d[1]) & 0x8000)? 2: 1; // of short deltas, long ones twice that
+		if (nwords > nregions) return false;
+		const size_t row = nwords * 2 * width + (nregions - nwords) * width;
+		if (!blob(off + rel, 6 + 2 * nregions + items * row, ids[i])) return false;
+	}
+	Out out;
+	out.u16(1);
+	out.offset(rid, 4);
+	out.u16(n);
+	for (unsigned i=0; i<n; ++i) out.offset(ids[i], 4);
+	return commit(id, out, off + 8 + 4 * n);
+}
+
+
+bool Layout::gdef(uint32_t& id) {
+	bool fresh;
+	const wuint16_t* h = words(0, 6);
+	if (!h || w2uint16(h[0]) != 1 || !open(0, OBJ_HEADER, 0, id, fresh)) return false;
+	const unsigned minor = w2uint16(h[1]);
+	const size_t len = (minor >= 3)? 18: (minor == 2)? 14: 12;
+	if (!(h = words(0, len / 2))) return false;
+	uint32_t ids[6] = {LAYOUT_NONE, LAYOUT_NONE, LAYOUT_NONE, LAYOUT_NONE, LAYOUT_NONE, LAYOUT_NONE};
+	if (w2uint16(h[2]) && !class_def(w2uint16(h[2]), ids[0])) return false;
+	if (w2uint16(h[3]) && !glyph_list(w2uint16(h[3]), false, ids[1])) return false;
+	if (w2uint16(h[4]) && !glyph_list(w2uint16(h[4]), true, ids[2])) return false;
+	if (w2uint16(h[5]) && !class_def(w2uint16(h[5]), ids[3])) return false;
+	if (len > 12 && w2uint16(h[6]) && !mark_sets(w2uint16(h[6]), ids[4])) return false;
+	const uint32_t store = (len > 14)? w2uint32(*(const wuint32_t*)(h + 7)): 0;
+	if (store && !var_store(store, ids[5])) return false;
+	Out out;
+	out.words(h, 2);
+	for (unsigned k=0; k<4; ++k) out.offset(ids[k]);
+	if (len > 12) out.offset(ids[4]);
+	if (len > 14) out.offset(ids[5], 4);
+	return commit(id, out, len);
+}
+
+
+char* Layout::pack(uint32_t root, size_t& len) {
+	// the objects still referenced, in their original order
+	std::vector<uint32_t> order;
+	std::vector<uint8_t> seen(objects.size(), 0);
+	order.push_back(root);
+	seen[root] = 1;
+	for (size_t i=0; i<order.size(); ++i) {
+		const object_t& o = objects[order[i]];
+		for (uint32_t k=o.links; k<o.links+o.nlinks; ++k) {
+			if (links[k].size && !seen[links[k].target]) {
+				seen[links[k].target] = 1;
+				order.push_back(links[k].target);
+			}
+		}
+	}
+	std::vector<uint64_t> keys(order.size());
+	for (size_t i=0; i<order.size(); ++i) keys[i] = (uint64_t)objects[order[i]].start << 32 | order[i];
+	std::sort(keys.begin(), keys.end());
+	for (size_t i=0; i<order.size(); ++i) order[i] = (uint32_t)keys[i];
+	len = 0;
+	for (size_t i=0; i<order.size(); ++i) {
+		object_t& o = objects[order[i]];
+		const object_t& prev = objects[order[MAX(i, 1) - 1]];
+		if (i && prev.end > o.start && prev.start != o.start) { // but forks
+			LOG_INFO("overlapping subtables at %u", o.start);
+			return NULL;
+		}
+		o.pos = len;
+		len += o.len;
+	}
+
+	char* out = (char*)arena.alloc(MAX(len, 1));
+	for (size_t i=0; i<order.size(); ++i) {
+		const object_t& o = objects[order[i]];
+		memcpy(out + o.pos, work + o.data, o.len);
+		for (uint32_t k=o.links; k<o.links+o.nlinks; ++k) {
+			const link_t& l = links[k];
+			uint32_t v;
+			if (!l.size) {
+				v = lookup_map[l.target];
+				assert(v != LAYOUT_NONE); // nested ones are kept
+			} else {
+				const uint32_t from = objects[l.base].pos, to = objects[l.target].pos;
+				if (from == LAYOUT_NONE || to < from || (l.size == 2 && to - from > 0xffff)) {
+					LOG_INFO("cannot keep offset at %u", o.start + l.at);
+					arena.free(out);
+					return NULL;
+				}
+				v = to - from;
+			}
+			uint8_t* p = (uint8_t*)out + o.pos + l.at;
+			if (l.size == 4) {
+				*(wuint32_t*)p = uint2w32(v);
+			} else {
+				*(wuint16_t*)p = uint2w16(v);
+			}
+		}
+	}
+	return out;
+}
+
+
+char* Layout::kern(size_t& len) {
+	// pairs of format 0 subtables, empty ones are removed, others are kept as is
+	const wuint16_t* h = words(0, 4);
+	if (!h) return NULL;
+	const bool apple = w2uint16(h[0]) == 1 && w2uint16(h[1]) == 0; // 1.0 as fixed
+	if (!apple && w2uint16(h[0]) != 0) return NULL;
+	const size_t hlen = apple? 8: 4, shlen = apple? 8: 6;
+	const uint32_t n = apple? w2uint32(*(const wuint32_t*)(h + 2)): w2uint16(h[1]);
+
+	char* out = (char*)arena.alloc(buf.size()); // pruned in order, so never larger
+	memcpy(out, h, hlen);
+	size_t p = hlen, o = hlen;
+	uint32_t i, m = 0;
+	for (i=0; i<n; ++i) {
+		const wuint16_t* s = words(p, shlen / 2);
+		const unsigned coverage = s? w2uint16(s[2]): 0;
+		const unsigned format = apple? coverage & 0xff: coverage >> 8;
+		const wuint16_t* b = s? words(p + shlen, 4): NULL;
+		if (!s) break;
+		if (format == 0 && b) { // sorted pairs, the length field may have overflowed
+			const unsigned npairs = w2uint16(b[0]);
+			const wuint16_t* pairs = words(p + shlen + 8, 3 * npairs);
+			if (!pairs) break;
+			char* q = out + o + shlen + 8;
+			unsigned kept = 0;
+			for (unsigned j=0; j<npairs; ++j) {
+				if (gone(w2uint16(pairs[3*j])) || gone(w2uint16(pairs[3*j+1]))) continue;
+				memcpy(q, pairs + 3*j, 6);
+				q += 6;
+				++kept;
+			}
+			p += shlen + 8 + 6 * npairs;
+			if (!kept) continue;
+			const size_t sublen = shlen + 8 + 6 * kept;
+			memcpy(out + o, s, shlen);
+			if (apple) {
+				*(wuint32_t*)(out + o) = uint2w32(sublen);
+			} else {
+				*(wuint16_t*)(out + o + 2) = uint2w16(sublen & 0xffff);
+			}
+			unsigned sel = 0;
+			while ((2u << sel) <= kept) ++sel;
+			wuint16_t* sh = (wuint16_t*)(out + o + shlen);
+			sh[0] = uint2w16(kept);
+			sh[1] = uint2w16(6 << sel); // searchRange
+			sh[2] = uint2w16(sel); // entrySelector
+			sh[3] = uint2w16(6 * kept - (6 << sel)); // rangeShift
+			o += sublen;
+		} else {
+			const size_t size = apple? w2uint32(*(const wuint32_t*)s): w2uint16(s[1]);
+			if (size < shlen || size % 2 || !words(p, size / 2)) break;
+			memmove(out + o, s, size);
+			o += size;
+			p += size;
+		}
+		++m;
+	}
+	if (i < n) { // malformed
+		arena.free(out);
+		return NULL;
+	}
+	if (apple) {
+		*(wuint32_t*)(out + 4) = uint2w32(m);
+	} else {
+		*(wuint16_t*)(out + 2) = uint2w16(m);
+	}
+	len = o;
+	return out;
+}
+
+
+char* Layout::prune(const char* tag, const char* data, size_t len, size_t& outlen) {
+	buf = View(data, len);
+	if (strcmp(tag, "kern") == 0) return kern(outlen);
+	if (len >= LAYOUT_NONE) return NULL;
+
+	objat = (uint32_t*)arena.calloc(MAX(len, 1), sizeof(uint32_t));
+	objects.clear();
+	links.clear();
+	work_len = 0;
+	nested.clear();
+	lookup_map.clear();
+	feature_map.clear();
+	feature_tags.clear();
+	gsub = strcmp(tag, "GSUB") == 0;
+
+	uint32_t root;
+	const bool ok = (strcmp(tag, "GDEF") == 0)? gdef(root): gsub_gpos(root);
+	char* out = ok? pack(root, outlen): NULL;
+	arena.free(objat);
+	objat = NULL;
+	return out;
+}
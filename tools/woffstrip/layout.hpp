@@ -0,0 +1,106 @@
+#pragma once
+#include "main.hpp"
+#include "types.hpp"
+#include "arena.hpp"
+#include <vector>
+
+
+#define LAYOUT_NONE UINT32_MAX // null offset or removed index
+
+
+/**
+ * GSUB, GPOS and GDEF, or kern, without the rules and records that involve dropped glyphs, and without lookups and features that became empty.
+ * Subtables are pruned one by one into objects that are packed again in their original order, so shared ones stay shared and offsets can only shrink.
+ */
+class Layout {
+	private:
+		typedef struct {
+			uint32_t target; // object, or lookup index for size 0
+			uint32_t base; // object the offset is relative to
+			uint32_t at; // in the pruned object
+			uint8_t size; // 2 or 4, 0 for a lookup index to be renumbered
+		} link_t;
+		typedef struct {
+			uint32_t start, end; // extent in the input
+			uint16_t kind;
+			uint64_t param; // must match when shared, e.g. value formats
+			uint32_t data, len; // pruned content in work
+			uint32_t links, nlinks;
+			uint32_t pos; // in the output, LAYOUT_NONE unless reachable
+			uint32_t fork; // next object at the same offset, pruned differently
+			bool done, empty; // matches nothing anymore
+		} object_t;
+		struct Out; // pruned content of an object being built
+
+		Arena& arena;
+		const uint8_t* dropped; // by glyph
+		unsigned nglyphs;
+		View buf;
+		bool gsub;
+
+		uint32_t* objat; // object+1 by input offset
+		std::vector<object_t> objects;
+		std::vector<link_t> links;
+		char* work;
+		size_t work_len, work_cap;
+
+		std::vector<uint8_t> nested; // lookups called by contextual rules, kept even if empty
+		std::vector<uint32_t> lookup_map; // old to new index
+		std::vector<uint32_t> feature_map;
+		std::vector<uint32_t> feature_tags;
+
+		bool gone(unsigned g) const { return g < nglyphs && dropped[g]; }
+		const wuint16_t* words(uint32_t off, size_t n) const { return buf.get<wuint16_t>(off, n); }
+		bool open(uint32_t, unsigned, uint64_t, uint32_t&, bool&);
+		bool commit(uint32_t, Out&, uint32_t, bool=false);
+		bool same(uint32_t, const Out&) const;
+		bool variant(uint32_t&, bool, Out&, uint32_t, bool=false);
+		bool is_empty(uint32_t id) const { return id == LAYOUT_NONE || objects[id].empty; }
+
+		bool read_coverage(uint32_t, std::vector<uint16_t>&) const;
+		void alive(const std::vector<uint16_t>&, std::vector<uint8_t>&) const;
+		bool coverage(uint32_t, const std::vector<uint16_t>&, const std::vector<uint8_t>&, uint32_t&);
+		bool pruned_coverage(uint32_t, uint32_t&); // without the dropped glyphs only
+		bool class_def(uint32_t, uint32_t&);
+		bool device(uint32_t, uint32_t&);
+		bool anchor(uint32_t, uint32_t&);
+		bool blob(uint32_t, size_t, uint32_t&);
+		bool value_devices(uint32_t, unsigned, uint32_t, std::vector<uint32_t>&);
+		void put_value(Out&, uint32_t, unsigned, const uint32_t*&, uint32_t);
+
+		bool sequence(uint32_t, unsigned, uint32_t&);
+		bool ligature_set(uint32_t, uint32_t&);
+		bool ligature(uint32_t, uint32_t&);
+		bool rule_set(uint32_t, unsigned, uint32_t&);
+		bool rule(uint32_t, unsigned, uint32_t&);
+		bool context(uint32_t, bool, uint32_t&);
+		bool pair_set(uint32_t, unsigned, unsigned, uint32_t, uint32_t&);
+		bool mark_array(uint32_t, const std::vector<uint8_t>&, uint32_t&);
+		bool anchor_array(uint32_t, const std::vector<uint8_t>&, unsigned, uint32_t&);
+		bool ligature_array(uint32_t, const std::vector<uint8_t>&, unsigned, uint32_t&);
+		bool glyph_list(uint32_t, bool, uint32_t&);
+		bool lig_glyph(uint32_t, uint32_t&);
+		bool mark_sets(uint32_t, uint32_t&);
+		bool var_store(uint32_t, uint32_t&);
+		bool substitution(uint32_t, unsigned, uint32_t&);
+		bool positioning(uint32_t, unsigned, uint32_t&);
+		bool subtable(uint32_t, unsigned, uint32_t&);
+		bool lookup(uint32_t, uint32_t&);
+		bool lookup_list(uint32_t, uint32_t&);
+		bool feature(uint32_t, uint32_t, uint32_t&);
+		bool feature_list(uint32_t, bool, uint32_t&);
+		bool feature_variations(uint32_t, uint32_t&);
+		bool lang_sys(uint32_t, uint32_t&);
+		bool script(uint32_t, uint32_t&);
+		bool script_list(uint32_t, uint32_t&);
+		bool gsub_gpos(uint32_t&);
+		bool gdef(uint32_t&);
+		char* pack(uint32_t, size_t&);
+		char* kern(size_t&);
+
+	public:
+		Layout(Arena&, const uint8_t*, unsigned); // dropped glyphs
+		~Layout();
+
+		char* prune(const char*, const char*, size_t, size_t&); // by tag, owned by the caller, NULL if unsupported or invalid
+};
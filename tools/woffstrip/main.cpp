@@ -1,23 +1,101 @@
 #include "main.hpp"
 #include "woff.hpp"
 #include "io.hpp"
+#include "dump.hpp"
+#include "keepset.hpp"
+#include "watch.hpp"
+#include "hash.hpp"
+#include "plan.hpp"
+#include "base64.hpp"
 #include <vector>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <strings.h>
 
 
 config_s config = {};
 
+#define WATCH_SETTLE_MS 50 // to debounce editors that write several times or several files
+#define BUDGET_ROUNDS 6 // actual runs to correct the estimate by, before falling back to no chars at all
+
+typedef struct {
+	bool charcodes_exclude;
+	bool charcodes_set;
+	std::vector<char_range_t> charcodes;
+	const char* codepointsfile;
+	std::vector<const char*> contentfiles;
+	int align_to;
+	bool align_charcodes_set;
+	std::vector<char_range_t> align_charcodes;
+	const char* indexfile;
+	bool sfnt;
+	int metadata;
+	std::vector<axis_pin_t> instance;
+	size_t budget; // output bytes, 0 for none
+	const char* pagesfile; // or frequencies, for planning shards
+	const char* freqfile;
+	size_t request; // bytes a request costs, for planning shards
+	bool always; // write an output even if nothing changes
+	std::vector<const char*> merges; // fonts to append glyphs of, each with its own chars optionally
+	const char* inlinefile; // stylesheet or HTML document to write the output into as a data URI
+	const char* infile; // for the font-family name
+} options_t;
+
 static void usage(const char* name) {
 	LOG(
-		"usage: %s [-v] [-d] [-e|-i range1[,range2[,...]]] [-a range1[,range2[,...]] -b num] infile.woff [outfile.woff]\n"
-		"       -v: be verbose (to stderr)\n"
-		"       -d: dump woff information (to stdout)\n"
+		"usage: %s [-v] [-d] [-P] [-t threads] [-S] [-D] [-R] [-W KiB] [-x index] [-s] [-m keep|minify|drop] [-V axis=value[,...]] [-p previous.woff] [-w] [-e|-i range1[,range2[,...]]] [-c codepoints] [-k content [-k ...]] [-B bytes] [-M font.woff[=ranges|@codepoints] [-M ...]] [-I file.css|file.html] [-a range1[,range2[,...]] -b num] infile.woff [outfile.woff]\n"
+		"       %s -f outdir [options] infile1.woff infile2.woff [...]\n"
+		"       %s -g pages|-G frequencies [-q bytes] [options] infile.woff outdir\n"
+		"       %s -j section1[,section2[,...]] infile.woff\n"
+		"       -v, --verbose: be verbose (to stderr)\n"
+		"       -d, --dump: dump woff information (to stdout)\n"
+		"       -P, --paranoid: expensive self-checks, e.g. decompress all compressed output again and compare\n"
+		"       -t, --threads: for compressing glyf in chunks and family members, defaults to the number of CPUs\n"
+		"       -S, --single-stream: compress glyf as a whole instead, e.g. to compare the size\n"
+		"       -D, --deterministic: sort tables by tag and keep the original compressed data of unchanged ones,\n"
+		"           then print a content hash of each output (to stdout), e.g. for cache-busting filenames\n"
+		"       -R, --desubroutinize: inline all subroutines of CFF/CFF2 charstrings, often compresses better\n"
+		"       -W, --window: process glyf in a single streaming pass through an inflate window of this size,\n"
+		"           for bounded memory with very large fonts, cannot be combined with -s, -p or -V\n"
+		"       -j, --inspect: only stream the given sections as JSON lines (to stdout) and exit\n"
+		"           sections are header, tables, head, cmap (as ranges), loca, or all\n"
+		"       -s, --sfnt: write a raw TTF/OTF instead of WOFF, input can be either\n"
+		"       -m, --metadata: keep the extended metadata block as is (default), minify it, or drop it, the private data block is kept\n"
+		"       -V, --instance: pin the axes of a variable font at these user coordinates, e.g. wght=700,wdth=87.5, others\n"
+		"           at their default, for a static font without the variation tables, with the outlines, metrics by MVAR and\n"
+		"           cvt values by cvar at that location, cannot be combined with -p\n"
+		"       -f, --family: strip several fonts, e.g. weights of a family, with the same options into this directory\n"
+		"           in parallel, and identical tables are compressed only once\n"
+		"       -g, --pages: split into unicode-range shards by these sample page views, one per line as UTF-8 text, for the least\n"
+		"           bytes and requests to expect per page view, each into the directory as a font and an @font-face in a stylesheet\n"
+		"       -G, --frequencies: likewise by independent char frequencies instead, a code and a count per line, the most frequent\n"
+		"           char is assumed to be used by every page view\n"
+		"       -q, --request: cost of a request in bytes when planning shards or inlining, defaults to %d\n"
+		"       -x, --index: use this sidecar index instead of parsing the input font, (re-)create it if missing or outdated,\n"
+		"           as by the size, time and table directory of the input font, with -P also by hashing all of it\n"
+		"       -p, --previous: earlier output of the same font, only glyphs that are used again or not anymore are changed\n"
+		"           (for the same or another selection, with the same alignment options)\n"
+		"       -w, --watch: keep running, and write the output again when the input font or the -c/-k files change\n"
 		"       -e: exclude/strip following ranges from input file\n"
 		"       -i: include/keep only following ranges from input file\n"
+		"       -c, --codepoints: include/keep the character codes listed in this file, one per line\n"
+		"       -k, --keep-from: include/keep all characters used in this HTML/CSS/JS file (repeatable)\n"
+		"       -B, --budget: include/keep only as many characters of -i, -c and -k, in this order, as fit into this output size,\n"
+		"           found by a size estimate that is corrected by a few actual runs, cannot be combined with -e, -W, -w or -f\n"
+		"       -M, --merge: append the glyphs of the kept chars of this font (repeatable), or of its own ranges or codepoints file,\n"
+		"           for a single font with the chars of all, scaled to the unitsPerEm of the input font and without their hinting,\n"
+		"           a char mapped by several fonts is taken from the first one, cannot be combined with -W, -p, -w, -f, -B or -g/-G,\n"
+		"           split at the first '=' followed by only ranges or by '@', so the font path can contain '=' as well\n"
+		"       -I, --inline: write the output as a base64 data URI in an @font-face with the kept chars as unicode-range, into this\n"
+		"           stylesheet, or into the <head> of this HTML document, replacing an earlier one of the same font there, the output\n"
+		"           file is then optional, and whether inlining pays off against a request is reported, cannot be combined with -f or -g/-G\n"
 		"       -a: align character bounding boxes to a determined minimum baseline (can be combined with -i or -e)\n"
 		"           for an empty range argument, all (leftover) characters are assumed\n"
 		"       -b: when aligning, use this y-coordinate above the baseline instead (> 0)\n"
 		"       ranges are a list of ASCII/UTF character codes in hex notation, e.g: 20-7e,F001-F008,E12a"
-		, name
+		, name, name, name, name, PLAN_REQUEST
 	);
 }
 
@@ -44,89 +122,244 @@ static bool parse_range_list(std::vector<char_range_t>& v, char* a) {
 	return true;
 }
 
-int main(int argc, char** argv) {
-	bool charcodes_exclude = false;
-	bool charcodes_set = false;
-	std::vector<char_range_t> charcodes;
-	int align_to = 0;
-	bool align_charcodes_set = false;
-	std::vector<char_range_t> align_charcodes;
+static bool parse_axis_list(std::vector<axis_pin_t>& v, char* a) {
+	char* p = a;
+	while (*p) {
+		char* e = strchr(p, ',');
+		if (e) *e = '\0';
+		char* q = strchr(p, '=');
+		if (!q || q == p || q-p > 4) return false;
+		char tag[4] = {' ', ' ', ' ', ' '}; // padded as in fvar
+		memcpy(tag, p, q-p);
+		char* end;
+		const float value = strtof(q+1, &end);
+		if (end == q+1 || *end) return false;
+		v.push_back((axis_pin_t){w2uint32(*(const wuint32_t*)tag), value});
 
-	int opt;
-	while ((opt = getopt(argc, argv, "vde:i:a:b:")) != -1) {
-		switch (opt) {
-			case 'v':
-				config.verbose = true;
-				break;
-			case 'd':
-				config.dump = true;
-				break;
-			case 'e':
-			case 'i':
-				charcodes_exclude = (opt == 'e');
-				if (charcodes_set || !parse_range_list(charcodes, optarg)) {
-					usage(argv[0]);
-					return 1;
-				}
-				charcodes_set = true;
-				break;
-			case 'a':
-				if (align_charcodes_set || !parse_range_list(align_charcodes, optarg)) {
-					usage(argv[0]);
-					return 1;
-				}
-				align_charcodes_set = true;
-				break;
-			case 'b':
-				if (align_to || (align_to = atoi(optarg)) <= 0) {
-					usage(argv[0]);
-					return 1;
-				}
-				break;
-			default:
-				usage(argv[0]);
-				return 1;
-		}
-	}
-	if (optind+2 < argc) {
-		usage(argv[0]);
-		return 1;
+		if (!e) break;
+		p = e+1;
 	}
-	const char* infile = (optind <= argc)? argv[optind]: NULL;
-	const char* outfile = (optind < argc)? argv[optind+1]: NULL;
+	return !v.empty();
+}
 
+static Woff* load(const char* infile) {
 	char* buf;
 	size_t len;
-	if (!infile) {
-		usage(argv[0]);
-		return 1;
-	}
-	if (!file_read(infile, buf, len)) {
-		return 1;
+	uint64_t mtime = 0; // only for an index
+	if (!file_read(infile, buf, len, &mtime)) {
+		return NULL;
 	}
 
-	Woff woff(buf, len);
-	if (!woff.parseHeader()) {
+	Woff* woff = new Woff(buf, len, mtime);
+	if (!woff->parseHeader()) {
 		LOG("cannot parse header");
-		return 1;
-	}
-	if (!woff.parseTables()) {
+	} else if (!woff->parseTables()) {
 		LOG("cannot parse tables");
-		return 1;
+	} else {
+		return woff;
+	}
+	delete woff;
+	return NULL;
+}
+
+static bool parse(Woff& woff, const char* indexfile) {
+	if (indexfile && woff.loadIndex(indexfile)) {
+		return true;
 	}
 	if (!woff.parseCharMaps()) {
 		LOG("cannot parse character maps");
-		return 1;
+		return false;
 	}
-	LOG("found %zu chars", woff.getCharMap().size());
 	if (!woff.parseLoca()) {
 		LOG("cannot parse character indices");
-		return 1;
+		return false;
+	}
+	if (!woff.parseComposites()) {
+		LOG("cannot parse composite glyphs");
+		return false;
+	}
+	if (indexfile && !woff.writeIndex(indexfile)) {
+		LOG("cannot write index, going on anyways..");
 	}
+	return true;
+}
 
+static bool keepset(const options_t& opts, std::vector<char_range_t>& charcodes) {
+	charcodes = opts.charcodes;
+	if (opts.codepointsfile && !keepset_codepoints(opts.codepointsfile, charcodes)) {
+		LOG("cannot read codepoints");
+		return false;
+	}
+	for (std::vector<const char*>::const_iterator it=opts.contentfiles.begin(); it!=opts.contentfiles.end(); ++it) {
+		if (!keepset_content(*it, charcodes)) {
+			LOG("cannot read content");
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint64_t iov_hash(const std::vector<struct iovec>& iov) {
+	// as over the contiguous output, so regardless of its chunks
+	size_t len = 0;
+	for (std::vector<struct iovec>::const_iterator it=iov.begin(); it!=iov.end(); ++it) len += it->iov_len;
+	Hash64 h(len);
+	for (std::vector<struct iovec>::const_iterator it=iov.begin(); it!=iov.end(); ++it) h.update(it->iov_base, it->iov_len);
+	return h.final();
+}
+
+static char* merge_chars(char* spec) {
+	// the first '=' followed by ranges or a codepoints file, as the font path might contain one as well
+	for (char* p=strchr(spec, '='); p; p=strchr(p+1, '=')) {
+		if (p[1] == '@' || (p[1] && strspn(p+1, "0123456789abcdefABCDEF,-") == strlen(p+1))) return p;
+	}
+	return NULL;
+}
+
+static bool merge(Woff& woff, const options_t& opts, const std::vector<char_range_t>& keep, const char* spec) {
+	// chars as for the input font, unless given after the filename
+	char* infile = strdup(spec);
+	char* own = merge_chars(infile);
+	if (own) *own++ = '\0';
+	if (!*infile) {
+		LOG("no font to merge in '%s'", spec);
+		free(infile);
+		return false;
+	}
+	std::vector<char_range_t> charcodes(keep);
+	bool set = opts.charcodes_set, exclude = opts.charcodes_exclude;
+	bool rv = true;
+	if (own) {
+		charcodes.clear();
+		set = true;
+		exclude = false;
+		rv = (*own == '@')? keepset_codepoints(own+1, charcodes): parse_range_list(charcodes, own);
+		if (!rv) LOG("invalid chars for '%s'", infile);
+	}
+	Woff* other = rv? load(infile): NULL;
+	if (!other || !parse(*other, NULL)) {
+		LOG("cannot merge '%s'", infile);
+		delete other;
+		free(infile);
+		return false;
+	}
+
+	std::vector<char_range_t> kept;
+	if (!set) {
+		charcodes.clear();
+		other->getCharMap().set_intersect(charcodes, kept);
+	} else if (exclude) {
+		other->getCharMap().set_intersect(charcodes, kept);
+	} else {
+		other->getCharMap().set_substract(charcodes, kept);
+	}
+	Cmaps::normalize(kept);
+	LOG("merging %zu chars of '%s'", Cmaps::count(kept), infile);
+	rv = woff.merge(*other, kept);
+	if (!rv) LOG("cannot merge '%s'", infile);
+	delete other;
+	free(infile);
+	return rv;
+}
+
+static void css_ranges(FILE* f, const std::vector<char_range_t>& v) {
+	for (std::vector<char_range_t>::const_iterator it=v.begin(); it!=v.end(); ++it) {
+		fprintf(f, (it->from == it->to)? "%sU+%X": "%sU+%X-%X", (it == v.begin())? "": ", ", it->from, it->to);
+	}
+}
+
+static const char* find_nocase(const char* s, size_t len, const char* needle) {
+	const size_t n = strlen(needle);
+	for (size_t i=0; i+n<=len; ++i) {
+		if (strncasecmp(s + i, needle, n) == 0) return s + i;
+	}
+	return NULL;
+}
+
+static bool inline_font(const Woff& woff, const options_t& opts, const std::vector<struct iovec>& iov, size_t len) {
+	// encoded straight from the output chunks into the rule, which then replaces the file or a block in the document
+	const char* base = strrchr(opts.infile, '/');
+	base = base? base+1: opts.infile;
+	const char* dot = strrchr(base, '.');
+	const int baselen = dot? dot - base: strlen(base);
+	const char* mime = !opts.sfnt? "font/woff": woff.isCff()? "font/otf": "font/ttf";
+	const char* format = !opts.sfnt? "woff": woff.isCff()? "opentype": "truetype";
+	const size_t n = strlen(opts.inlinefile);
+	const bool html = (n > 5 && strcasecmp(opts.inlinefile + n - 5, ".html") == 0) || (n > 4 && strcasecmp(opts.inlinefile + n - 4, ".htm") == 0);
+
+	char* css;
+	size_t csslen;
+	FILE* f = open_memstream(&css, &csslen);
+	if (!f) {
+		LOG_ERRNO("open_memstream()");
+		return false;
+	}
+	if (html) fprintf(f, "<style data-woffstrip=\"%.*s\">\n", baselen, base);
+	fprintf(f, "/* %zu bytes inlined */\n@font-face {\n\tfont-family: \"%.*s\";\n\tsrc: url(\"data:%s;base64,", len, baselen, base, mime);
+	Base64Stream b64(f, true);
+	for (std::vector<struct iovec>::const_iterator it=iov.begin(); it!=iov.end(); ++it) {
+		b64.write(it->iov_base, it->iov_len);
+	}
+	bool rv = b64.finish();
+	fprintf(f, "\") format(\"%s\");\n\tunicode-range: ", format);
+	std::vector<char_range_t> chars;
+	size_t nruns;
+	const cmap_run_t* runs = woff.getCharMap().getRuns(nruns);
+	for (size_t r=0; r<nruns; ++r) {
+		chars.push_back((char_range_t){runs[r].from, runs[r].to});
+	}
+	Cmaps::normalize(chars);
+	css_ranges(f, chars);
+	fprintf(f, ";\n}\n");
+	if (html) fprintf(f, "</style>");
+	if (fclose(f) != 0 || !rv) {
+		LOG("cannot encode data URI");
+		free(css);
+		return false;
+	}
+
+	if (!html) {
+		rv = file_write(opts.inlinefile, css, csslen);
+	} else {
+		char* doc;
+		size_t doclen;
+		if (!file_read(opts.inlinefile, doc, doclen)) {
+			free(css);
+			return false;
+		}
+		const char* from = (const char*)memmem(doc, doclen, css, strchr(css, '\n') - css);
+		const char* to = from? find_nocase(from, doc + doclen - from, "</style>"): NULL;
+		if (to) {
+			to += strlen("</style>");
+		} else {
+			from = to = find_nocase(doc, doclen, "</head");
+		}
+		if (!from) {
+			LOG("no <head> in '%s'", opts.inlinefile);
+			rv = false;
+		} else {
+			const struct iovec parts[3] = {{doc, (size_t)(from - doc)}, {css, csslen}, {(void*)to, (size_t)(doc + doclen - to)}}; // const-cast
+			rv = file_writev(opts.inlinefile, parts, 3);
+		}
+		free(doc);
+	}
+	free(css);
+	if (!rv) return false;
+
+	// worth it if the text as served compressed grows by less than a request costs
+	const long gain = (long)len + (long)opts.request - (long)b64.deflated();
+	LOG("inlined %zu bytes as %zu of base64 into '%s', %zu deflated: %s %ld bytes against a request of %zu", len, b64.size(), opts.inlinefile, b64.deflated(), (gain >= 0)? "saves": "costs", labs(gain), opts.request);
+	return true;
+}
+
+static int strip(Woff& woff, const options_t& opts, const std::vector<char_range_t>& keep, const char* outfile, const char* prevfile, bool& written, size_t* outlen=NULL) {
+	written = false;
+	LOG("found %zu chars", woff.getCharMap().size());
+
+	std::vector<char_range_t> charcodes(keep);
 	std::vector<char_range_t> remainders;
-	if (charcodes_set) {
-		if (charcodes_exclude) {
+	if (opts.charcodes_set) {
+		if (opts.charcodes_exclude) {
 			woff.getCharMap().set_intersect(charcodes, remainders);
 		} else {
 			woff.getCharMap().set_substract(charcodes, remainders);
@@ -135,7 +368,28 @@ int main(int argc, char** argv) {
 		std::vector<char_range_t> tmp;
 		woff.getCharMap().set_intersect(tmp, remainders);
 	}
-	if (align_charcodes_set) {
+	woff.selectGlyphs(remainders);
+	if (prevfile) {
+		char* prevbuf;
+		size_t prevlen;
+		if (!file_read(prevfile, prevbuf, prevlen)) {
+			return 1;
+		}
+		Woff prev(prevbuf, prevlen);
+		if (!prev.parseHeader() || !prev.parseTables() || !woff.loadPrevious(prev)) {
+			LOG("cannot use previous output '%s'", prevfile);
+			return 1;
+		}
+	}
+	if (!opts.instance.empty()) {
+		LOG("instancing at %zu axis coordinates", opts.instance.size());
+		if (!woff.instance(opts.instance, charcodes)) {
+			LOG("cannot instance variable font");
+			return 1;
+		}
+	}
+	std::vector<char_range_t> align_charcodes(opts.align_charcodes);
+	if (opts.align_charcodes_set) {
 		if (align_charcodes.empty()) {
 			align_charcodes.swap(remainders);
 		} else {
@@ -147,7 +401,7 @@ int main(int argc, char** argv) {
 	if (charcodes.empty()) {
 		LOG("not removing any char glyphs");
 	} else {
-		LOG("removing %zu char glyphs", charcodes.size());
+		LOG("removing %zu char glyphs", Cmaps::count(charcodes));
 		for (std::vector<char_range_t>::const_iterator it=charcodes.begin(); it!=charcodes.end(); ++it) {
 			for (char_t c=it->from; c<=it->to; ++c) {
 				index_t index = woff.getCharMap().find(c);
@@ -164,13 +418,13 @@ int main(int argc, char** argv) {
 	if (align_charcodes.empty()) {
 		LOG("not aligning any char glyphs");
 	} else {
-		assert(align_to >= 0);
-		align_to = woff.getMinAlignment(align_charcodes, (unsigned)align_to);
+		assert(opts.align_to >= 0);
+		const int align_to = woff.getMinAlignment(align_charcodes, (unsigned)opts.align_to);
 		if (!align_to) {
 			LOG("cannot infer or validate baseline alignment");
 			return 1;
 		}
-		LOG("aligning %zu char glyphs to %d", align_charcodes.size(), align_to);
+		LOG("aligning %zu char glyphs to %d", Cmaps::count(align_charcodes), align_to);
 		for (std::vector<char_range_t>::const_iterator it=align_charcodes.begin(); it!=align_charcodes.end(); ++it) {
 			for (char_t c=it->from; c<=it->to; ++c) {
 				index_t index = woff.getCharMap().find(c);
@@ -183,26 +437,577 @@ int main(int argc, char** argv) {
 		}
 	}
 
-	if (charcodes.empty() && align_charcodes.empty()) {
+	if (!woff.updateCharMap(charcodes)) {
+		LOG("cannot update character map");
+		return 1;
+	}
+
+	for (std::vector<const char*>::const_iterator it=opts.merges.begin(); it!=opts.merges.end(); ++it) {
+		if (!merge(woff, opts, keep, *it)) return 1;
+	}
+
+	if (!woff.updateMetadata((unsigned)opts.metadata)) {
+		LOG("cannot update metadata");
+		return 1;
+	}
+
+	if (charcodes.empty() && align_charcodes.empty() && opts.sfnt == woff.isSfnt() && opts.metadata == META_KEEP && opts.instance.empty() && !config.desubroutinize && !opts.always) {
 		LOG("nothing to do");
 		return 0;
 	}
 
-	if (!woff.finalize()) return 1;
+	if (!woff.finalize(opts.sfnt)) return 1;
+	std::vector<struct iovec> iov;
+	const size_t len = woff.toIov(iov);
+	if (outlen) *outlen = len;
+	if (opts.inlinefile && !inline_font(woff, opts, iov, len)) return 1;
 	if (!outfile) return 0;
 
-	size_t outlen;
-	char* outbuf = woff.toBuf(outlen);
-	if (!outbuf) {
-		LOG("cannot pack result");
+	if (!file_writev(outfile, &iov[0], iov.size())) {
 		return 1;
 	}
-	if (!file_write(outfile, outbuf, outlen)) {
-		free(outbuf);
+	LOG("wrote to '%s' - done.", outfile);
+	written = true;
+	if (config.deterministic) {
+		printf("%016llx  %s\n", (unsigned long long)iov_hash(iov), outfile);
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+static int budget(Woff& woff, const options_t& opts, const std::vector<char_range_t>& keep, const char* outfile, const char* prevfile, bool& written) {
+	// the longest prefix of the chars as given that is expected to fit, with the estimate corrected by the actual size of the last run
+	Estimate est;
+	if (!woff.buildEstimate(est, opts.sfnt)) {
+		LOG("cannot estimate output sizes");
 		return 1;
 	}
-	free(outbuf);
-	LOG("wrote to '%s' - done.", outfile);
+	char_t maxc = 0;
+	for (std::vector<char_range_t>::const_iterator it=keep.begin(); it!=keep.end(); ++it) {
+		maxc = MAX(maxc, it->to);
+	}
+	std::vector<bool> seen(keep.empty()? 0: maxc+1, false);
+	std::vector<char_t> chars; // mapped ones by priority, without repetitions
+	for (std::vector<char_range_t>::const_iterator it=keep.begin(); it!=keep.end(); ++it) {
+		for (char_t c=it->from; c<=it->to; ++c) {
+			if (!seen[c] && woff.getCharMap().find(c)) chars.push_back(c);
+			seen[c] = true;
+		}
+	}
 
+	options_t trial(opts); // only the final run is inlined
+	trial.inlinefile = NULL;
+	size_t lo = 0, hi = chars.size()+1; // prefixes known to fit, and not to
+	bool fits = false;
+	int64_t correction = 0; // actual minus estimated size
+	for (unsigned round=0; round<BUDGET_ROUNDS && !(fits && lo+1 == hi); ++round) {
+		est.reset();
+		size_t n = 0;
+		while (n < chars.size() && (int64_t)est.add(chars[n]) + correction <= (int64_t)opts.budget) ++n;
+		n = MIN(n, hi-1);
+		if (fits && n <= lo) break;
+
+		std::vector<char_range_t> prefix;
+		for (size_t i=0; i<n; ++i) {
+			prefix.push_back((char_range_t){chars[i], chars[i]});
+		}
+		const size_t guess = est.estimate(prefix);
+		size_t len;
+		if (strip(woff, trial, prefix, NULL, prevfile, written, &len) != 0) return 1;
+		if (!woff.revert()) return 1;
+		LOG("%zu of %zu chars: estimated %zu bytes, actually %zu for a budget of %zu", n, chars.size(), guess, len, opts.budget);
+		if (len <= opts.budget) {
+			lo = n;
+			fits = true;
+		} else {
+			hi = n;
+			if (!n) break;
+		}
+		correction = (int64_t)len - (int64_t)guess;
+	}
+	if (!fits && hi) { // the estimate did not converge
+		lo = 0;
+		fits = true;
+	}
+	if (!fits) {
+		LOG("cannot fit into %zu bytes even without any chars", opts.budget);
+		return 1;
+	}
+
+	std::vector<char_range_t> prefix;
+	for (size_t i=0; i<lo; ++i) {
+		prefix.push_back((char_range_t){chars[i], chars[i]});
+	}
+	size_t len;
+	const int rv = strip(woff, opts, prefix, outfile, prevfile, written, &len);
+	if (rv == 0 && len > opts.budget) {
+		LOG("cannot fit into %zu bytes even without any chars", opts.budget);
+		return 1;
+	}
+	if (rv == 0) LOG("kept %zu of %zu chars in %zu bytes", lo, chars.size(), len);
+	return rv;
+}
+
+static int shards(Woff& woff, const options_t& opts, const std::vector<char_range_t>& keep, const char* infile, const char* outdir) {
+	// the chars that would be kept, as planned into fonts with an @font-face each
+	std::vector<char_range_t> charcodes(keep);
+	std::vector<char_range_t> kept;
+	if (opts.charcodes_set && !opts.charcodes_exclude) {
+		woff.getCharMap().set_substract(charcodes, kept);
+	} else {
+		woff.getCharMap().set_intersect(charcodes, kept);
+	}
+	Estimate est;
+	if (!woff.buildEstimate(est, opts.sfnt)) {
+		LOG("cannot estimate output sizes");
+		return 1;
+	}
+	ShardPlan plan(kept);
+	if (!(opts.pagesfile? plan.loadPages(opts.pagesfile, config.threads): plan.loadFrequencies(opts.freqfile)) || !plan.solve(est, opts.request)) {
+		LOG("cannot plan shards");
+		return 1;
+	}
+	LOG("planned %zu shards of %zu chars: %.0f bytes in %.2f requests expected per page view", plan.size(), Cmaps::count(kept), plan.getBytes(), plan.getRequests());
+
+	const char* base = strrchr(infile, '/');
+	base = base? base+1: infile;
+	const char* dot = strrchr(base, '.');
+	const int baselen = dot? dot - base: strlen(base);
+	const char* ext = !opts.sfnt? "woff": woff.isCff()? "otf": "ttf";
+	const char* format = !opts.sfnt? "woff": woff.isCff()? "opentype": "truetype";
+	char* fn = (char*)malloc(strlen(outdir) + 1 + baselen + 24);
+	char* css;
+	size_t csslen;
+	FILE* f = open_memstream(&css, &csslen);
+	if (!f) {
+		LOG_ERRNO("open_memstream()");
+		free(fn);
+		return 1;
+	}
+
+	options_t shard(opts);
+	shard.charcodes_set = true;
+	shard.charcodes_exclude = false;
+	int rv = 0;
+	for (size_t k=0; k<plan.size() && !rv; ++k) {
+		std::vector<char_range_t> chars;
+		plan.getShard(k, chars);
+		sprintf(fn, "%s/%.*s.%zu.%s", outdir, baselen, base, k, ext);
+		bool written;
+		size_t len = 0;
+		rv = strip(woff, shard, chars, fn, NULL, written, &len);
+		if (!woff.revert()) rv = 1;
+		fprintf(f, "%s/* %zu chars, %zu bytes, needed by %.1f%% of page views */\n", k? "\n": "", Cmaps::count(chars), len, plan.getUsage(k) * 100);
+		fprintf(f, "@font-face {\n\tfont-family: \"%.*s\";\n\tsrc: url(\"%.*s.%zu.%s\") format(\"%s\");\n\tunicode-range: ", baselen, base, baselen, base, k, ext, format);
+		css_ranges(f, chars);
+		fprintf(f, ";\n}\n");
+	}
+	fclose(f);
+	sprintf(fn, "%s/%.*s.css", outdir, baselen, base);
+	if (!rv && !file_write(fn, css, csslen)) rv = 1;
+	if (!rv) LOG("wrote %zu shards and '%s' - done.", plan.size(), fn);
+	free(css);
+	free(fn);
+	return rv;
+}
+
+typedef struct {
+	const options_t* opts;
+	const std::vector<char_range_t>* keep;
+	const char* outdir;
+	const char* const* infiles; // largest first
+	size_t nfonts;
+	TableCache* cache;
+	size_t next; // atomic
+	int* rv;
+} family_job_t;
+
+static int strip_member(const family_job_t& job, const char* infile) {
+	const char* base = strrchr(infile, '/');
+	base = base? base+1: infile;
+	char* outfile = (char*)malloc(strlen(job.outdir) + 1 + strlen(base) + 1);
+	sprintf(outfile, "%s/%s", job.outdir, base);
+
+	int rv = 1;
+	struct stat in, out;
+	Woff* woff;
+	if (stat(infile, &in) == 0 && stat(outfile, &out) == 0 && in.st_dev == out.st_dev && in.st_ino == out.st_ino) {
+		LOG("'%s': output would replace input", infile);
+	} else if ((woff = load(infile)) != NULL) {
+		woff->setTableCache(job.cache);
+		bool written;
+		rv = parse(*woff, NULL)? strip(*woff, *job.opts, *job.keep, outfile, NULL, written): 1;
+		delete woff;
+	}
+	free(outfile);
+	return rv;
+}
+
+static void* family_worker(void* arg) {
+	family_job_t* job = (family_job_t*)arg;
+	size_t i;
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->nfonts) {
+		job->rv[i] = strip_member(*job, job->infiles[i]);
+		if (job->rv[i]) LOG("'%s': failed", job->infiles[i]);
+	}
+	return NULL;
+}
+
+static off_t file_size(const char* fn) {
+	struct stat ss;
+	return (stat(fn, &ss) == 0)? ss.st_size: 0;
+}
+
+static bool file_size_cmp(const char* a, const char* b) {
+	return file_size(a) > file_size(b);
+}
+
+static int family(const options_t& opts, const char* outdir, char* const* infiles, size_t nfonts) {
+	// the keep-set once for all, per font only the set operations against its own character map
+	std::vector<char_range_t> keep;
+	if (!keepset(opts, keep)) return 1;
+
+	std::vector<const char*> order(infiles, infiles + nfonts); // largest first, so the last ones to finish are short
+	std::stable_sort(order.begin(), order.end(), file_size_cmp);
+	std::vector<int> rv(nfonts, 1);
+	TableCache cache;
+	family_job_t job = {&opts, &keep, outdir, &order[0], nfonts, &cache, 0, &rv[0]};
+
+	const unsigned threads = MAX(1, MIN(config.threads, nfonts));
+	std::vector<pthread_t> tids(threads);
+	unsigned nthreads = 0;
+	for (; nthreads < threads-1; ++nthreads) { // the current one works as well
+		if (pthread_create(&tids[nthreads], NULL, family_worker, &job) != 0) break;
+	}
+	family_worker(&job);
+	for (unsigned t=0; t<nthreads; ++t) {
+		pthread_join(tids[t], NULL);
+	}
+
+	LOG("family of %zu fonts with %u threads: %zu distinct tables compressed, %zu shared", nfonts, nthreads+1, cache.size(), cache.getHits());
+	for (size_t i=0; i<nfonts; ++i) {
+		if (rv[i]) return 1;
+	}
 	return 0;
 }
+
+int main(int argc, char** argv) {
+	options_t opts;
+	opts.charcodes_exclude = false;
+	opts.charcodes_set = false;
+	opts.codepointsfile = NULL;
+	opts.align_to = 0;
+	opts.align_charcodes_set = false;
+	opts.indexfile = NULL;
+	opts.sfnt = false;
+	opts.metadata = -1;
+	opts.budget = 0;
+	opts.pagesfile = NULL;
+	opts.freqfile = NULL;
+	opts.request = PLAN_REQUEST;
+	opts.inlinefile = NULL;
+	opts.infile = NULL;
+	unsigned inspect = 0;
+	const char* prevfile = NULL;
+	bool watch = false;
+	const char* familydir = NULL;
+
+	static const struct option longopts[] = {
+		{"verbose", no_argument, NULL, 'v'},
+		{"dump", no_argument, NULL, 'd'},
+		{"paranoid", no_argument, NULL, 'P'},
+		{"threads", required_argument, NULL, 't'},
+		{"single-stream", no_argument, NULL, 'S'},
+		{"deterministic", no_argument, NULL, 'D'},
+		{"desubroutinize", no_argument, NULL, 'R'},
+		{"window", required_argument, NULL, 'W'},
+		{"inspect", required_argument, NULL, 'j'},
+		{"index", required_argument, NULL, 'x'},
+		{"sfnt", no_argument, NULL, 's'},
+		{"metadata", required_argument, NULL, 'm'},
+		{"instance", required_argument, NULL, 'V'},
+		{"previous", required_argument, NULL, 'p'},
+		{"watch", no_argument, NULL, 'w'},
+		{"family", required_argument, NULL, 'f'},
+		{"exclude", required_argument, NULL, 'e'},
+		{"include", required_argument, NULL, 'i'},
+		{"codepoints", required_argument, NULL, 'c'},
+		{"keep-from", required_argument, NULL, 'k'},
+		{"budget", required_argument, NULL, 'B'},
+		{"pages", required_argument, NULL, 'g'},
+		{"frequencies", required_argument, NULL, 'G'},
+		{"request", required_argument, NULL, 'q'},
+		{"merge", required_argument, NULL, 'M'},
+		{"inline", required_argument, NULL, 'I'},
+		{"align", required_argument, NULL, 'a'},
+		{"baseline", required_argument, NULL, 'b'},
+		{NULL, 0, NULL, 0}
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "vdPt:SDRW:j:x:sm:V:p:wf:e:i:c:k:B:g:G:q:M:I:a:b:", longopts, NULL)) != -1) {
+		switch (opt) {
+			case 'v':
+				config.verbose = true;
+				break;
+			case 'd':
+				config.dump = true;
+				break;
+			case 'P':
+				config.paranoid = true;
+				break;
+			case 't':
+				if (atoi(optarg) <= 0) {
+					usage(argv[0]);
+					return 1;
+				}
+				config.threads = atoi(optarg);
+				break;
+			case 'S':
+				config.single_stream = true;
+				break;
+			case 'D':
+				config.deterministic = true;
+				break;
+			case 'R':
+				config.desubroutinize = true;
+				break;
+			case 'W':
+				if (atoi(optarg) <= 0) {
+					usage(argv[0]);
+					return 1;
+				}
+				config.glyf_window = (size_t)atoi(optarg) * 1024;
+				break;
+			case 'j':
+				if (inspect || !(inspect = dump_sections(optarg))) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'x':
+				opts.indexfile = optarg;
+				break;
+			case 's':
+				opts.sfnt = true;
+				break;
+			case 'm':
+				if (opts.metadata != -1) {
+					usage(argv[0]);
+					return 1;
+				} else if (strcmp(optarg, "keep") == 0) {
+					opts.metadata = META_KEEP;
+				} else if (strcmp(optarg, "minify") == 0) {
+					opts.metadata = META_MINIFY;
+				} else if (strcmp(optarg, "drop") == 0) {
+					opts.metadata = META_DROP;
+				} else {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'V':
+				if (!opts.instance.empty() || !parse_axis_list(opts.instance, optarg)) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'p':
+				prevfile = optarg;
+				break;
+			case 'w':
+				watch = true;
+				break;
+			case 'f':
+				familydir = optarg;
+				break;
+			case 'e':
+			case 'i':
+				if ((opts.charcodes_set && opts.charcodes_exclude != (opt == 'e')) || !opts.charcodes.empty() || !parse_range_list(opts.charcodes, optarg)) {
+					usage(argv[0]);
+					return 1;
+				}
+				opts.charcodes_exclude = (opt == 'e');
+				opts.charcodes_set = true;
+				break;
+			case 'c':
+			case 'k':
+				if (opts.charcodes_exclude || (opt == 'c' && opts.codepointsfile)) {
+					usage(argv[0]);
+					return 1;
+				}
+				if (opt == 'c') {
+					opts.codepointsfile = optarg;
+				} else {
+					opts.contentfiles.push_back(optarg);
+				}
+				opts.charcodes_set = true;
+				break;
+			case 'B':
+				if (opts.budget || atol(optarg) <= 0) {
+					usage(argv[0]);
+					return 1;
+				}
+				opts.budget = (size_t)atol(optarg);
+				break;
+			case 'g':
+			case 'G':
+				if (opts.pagesfile || opts.freqfile) {
+					usage(argv[0]);
+					return 1;
+				}
+				if (opt == 'g') {
+					opts.pagesfile = optarg;
+				} else {
+					opts.freqfile = optarg;
+				}
+				break;
+			case 'q':
+				if (atol(optarg) < 0) {
+					usage(argv[0]);
+					return 1;
+				}
+				opts.request = (size_t)atol(optarg);
+				break;
+			case 'M':
+				opts.merges.push_back(optarg);
+				break;
+			case 'I':
+				opts.inlinefile = optarg;
+				break;
+			case 'a':
+				if (opts.align_charcodes_set || !parse_range_list(opts.align_charcodes, optarg)) {
+					usage(argv[0]);
+					return 1;
+				}
+				opts.align_charcodes_set = true;
+				break;
+			case 'b':
+				if (opts.align_to || (opts.align_to = atoi(optarg)) <= 0) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if ((config.glyf_window && (opts.sfnt || prevfile || !opts.instance.empty())) || (prevfile && !opts.instance.empty()) || (opts.budget && (!opts.charcodes_set || opts.charcodes_exclude || config.glyf_window || watch || familydir))) {
+		usage(argv[0]);
+		return 1;
+	}
+	const bool planning = opts.pagesfile || opts.freqfile;
+	if (planning && (opts.budget || config.glyf_window || prevfile || watch || familydir || inspect)) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (!opts.merges.empty() && (opts.budget || planning || config.glyf_window || prevfile || watch || familydir || inspect)) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (opts.inlinefile && (planning || familydir || inspect)) {
+		usage(argv[0]);
+		return 1;
+	}
+	opts.always = opts.budget || planning || !opts.merges.empty() || opts.inlinefile;
+	if (opts.metadata == -1) opts.metadata = META_KEEP;
+	if (!config.threads) config.threads = MAX(1, sysconf(_SC_NPROCESSORS_ONLN));
+	if (familydir) {
+		if (optind >= argc || inspect || watch || prevfile || opts.indexfile) {
+			usage(argv[0]);
+			return 1;
+		}
+		return family(opts, familydir, argv + optind, argc - optind);
+	}
+
+	if (optind+2 < argc) {
+		usage(argv[0]);
+		return 1;
+	}
+	const char* infile = (optind <= argc)? argv[optind]: NULL;
+	const char* outfile = (optind < argc)? argv[optind+1]: NULL;
+	if (!infile || (watch && (!(outfile || opts.inlinefile) || inspect)) || (planning && !outfile)) {
+		usage(argv[0]);
+		return 1;
+	}
+	opts.infile = infile;
+
+	if (!watch) {
+		Woff* woff = load(infile);
+		if (!woff) return 1;
+		int rv;
+		bool written;
+		if (inspect) {
+			Dump out;
+			rv = woff->dump(out, inspect)? 0: 1;
+			if (rv) LOG("cannot dump");
+		} else {
+			std::vector<char_range_t> keep;
+			if (!keepset(opts, keep) || !parse(*woff, opts.indexfile)) {
+				rv = 1;
+			} else if (planning) {
+				rv = shards(*woff, opts, keep, infile, outfile);
+			} else if (opts.budget) {
+				rv = budget(*woff, opts, keep, outfile, prevfile, written);
+			} else {
+				rv = strip(*woff, opts, keep, outfile, prevfile, written);
+			}
+		}
+		delete woff;
+		return rv;
+	}
+
+	// the parsed font stays resident, reverted after each run and only reloaded on changes, the last output serves as previous one
+	bool loop = outfile && (strcmp(outfile, infile) == 0 || (opts.codepointsfile && strcmp(outfile, opts.codepointsfile) == 0));
+	if (opts.inlinefile) {
+		loop |= strcmp(opts.inlinefile, infile) == 0 || (opts.codepointsfile && strcmp(opts.inlinefile, opts.codepointsfile) == 0);
+		for (std::vector<const char*>::const_iterator it=opts.contentfiles.begin(); it!=opts.contentfiles.end(); ++it) {
+			loop |= strcmp(*it, opts.inlinefile) == 0;
+		}
+	}
+	if (loop) {
+		LOG("output would trigger itself");
+		return 1;
+	}
+	Watch w;
+	if (!w.add(infile)) return 1;
+	if (opts.codepointsfile && !w.add(opts.codepointsfile)) return 1;
+	for (std::vector<const char*>::const_iterator it=opts.contentfiles.begin(); it!=opts.contentfiles.end(); ++it) {
+		if (!w.add(*it)) return 1;
+	}
+	Woff* woff = NULL;
+	bool have_output = false; // as previous one
+	std::vector<bool> changed;
+	while (true) {
+		if (!woff && (woff = load(infile)) != NULL && !parse(*woff, opts.indexfile)) {
+			delete woff;
+			woff = NULL;
+		}
+		if (woff) {
+			const char* prev = (config.glyf_window || !opts.instance.empty())? NULL: have_output? outfile: prevfile; // not when streaming or instancing
+			std::vector<char_range_t> keep;
+			bool written = false;
+			if (keepset(opts, keep) && strip(*woff, opts, keep, outfile, prev, written) != 0 && prev) {
+				LOG("retrying without previous output");
+				if (woff->revert()) strip(*woff, opts, keep, outfile, NULL, written);
+			}
+			have_output |= written;
+			if (!woff->revert()) {
+				delete woff;
+				woff = NULL;
+			}
+		}
+
+		LOG("watching for changes..");
+		if (!w.wait(changed, WATCH_SETTLE_MS)) break;
+		if (changed[0]) { // the font itself, outputs of the old one cannot be used anymore
+			delete woff;
+			woff = NULL;
+			have_output = false;
+			prevfile = NULL;
+		}
+	}
+	delete woff;
+	return 1;
+}
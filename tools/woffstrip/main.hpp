@@ -18,10 +18,17 @@
 #define CONCAT(a, b) CONCAT_(a, b)
 
 #define MAX(a,b) (((a)>(b))?(a):(b))
+#define MIN(a,b) (((a)<(b))?(a):(b))
 #define PAD4(l) (((l + 3) / 4) * 4)
 #define PADMEMB uint8_t CONCAT(padmemb_, __LINE__)
 
 extern struct config_s {
 	bool verbose;
 	bool dump;
+	bool single_stream; // instead of chunked glyf compression
+	bool deterministic; // canonical table order and original compressed data of unchanged tables
+	bool paranoid; // expensive self-checks, e.g. decompressing all output again
+	bool desubroutinize; // CFF charstrings flattened without subroutines
+	size_t glyf_window; // streaming glyf processing through an inflate window of this size, 0 for in memory
+	unsigned threads;
 } config;
@@ -0,0 +1,321 @@
+#include "plan.hpp"
+#include "cmaps.hpp"
+#include "keepset.hpp"
+#include "io.hpp"
+#include <math.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <algorithm>
+
+
+#define PLAN_NONE 0xffff // not a char to distribute
+
+typedef struct {
+	double freq;
+	char_t c;
+} plan_char_t;
+
+typedef struct {
+	const char* start; // whole lines
+	const char* end;
+	const uint16_t* block; // by char for the pairs, NULL for the frequencies
+	size_t nchars, nblocks;
+	std::vector<uint32_t> counts; // pages by char, or by pair of blocks
+	size_t pages;
+} plan_job_t;
+
+
+static bool plan_char_cmp(const plan_char_t& a, const plan_char_t& b) {
+	return (a.freq != b.freq)? a.freq > b.freq: a.c < b.c;
+}
+
+
+ShardPlan::ShardPlan(const std::vector<char_range_t>& v): pages(0), bytes(0), requests(0) {
+	for (std::vector<char_range_t>::const_iterator it=v.begin(); it!=v.end(); ++it) {
+		for (char_t c=it->from; c<=it->to; ++c) {
+			chars.push_back(c);
+		}
+	}
+	freq.assign(chars.empty()? 0: chars.back()+1, 0);
+}
+
+
+static void* plan_worker(void* arg) {
+	// chars as used by each page, or the consecutive pairs of blocks, each page counted once
+	plan_job_t* job = (plan_job_t*)arg;
+	job->counts.assign(job->block? (job->nblocks+1) * job->nblocks: job->nchars, 0);
+	std::vector<uint64_t> used(job->block? (job->nblocks+63) / 64: (job->nchars+63) / 64, 0);
+	std::vector<char_t> touched;
+	const char* p = job->start;
+	while (p < job->end) {
+		const char* eol = (const char*)memchr(p, '\n', job->end - p);
+		if (!eol) eol = job->end;
+		bool any = false;
+		while (p < eol) {
+			char_t c;
+			const size_t n = keepset_utf8(p, eol, c);
+			p += n? n: 1;
+			any |= n && c > ' ';
+			if (!n || c >= job->nchars) continue;
+			const uint32_t i = job->block? job->block[c]: c;
+			if (i == PLAN_NONE || (used[i / 64] & (1ull << (i % 64)))) continue;
+			used[i / 64] |= 1ull << (i % 64);
+			if (!job->block) {
+				++job->counts[c];
+				touched.push_back(c);
+			}
+		}
+		if (job->block) { // ascending, from none before the first one
+			uint32_t prev = 0;
+			for (size_t w=0; w<used.size(); ++w) {
+				while (used[w]) {
+					const uint32_t b = w * 64 + __builtin_ctzll(used[w]);
+					used[w] &= used[w] - 1;
+					++job->counts[prev * job->nblocks + b];
+					prev = b + 1;
+				}
+			}
+		} else {
+			for (std::vector<char_t>::const_iterator it=touched.begin(); it!=touched.end(); ++it) {
+				used[*it / 64] = 0;
+			}
+			touched.clear();
+		}
+		job->pages += any;
+		p = eol + 1;
+	}
+	return NULL;
+}
+
+
+static void plan_run(std::vector<plan_job_t>& jobs) {
+	std::vector<pthread_t> tids(jobs.size());
+	size_t nthreads = 0;
+	for (; nthreads < jobs.size()-1; ++nthreads) { // the current one works as well
+		if (pthread_create(&tids[nthreads], NULL, plan_worker, &jobs[nthreads+1]) != 0) break;
+	}
+	plan_worker(&jobs[0]);
+	for (size_t t=0; t<nthreads; ++t) {
+		pthread_join(tids[t], NULL);
+	}
+	for (size_t t=nthreads+1; t<jobs.size(); ++t) { // could not be started
+		plan_worker(&jobs[t]);
+	}
+}
+
+
+bool ShardPlan::loadPages(const char* fn, unsigned threads) {
+	char* buf;
+	size_t len;
+	if (!file_read(fn, buf, len)) return false;
+
+	// line-aligned parts, one per thread
+	std::vector<plan_job_t> jobs(MAX(1, MIN(threads, len / 4096 + 1)));
+	const char* p = buf;
+	for (size_t t=0; t<jobs.size(); ++t) {
+		const char* e = (t == jobs.size()-1)? buf + len: MAX(p, buf + len * (t+1) / jobs.size());
+		while (e < buf + len && e > buf && e[-1] != '\n') ++e;
+		jobs[t].start = p;
+		jobs[t].end = e;
+		jobs[t].block = NULL;
+		jobs[t].nchars = freq.size();
+		jobs[t].nblocks = 0;
+		jobs[t].pages = 0;
+		p = e;
+	}
+	plan_run(jobs);
+	pages = 0;
+	for (std::vector<plan_job_t>::const_iterator it=jobs.begin(); it!=jobs.end(); ++it) {
+		pages += it->pages;
+		for (std::vector<char_t>::const_iterator c=chars.begin(); c!=chars.end(); ++c) {
+			freq[*c] += it->counts[*c];
+		}
+	}
+	if (!pages) {
+		LOG("%s: no pages", fn);
+		free(buf);
+		return false;
+	}
+	order();
+
+	const size_t nblocks = blocks.size()-1;
+	std::vector<uint16_t> block(freq.size(), PLAN_NONE);
+	for (size_t b=0; b<nblocks; ++b) {
+		for (uint32_t i=blocks[b]; i<blocks[b+1]; ++i) {
+			block[chars[i]] = b;
+		}
+	}
+	for (std::vector<plan_job_t>::iterator it=jobs.begin(); it!=jobs.end(); ++it) {
+		it->block = &block[0];
+		it->nblocks = nblocks;
+		it->pages = 0;
+	}
+	plan_run(jobs);
+	pairs.assign((nblocks+1) * nblocks, 0);
+	for (std::vector<plan_job_t>::const_iterator it=jobs.begin(); it!=jobs.end(); ++it) {
+		for (size_t i=0; i<pairs.size(); ++i) {
+			pairs[i] += it->counts[i];
+		}
+	}
+	free(buf);
+	LOG_INFO("%s: %.0f page views in %zu parts, %zu blocks of chars", fn, pages, jobs.size(), nblocks);
+	return true;
+}
+
+
+bool ShardPlan::loadFrequencies(const char* fn) {
+	char* buf;
+	size_t len;
+	if (!file_read(fn, buf, len)) return false;
+
+	unsigned lineno = 0;
+	bool rv = true;
+	for (char* line=buf; rv && line; ) {
+		char* next = strchr(line, '\n');
+		if (next) *next++ = '\0';
+		++lineno;
+		char* p = strchr(line, '#');
+		if (p) *p = '\0';
+		p = line;
+		while (isspace((unsigned char)*p)) ++p;
+		if (*p) {
+			if ((p[0] == 'U' || p[0] == 'u') && p[1] == '+') p += 2;
+			char* e;
+			const unsigned long c = strtoul(p, &e, 16);
+			const double f = (e != p)? strtod(e, &p): -1;
+			while (isspace((unsigned char)*p)) ++p;
+			if (e == p || f < 0 || *p) {
+				LOG("%s:%u: invalid frequency", fn, lineno);
+				rv = false;
+			} else if (c < freq.size()) {
+				freq[c] += f;
+			}
+		}
+		line = next;
+	}
+	free(buf);
+	if (!rv) return false;
+
+	double most = 0;
+	for (std::vector<char_t>::const_iterator it=chars.begin(); it!=chars.end(); ++it) {
+		most = MAX(most, freq[*it]);
+	}
+	if (most <= 0) {
+		LOG("%s: no frequencies", fn);
+		return false;
+	}
+	for (std::vector<double>::iterator it=freq.begin(); it!=freq.end(); ++it) {
+		*it /= most;
+	}
+	pages = 0;
+	order();
+	return true;
+}
+
+
+void ShardPlan::order() {
+	// most used first, so shards are runs of similarly frequent chars, unused ones by code for compact ranges
+	std::vector<plan_char_t> v;
+	v.reserve(chars.size());
+	for (std::vector<char_t>::const_iterator it=chars.begin(); it!=chars.end(); ++it) {
+		v.push_back((plan_char_t){freq[*it], *it});
+	}
+	std::sort(v.begin(), v.end(), plan_char_cmp);
+	for (size_t i=0; i<v.size(); ++i) {
+		chars[i] = v[i].c;
+	}
+	const size_t nblocks = MIN(chars.size(), (size_t)PLAN_BLOCKS);
+	blocks.resize(nblocks+1);
+	for (size_t b=0; b<=nblocks; ++b) {
+		blocks[b] = chars.size() * b / MAX(nblocks, 1);
+	}
+}
+
+
+bool ShardPlan::solve(Estimate& est, size_t request) {
+	// cheapest partition into runs of blocks, the expected cost of a run is its size and a request times the probability it is needed
+	if (blocks.size() < 2) return false;
+	const size_t nblocks = blocks.size()-1;
+	est.reset();
+	const double base = est.size();
+	std::vector<double> glyphs(nblocks+1, 0); // cumulative costs
+	std::vector<double> logq(nblocks, 0); // of not needing each block, for independent frequencies
+	for (size_t b=0; b<nblocks; ++b) {
+		est.reset();
+		for (uint32_t i=blocks[b]; i<blocks[b+1]; ++i) {
+			est.add(chars[i]);
+			if (!pages) logq[b] += log1p(-MIN(freq[chars[i]], 1 - 1e-9));
+		}
+		glyphs[b+1] = glyphs[b] + (est.size() - base);
+	}
+
+	std::vector<double> best(nblocks+1, HUGE_VAL);
+	std::vector<uint32_t> from(nblocks+1, 0);
+	std::vector<double> hits(nblocks, 0); // pages by the next block they use from the current start on
+	best[0] = 0;
+	for (size_t i=0; i<nblocks; ++i) {
+		if (pages) {
+			for (size_t b=i; b<nblocks; ++b) hits[b] += pairs[i * nblocks + b];
+		}
+		double h = 0, l = 0;
+		for (size_t j=i+1; j<=nblocks; ++j) {
+			double p;
+			if (pages) {
+				h += hits[j-1];
+				p = h / pages;
+			} else {
+				l += logq[j-1];
+				p = -expm1(l);
+			}
+			const double cost = best[i] + p * (base + glyphs[j] - glyphs[i] + request);
+			if (cost < best[j]) {
+				best[j] = cost;
+				from[j] = i;
+			}
+		}
+	}
+
+	cuts.clear();
+	for (uint32_t j=nblocks; j; j=from[j]) {
+		cuts.push_back(j);
+	}
+	cuts.push_back(0);
+	std::reverse(cuts.begin(), cuts.end());
+
+	bytes = requests = 0;
+	for (size_t k=0; k<size(); ++k) {
+		const double p = getUsage(k);
+		bytes += p * (base + glyphs[cuts[k+1]] - glyphs[cuts[k]]);
+		requests += p;
+	}
+	return true;
+}
+
+
+double ShardPlan::getUsage(size_t k) const {
+	const size_t nblocks = blocks.size()-1;
+	const uint32_t i = cuts[k], j = cuts[k+1];
+	if (!pages) {
+		double l = 0;
+		for (uint32_t c=blocks[i]; c<blocks[j]; ++c) {
+			l += log1p(-MIN(freq[chars[c]], 1 - 1e-9));
+		}
+		return -expm1(l);
+	}
+	double h = 0; // pages with none before the run and one in it
+	for (size_t a=0; a<=i; ++a) {
+		for (size_t b=i; b<j; ++b) {
+			h += pairs[a * nblocks + b];
+		}
+	}
+	return h / pages;
+}
+
+
+void ShardPlan::getShard(size_t k, std::vector<char_range_t>& v) const {
+	v.clear();
+	for (uint32_t i=blocks[cuts[k]]; i<blocks[cuts[k+1]]; ++i) {
+		v.push_back((char_range_t){chars[i], chars[i]});
+	}
+	Cmaps::normalize(v);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "main.hpp"
+#include "types.hpp"
+#include "estimate.hpp"
+#include <vector>
+
+
+#define PLAN_BLOCKS 1024 // at most, groups of chars by frequency that shards are runs of
+#define PLAN_REQUEST 2048 // cost of a request in bytes, by default
+
+
+/**
+ * Partition of the chars of a font into unicode-range shards, with minimal expected bytes and requests per page view.
+ * Chars are ordered by how many pages use them and grouped into blocks, and shards are the runs of blocks as found by dynamic programming.
+ * The probability that a page view needs a run is counted exactly from sample pages, or follows from independent char frequencies otherwise.
+ */
+class ShardPlan {
+	private:
+		std::vector<char_t> chars; // by frequency, then code
+		std::vector<uint32_t> blocks; // nblocks+1 starts in chars
+		std::vector<double> freq; // by char, pages or their share that use it
+		std::vector<uint32_t> pairs; // (nblocks+1) x nblocks, pages by previous and next block they use
+		double pages; // views, 0 for independent frequencies
+		std::vector<uint32_t> cuts; // block starts of the shards
+		double bytes, requests; // expected per page view
+
+		void order();
+
+	public:
+		ShardPlan(const std::vector<char_range_t>&); // chars to distribute, sorted and disjoint
+		bool loadPages(const char*, unsigned); // one page view per line, as UTF-8 text, evaluated in parallel
+		bool loadFrequencies(const char*); // code and count per line, relative to the most frequent char as used by every page view
+		bool solve(Estimate&, size_t); // by shard sizes and the cost of a request in bytes
+
+		size_t size() const { return cuts.empty()? 0: cuts.size()-1; }
+		void getShard(size_t, std::vector<char_range_t>&) const; // sorted and disjoint
+		double getUsage(size_t) const; // probability that a page view needs the shard
+		double getBytes() const { return bytes; }
+		double getRequests() const { return requests; }
+};
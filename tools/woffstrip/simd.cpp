@@ -0,0 +1,300 @@
+#include "simd.hpp"
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+	#include <immintrin.h>
+	#define SIMD_X86
+#endif
+
+
+static inline uint16_t load_be16(const uint8_t* p) {
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void store_be16(uint8_t* p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static inline uint32_t load_be32(const uint8_t* p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void store_be32(uint8_t* p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+#ifdef SIMD_X86
+
+static bool have_avx2() {
+	static const bool rv = (__builtin_cpu_init(), __builtin_cpu_supports("avx2")); // initialized once, also from threads
+	return rv;
+}
+
+#define BSWAP16_MASK 1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14
+#define BSWAP32_MASK 3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12
+
+static inline __m128i bswap16_sse2(__m128i v) {
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static inline __m128i bswap32_sse2(__m128i v) {
+	v = bswap16_sse2(v);
+	v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+static inline uint32_t hsum_sse2(__m128i v) {
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (uint32_t)_mm_cvtsi128_si32(v);
+}
+
+static size_t be32_sum_sse2(const uint8_t* p, size_t n, uint32_t& sum) {
+	__m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i+8 <= n; i+=8) {
+		acc0 = _mm_add_epi32(acc0, bswap32_sse2(_mm_loadu_si128((const __m128i*)(p + 4*i))));
+		acc1 = _mm_add_epi32(acc1, bswap32_sse2(_mm_loadu_si128((const __m128i*)(p + 4*i + 16))));
+	}
+	sum += hsum_sse2(_mm_add_epi32(acc0, acc1));
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t be32_sum_avx2(const uint8_t* p, size_t n, uint32_t& sum) {
+	const __m256i mask = _mm256_setr_epi8(BSWAP32_MASK, BSWAP32_MASK);
+	__m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i+16 <= n; i+=16) {
+		acc0 = _mm256_add_epi32(acc0, _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(p + 4*i)), mask));
+		acc1 = _mm256_add_epi32(acc1, _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(p + 4*i + 32)), mask));
+	}
+	acc0 = _mm256_add_epi32(acc0, acc1);
+	sum += hsum_sse2(_mm_add_epi32(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1)));
+	return i;
+}
+
+static size_t be16_to_host_sse2(uint16_t* dst, const uint8_t* src, size_t n) {
+	size_t i = 0;
+	for (; i+8 <= n; i+=8) {
+		_mm_storeu_si128((__m128i*)(dst + i), bswap16_sse2(_mm_loadu_si128((const __m128i*)(src + 2*i))));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t be16_to_host_avx2(uint16_t* dst, const uint8_t* src, size_t n) {
+	const __m256i mask = _mm256_setr_epi8(BSWAP16_MASK, BSWAP16_MASK);
+	size_t i = 0;
+	for (; i+16 <= n; i+=16) {
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src + 2*i)), mask));
+	}
+	return i;
+}
+
+static size_t be32_to_host_sse2(uint32_t* dst, const uint8_t* src, size_t n) {
+	size_t i = 0;
+	for (; i+4 <= n; i+=4) {
+		_mm_storeu_si128((__m128i*)(dst + i), bswap32_sse2(_mm_loadu_si128((const __m128i*)(src + 4*i))));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t be32_to_host_avx2(uint32_t* dst, const uint8_t* src, size_t n) {
+	const __m256i mask = _mm256_setr_epi8(BSWAP32_MASK, BSWAP32_MASK);
+	size_t i = 0;
+	for (; i+8 <= n; i+=8) {
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src + 4*i)), mask));
+	}
+	return i;
+}
+
+static size_t be16_sub_sse2(uint8_t* p, size_t n, uint16_t v) {
+	const __m128i d = _mm_set1_epi16((short)v);
+	size_t i = 0;
+	for (; i+8 <= n; i+=8) {
+		__m128i x = bswap16_sse2(_mm_loadu_si128((const __m128i*)(p + 2*i)));
+		_mm_storeu_si128((__m128i*)(p + 2*i), bswap16_sse2(_mm_sub_epi16(x, d)));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t be16_sub_avx2(uint8_t* p, size_t n, uint16_t v) {
+	const __m256i mask = _mm256_setr_epi8(BSWAP16_MASK, BSWAP16_MASK);
+	const __m256i d = _mm256_set1_epi16((short)v);
+	size_t i = 0;
+	for (; i+16 <= n; i+=16) {
+		__m256i x = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(p + 2*i)), mask);
+		_mm256_storeu_si256((__m256i*)(p + 2*i), _mm256_shuffle_epi8(_mm256_sub_epi16(x, d), mask));
+	}
+	return i;
+}
+
+static size_t be32_sub_sse2(uint8_t* p, size_t n, uint32_t v) {
+	const __m128i d = _mm_set1_epi32((int)v);
+	size_t i = 0;
+	for (; i+4 <= n; i+=4) {
+		__m128i x = bswap32_sse2(_mm_loadu_si128((const __m128i*)(p + 4*i)));
+		_mm_storeu_si128((__m128i*)(p + 4*i), bswap32_sse2(_mm_sub_epi32(x, d)));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t be32_sub_avx2(uint8_t* p, size_t n, uint32_t v) {
+	const __m256i mask = _mm256_setr_epi8(BSWAP32_MASK, BSWAP32_MASK);
+	const __m256i d = _mm256_set1_epi32((int)v);
+	size_t i = 0;
+	for (; i+8 <= n; i+=8) {
+		__m256i x = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(p + 4*i)), mask);
+		_mm256_storeu_si256((__m256i*)(p + 4*i), _mm256_shuffle_epi8(_mm256_sub_epi32(x, d), mask));
+	}
+	return i;
+}
+
+static size_t f32_axpy_sse2(float* y, const float* x, float a, size_t n) {
+	const __m128 s = _mm_set1_ps(a);
+	size_t i = 0;
+	for (; i+4 <= n; i+=4) {
+		_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(_mm_loadu_ps(x + i), s)));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t f32_axpy_avx2(float* y, const float* x, float a, size_t n) {
+	const __m256 s = _mm256_set1_ps(a);
+	size_t i = 0;
+	for (; i+8 <= n; i+=8) { // not fused, as the scalar remainder
+		_mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(_mm256_loadu_ps(x + i), s)));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t base64_encode_avx2(char* dst, const uint8_t* src, size_t n) {
+	// 24 bytes per round by two 16-byte loads, split into 6-bit indices by multiplies and mapped to chars by offsets per range, as by W. Muła
+	const __m256i shuf = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i offsets = _mm256_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0,
+	                                         'a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0);
+	size_t i = 0;
+	for (; i+28 <= n; i+=24) { // the second load reads 4 bytes ahead
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + i))), _mm_loadu_si128((const __m128i*)(src + i + 12)), 1);
+		v = _mm256_shuffle_epi8(v, shuf);
+		const __m256i hi = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+		const __m256i lo = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+		const __m256i idx = _mm256_or_si256(hi, lo);
+		__m256i range = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+		range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx), _mm256_set1_epi8(13)));
+		_mm256_storeu_si256((__m256i*)(dst + i/3*4), _mm256_add_epi8(idx, _mm256_shuffle_epi8(offsets, range)));
+	}
+	return i;
+}
+
+#endif // SIMD_X86
+
+
+uint32_t be32_sum(const void* buf, size_t len) {
+	const uint8_t* p = (const uint8_t*)buf;
+	const size_t n = len / 4;
+	uint32_t sum = 0;
+	size_t i = 0;
+	#ifdef SIMD_X86
+		i = have_avx2()? be32_sum_avx2(p, n, sum): be32_sum_sse2(p, n, sum);
+	#endif
+	for (; i<n; ++i) {
+		sum += load_be32(p + 4*i);
+	}
+	if (len % 4) { // in case it's not fully initialized/padded (yet)
+		uint8_t rem[4] = {0, 0, 0, 0};
+		memcpy(rem, p + 4*n, len % 4);
+		sum += load_be32(rem);
+	}
+	return sum;
+}
+
+
+void be16_to_host(uint16_t* dst, const void* src, size_t n) {
+	const uint8_t* p = (const uint8_t*)src;
+	size_t i = 0;
+	#ifdef SIMD_X86
+		i = have_avx2()? be16_to_host_avx2(dst, p, n): be16_to_host_sse2(dst, p, n);
+	#endif
+	for (; i<n; ++i) {
+		dst[i] = load_be16(p + 2*i);
+	}
+}
+
+
+void be32_to_host(uint32_t* dst, const void* src, size_t n) {
+	const uint8_t* p = (const uint8_t*)src;
+	size_t i = 0;
+	#ifdef SIMD_X86
+		i = have_avx2()? be32_to_host_avx2(dst, p, n): be32_to_host_sse2(dst, p, n);
+	#endif
+	for (; i<n; ++i) {
+		dst[i] = load_be32(p + 4*i);
+	}
+}
+
+
+void be16_sub(void* buf, size_t n, uint16_t v) {
+	uint8_t* p = (uint8_t*)buf;
+	size_t i = 0;
+	#ifdef SIMD_X86
+		i = have_avx2()? be16_sub_avx2(p, n, v): be16_sub_sse2(p, n, v);
+	#endif
+	for (; i<n; ++i) {
+		store_be16(p + 2*i, load_be16(p + 2*i) - v);
+	}
+}
+
+
+void be32_sub(void* buf, size_t n, uint32_t v) {
+	uint8_t* p = (uint8_t*)buf;
+	size_t i = 0;
+	#ifdef SIMD_X86
+		i = have_avx2()? be32_sub_avx2(p, n, v): be32_sub_sse2(p, n, v);
+	#endif
+	for (; i<n; ++i) {
+		store_be32(p + 4*i, load_be32(p + 4*i) - v);
+	}
+}
+
+
+void f32_axpy(float* y, const float* x, float a, size_t n) {
+	size_t i = 0;
+	#ifdef SIMD_X86
+		i = have_avx2()? f32_axpy_avx2(y, x, a, n): f32_axpy_sse2(y, x, a, n);
+	#endif
+	for (; i<n; ++i) {
+		y[i] += x[i] * a;
+	}
+}
+
+
+size_t base64_encode(char* dst, const void* src, size_t n) {
+	const uint8_t* p = (const uint8_t*)src;
+	n -= n % 3;
+	size_t i = 0;
+	#ifdef SIMD_X86
+		if (have_avx2()) i = base64_encode_avx2(dst, p, n);
+	#endif
+	for (; i<n; i+=3) {
+		const uint32_t v = ((uint32_t)p[i] << 16) | ((uint32_t)p[i+1] << 8) | p[i+2];
+		char* o = dst + i/3*4;
+		o[0] = base64_chars[v >> 18];
+		o[1] = base64_chars[(v >> 12) & 0x3f];
+		o[2] = base64_chars[(v >> 6) & 0x3f];
+		o[3] = base64_chars[v & 0x3f];
+	}
+	return n;
+}
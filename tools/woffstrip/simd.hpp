@@ -0,0 +1,14 @@
+#pragma once
+#include "main.hpp"
+
+
+// Kernels on big-endian, float and byte arrays, using AVX2 or SSE2 if available, with a scalar fallback otherwise.
+// No alignment requirements.
+
+uint32_t be32_sum(const void*, size_t); // sum of all 32-bit words, given length in bytes with a zero-padded remainder
+void be16_to_host(uint16_t*, const void*, size_t); // number of elements
+void be32_to_host(uint32_t*, const void*, size_t);
+void be16_sub(void*, size_t, uint16_t); // in-place
+void be32_sub(void*, size_t, uint32_t);
+void f32_axpy(float*, const float*, float, size_t); // y += a*x elementwise, the same result on any path
+size_t base64_encode(char*, const void*, size_t); // whole groups of 3 bytes into 4 chars each, returns the bytes consumed, AVX2 only
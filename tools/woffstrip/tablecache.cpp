@@ -0,0 +1,65 @@
+#include "tablecache.hpp"
+#include "hash.hpp"
+#include "io.hpp"
+
+
+TableCache::TableCache(): hits(0) {
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+
+TableCache::~TableCache() {
+	for (std::vector<entry_t*>::iterator it=entries.begin(); it!=entries.end(); ++it) {
+		free((*it)->data);
+		free(*it);
+	}
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+
+bool TableCache::compress(const char* src, size_t len, char*& dst, size_t& dstlen, Arena& arena) {
+	const uint64_t h0 = hash64(src, len, 0);
+	const uint64_t h1 = hash64(src, len, len);
+
+	pthread_mutex_lock(&mutex);
+	entry_t* e = NULL;
+	for (std::vector<entry_t*>::const_iterator it=entries.begin(); it!=entries.end(); ++it) {
+		if ((*it)->len == len && (*it)->hash[0] == h0 && (*it)->hash[1] == h1) {
+			e = *it;
+			break;
+		}
+	}
+	if (e) {
+		while (!e->done) pthread_cond_wait(&cond, &mutex); // compressed by another font right now
+		if (!e->failed) {
+			++hits;
+			dstlen = e->clen;
+			dst = (char*)memcpy(arena.calloc(1, PAD4(dstlen)), e->data, dstlen);
+		}
+		pthread_mutex_unlock(&mutex);
+		return !e->failed;
+	}
+	e = (entry_t*)calloc(1, sizeof(entry_t));
+	e->hash[0] = h0;
+	e->hash[1] = h1;
+	e->len = len;
+	entries.push_back(e);
+	pthread_mutex_unlock(&mutex);
+
+	// outside of the lock, others wait only for the same content
+	size_t clen;
+	const bool rv = docompress(src, len, dst, &clen, arena);
+	pthread_mutex_lock(&mutex);
+	if (rv) {
+		dstlen = clen;
+		e->clen = clen;
+		e->data = (char*)memcpy(malloc(MAX(clen, 1)), dst, clen);
+	}
+	e->failed = !rv;
+	e->done = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+	return rv;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "main.hpp"
+#include "arena.hpp"
+#include <vector>
+#include <pthread.h>
+
+
+/**
+ * Compressed tables shared between the fonts of a family, so byte-identical ones get deflated only once.
+ * Thread-safe: concurrent requests for the same content wait for the first one instead of compressing it again.
+ */
+class TableCache {
+	private:
+		typedef struct {
+			uint64_t hash[2]; // of the plain data, with different seeds
+			size_t len;
+			bool done, failed;
+			char* data; // as by docompress, malloc'd as shared
+			size_t clen;
+		} entry_t;
+		std::vector<entry_t*> entries;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		size_t hits;
+
+	public:
+		TableCache();
+		~TableCache();
+
+		bool compress(const char*, size_t, char*&, size_t&, Arena&); // as docompress, output owned by the arena
+		size_t getHits() const { return hits; }
+		size_t size() const { return entries.size(); }
+};
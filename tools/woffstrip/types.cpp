@@ -2,13 +2,13 @@
 
 
 const char* w2str32(wuint32_t w) {
-	static union {
+	static __thread union { // per thread, as used in logging
 		char s[5];
 		wuint32_t w;
 	} s;
 	s.w = w;
 	for (size_t i=0; i<4; ++i) {
-		if (s.s[i] <= ' ' || s.s[i] >= '~') s.s[i] = '*';
+		if (s.s[i] < ' ' || s.s[i] >= '~') s.s[i] = '*'; // tags are padded with spaces
 	}
 	s.s[4] = '\0';
 	return s.s;
@@ -48,13 +48,24 @@ void WoffTableHead::print(const char* prefix, const char* head) const {
 	if (!config.dump) return;
 	if (head) puts(head);
 	prefix = prefix?:"";
-	printf("%scheckSumAdjustment: %08x\n", prefix, w2uint32(indexToLocFormat));
+	printf("%scheckSumAdjustment: %08x\n", prefix, w2uint32(checkSumAdjustment));
 	printf("%sflags:              %04x\n", prefix, w2uint16(flags));
+	printf("%sunitsPerEm:         %u\n", prefix, w2uint16(unitsPerEm));
 	printf("%smin:                %d/%d\n", prefix, w2int16(xMin), w2int16(yMin));
 	printf("%smax:                %d/%d\n", prefix, w2int16(xMax), w2int16(yMax));
 	printf("%sindexToLocFormat:   %u\n", prefix, w2uint16(indexToLocFormat));
 }
 
+void WoffTableHhea::print(const char* prefix, const char* head) const {
+	if (!config.dump) return;
+	if (head) puts(head);
+	prefix = prefix?:"";
+	printf("%sadvanceWidthMax:    %u\n", prefix, w2uint16(advanceWidthMax));
+	printf("%sminSideBearing:     %d/%d\n", prefix, w2int16(minLeftSideBearing), w2int16(minRightSideBearing));
+	printf("%sxMaxExtent:         %d\n", prefix, w2int16(xMaxExtent));
+	printf("%snumberOfHMetrics:   %u\n", prefix, w2uint16(numberOfHMetrics));
+}
+
 void WoffCmapIndex::print(const char* prefix, const char* head) const {
 	if (!config.dump) return;
 	if (head) puts(head);
@@ -98,6 +109,28 @@ void WoffCmap4::print(const char* prefix, const char* head) const {
 	printf("%srangeShift:    %u\n", prefix, w2uint16(rangeShift));
 }
 
+void WoffCmap6::print(const char* prefix, const char* head) const {
+	if (!config.dump) return;
+	if (head) puts(head);
+	prefix = prefix?:"";
+	printf("%sformat:     %u\n", prefix, w2uint16(format));
+	printf("%slength:     %u\n", prefix, w2uint16(length));
+	printf("%slanguage:   %u\n", prefix, w2uint16(language));
+	printf("%sfirstCode:  %u\n", prefix, w2uint16(firstCode));
+	printf("%sentryCount: %u\n", prefix, w2uint16(entryCount));
+}
+
+void WoffCmap10::print(const char* prefix, const char* head) const {
+	if (!config.dump) return;
+	if (head) puts(head);
+	prefix = prefix?:"";
+	printf("%sformat:        %u\n", prefix, w2uint16(format));
+	printf("%slength:        %u\n", prefix, w2uint32(length));
+	printf("%slanguage:      %u\n", prefix, w2uint32(language));
+	printf("%sstartCharCode: %u\n", prefix, w2uint32(startCharCode));
+	printf("%snumChars:      %u\n", prefix, w2uint32(numChars));
+}
+
 void WoffCmap12::print(const char* prefix, const char* head) const {
 	if (!config.dump) return;
 	if (head) puts(head);
@@ -115,6 +148,15 @@ void WoffCmap12Group::print(const char* prefix, const char* head) const {
 	printf("%s%04x-%04x (@ %u)\n", prefix, w2uint32(startCharCode), w2uint32(endCharCode), w2uint32(startGlyphCode));
 }
 
+void WoffCmap14::print(const char* prefix, const char* head) const {
+	if (!config.dump) return;
+	if (head) puts(head);
+	prefix = prefix?:"";
+	printf("%sformat:                %u\n", prefix, w2uint16(format));
+	printf("%slength:                %u\n", prefix, w2uint32(length));
+	printf("%snumVarSelectorRecords: %u\n", prefix, w2uint32(numVarSelectorRecords));
+}
+
 void WoffGlyph::print(const char* prefix, const char* head) const {
 	if (!config.dump) return;
 	if (head) puts(head);
@@ -1,36 +1,73 @@
 #pragma once
 #include "main.hpp"
-#include <arpa/inet.h> // [nh]to[hn][ls]
+#include <type_traits>
+
+
+/**
+ * Big-endian on-disk integers as byte arrays, so without alignment requirements and well-defined through any buffer pointer.
+ * Only explicitly convertible, compilers turn that into (unaligned) loads and stores with byte swaps.
+ */
+template <typename T> struct be_t {
+	uint8_t bytes[sizeof(T)];
+
+	constexpr T get() const {
+		typename std::make_unsigned<T>::type v = 0;
+		for (size_t i=0; i<sizeof(T); ++i) v = (v << 8) | bytes[i];
+		return (T)v;
+	}
+	static constexpr be_t make(T v) {
+		be_t w = {};
+		for (size_t i=0; i<sizeof(T); ++i) w.bytes[i] = (uint8_t)((typename std::make_unsigned<T>::type)v >> (8 * (sizeof(T)-1-i)));
+		return w;
+	}
+	constexpr bool operator==(const be_t& o) const { return get() == o.get(); }
+	constexpr bool operator!=(const be_t& o) const { return get() != o.get(); }
+};
 
+typedef be_t<uint32_t> wuint32_t;
+typedef be_t<uint16_t> wuint16_t;
+typedef be_t<int16_t> wint16_t; // woff/sfnt "Fword"
+static_assert(sizeof(wuint32_t) == 4 && alignof(wuint32_t) == 1, "wuint32_t layout");
+static_assert(sizeof(wuint16_t) == 2 && alignof(wuint16_t) == 1, "wuint16_t layout");
+
+constexpr uint32_t w2uint32(wuint32_t w) { return w.get(); }
+constexpr uint16_t w2uint16(wuint16_t w) { return w.get(); }
+constexpr int16_t w2int16(wint16_t w) { return w.get(); }
+constexpr wuint32_t uint2w32(uint32_t u) { return wuint32_t::make(u); }
+constexpr wuint16_t uint2w16(uint16_t u) { return wuint16_t::make(u); }
+constexpr wint16_t int2w16(int16_t i) { return wint16_t::make(i); }
+const char* w2str32(wuint32_t);
 
-#define PACKED __attribute__((packed))
-#define STRUCT struct PACKED
+/**
+ * Bounds-checked read-only view over a table buffer, for the structs below and arrays of them at any offset.
+ */
+class View {
+	private:
+		const char* buf;
+		size_t len;
+
+	public:
+		View(const char* b, size_t l): buf(b), len(l) {}
+		size_t size() const { return len; }
+		template <typename T> const T* get(size_t off=0, size_t n=1) const { // NULL unless entirely within
+			if (off > len || (len - off) / sizeof(T) < n) return NULL;
+			return (const T*)(buf + off);
+		}
+		View sub(size_t off, size_t l=SIZE_MAX) const { off = MIN(off, len); return View(buf + off, MIN(l, len - off)); }
+};
 
-typedef uint32_t wuint32_t; // not strongly typed enough to enforce, but at lest for little/big endianness documentation..
-typedef uint16_t wuint16_t;
-typedef int16_t wint16_t; // woff/sfnt "Fword"
-#define w2uint32(w) ntohl(w)
-#define w2uint16(w) ntohs(w)
-#define w2int16(w) ((int16_t)ntohs(w))
-const char* w2str32(wuint32_t);
-#define uint2w32(u) htonl(u)
-#define uint2w16(u) htons(u)
-#define int2w16(u) ((wint16_t)htons(u))
 typedef uint32_t char_t; // utf-8
 typedef unsigned index_t;
 
 typedef struct {
 	char_t from, to;
 } char_range_t;
-typedef struct {
-	size_t from, to;
-} range_t;
 
 // https://www.w3.org/TR/2012/REC-WOFF-20121213/
 // https://developer.apple.com/fonts/TrueType-Reference-Manual/
 // https://docs.microsoft.com/en-us/typography/opentype/spec/font-file
 
-STRUCT WoffHeader {
+struct WoffHeader {
 	wuint32_t signature;      // 0x774F4646 'wOFF'
 	wuint32_t flavor;         // The "sfnt version" of the input font.
 	wuint32_t length;         // Total size of the WOFF file.
@@ -46,8 +83,9 @@ STRUCT WoffHeader {
 	wuint32_t privLength;     // Length of private data block.
 	void print(const char* prefix=NULL, const char* head=NULL) const;
 };
+static_assert(sizeof(WoffHeader) == 44, "WoffHeader layout");
 
-STRUCT WoffTableDirectoryEntry {
+struct WoffTableDirectoryEntry {
 	wuint32_t tag;          // 4-byte sfnt table identifier.
 	wuint32_t offset;       // Offset to the data, from beginning of WOFF file.
 	wuint32_t compLength;   // Length of the compressed data, excluding padding.
@@ -55,57 +93,77 @@ STRUCT WoffTableDirectoryEntry {
 	wuint32_t origChecksum; // Checksum of the uncompressed table.
 	void print(const char* prefix=NULL, const char* head=NULL) const;
 };
+static_assert(sizeof(WoffTableDirectoryEntry) == 20, "WoffTableDirectoryEntry layout");
 
-STRUCT SfntHeader {
+struct SfntHeader {
 	wuint32_t flavor;        // The "sfnt version" of the input font.
 	wuint16_t numTables;     // number of tables
 	wuint16_t searchRange;   // (maximum power of 2 <= numTables)*16
 	wuint16_t entrySelector; // log2(maximum power of 2 <= numTables)
 	wuint16_t rangeShift;    // numTables*16-searchRange
 };
+static_assert(sizeof(SfntHeader) == 12, "SfntHeader layout");
 
-STRUCT SfntTableDirectoryEntry {
+struct SfntTableDirectoryEntry {
 	wuint32_t tag;      // 4-byte identifier
 	wuint32_t checkSum; // checksum for this table
 	wuint32_t offset;   // offset from beginning of sfnt
 	wuint32_t length;   // length of this table in byte (actual length not padded length)
 };
+static_assert(sizeof(SfntTableDirectoryEntry) == 16, "SfntTableDirectoryEntry layout");
 
-STRUCT WoffTableHead {
+struct WoffTableHead {
 	PADMEMB[2+2 + 2+2];
 	wuint32_t checkSumAdjustment;    // To compute: set it to 0, calculate the checksum for the 'head' table and put it in the table directory, sum the entire font as a uint32_t, then store 0xB1B0AFBA - sum. (The checksum for the 'head' table will be wrong as a result. That is OK; do not reset it.)
 	PADMEMB[4];
 	wuint16_t flags;                 // bit 0 - y value of 0 specifies baseline
-	PADMEMB[2 + 8+8];
+	wuint16_t unitsPerEm;            // 16 to 16384
+	PADMEMB[8+8];
 	wint16_t xMin, yMin, xMax, yMax; // for all glyph bounding boxes
 	PADMEMB[2 + 2 + 2];
 	wuint16_t indexToLocFormat;      // signed actually but only 0/1
 	PADMEMB[2];
 	void print(const char* prefix=NULL, const char* head=NULL) const;
 };
+static_assert(sizeof(WoffTableHead) == 54, "WoffTableHead layout");
+
+struct WoffTableHhea {
+	PADMEMB[4 + 2+2+2];
+	wuint16_t advanceWidthMax;       // maximum advance width value in 'hmtx' table
+	wint16_t minLeftSideBearing;     // minimum left sidebearing of glyphs with contours
+	wint16_t minRightSideBearing;    // min(aw - (lsb + xMax - xMin))
+	wint16_t xMaxExtent;             // max(lsb + (xMax - xMin))
+	PADMEMB[2+2+2 + 8 + 2];
+	wuint16_t numberOfHMetrics;      // number of hMetric entries in 'hmtx' table
+	void print(const char* prefix=NULL, const char* head=NULL) const;
+};
+static_assert(sizeof(WoffTableHhea) == 36, "WoffTableHhea layout");
 
-STRUCT WoffCmapIndex {
+struct WoffCmapIndex {
 	wuint16_t version;         // Version number (Set to zero)
 	wuint16_t numberSubtables; // Number of encoding subtables
 	void print(const char* prefix=NULL, const char* head=NULL) const;
 };
+static_assert(sizeof(WoffCmapIndex) == 4, "WoffCmapIndex layout");
 
-STRUCT WoffCmapSubtable {
+struct WoffCmapSubtable {
 	wuint16_t platformID;         // Platform identifier
 	wuint16_t platformSpecificID; // Platform-specific encoding identifier
 	wuint32_t offset;             // Offset of the mapping table
 	void print(const char* prefix=NULL, const char* head=NULL) const;
 };
+static_assert(sizeof(WoffCmapSubtable) == 8, "WoffCmapSubtable layout");
 
-STRUCT WoffCmap0 {
+struct WoffCmap0 {
 	wuint16_t format;   // Set to 0
 	wuint16_t length;   // Length in bytes of the subtable (set to 262 for format 0)
 	wuint16_t language; // Language code (see above)
 	uint8_t glyphIndexArray[256]; // An array that maps character codes to glyph index values
 	void print(const char* prefix=NULL, const char* head=NULL) const;
 };
+static_assert(sizeof(WoffCmap0) == 262, "WoffCmap0 layout");
 
-STRUCT WoffCmap4 {
+struct WoffCmap4 {
 	wuint16_t format;        // Format number is set to 4
 	wuint16_t length;        // Length of subtable in bytes
 	wuint16_t language;      // Language code (see above)
@@ -121,8 +179,32 @@ STRUCT WoffCmap4 {
 	// wuint16_t glyphIndexArray[variable]; // Glyph index array
 	void print(const char* prefix=NULL, const char* head=NULL) const;
 };
+static_assert(sizeof(WoffCmap4) == 14, "WoffCmap4 layout");
+
+struct WoffCmap6 {
+	wuint16_t format;     // Format number is set to 6
+	wuint16_t length;     // Length in bytes
+	wuint16_t language;   // Language code (see above)
+	wuint16_t firstCode;  // First character code of subrange
+	wuint16_t entryCount; // Number of character codes in subrange
+	// wuint16_t glyphIndexArray[entryCount]; // Array of glyph index values for character codes in the range
+	void print(const char* prefix=NULL, const char* head=NULL) const;
+};
+static_assert(sizeof(WoffCmap6) == 10, "WoffCmap6 layout");
 
-STRUCT WoffCmap12 {
+struct WoffCmap10 {
+	wuint16_t format;        // Subtable format; set to 10
+	PADMEMB[2];
+	wuint32_t length;        // Byte length of this subtable (including the header)
+	wuint32_t language;      // Language code (see above)
+	wuint32_t startCharCode; // First character code covered
+	wuint32_t numChars;      // Number of character codes covered
+	// wuint16_t glyphs[numChars]; // Array of glyph indices for the character codes covered
+	void print(const char* prefix=NULL, const char* head=NULL) const;
+};
+static_assert(sizeof(WoffCmap10) == 20, "WoffCmap10 layout");
+
+struct WoffCmap12 {
 	wuint16_t format;   // Subtable format; set to 12.0
 	PADMEMB[2];
 	wuint32_t length;   // Byte length of this subtable (including the header)
@@ -130,14 +212,29 @@ STRUCT WoffCmap12 {
 	wuint32_t nGroups;  // Number of groupings which follow
 	void print(const char* prefix=NULL, const char* head=NULL) const;
 };
-STRUCT WoffCmap12Group {
+static_assert(sizeof(WoffCmap12) == 16, "WoffCmap12 layout");
+struct WoffCmap12Group {
 	wuint32_t startCharCode;  // First character code in this group
 	wuint32_t endCharCode;    // Last character code in this group
 	wuint32_t startGlyphCode; // Glyph index corresponding to the starting character code; subsequent charcters are mapped to sequential glyphs
 	void print(const char* prefix=NULL, const char* head=NULL) const;
 };
+static_assert(sizeof(WoffCmap12Group) == 12, "WoffCmap12Group layout");
+
+// format 13 has the same layout as 12, but all characters of a group map to startGlyphCode
+
+struct WoffCmap14 {
+	wuint16_t format;                // Subtable format; set to 14
+	wuint32_t length;                // Byte length of this subtable (including this header)
+	wuint32_t numVarSelectorRecords; // Number of variation selector records
+	// 11 bytes each, 24-bit varSelector, 32-bit defaultUVSOffset and nonDefaultUVSOffset from the beginning of this subtable, or 0
+	// default UVS: 32-bit numUnicodeValueRanges, then 24-bit startUnicodeValue and 8-bit additionalCount each
+	// non-default UVS: 32-bit numUVSMappings, then 24-bit unicodeValue and 16-bit glyphID each
+	void print(const char* prefix=NULL, const char* head=NULL) const;
+};
+static_assert(sizeof(WoffCmap14) == 10, "WoffCmap14 layout");
 
-STRUCT WoffGlyph {
+struct WoffGlyph {
 	wuint16_t numberOfContours; // If the number of contours is positive or zero, it is a single glyph; If the number of contours less than zero, the glyph is compound
 	wint16_t xMin; // Minimum x for coordinate data
 	wint16_t yMin; // Minimum y for coordinate data
@@ -145,3 +242,4 @@ STRUCT WoffGlyph {
 	wint16_t yMax; // Maximum y for coordinate data
 	void print(const char* prefix=NULL, const char* head=NULL) const;
 };
+static_assert(sizeof(WoffGlyph) == 10, "WoffGlyph layout");
@@ -0,0 +1,71 @@
+#include "watch.hpp"
+#include <sys/inotify.h>
+#include <poll.h>
+
+
+Watch::Watch(): fd(inotify_init1(IN_CLOEXEC)) {
+	if (fd == -1) LOG_ERRNO("inotify_init1()");
+}
+
+
+Watch::~Watch() {
+	if (fd != -1) close(fd);
+}
+
+
+bool Watch::add(const char* fn) {
+	if (fd == -1) return false;
+	const char* base = strrchr(fn, '/');
+	char* dir = base? strndup(fn, MAX(base-fn, 1)): strdup("."); // keeps "/" as such
+	const int wd = inotify_add_watch(fd, dir, IN_CLOSE_WRITE|IN_MOVED_TO);
+	if (wd == -1) {
+		LOG_ERRNO("inotify_add_watch(%s)", dir);
+		free(dir);
+		return false;
+	}
+	free(dir);
+	files.push_back((watch_t){wd, base? base+1: fn}); // same descriptor for the same directory
+	return true;
+}
+
+
+bool Watch::wait(std::vector<bool>& changed, unsigned settle) {
+	changed.assign(files.size(), false);
+	bool any = false;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while (true) {
+		struct pollfd pfd = {fd, POLLIN, 0};
+		int rv = poll(&pfd, 1, any? (int)settle: -1);
+		if (rv < 0) {
+			if (errno == EINTR) continue;
+			LOG_ERRNO("poll()");
+			return false;
+		} else if (rv == 0) {
+			return true; // settled
+		}
+
+		ssize_t len = read(fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN) continue;
+			LOG_ERRNO("read()");
+			return false;
+		}
+		for (const char* p=buf; p<buf+len; ) {
+			const struct inotify_event* ev = (const struct inotify_event*)p;
+			p += sizeof(struct inotify_event) + ev->len;
+			if (ev->mask & IN_Q_OVERFLOW) { // lost events
+				changed.assign(files.size(), true);
+				any = true;
+				continue;
+			}
+			if (!ev->len) continue;
+			for (size_t i=0; i<files.size(); ++i) {
+				if (files[i].wd == ev->wd && strcmp(files[i].name, ev->name) == 0) {
+					LOG_INFO("changed: %s", ev->name);
+					changed[i] = true;
+					any = true;
+				}
+			}
+		}
+	}
+}
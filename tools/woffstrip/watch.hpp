@@ -0,0 +1,26 @@
+#pragma once
+#include "main.hpp"
+#include <vector>
+
+
+/**
+ * Waits for changes of a set of files via inotify.
+ * Their directories are watched instead, to also catch editors that replace files by renaming.
+ */
+class Watch {
+	private:
+		typedef struct {
+			int wd;
+			const char* name; // basename, borrowed
+		} watch_t;
+
+		int fd;
+		std::vector<watch_t> files;
+
+	public:
+		Watch();
+		~Watch();
+
+		bool add(const char*); // indices as added
+		bool wait(std::vector<bool>&, unsigned); // blocks until changes, then until none for the given milliseconds
+};
@@ -1,73 +1,100 @@
 #include "woff.hpp"
 #include "types.hpp"
 #include "io.hpp"
+#include "hash.hpp"
+#include "simd.hpp"
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
 
 
-Woff::Woff(char* b, size_t l):
-	orig_buf(b), orig_len(l),
+#define TABLE_DIRTY 0x01 // decoded data has been changed, compressed data is outdated
+#define TABLE_RAW   0x02 // compressed data is stored uncompressed and has not been tried to compress yet
+#define TABLE_CHANGED 0x04 // differs from the input, until reverted
+#define TABLE_SUMMED  0x08 // checksum is known to match the decoded data, so deltas can be applied to it
+#define TABLE_DROPPED 0x10 // left out of the output, until reverted
+
+#define GLYPH_DELETE 0x01 // contours stripped, as by delete_glyph()
+#define GLYPH_ALIGN  0x02 // as by align_glyph()
+
+#define MAX_COMPONENT_DEPTH 16 // of nested composite glyphs
+
+
+Woff::Woff(char* b, size_t l, uint64_t mtime):
+	orig_buf(b), orig_len(l), orig_mtime(mtime),
 	header(NULL),
-	ntables(0), tables(NULL), table_data(NULL),
-	indexToLocFormat(0), nloca(0), loca(NULL) {
+	ntables(0), orig_tables(NULL), tables(NULL), table_data(NULL), table_plain(NULL), table_state(NULL),
+	sfnt_in(false), sfnt_out(false),
+	meta(NULL), meta_len(0), meta_orig_len(0), priv(NULL), priv_len(0),
+	indexToLocFormat(0), nloca(0), loca(NULL), cff(NULL),
+	depidx(NULL), deps(NULL), keep(NULL), dropped(NULL), glyph_ops(NULL), glyph_align(0),
+	glyf_sum(arena), orig_cmaps(arena), cmaps(arena), index(NULL), table_cache(NULL), plain_hash(NULL) {
 }
 
 
 Woff::~Woff() {
 	free((void*)orig_buf); // const-cast
-	free(header);
-	free(tables);
+	delete index;
+	delete cff;
+	// everything else is in the arena
+}
+
+
+uint32_t Woff::checksum(const void* table, size_t len, uint32_t sum) {
+	assert(table && len);
+	return sum + be32_sum(table, len);
+}
+
+
+unsigned Woff::out_tables() const {
+	unsigned n = 0;
 	for (unsigned i=0; i<ntables; ++i) {
-		free(table_data[i]);
+		if (!(table_state[i] & TABLE_DROPPED)) ++n;
 	}
-	free(table_data);
-	free(loca);
+	return n;
 }
 
 
-wuint32_t Woff::checksum(const wuint32_t* table, size_t len, wuint32_t sum) {
-	assert(table && len);
-	while (len >= sizeof(wuint32_t)) {
-		sum = uint2w32(w2uint32(sum) + w2uint32(*table++));
-		len -= sizeof(wuint32_t);
+void Woff::sfnt_directory(SfntHeader& sfnt_header, SfntTableDirectoryEntry* entries) const {
+	const unsigned n = out_tables();
+	sfnt_header.flavor = header->flavor;
+	sfnt_header.numTables = uint2w16(n);
+	unsigned search_range = 1, entry_selector = 0;
+	while (search_range <= n) {
+		search_range <<= 1;
+		entry_selector++;
 	}
-	if (len) { // in case it's not fully initialized/padded (yet)
-		wuint32_t rem = 0;
-		memcpy(&rem, table, len);
-		sum = uint2w32(w2uint32(sum) + w2uint32(rem));
+	sfnt_header.searchRange = uint2w16((search_range >> 1) * 16);
+	sfnt_header.entrySelector = uint2w16(entry_selector - 1);
+	sfnt_header.rangeShift = uint2w16(n * 16 - w2uint16(sfnt_header.searchRange));
+
+	wuint32_t orig_offset = uint2w32(PAD4(sizeof(SfntHeader)) + PAD4(n*sizeof(SfntTableDirectoryEntry)));
+	for (unsigned i=0, j=0; i<ntables; ++i) {
+		if (table_state[i] & TABLE_DROPPED) continue;
+		entries[j].tag = tables[i].tag;
+		entries[j].checkSum = tables[i].origChecksum;
+		entries[j].offset = orig_offset;
+		entries[j].length = tables[i].origLength;
+		orig_offset = uint2w32(w2uint32(orig_offset) + PAD4(w2uint32(tables[i].origLength)));
+		++j;
 	}
-	return sum;
 }
 
 
 wuint32_t Woff::sfnt_checksum() const {
-	wuint32_t csum = 0;
+	uint32_t csum = 0;
 
 	SfntHeader sfnt_header;
-	sfnt_header.flavor = header->flavor;
-	sfnt_header.numTables = header->numTables;
-	sfnt_header.searchRange = 1;
-	sfnt_header.entrySelector = 0;
-	while (sfnt_header.searchRange <= ntables) {
-		sfnt_header.searchRange = sfnt_header.searchRange << 1;
-		sfnt_header.entrySelector++;
-	}
-	sfnt_header.searchRange = uint2w16((sfnt_header.searchRange >> 1) * 16);
-	sfnt_header.entrySelector = uint2w16(sfnt_header.entrySelector - 1);
-	sfnt_header.rangeShift = uint2w16(ntables * 16 - w2uint16(sfnt_header.searchRange));
-	csum = checksum((wuint32_t*)&sfnt_header, sizeof(sfnt_header), csum);
-
-	wuint32_t orig_offset = uint2w32(PAD4(sizeof(SfntHeader)) + PAD4(ntables*sizeof(SfntTableDirectoryEntry)));
-	for (unsigned i=0; i<ntables; ++i) {
-		SfntTableDirectoryEntry entry;
-		entry.tag = tables[i].tag;
-		entry.checkSum = tables[i].origChecksum;
-		entry.offset = orig_offset;
-		entry.length = tables[i].origLength;
-		csum = checksum((wuint32_t*)&entry, sizeof(entry), csum);
-		csum = checksum(&tables[i].origChecksum, sizeof(tables[i].origChecksum), csum);
-		orig_offset = uint2w32(w2uint32(orig_offset) + PAD4(w2uint32(tables[i].origLength)));
+	SfntTableDirectoryEntry* entries = (SfntTableDirectoryEntry*)arena.calloc(ntables, sizeof(SfntTableDirectoryEntry));
+	sfnt_directory(sfnt_header, entries);
+	csum = checksum(&sfnt_header, sizeof(sfnt_header), csum);
+	for (unsigned j=0; j<w2uint16(sfnt_header.numTables); ++j) {
+		csum = checksum(&entries[j], sizeof(entries[j]), csum);
+		csum += w2uint32(entries[j].checkSum);
 	}
+	arena.free(entries);
 
-	return uint2w32(0xB1B0AFBAu - w2uint32(csum));
+	return uint2w32(0xB1B0AFBAu - csum);
 }
 
 
@@ -79,34 +106,32 @@ bool Woff::update_sfnt_checksum() {
 	assert(w2uint32(head->origLength) == sizeof(WoffTableHead));
 	((WoffTableHead*)headdata)->checkSumAdjustment = sfnt_checksum();
 	if (!set_table("head", headdata, sizeof(WoffTableHead), false)) {
-		free(headdata);
 		return false;
 	}
 
 	LOG_INFO("updated full header checksum: %08x", w2uint32(((WoffTableHead*)headdata)->checkSumAdjustment));
-	free(headdata);
 	return true;
 }
 
 
 wuint32_t Woff::table_checksum(const char* name, const char* data, size_t len) {
-	wuint32_t csum;
+	uint32_t csum;
 	if (strcmp(name, "head") == 0) {
 		WoffTableHead head;
 		assert(len == sizeof(head));
 		memcpy(&head, data, sizeof(head));
-		head.checkSumAdjustment = 0; // To calculate the checkSum for the 'head' table which itself includes the checkSumAdjustment entry for the entire font, do the following: Set the checkSumAdjustment to 0.
-		csum = checksum((wuint32_t*)&head, sizeof(head));
+		head.checkSumAdjustment = uint2w32(0); // To calculate the checkSum for the 'head' table which itself includes the checkSumAdjustment entry for the entire font, do the following: Set the checkSumAdjustment to 0.
+		csum = checksum(&head, sizeof(head));
 	} else {
-		csum = checksum((wuint32_t*)data, len);
+		csum = checksum(data, len);
 	}
-	return csum;
+	return uint2w32(csum);
 }
 
 
 int Woff::get_table_index(const char* name) const {
 	for (unsigned i=0; i<ntables; ++i) {
-		if (strcmp(name, w2str32(tables[i].tag)) == 0) return i;
+		if (strcmp(name, w2str32(tables[i].tag)) == 0 && !(table_state[i] & TABLE_DROPPED)) return i;
 	}
 	return -1;
 }
@@ -122,16 +147,34 @@ WoffTableDirectoryEntry* Woff::get_table(const char* name, char** data) {
 	WoffTableDirectoryEntry* table = &tables[i];
 
 	if (data) {
-		if (!decompress(table_data[i], w2uint32(table->compLength), *data, w2uint32(table->origLength))) {
-			*data = NULL;
+		*data = get_plain(i);
+		if (!*data) return NULL;
+	}
+
+	return table;
+}
+
+
+char* Woff::get_plain(unsigned i) {
+	assert(i < ntables);
+	if (!table_plain[i]) {
+		if (!decompress(table_data[i], w2uint32(tables[i].compLength), table_plain[i], w2uint32(tables[i].origLength), arena)) {
+			table_plain[i] = NULL;
 			return NULL;
 		}
-		if (table->origChecksum != table_checksum(name, *data, w2uint32(table->origLength))) {
-			LOG_INFO("table '%s' checksum mismatch", name);
+		const char* name = w2str32(tables[i].tag);
+		if (config.verbose || config.paranoid) {
+			if (tables[i].origChecksum != table_checksum(name, table_plain[i], w2uint32(tables[i].origLength))) { // only reported
+				LOG("table '%s' checksum mismatch", name);
+			} else {
+				table_state[i] |= TABLE_SUMMED;
+			}
+		}
+		if (plain_hash && !(table_state[i] & TABLE_CHANGED)) {
+			plain_hash[i] = hash64(table_plain[i], w2uint32(tables[i].origLength));
 		}
 	}
-
-	return table;
+	return table_plain[i];
 }
 
 
@@ -144,29 +187,156 @@ bool Woff::set_table(const char* name, const char* data, size_t len, bool update
 	if (update_csum) {
 		wuint32_t csum = table_checksum(name, data, len);
 		if (csum == table->origChecksum) {
-			LOG("checksum for '%s' has not changed", name);
-			return false;
+			LOG_INFO("checksum for '%s' has not changed", name);
 		}
 		table->origChecksum = csum;
+		table_state[index] |= TABLE_SUMMED;
 		LOG_INFO("updated checksum for '%s': %08x", name, w2uint32(csum));
 	}
 
-	char* cdata;
-	size_t clen;
-	if (!docompress(data, len, cdata, &clen)) return false;
-	free(table_data[index]);
-	table_data[index] = cdata;
-	table->compLength = uint2w32(clen);
+	if (data != table_plain[index]) { // otherwise changed in-place
+		char* copy = (char*)memcpy(arena.calloc(1, PAD4(len)), data, len);
+		arena.free(table_plain[index]);
+		table_plain[index] = copy;
+	}
 	table->origLength = uint2w32(len);
+	table_state[index] |= TABLE_DIRTY|TABLE_CHANGED;
 	LOG_INFO("updated data for '%s'", name);
 
 	return true;
 }
 
 
-bool Woff::finalize() {
-	if (!update_offsets()) return false;
+void Woff::drop_table(const char* name) {
+	const int index = get_table_index(name);
+	if (index < 0) return;
+	table_state[index] |= TABLE_DROPPED|TABLE_CHANGED;
+	LOG_INFO("dropped '%s'", name);
+}
+
+
+bool Woff::set_table_sum(const char* name, const char* data, size_t len, uint32_t csum) {
+	if (config.paranoid && table_checksum(name, data, len) != uint2w32(csum)) { // the full pass only to verify
+		LOG("incremental checksum for '%s' does not match", name);
+		return false;
+	}
+	if (!set_table(name, data, len, false)) return false;
+	const int index = get_table_index(name);
+	tables[index].origChecksum = uint2w32(csum);
+	table_state[index] |= TABLE_SUMMED;
+	LOG_INFO("updated checksum for '%s': %08x", name, csum);
+	return true;
+}
+
+
+uint32_t Woff::known_checksum(unsigned i) {
+	// as base for deltas, the one from the input is trusted only once verified
+	assert(table_plain[i]);
+	if (!(table_state[i] & TABLE_SUMMED)) {
+		tables[i].origChecksum = table_checksum(w2str32(tables[i].tag), table_plain[i], w2uint32(tables[i].origLength));
+		table_state[i] |= TABLE_SUMMED;
+	}
+	return w2uint32(tables[i].origChecksum);
+}
+
+
+bool Woff::sum_glyf(const char* glyfbuf, size_t glyflen) {
+	// a single pass on the first in-memory change, later ones are applied by glyph
+	if (!glyf_sum.empty()) return true;
+	for (unsigned i=0; i<nloca; ++i) {
+		if (loca[i] > loca[i+1]) return false; // overlapping, full checksums then
+	}
+	if (loca[nloca] > glyflen) return false;
+
+	size_t* bounds = (size_t*)arena.alloc((nloca+3) * sizeof(size_t));
+	bounds[0] = 0;
+	for (unsigned i=0; i<nloca+1; ++i) {
+		bounds[i+1] = loca[i];
+	}
+	bounds[nloca+2] = glyflen;
+	glyf_sum.build(glyfbuf, bounds, nloca+2);
+	arena.free(bounds);
+	return true;
+}
+
+
+bool Woff::verify_compressed(const char* src, size_t len, const char* cdata, size_t clen) {
+	char* plain = NULL;
+	if (!decompress(cdata, clen, plain, len, arena)) return false;
+	const bool rv = memcmp(plain, src, len) == 0;
+	arena.free(plain);
+	return rv;
+}
+
+
+bool Woff::compress_tables() {
+	for (unsigned i=0; i<ntables; ++i) {
+		if (!(table_state[i] & (TABLE_DIRTY|TABLE_RAW)) || (table_state[i] & TABLE_DROPPED)) continue;
+		const char* src = (table_state[i] & TABLE_DIRTY)? table_plain[i]: table_data[i];
+		const size_t len = w2uint32(tables[i].origLength);
+		char* cdata;
+		size_t clen;
+		if (plain_hash && plain_hash[i] && !sfnt_in && (table_state[i] & TABLE_DIRTY) && tables[i].origLength == orig_tables[i].origLength && tables[i].origChecksum == orig_tables[i].origChecksum && hash64(src, len) == plain_hash[i]) {
+			// unchanged after all, the original bytes do not depend on the zlib version or the chunking
+			clen = w2uint32(orig_tables[i].compLength);
+			cdata = (char*)memcpy(arena.calloc(1, PAD4(clen) + 4), orig_buf + w2uint32(orig_tables[i].offset), clen);
+			LOG_INFO("keeping original '%s'", w2str32(tables[i].tag));
+		} else if (!config.single_stream && !glyf_chunks.empty() && len > 2*GLYF_CHUNK && strcmp(w2str32(tables[i].tag), "glyf") == 0) {
+			if (!compress_glyf(src, len, cdata, clen)) return false;
+		} else if (table_cache) {
+			if (!table_cache->compress(src, len, cdata, clen, arena)) return false;
+		} else {
+			if (!docompress(src, len, cdata, &clen, arena)) return false;
+		}
+		if (config.paranoid && !verify_compressed(src, len, cdata, clen)) {
+			LOG("compressed '%s' does not match", w2str32(tables[i].tag));
+			return false;
+		}
+		arena.free(table_data[i]);
+		table_data[i] = cdata;
+		tables[i].compLength = uint2w32(clen);
+		table_state[i] &= ~(TABLE_DIRTY|TABLE_RAW);
+		LOG_INFO("compressed '%s': %u -> %zu", w2str32(tables[i].tag), w2uint32(tables[i].origLength), clen);
+	}
+	return true;
+}
+
+
+bool Woff::compress_glyf(const char* src, size_t len, char*& cdata, size_t& clen) {
+	assert(!glyf_chunks.empty());
+	const size_t n = glyf_chunks.size();
+	size_t* bounds = (size_t*)arena.alloc((n+1) * sizeof(size_t));
+	bounds[0] = 0;
+	for (size_t c=1; c<n; ++c) {
+		bounds[c] = MAX(bounds[c-1], MIN(loca[glyf_chunks[c]], len));
+	}
+	bounds[n] = len;
+
+	const bool rv = glyf_deflate.compress(src, bounds, n, cdata, clen, arena, config.threads);
+	arena.free(bounds);
+	return rv;
+}
+
+
+bool Woff::finalize(bool sfnt) {
+	sfnt_out = sfnt;
+	if (glyph_ops) {
+		assert(!sfnt);
+		if (!stream_glyf()) return false;
+	}
+	if (cff && !update_cff()) return false;
+	if (dropped && !update_layout()) return false;
 	if (!update_sfnt_checksum()) return false;
+	if (sfnt) {
+		if (meta || priv) LOG("metadata and private data blocks cannot be kept for sfnt output");
+		for (unsigned i=0; i<ntables; ++i) {
+			if (!(table_state[i] & TABLE_DROPPED) && !get_plain(i)) return false;
+		}
+	} else {
+		if (!compress_tables()) return false;
+	}
+	if (!update_offsets()) return false;
+	LOG_INFO("working memory: %zu bytes peak, %zu bytes allocated", arena.getPeak(), arena.getSystem());
 	return true;
 }
 
@@ -179,7 +349,6 @@ WoffGlyph* Woff::get_glyph(size_t start, size_t end, char*& buf, size_t& len) {
 
 	assert(end > start && end-start >= sizeof(WoffGlyph));
 	if (len < end) {
-		free(buf);
 		buf = NULL;
 		return NULL;
 	}
@@ -213,14 +382,14 @@ int Woff::align_glyph(WoffGlyph* g, int setTo) {
 	uint8_t* instructions = (uint8_t*)(instructionLength + 1);
 
 	uint8_t* flagptr = instructions + w2uint16(*instructionLength);
-	uint8_t** flags = (uint8_t**)calloc(coords, sizeof(uint8_t*));
+	uint8_t** flags = (uint8_t**)arena.calloc(coords, sizeof(uint8_t*));
 	uint16_t flaglen = 0;
 	for (uint16_t f=0; f<coords;) {
 		assert((flagptr[flaglen] & 0xC0) == 0); // reserved
 		if (flagptr[flaglen] & 0x08) { // If set, the next byte specifies the number of additional times this set of flags is to be repeated. In this way, the number of flags listed can be smaller than the number of points in a character.
 			if (flaglen+1 >= coords || !flagptr[flaglen+1] || f+flagptr[flaglen+1] >= coords || flaglen+flagptr[flaglen+1] >= coords) {
 				LOG("Bogus repeat flag: %u %u %u %u", flagptr[flaglen+1], f, flaglen, coords);
-				free(flags);
+				arena.free(flags);
 				return -1;
 			}
 			for (uint16_t ff=0; ff<flagptr[flaglen+1]+1; ++ff) {
@@ -266,19 +435,19 @@ int Woff::align_glyph(WoffGlyph* g, int setTo) {
 			}
 		}
 	} else if ((*flags[0] & 0x20) == 0) { // !Y_IS_SAME_OR_POSITIVE_X_SHORT_VECTOR: the current coordinate is a signed 16-bit delta vector
-		val = (int32_t)(w2uint16(*((wuint16_t*)y_start))); // signed 16bit
+		val = w2int16(*((wint16_t*)y_start));
 		if (val + adjust >= INT16_MIN) {
-			*((int16_t*)y_start) = (int16_t)uint2w16((int16_t)(val + adjust));
+			*((wint16_t*)y_start) = int2w16((int16_t)(val + adjust));
 			fixed = true;
 		}
 	}
 
 	if (!fixed) {
 		LOG("TODO: could not adjust coordinates, going on anyways.."); // TODO: memmove + insert needed
-		free(flags);
+		arena.free(flags);
 		return 0; // not fatal
 	}
-	free(flags);
+	arena.free(flags);
 
 	assert(w2int16(g->yMin) + adjust == setTo);
 	g->yMin = int2w16(w2int16(g->yMin) + adjust);
@@ -289,11 +458,15 @@ int Woff::align_glyph(WoffGlyph* g, int setTo) {
 }
 
 
-size_t Woff::delete_glyph(size_t start, size_t end) {
+bool Woff::delete_glyph(index_t index, size_t& dellen) {
+	const size_t start = loca[index], end = loca[index+1];
+	dellen = 0;
+	if (end-start <= sizeof(WoffGlyph)) return true; // already stripped
 	char* glyfbuf = NULL;
 	size_t glyflen;
 	WoffGlyph* g = get_glyph(start, end, glyfbuf, glyflen);
 	if (!g) return false;
+	const bool summed = sum_glyf(glyfbuf, glyflen);
 
 	// TODO: completely removing should be legit, as: "If a glyph has no outline, then loca[n] = loca [n+1]." - but this gave display issues?..
 	memmove(glyfbuf+start+sizeof(WoffGlyph), glyfbuf+end, glyflen-end);
@@ -302,24 +475,158 @@ size_t Woff::delete_glyph(size_t start, size_t end) {
 	g->print("  ", "deleting glyph contours");
 	g->numberOfContours = uint2w16(0); // keep min/max bounding box
 
-	if (!set_table("glyf", glyfbuf, glyflen)) {
-		free(glyfbuf);
-		return 0;
+	bool rv;
+	if (summed) { // the glyph is span index+1, all following ones moved
+		glyf_sum.set(index+1, (const char*)g, sizeof(WoffGlyph), start);
+		glyf_sum.shift(index+2, -(ssize_t)(end-start-sizeof(WoffGlyph)));
+		rv = set_table_sum("glyf", glyfbuf, glyflen, glyf_sum.sum());
+	} else {
+		rv = set_table("glyf", glyfbuf, glyflen);
+	}
+	if (rv) dellen = end-start-sizeof(WoffGlyph);
+	return rv;
+}
+
+
+bool Woff::open_glyf(GlyfReader& reader, size_t& len) {
+	const int i = get_table_index("glyf");
+	if (i < 0) {
+		LOG("table 'glyf' not found");
+		return false;
+	}
+	assert(!(table_state[i] & TABLE_DIRTY)); // never decoded as a whole
+	len = w2uint32(tables[i].origLength);
+	if (!reader.open(table_data[i], w2uint32(tables[i].compLength), len)) {
+		LOG("cannot read 'glyf'");
+		return false;
+	}
+	return true;
+}
+
+
+bool Woff::stream_glyf() {
+	// a single pass in loca order: deleted glyphs are cut to their header, aligned ones patched in a copy, all deflated right away
+	GlyfReader reader(arena, config.glyf_window);
+	size_t glyflen;
+	if (!open_glyf(reader, glyflen)) return false;
+	TableWriter writer(arena);
+	uint32_t* offsets = (uint32_t*)arena.alloc((nloca+1) * sizeof(uint32_t));
+
+	bool rv = true;
+	size_t deleted = 0;
+	if (loca[0]) { // leading data, kept as when deleting in memory
+		const char* t = reader.get(0, loca[0]);
+		rv = t && writer.write(t, loca[0]);
+	}
+	for (unsigned i=0; i<nloca && rv; ++i) {
+		offsets[i] = writer.size();
+		const size_t len = loca[i+1] - loca[i];
+		if (!len) continue;
+		const char* g = reader.get(loca[i], loca[i+1]);
+		if (!g) {
+			LOG("cannot read glyph #%u", i);
+			rv = false;
+		} else if ((glyph_ops[i] & GLYPH_DELETE) && len > sizeof(WoffGlyph)) {
+			WoffGlyph h;
+			memcpy(&h, g, sizeof(h));
+			h.print("  ", "deleting glyph contours");
+			h.numberOfContours = uint2w16(0); // keep min/max bounding box
+			rv = writer.write((const char*)&h, sizeof(h));
+			deleted += len - sizeof(WoffGlyph);
+		} else if ((glyph_ops[i] & GLYPH_ALIGN) && len >= sizeof(WoffGlyph)) {
+			char* copy = (char*)memcpy(arena.alloc(len), g, len);
+			((WoffGlyph*)copy)->print("  ", "aligning glyph");
+			if (align_glyph((WoffGlyph*)copy, glyph_align) < 0) {
+				LOG("cannot align glyph #%u", i);
+				rv = false;
+			} else {
+				rv = writer.write(copy, len);
+			}
+			arena.free(copy);
+		} else {
+			rv = writer.write(g, len);
+		}
 	}
-	free(glyfbuf);
-	return end-start-sizeof(WoffGlyph);
+	offsets[nloca] = writer.size();
+	if (rv && loca[nloca] < glyflen) { // trailing data, likewise
+		const char* t = reader.get(loca[nloca], glyflen);
+		rv = t && writer.write(t, glyflen - loca[nloca]);
+	}
+
+	char* cdata;
+	size_t clen;
+	if (!rv || !writer.finish(cdata, clen)) {
+		arena.free(offsets);
+		return false;
+	}
+	if (config.paranoid) { // whole table after all, only to verify the streamed checksum
+		char* plain = NULL;
+		const bool ok = decompress(cdata, clen, plain, writer.size(), arena) && table_checksum("glyf", plain, writer.size()) == uint2w32(writer.checksum());
+		arena.free(plain);
+		if (!ok) {
+			LOG("streamed 'glyf' does not match");
+			arena.free(cdata);
+			return false;
+		}
+	}
+	const int gi = get_table_index("glyf");
+	arena.free(table_data[gi]);
+	table_data[gi] = cdata;
+	tables[gi].compLength = uint2w32(clen);
+	tables[gi].origLength = uint2w32(writer.size());
+	tables[gi].origChecksum = uint2w32(writer.checksum());
+	table_state[gi] = (table_state[gi] & ~TABLE_RAW) | TABLE_CHANGED;
+	LOG_INFO("streamed 'glyf': %zu -> %zu, %zu bytes of contours deleted, compressed to %zu", glyflen, writer.size(), deleted, clen);
+
+	// loca by the new offsets
+	memcpy(loca, offsets, (nloca+1) * sizeof(uint32_t));
+	arena.free(offsets);
+	char* locabuf = NULL;
+	WoffTableDirectoryEntry* l = get_table("loca", &locabuf);
+	if (!l) return false;
+	if (indexToLocFormat) {
+		for (unsigned i=0; i<nloca+1; ++i) ((wuint32_t*)locabuf)[i] = uint2w32(loca[i]);
+	} else {
+		for (unsigned i=0; i<nloca+1; ++i) {
+			assert(loca[i] % 2 == 0);
+			((wuint16_t*)locabuf)[i] = uint2w16(loca[i] / 2);
+		}
+	}
+	return set_table("loca", locabuf, w2uint32(l->origLength));
 }
 
 
 bool Woff::update_offsets() {
-	uint32_t sfntlen = PAD4(sizeof(SfntHeader)) + PAD4(ntables * sizeof(SfntTableDirectoryEntry));
-	uint32_t offset = PAD4(sizeof(WoffHeader)) + PAD4(ntables * sizeof(WoffTableDirectoryEntry));
+	const unsigned n = out_tables();
+	header->numTables = uint2w16(n);
+	uint32_t sfntlen = PAD4(sizeof(SfntHeader)) + PAD4(n * sizeof(SfntTableDirectoryEntry));
+	uint32_t offset = PAD4(sizeof(WoffHeader)) + PAD4(n * sizeof(WoffTableDirectoryEntry));
 	for (unsigned i=0; i<ntables; ++i) {
+		if (table_state[i] & TABLE_DROPPED) continue;
 		WoffTableDirectoryEntry* table = &tables[i];
 		table->offset = uint2w32(offset);
 		sfntlen += PAD4(w2uint32(table->origLength));
 		offset += PAD4(w2uint32(table->compLength));
 	}
+
+	// blocks as by the WOFF spec, the last one is not padded
+	if (meta) {
+		header->metaOffset = uint2w32(offset);
+		header->metaLength = uint2w32(meta_len);
+		header->metaOrigLength = uint2w32(meta_orig_len);
+		offset += meta_len;
+	} else {
+		header->metaOffset = header->metaLength = header->metaOrigLength = uint2w32(0);
+	}
+	if (priv) {
+		offset = PAD4(offset);
+		header->privOffset = uint2w32(offset);
+		header->privLength = uint2w32(priv_len);
+		offset += priv_len;
+	} else {
+		header->privOffset = header->privLength = uint2w32(0);
+	}
+
 	header->length = uint2w32(offset);
 	header->totalSfntSize = uint2w32(sfntlen);
 	return true;
@@ -327,29 +634,146 @@ bool Woff::update_offsets() {
 
 
 bool Woff::parseHeader() {
+	if (orig_len < sizeof(SfntHeader)) return false;
+	const uint32_t signature = w2uint32(*(const wuint32_t*)orig_buf);
+	if (signature == 0x00010000u || signature == 0x4F54544Fu || signature == 0x74727565u) { // TrueType, 'OTTO', 'true'
+		return parseSfntHeader();
+	} else if (signature == 0x774F4632u) { // 'wOF2'
+		LOG("WOFF2 is not supported");
+		return false;
+	}
+
 	if (orig_len < sizeof(WoffHeader)) return false;
-	header = (WoffHeader*)memcpy(calloc(1, sizeof(WoffHeader)+4), orig_buf, sizeof(WoffHeader));
+	header = (WoffHeader*)memcpy(arena.calloc(1, sizeof(WoffHeader)+4), orig_buf, sizeof(WoffHeader));
 	header->print("  ", "WOFF header");
 
 	if (w2uint32(header->length) != orig_len) { // TODO: more checks
 		LOG("header length mismatch");
 		return false;
 	}
-	if (w2uint32(header->metaLength) || w2uint32(header->privLength)) {
-		LOG("unknown metadata present");
+	return parse_blocks();
+}
+
+
+bool Woff::parse_blocks() {
+	// extended metadata and private data blocks, after the table data, kept as slices
+	meta = priv = NULL;
+	meta_len = meta_orig_len = priv_len = 0;
+	const size_t dirlen = sizeof(WoffHeader) + w2uint16(header->numTables) * sizeof(WoffTableDirectoryEntry);
+	if ((meta_len = w2uint32(header->metaLength)) != 0) {
+		const size_t offset = w2uint32(header->metaOffset);
+		meta_orig_len = w2uint32(header->metaOrigLength);
+		if (offset < dirlen || offset > orig_len || meta_len > orig_len - offset || !meta_orig_len) {
+			LOG("invalid metadata block");
+			return false;
+		}
+		meta = orig_buf + offset;
+		LOG_INFO("metadata: %zu -> %zu bytes", meta_len, meta_orig_len);
+	}
+	if ((priv_len = w2uint32(header->privLength)) != 0) {
+		const size_t offset = w2uint32(header->privOffset);
+		if (offset < dirlen || offset > orig_len || priv_len > orig_len - offset) {
+			LOG("invalid private data block");
+			return false;
+		}
+		priv = orig_buf + offset;
+		LOG_INFO("private data: %zu bytes", priv_len);
+	}
+	return true;
+}
+
+
+bool Woff::parseSfntHeader() {
+	const SfntHeader* sfnt_header = (const SfntHeader*)orig_buf;
+	sfnt_in = true;
+
+	// virtual WOFF header, the sizes are computed when finalizing
+	header = (WoffHeader*)arena.calloc(1, sizeof(WoffHeader)+4);
+	header->signature = uint2w32(0x774F4646u); // 'wOFF'
+	header->flavor = sfnt_header->flavor;
+	header->numTables = sfnt_header->numTables;
+	header->totalSfntSize = uint2w32(orig_len);
+	header->print("  ", "sfnt header");
+	return true;
+}
+
+
+bool Woff::parseSfntTables() {
+	ntables = w2uint16(header->numTables);
+	if (!ntables || (sizeof(SfntHeader) + ntables * sizeof(SfntTableDirectoryEntry)) > orig_len) {
 		return false;
 	}
+	const SfntTableDirectoryEntry* entries = (const SfntTableDirectoryEntry*)(orig_buf + sizeof(SfntHeader));
+
+	tables = (WoffTableDirectoryEntry*)arena.calloc(1, ntables * sizeof(WoffTableDirectoryEntry) + 4);
+	table_data = (char**)arena.calloc(ntables, sizeof(char*));
+	table_plain = (char**)arena.calloc(ntables, sizeof(char*));
+	table_state = (uint8_t*)arena.calloc(ntables, sizeof(uint8_t));
+	for (unsigned i=0; i<ntables; ++i) {
+		const size_t offset = w2uint32(entries[i].offset);
+		const size_t length = w2uint32(entries[i].length);
+		if (offset > orig_len || length > orig_len - offset) {
+			return false;
+		}
+		tables[i].tag = entries[i].tag;
+		tables[i].offset = entries[i].offset;
+		tables[i].compLength = entries[i].length; // stored uncompressed, so decompressing is a copy only
+		tables[i].origLength = entries[i].length;
+		tables[i].origChecksum = entries[i].checkSum;
+		tables[i].print("  ", "table");
+	}
+	orig_tables = (WoffTableDirectoryEntry*)memcpy(arena.alloc(ntables * sizeof(WoffTableDirectoryEntry)), tables, ntables * sizeof(WoffTableDirectoryEntry));
+	if (config.deterministic) sort_tables();
+	for (unsigned i=0; i<ntables; ++i) {
+		load_table(i);
+	}
 	return true;
 }
 
 
+void Woff::sort_tables() {
+	// canonical order by tag as demanded by the spec anyways, the output lays out the data in directory order
+	plain_hash = (uint64_t*)arena.calloc(ntables, sizeof(uint64_t));
+	bool sorted = true;
+	for (unsigned i=1; i<ntables && sorted; ++i) {
+		sorted = w2uint32(tables[i-1].tag) < w2uint32(tables[i].tag);
+	}
+	if (sorted) return;
+
+	WoffTableDirectoryEntry* v = (WoffTableDirectoryEntry*)memcpy(arena.alloc(ntables * sizeof(WoffTableDirectoryEntry)), orig_tables, ntables * sizeof(WoffTableDirectoryEntry));
+	for (unsigned i=1; i<ntables; ++i) {
+		for (unsigned j=i; j>0 && w2uint32(v[j-1].tag) > w2uint32(v[j].tag); --j) {
+			std::swap(v[j-1], v[j]);
+		}
+	}
+	if (orig_tables != (const WoffTableDirectoryEntry*)(orig_buf + sizeof(WoffHeader))) arena.free((void*)orig_tables); // owned for sfnt
+	orig_tables = v;
+	memcpy(tables, orig_tables, ntables * sizeof(WoffTableDirectoryEntry));
+	LOG_INFO("sorted table directory");
+}
+
+
+void Woff::load_table(unsigned i) {
+	// as in the input, which is stored uncompressed for sfnt
+	const size_t len = w2uint32(orig_tables[i].compLength);
+	table_data[i] = (char*)memcpy(arena.calloc(1, PAD4(len) + 4), orig_buf + w2uint32(orig_tables[i].offset), len);
+	table_plain[i] = NULL;
+	table_state[i] = sfnt_in? TABLE_RAW: 0;
+}
+
+
 bool Woff::parseTables() {
+	if (sfnt_in) {
+		if (!parseSfntTables()) return false;
+		return parseHead();
+	}
+
 	ntables = w2uint16(header->numTables);
 	if (!ntables || (sizeof(WoffHeader) + ntables * sizeof(WoffTableDirectoryEntry)) > orig_len) {
 		return false;
 	}
 	tables = (WoffTableDirectoryEntry*)memcpy(
-		calloc(1, ntables * sizeof(WoffTableDirectoryEntry) + 4),
+		arena.calloc(1, ntables * sizeof(WoffTableDirectoryEntry) + 4),
 		orig_buf + sizeof(WoffHeader),
 		ntables * sizeof(WoffTableDirectoryEntry)
 	);
@@ -359,18 +783,25 @@ bool Woff::parseTables() {
 		assert(w2uint32(tables[i].offset) % 4 == 0); // TODO: more checks
 	}
 
-	table_data = (char**)calloc(ntables, sizeof(char*));
+	table_data = (char**)arena.calloc(ntables, sizeof(char*));
+	table_plain = (char**)arena.calloc(ntables, sizeof(char*));
+	table_state = (uint8_t*)arena.calloc(ntables, sizeof(uint8_t));
 	for (unsigned i=0; i<ntables; ++i) {
 		if (w2uint32(tables[i].offset) + w2uint32(tables[i].compLength) > orig_len) {
 			return false;
 		}
-		table_data[i] = (char*)memcpy(
-			calloc(1, w2uint32(tables[i].compLength) + 4),
-			orig_buf + w2uint32(tables[i].offset),
-			w2uint32(tables[i].compLength)
-		);
 	}
+	orig_tables = (WoffTableDirectoryEntry*)(orig_buf + sizeof(WoffHeader));
+	if (config.deterministic) sort_tables();
+	for (unsigned i=0; i<ntables; ++i) {
+		load_table(i);
+	}
+
+	return parseHead();
+}
 
+
+bool Woff::parseHead() {
 	char* headdata = NULL;
 	WoffTableDirectoryEntry* head = get_table("head", &headdata);
 	if (!head) return false;
@@ -379,7 +810,6 @@ bool Woff::parseTables() {
 	if (((WoffTableHead*)headdata)->checkSumAdjustment != sfnt_checksum()) {
 		LOG_INFO("overall checksum mismatch, ignoring");
 	}
-	free(headdata);
 
 	return true;
 }
@@ -390,16 +820,24 @@ bool Woff::parseCharMaps() {
 	WoffTableDirectoryEntry* cmap = get_table("cmap", &buf);
 	if (!cmap) return false;
 
-	if (!cmaps.parse(buf, w2uint32(cmap->origLength))) {
-		free(buf);
-		return false;
-	}
-	free(buf);
+	if (!orig_cmaps.parse(buf, w2uint32(cmap->origLength))) return false;
+	revert_cmaps();
 	return true;
 }
 
 
+void Woff::revert_cmaps() {
+	size_t nruns, nuvs;
+	const cmap_run_t* runs = orig_cmaps.getRuns(nruns);
+	const cmap_uvs_t* uvs = orig_cmaps.getVariations(nuvs);
+	cmaps.assign(runs, nruns, uvs, nuvs); // changes are made on a copy
+}
+
+
 bool Woff::parseLoca() {
+	if (get_table_index("loca") < 0 && (get_table_index("CFF ") >= 0 || get_table_index("CFF2") >= 0)) {
+		return parse_cff();
+	}
 	char* locabuf = NULL;
 	WoffTableDirectoryEntry* l = get_table("loca", &locabuf);
 	if (!l) return false;
@@ -408,16 +846,12 @@ bool Woff::parseLoca() {
 	char* headbuf = NULL;
 	WoffTableDirectoryEntry* head = get_table("head", &headbuf);
 	if (!head) {
-		free(locabuf);
 		return false;
 	}
 	indexToLocFormat = w2uint16(((WoffTableHead*)headbuf)->indexToLocFormat);
 	if (indexToLocFormat != 0 && indexToLocFormat != 1) {
-		free(locabuf);
-		free(headbuf);
 		return false;
 	}
-	free(headbuf);
 
 	if (indexToLocFormat) {
 		assert(localen % sizeof(wuint32_t) == 0);
@@ -436,161 +870,1697 @@ bool Woff::parseLoca() {
 	offsets.u16 = (wuint16_t*)locabuf;
 
 	assert(!loca);
-	loca = (range_t*)calloc(nloca, sizeof(range_t));
-	for (unsigned i=0; i<nloca; ++i) {
-		if (indexToLocFormat) {
-			loca[i].from = w2uint32(offsets.u32[i]);
-			loca[i].to = w2uint32(offsets.u32[i+1]);
-		} else {
-			loca[i].from = w2uint16(offsets.u16[i]) * 2;
-			loca[i].to = w2uint16(offsets.u16[i+1]) * 2;
+	loca = (uint32_t*)arena.calloc(nloca+1, sizeof(uint32_t));
+	if (indexToLocFormat) {
+		be32_to_host(loca, offsets.u32, nloca+1);
+	} else {
+		for (unsigned i=0; i<nloca+1; ++i) {
+			loca[i] = w2uint16(offsets.u16[i]) * 2;
 		}
 	}
 
 	LOG_INFO("parsed %u loca/glyph indices", nloca);
+	chunk_glyphs();
 	for (unsigned i=0; i<nloca; ++i) {
-		LOG_DUMP("  glyph %u @ %zu (#%zu)", i, loca[i].from, loca[i].to-loca[i].from);
+		LOG_DUMP("  glyph %u @ %u (#%u)", i, loca[i], loca[i+1]-loca[i]);
 	}
-	free(locabuf);
 	return true;
 }
 
 
-unsigned Woff::getMinAlignment(const std::vector<char_range_t>& v, unsigned usermin) {
+void Woff::chunk_glyphs() {
+	// glyph aligned by the original offsets, so that changes neither shift subsequent boundaries nor depend on previous runs
+	if (!glyf_chunks.empty()) return;
+	glyf_chunks.push_back(0);
+	for (unsigned i=1; i<nloca; ++i) {
+		if (loca[i] - loca[glyf_chunks.back()] >= GLYF_CHUNK) glyf_chunks.push_back(i);
+	}
+}
+
+
+bool Woff::parse_cff() {
+	// charstrings by glyph instead of loca, the table is borrowed until changed
+	assert(!cff);
+	const char* name = (get_table_index("CFF2") >= 0)? "CFF2": "CFF ";
 	char* buf = NULL;
-	size_t len;
-	int headermin;
-	{
-		if (!get_table("head", &buf)) return -1;
-		WoffTableHead* head = (WoffTableHead*)buf;
-		if ((w2uint16(head->flags) & 0x01) != 1) {
-			LOG("baseline is not at y=0");
-			free(buf);
-			return 0;
-		}
-		headermin = w2int16(head->yMin);
-		LOG_INFO("global bounding box minimum y is %d (baseline 0)", headermin);
-		free(buf);
-		buf = NULL;
+	WoffTableDirectoryEntry* t = get_table(name, &buf);
+	if (!t) return false;
+	cff = new Cff(arena);
+	if (!cff->parse(buf, w2uint32(t->origLength), name[3] == '2')) {
+		LOG("cannot parse '%s'", name);
+		return false;
 	}
+	nloca = cff->glyphs();
+	LOG_INFO("parsed %u '%s' charstrings", nloca, name);
+	return true;
+}
 
-	if (usermin) {
-		if ((int)usermin < headermin) {
-			LOG("given alignment %u is less than global bounding box minimum y %d", usermin, headermin);
-			return 0;
-		} else {
-			return usermin;
-		}
+
+bool Woff::update_cff() {
+	if (!cff->isChanged() && !config.desubroutinize) return true;
+	size_t len;
+	char* buf = cff->encode(len, config.desubroutinize);
+	if (!buf) return false;
+	const bool rv = set_table(cff->isCff2()? "CFF2": "CFF ", buf, len);
+	arena.free(buf);
+	return rv;
+}
+
+
+static const char* const layout_tables[] = {"GDEF", "GSUB", "GPOS", "kern"};
+#define LAYOUT_TABLES (sizeof(layout_tables)/sizeof(*layout_tables))
+
+static bool is_layout_table(const char* name) {
+	for (unsigned t=0; t<LAYOUT_TABLES; ++t) {
+		if (strcmp(name, layout_tables[t]) == 0) return true;
 	}
+	return false;
+}
 
-	unsigned min = 0;
-	for (std::vector<char_range_t>::const_iterator it=v.begin(); it!=v.end(); ++it) {
-		for (char_t c=it->from; c<=it->to; ++c) {
-			index_t i = cmaps.find(c);
-			if (!i) continue;
-			assert(i<nloca);
-			if (loca[i].from == loca[i].to) continue;
-			const WoffGlyph* g = get_glyph(loca[i].from, loca[i].to, buf, len);
-			if (!g) continue;
-			if (w2int16(g->yMin) > 0 && w2int16(g->yMin) < (int)min) {
-				min = (unsigned)w2int16(g->yMin);
+
+bool Woff::update_layout() {
+	// without the rules and records of the dropped glyphs, as they cannot occur anymore
+	Layout layout(arena, dropped, nloca);
+	for (unsigned t=0; t<LAYOUT_TABLES; ++t) {
+		if (get_table_index(layout_tables[t]) < 0) continue;
+		char* buf = NULL;
+		WoffTableDirectoryEntry* table = get_table(layout_tables[t], &buf);
+		if (!table) return false;
+		const size_t len = w2uint32(table->origLength);
+		size_t outlen;
+		char* out = layout.prune(layout_tables[t], buf, len, outlen);
+		if (!out) {
+			LOG("cannot prune '%s', keeping it", layout_tables[t]);
+			continue;
+		}
+		if (config.paranoid) { // pruning again changes nothing
+			size_t againlen;
+			char* again = layout.prune(layout_tables[t], out, outlen, againlen);
+			const bool same = again && againlen == outlen && memcmp(again, out, outlen) == 0;
+			arena.free(again);
+			if (!same) {
+				LOG("pruned '%s' is not stable", layout_tables[t]);
+				arena.free(out);
+				return false;
 			}
-			free(buf);
 		}
+		bool rv = true;
+		if (outlen != len || memcmp(out, buf, len)) {
+			LOG_INFO("pruned '%s': %zu -> %zu bytes", layout_tables[t], len, outlen);
+			rv = set_table(layout_tables[t], out, outlen);
+		}
+		arena.free(out);
+		if (!rv) return false;
 	}
-	return MAX(MAX(1, headermin), min);
+	return true;
 }
 
 
-bool Woff::alignCharIndex(index_t index, unsigned align) {
-	assert(index > 0 && index < nloca);
-	assert(align > 0); // as 0 is baseline and seems to break everything
-	if (loca[index].from == loca[index].to) return true;
-
-	char* gbuf;
-	size_t glen;
-	WoffGlyph* g = get_glyph(loca[index].from, loca[index].to, gbuf, glen);
-	if (!g) return false;
-	g->print("  ", "aligning glyph");
+bool Woff::parseComposites() {
+	assert((loca || cff) && !depidx);
+	if (cff) { // accented composites
+		std::vector<uint32_t, ArenaAllocator<uint32_t> > v((ArenaAllocator<uint32_t>(arena)));
+		depidx = (uint32_t*)arena.calloc(nloca+1, sizeof(uint32_t));
+		for (unsigned i=0; i<nloca; ++i) {
+			depidx[i] = v.size();
+			index_t c[2];
+			unsigned n;
+			if (!cff->components(i, c, n)) {
+				LOG("cannot read glyph #%u", i);
+				return false;
+			}
+			for (unsigned k=0; k<n; ++k) {
+				LOG_DUMP("  glyph %u uses %u", i, c[k]);
+				v.push_back(c[k]);
+			}
+		}
+		depidx[nloca] = v.size();
+		deps = (uint32_t*)arena.alloc(MAX(v.size(), 1) * sizeof(uint32_t));
+		if (!v.empty()) memcpy(deps, &v[0], v.size() * sizeof(uint32_t));
+		LOG_INFO("parsed %zu accented composite components", v.size());
+		return true;
+	}
+	char* glyfbuf = NULL;
+	size_t glyflen;
+	GlyfReader reader(arena, config.glyf_window);
+	if (config.glyf_window) {
+		if (!open_glyf(reader, glyflen)) return false;
+	} else {
+		WoffTableDirectoryEntry* glyf = get_table("glyf", &glyfbuf);
+		if (!glyf) return false;
+		glyflen = w2uint32(glyf->origLength);
+	}
 
-	int aligned = align_glyph(g, align);
-	if (aligned < 0) {
-		free(gbuf);
-		return false;
-	} else if (aligned > 0) {
-		if (!set_table("glyf", gbuf, glen)) {
-			free(gbuf);
+	std::vector<uint32_t, ArenaAllocator<uint32_t> > v((ArenaAllocator<uint32_t>(arena)));
+	depidx = (uint32_t*)arena.calloc(nloca+1, sizeof(uint32_t));
+	for (unsigned i=0; i<nloca; ++i) {
+		depidx[i] = v.size();
+		if (loca[i+1] - loca[i] < sizeof(WoffGlyph) || loca[i+1] > glyflen) continue;
+		const char* gbuf = glyfbuf? glyfbuf + loca[i]: reader.get(loca[i], loca[i+1]);
+		if (!gbuf) {
+			LOG("cannot read glyph #%u", i);
 			return false;
 		}
+		const WoffGlyph* g = (const WoffGlyph*)gbuf;
+		if ((int16_t)w2uint16(g->numberOfContours) >= 0) continue;
+
+		// https://docs.microsoft.com/en-us/typography/opentype/spec/glyf#composite-glyph-description
+		const char* p = (const char*)(g + 1);
+		const char* const e = gbuf + (loca[i+1] - loca[i]);
+		uint16_t flags;
+		do {
+			if (p + 2*sizeof(wuint16_t) > e) {
+				LOG("truncated composite glyph #%u", i);
+				return false;
+			}
+			flags = w2uint16(((const wuint16_t*)p)[0]);
+			index_t component = w2uint16(((const wuint16_t*)p)[1]);
+			p += 2*sizeof(wuint16_t);
+			p += (flags & 0x0001)? 4: 2; // ARG_1_AND_2_ARE_WORDS
+			if (flags & 0x0008) p += 2; // WE_HAVE_A_SCALE
+			else if (flags & 0x0040) p += 4; // WE_HAVE_AN_X_AND_Y_SCALE
+			else if (flags & 0x0080) p += 8; // WE_HAVE_A_TWO_BY_TWO
+			if (component >= nloca) {
+				LOG("invalid component #%u in glyph #%u", component, i);
+				return false;
+			}
+			LOG_DUMP("  glyph %u uses %u", i, component);
+			v.push_back(component);
+		} while (flags & 0x0020); // MORE_COMPONENTS
 	}
+	depidx[nloca] = v.size();
+	deps = (uint32_t*)arena.alloc(MAX(v.size(), 1) * sizeof(uint32_t));
+	if (!v.empty()) memcpy(deps, &v[0], v.size() * sizeof(uint32_t));
 
-	free(gbuf);
+	LOG_INFO("parsed %zu composite glyph components", v.size());
 	return true;
 }
 
 
-bool Woff::deleteCharIndex(index_t index) {
-	assert(nloca && loca);
-	if (!index) return true; // seems to mess up some things?
-	if (index >= nloca) return false;
-	if (index == nloca-1) return true; // keep last one as loca/glyf end marker
+void Woff::selectGlyphs(const std::vector<char_range_t>& chars) {
+	assert((loca || cff) && depidx);
+	arena.free(keep);
+	keep = (uint8_t*)arena.calloc(nloca, sizeof(uint8_t));
+	keep[0] = 1;
 
-	if (loca[index].from == loca[index].to) {
-		return true; // already nothing here
+	std::vector<index_t, ArenaAllocator<index_t> > stack((ArenaAllocator<index_t>(arena)));
+	for (std::vector<char_range_t>::const_iterator it=chars.begin(); it!=chars.end(); ++it) {
+		for (char_t c=it->from; c<=it->to; ++c) {
+			index_t i = cmaps.find(c);
+			if (i && i < nloca && !keep[i]) {
+				keep[i] = 1;
+				stack.push_back(i);
+			}
+		}
 	}
-	size_t dellen = delete_glyph(loca[index].from, loca[index].to);
-	if (!dellen) {
-		LOG_INFO("kept character #%u, is already stripped?", index);
+	size_t nuvs;
+	const cmap_uvs_t* uvs = cmaps.getVariations(nuvs);
+	for (size_t u=0; u<nuvs; ++u) { // own glyphs for variation sequences
+		const index_t i = uvs[u].glyph;
+		if (i && i < nloca && !keep[i] && Cmaps::contains(chars, uvs[u].from)) {
+			keep[i] = 1;
+			stack.push_back(i);
+		}
+	}
+	while (!stack.empty()) { // closure over composite glyph components
+		index_t i = stack.back();
+		stack.pop_back();
+		for (uint32_t d=depidx[i]; d<depidx[i+1]; ++d) {
+			if (!keep[deps[d]]) {
+				keep[deps[d]] = 1;
+				stack.push_back(deps[d]);
+			}
+		}
+	}
+}
+
+
+bool Woff::buildEstimate(Estimate& est, bool sfnt) {
+	// glyph data by its sampled compression, other tables and blocks as in the input, or deflated once if it is an sfnt
+	assert((loca || cff) && depidx);
+	const char* glyphs = cff? (cff->isCff2()? "CFF2": "CFF "): "glyf";
+	size_t fixed = sfnt? PAD4(sizeof(SfntHeader)) + out_tables() * sizeof(SfntTableDirectoryEntry): sizeof(WoffHeader) + out_tables() * sizeof(WoffTableDirectoryEntry) + PAD4(meta_len) + priv_len;
+	for (unsigned i=0; i<ntables; ++i) {
+		if ((table_state[i] & TABLE_DROPPED) || strcmp(w2str32(tables[i].tag), glyphs) == 0 || is_layout_table(w2str32(tables[i].tag))) continue;
+		const size_t len = w2uint32(tables[i].origLength);
+		if (sfnt) {
+			fixed += PAD4(len);
+		} else if (!sfnt_in) {
+			fixed += PAD4(w2uint32(tables[i].compLength));
+		} else {
+			const char* plain = get_plain(i);
+			char* cdata;
+			size_t clen;
+			if (!plain || !docompress(plain, len, cdata, &clen, arena)) return false;
+			arena.free(cdata);
+			fixed += PAD4(clen);
+		}
+	}
+
+	char* buf = NULL;
+	WoffTableDirectoryEntry* t = get_table(glyphs, &buf);
+	if (!t) return false;
+	const size_t len = w2uint32(t->origLength);
+	if (!cff) {
+		if (!est.build(orig_cmaps, buf, len, loca, nloca, sizeof(WoffGlyph), depidx, deps, fixed, 0, !sfnt)) return false;
+	} else {
+		const uint32_t* offsets;
+		const char* data = cff->charstringData(offsets);
+		const size_t datalen = offsets[nloca];
+		if (datalen > len || !est.build(orig_cmaps, data, datalen, offsets, nloca, cff->isCff2()? 0: 1, depidx, deps, fixed, len - datalen, !sfnt)) return false;
+	}
+
+	// layout tables as pruned for none, every other one, and all of the glyphs of chars, the last glyph stays as by deleteCharIndex()
+	uint8_t* drop = (uint8_t*)arena.calloc(MAX(nloca, 1), sizeof(uint8_t));
+	size_t sizes[3];
+	bool rv = true;
+	for (unsigned k=0; k<3 && rv; ++k) {
+		unsigned m = 0;
+		for (index_t i=0; i<nloca; ++i) {
+			drop[i] = est.isMapped(i) && (cff || i != nloca-1) && (k == 0 || (k == 1 && m++ % 2));
+		}
+		rv = layout_size(drop, sfnt, sizes[k]);
+	}
+	arena.free(drop);
+	if (rv) est.setLayout(sizes[0], sizes[1], sizes[2]);
+	return rv;
+}
+
+
+bool Woff::layout_size(const uint8_t* drop, bool sfnt, size_t& size) {
+	// of the pruned layout tables as they would be written, deflated unless for sfnt
+	Layout layout(arena, drop, nloca);
+	size = 0;
+	for (unsigned t=0; t<LAYOUT_TABLES; ++t) {
+		const int i = get_table_index(layout_tables[t]);
+		if (i < 0) continue;
+		const char* plain = get_plain(i);
+		if (!plain) return false;
+		size_t len;
+		char* out = layout.prune(layout_tables[t], plain, w2uint32(tables[i].origLength), len);
+		if (!out) len = w2uint32(tables[i].origLength); // kept as is
+		char* cdata = NULL;
+		if (!sfnt && len && !docompress(out? out: plain, len, cdata, &len, arena)) {
+			arena.free(out);
+			return false;
+		}
+		arena.free(cdata);
+		arena.free(out);
+		size += PAD4(len);
+	}
+	return true;
+}
+
+
+bool Woff::revert() {
+	// back to the state after parsing, for another run on the resident font, changed tables are reloaded from the input
+	const int l = get_table_index("loca");
+	const bool reloca = l >= 0 && (table_state[l] & TABLE_CHANGED);
+	for (unsigned i=0; i<ntables; ++i) {
+		if (!(table_state[i] & TABLE_CHANGED)) continue;
+		arena.free(table_data[i]);
+		arena.free(table_plain[i]);
+		tables[i] = orig_tables[i];
+		load_table(i);
+	}
+	if (!sfnt_in) {
+		memcpy(header, orig_buf, sizeof(WoffHeader));
+		if (!parse_blocks()) return false;
+	}
+	sfnt_out = false;
+
+	if (reloca) {
+		if (!index || loca != index->getLoca()) arena.free(loca);
+		loca = NULL;
+		if (!parseLoca()) return false;
+	}
+	if (cff) { // drops and changes are kept in there
+		delete cff;
+		cff = NULL;
+		if (!parse_cff()) return false;
+	}
+	arena.free(keep);
+	keep = NULL;
+	arena.free(dropped);
+	dropped = NULL;
+	arena.free(glyph_ops);
+	glyph_ops = NULL;
+	glyf_sum.clear();
+	revert_cmaps();
+	return true;
+}
+
+
+void Woff::index_source(FontIndexHeader& h, bool full) const {
+	// cheap, unless the time is unknown or a full check is wanted
+	const size_t dirlen = sfnt_in? sizeof(SfntHeader) + ntables * sizeof(SfntTableDirectoryEntry): sizeof(WoffHeader) + ntables * sizeof(WoffTableDirectoryEntry);
+	h.sourceLength = orig_len;
+	h.sourceMtime = orig_mtime;
+	h.directoryHash = hash64(orig_buf, MIN(dirlen, orig_len));
+	h.sourceHash = (full || !orig_mtime)? hash64(orig_buf, orig_len): 0;
+}
+
+
+bool Woff::loadIndex(const char* fn) {
+	assert(!index && !loca);
+	FontIndexHeader src;
+	index_source(src, config.paranoid);
+	FontIndex* idx = new FontIndex();
+	if (!idx->load(fn, src)) {
+		delete idx;
+		return false;
+	}
+	if (src.sourceHash && idx->getHeader()->sourceHash != src.sourceHash) {
+		LOG("%s: index is outdated, ignoring", fn);
+		delete idx;
+		return false;
+	}
+
+	const FontIndexHeader* h = idx->getHeader();
+	const FontIndexTable* t = idx->getTables();
+	bool valid = (h->ntables == ntables);
+	for (unsigned i=0; valid && i<ntables; ++i) {
+		valid = t[i].tag == tables[i].tag && t[i].origChecksum == w2uint32(tables[i].origChecksum);
+	}
+	if (!valid || h->nloca < 2) {
+		LOG("%s: index does not match tables, ignoring", fn);
+		delete idx;
+		return false;
+	}
+
+	index = idx;
+	indexToLocFormat = h->indexToLocFormat;
+	nloca = h->nloca;
+	loca = idx->getLoca();
+	depidx = (uint32_t*)idx->getDepIndex(); // read-only
+	deps = (uint32_t*)idx->getDeps();
+	chunk_glyphs();
+	orig_cmaps.assign(idx->getRuns(), h->nruns, idx->getVariations(), h->nuvs);
+	revert_cmaps();
+	LOG_INFO("loaded index '%s' with %u glyphs", fn, nloca);
+	return true;
+}
+
+
+bool Woff::writeIndex(const char* fn) const {
+	if (cff) {
+		LOG("%s: no index for CFF outlines", fn);
+		return false;
+	}
+	assert(loca && depidx);
+	FontIndexHeader h;
+	memset(&h, 0, sizeof(h));
+	index_source(h, true);
+	h.indexToLocFormat = indexToLocFormat;
+	h.ntables = ntables;
+	h.nloca = nloca;
+	h.ndeps = depidx[nloca];
+
+	size_t nruns;
+	const cmap_run_t* runs = cmaps.getRuns(nruns);
+	h.nruns = nruns;
+	size_t nuvs;
+	const cmap_uvs_t* uvs = cmaps.getVariations(nuvs);
+	h.nuvs = nuvs;
+
+	FontIndexTable* t = (FontIndexTable*)arena.calloc(ntables, sizeof(FontIndexTable));
+	uint32_t offset = PAD4(sizeof(SfntHeader)) + PAD4(ntables*sizeof(SfntTableDirectoryEntry));
+	for (unsigned i=0; i<ntables; ++i) {
+		t[i].tag = tables[i].tag;
+		t[i].origLength = w2uint32(tables[i].origLength);
+		t[i].origChecksum = w2uint32(tables[i].origChecksum);
+		t[i].sfntOffset = offset;
+		offset += PAD4(w2uint32(tables[i].origLength));
+	}
+
+	bool rv = FontIndex::write(fn, h, t, runs, loca, depidx, deps, uvs);
+	arena.free(t);
+	if (rv) LOG_INFO("wrote index '%s'", fn);
+	return rv;
+}
+
+
+static bool derived_table(const char* name) {
+	// as changed by a run, from the master again, including the pruned layout tables
+	return strcmp(name, "glyf") == 0 || strcmp(name, "loca") == 0 || strcmp(name, "cmap") == 0 || strcmp(name, "head") == 0 || is_layout_table(name);
+}
+
+
+bool Woff::loadPrevious(Woff& prev) {
+	// the previous output keeps the stripped glyphs as such, so the delta is given by its loca and the current selection
+	if (cff) {
+		LOG("previous output is not supported for CFF outlines");
+		return false;
+	}
+	assert(loca && keep);
+	if (!prev.parseLoca()) return false;
+	if (prev.ntables != ntables || prev.nloca != nloca || prev.indexToLocFormat != indexToLocFormat) {
+		LOG("previous output does not match the font");
+		return false;
+	}
+	for (unsigned i=0; i<ntables; ++i) {
+		const char* name = w2str32(tables[i].tag);
+		if (prev.tables[i].tag != tables[i].tag) {
+			LOG("previous output does not match the font");
+			return false;
+		} else if (!derived_table(name) && prev.tables[i].origChecksum != tables[i].origChecksum) {
+			LOG("previous output does not match the font in '%s'", name);
+			return false;
+		}
+	}
+	const int g = get_table_index("glyf");
+	const int l = get_table_index("loca");
+	if (g < 0 || l < 0) return false;
+
+	// glyphs to be restored from this font, as in use again
+	std::vector<index_t, ArenaAllocator<index_t> > restore((ArenaAllocator<index_t>(arena)));
+	for (unsigned i=0; i<nloca; ++i) {
+		const uint32_t prevlen = prev.loca[i+1] - prev.loca[i];
+		if (keep[i] && prevlen <= sizeof(WoffGlyph) && prevlen < loca[i+1] - loca[i]) {
+			restore.push_back(i);
+		}
+	}
+	char* origglyf = table_plain[g]; // possibly decoded already, e.g. for composites
+	if (!restore.empty() && !origglyf && !(origglyf = get_plain(g))) return false;
+	table_plain[g] = NULL; // still owned, released below
+	glyf_sum.clear();
+
+	// take over as is, so untouched glyph data stays compressed
+	const int idx[2] = {g, l};
+	for (unsigned t=0; t<2; ++t) {
+		const unsigned i = idx[t];
+		const size_t clen = w2uint32(prev.tables[i].compLength);
+		arena.free(table_data[i]);
+		arena.free(table_plain[i]);
+		table_data[i] = (char*)memcpy(arena.calloc(1, clen + 4), prev.table_data[i], clen);
+		table_plain[i] = NULL;
+		table_state[i] = (prev.table_state[i] & ~TABLE_DIRTY) | TABLE_CHANGED;
+		tables[i].compLength = prev.tables[i].compLength;
+		tables[i].origLength = prev.tables[i].origLength;
+		tables[i].origChecksum = prev.tables[i].origChecksum;
+	}
+	const uint32_t* const origloca = (const uint32_t*)memcpy(arena.alloc((nloca+1) * sizeof(uint32_t)), loca, (nloca+1) * sizeof(uint32_t));
+	memcpy(loca, prev.loca, (nloca+1) * sizeof(uint32_t));
+	LOG_INFO("loaded previous output, restoring %zu glyphs", restore.size());
+	if (restore.empty()) {
+		arena.free(origglyf);
+		arena.free((void*)origloca);
 		return true;
 	}
 
+	char* prevglyf = NULL;
+	if (!get_table("glyf", &prevglyf)) return false;
+	const size_t prevglyflen = w2uint32(tables[g].origLength);
+	size_t glyflen = prevglyflen;
+	for (std::vector<index_t, ArenaAllocator<index_t> >::const_iterator it=restore.begin(); it!=restore.end(); ++it) {
+		glyflen += (origloca[*it+1] - origloca[*it]) - (loca[*it+1] - loca[*it]);
+	}
+
+	// single pass, unchanged spans in between are copied at once
+	char* glyfbuf = (char*)arena.calloc(1, PAD4(glyflen));
+	size_t src = 0, dst = 0;
+	uint32_t delta = 0;
+	unsigned next = 0;
+	for (std::vector<index_t, ArenaAllocator<index_t> >::const_iterator it=restore.begin(); it!=restore.end(); ++it) {
+		const index_t i = *it;
+		const uint32_t start = loca[i], end = loca[i+1];
+		const uint32_t len = origloca[i+1] - origloca[i];
+		memcpy(glyfbuf + dst, prevglyf + src, start - src);
+		dst += start - src;
+		memcpy(glyfbuf + dst, origglyf + origloca[i], len);
+		dst += len;
+		src = end;
+		for (; next<=i; ++next) loca[next] += delta;
+		delta += len - (end - start);
+		LOG_INFO("restored glyph #%u", i);
+	}
+	memcpy(glyfbuf + dst, prevglyf + src, prevglyflen - src);
+	for (; next<=nloca; ++next) loca[next] += delta;
+	assert(dst + prevglyflen - src == glyflen && loca[nloca] == glyflen);
+	arena.free(origglyf);
+	arena.free((void*)origloca);
+	if (!set_table("glyf", glyfbuf, glyflen)) return false;
+	arena.free(glyfbuf);
+
 	char* locabuf = NULL;
-	WoffTableDirectoryEntry* l = get_table("loca", &locabuf);
-	if (!l) return false;
-	const uint32_t localen = w2uint32(l->origLength);
-	union {
-		wuint16_t* u16;
-		wuint32_t* u32;
-	} offsets;
-	offsets.u16 = (wuint16_t*)locabuf;
+	WoffTableDirectoryEntry* lt = get_table("loca", &locabuf);
+	if (!lt) return false;
+	if (indexToLocFormat) {
+		be32_to_host((uint32_t*)locabuf, loca, nloca+1); // swapping either way
+	} else {
+		for (unsigned i=0; i<nloca+1; ++i) {
+			((wuint16_t*)locabuf)[i] = uint2w16(loca[i] / 2);
+		}
+	}
+	return set_table("loca", locabuf, w2uint32(lt->origLength));
+}
 
-	loca[index].to -= dellen;
-	for (unsigned i=index+1; i<nloca+1; ++i) {
-		if (i<nloca) {
-			loca[i].from -= dellen;
-			loca[i].to -= dellen;
+
+static void min_ymin(int ymin, unsigned& min) {
+	if (ymin > 0 && ymin < (int)min) {
+		min = (unsigned)ymin;
+	}
+}
+
+
+unsigned Woff::getMinAlignment(const std::vector<char_range_t>& v, unsigned usermin) {
+	char* buf = NULL;
+	size_t len;
+	int headermin;
+	{
+		if (!get_table("head", &buf)) return -1;
+		WoffTableHead* head = (WoffTableHead*)buf;
+		if ((w2uint16(head->flags) & 0x01) != 1) {
+			LOG("baseline is not at y=0");
+			return 0;
 		}
+		headermin = w2int16(head->yMin);
+		LOG_INFO("global bounding box minimum y is %d (baseline 0)", headermin);
+	}
 
-		if (indexToLocFormat) {
-			offsets.u32[i] = uint2w32(w2uint32(offsets.u32[i]) - dellen); // ascending and/or != 0 seems to be expected
+	if (usermin) {
+		if ((int)usermin < headermin) {
+			LOG("given alignment %u is less than global bounding box minimum y %d", usermin, headermin);
+			return 0;
 		} else {
-			assert(dellen % 2 == 0);
-			offsets.u16[i] = uint2w16(w2uint16(offsets.u16[i]) - (dellen/2));
+			return usermin;
 		}
 	}
 
-	if (!set_table("loca", locabuf, localen)) {
-		free(locabuf);
+	unsigned min = 0;
+	if (cff) {
+		for (std::vector<char_range_t>::const_iterator it=v.begin(); it!=v.end(); ++it) {
+			for (char_t c=it->from; c<=it->to; ++c) {
+				index_t i = cmaps.find(c);
+				int16_t bbox[4];
+				if (i && i < nloca && cff->bounds(i, bbox)) min_ymin(bbox[1], min);
+			}
+		}
+		return MAX(MAX(1, headermin), min);
+	}
+	if (config.glyf_window) { // a pass in glyph order instead
+		uint8_t* need = (uint8_t*)arena.calloc(nloca, sizeof(uint8_t));
+		for (std::vector<char_range_t>::const_iterator it=v.begin(); it!=v.end(); ++it) {
+			for (char_t c=it->from; c<=it->to; ++c) {
+				index_t i = cmaps.find(c);
+				if (i) need[i] = 1;
+			}
+		}
+		GlyfReader reader(arena, config.glyf_window);
+		if (open_glyf(reader, len)) {
+			for (unsigned i=0; i<nloca; ++i) {
+				if (!need[i] || loca[i+1] - loca[i] < sizeof(WoffGlyph) || loca[i+1] > len) continue;
+				const WoffGlyph* g = (const WoffGlyph*)reader.get(loca[i], loca[i+1]);
+				if (!g) break;
+				min_ymin(w2int16(g->yMin), min);
+			}
+		}
+		arena.free(need);
+		return MAX(MAX(1, headermin), min);
+	}
+	for (std::vector<char_range_t>::const_iterator it=v.begin(); it!=v.end(); ++it) {
+		for (char_t c=it->from; c<=it->to; ++c) {
+			index_t i = cmaps.find(c);
+			if (!i) continue;
+			assert(i<nloca);
+			if (loca[i] == loca[i+1]) continue;
+			const WoffGlyph* g = get_glyph(loca[i], loca[i+1], buf, len);
+			if (!g) continue;
+			min_ymin(w2int16(g->yMin), min);
+		}
+	}
+	return MAX(MAX(1, headermin), min);
+}
+
+
+bool Woff::alignCharIndex(index_t index, unsigned align) {
+	assert(index > 0 && index < nloca);
+	assert(align > 0); // as 0 is baseline and seems to break everything
+	if (cff) return cff->align(index, align) >= 0;
+	if (loca[index] == loca[index+1]) return true;
+	if (config.glyf_window) { // applied when streaming
+		if (!glyph_ops) glyph_ops = (uint8_t*)arena.calloc(nloca, sizeof(uint8_t));
+		glyph_ops[index] |= GLYPH_ALIGN;
+		glyph_align = align;
+		return true;
+	}
+
+	char* gbuf;
+	size_t glen;
+	WoffGlyph* g = get_glyph(loca[index], loca[index+1], gbuf, glen);
+	if (!g) return false;
+	g->print("  ", "aligning glyph");
+	const bool summed = sum_glyf(gbuf, glen);
+
+	int aligned = align_glyph(g, align);
+	if (aligned < 0) {
+		return false;
+	} else if (aligned > 0) {
+		if (summed) {
+			glyf_sum.set(index+1, (const char*)g, loca[index+1] - loca[index], loca[index]);
+			if (!set_table_sum("glyf", gbuf, glen, glyf_sum.sum())) return false;
+		} else if (!set_table("glyf", gbuf, glen)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+static inline int16_t clamp16(float v) {
+	return (int16_t)MAX(-32768.0f, MIN(32767.0f, floorf(v + 0.5f)));
+}
+
+
+typedef std::vector<float, ArenaAllocator<float> > points_t; // x/y pairs
+
+static bool glyph_points(Arena& arena, const char* glyf, const uint32_t* loca, unsigned nloca, index_t i, points_t& pts, unsigned depth) {
+	// composites flattened by their offsets or matched points and transformations, as by fontTools getCoordinates()
+	if (i >= nloca || depth > MAX_COMPONENT_DEPTH) return false;
+	GlyphOutline o(arena);
+	if (!o.decode(glyf + loca[i], loca[i+1] - loca[i])) return false;
+	const size_t first = pts.size();
+	if (o.ncontours >= 0) {
+		for (unsigned k=0; k<o.n; ++k) {
+			pts.push_back(o.x[k]);
+			pts.push_back(o.y[k]);
+		}
+		return true;
+	}
+	for (unsigned k=0; k<o.n; ++k) {
+		const size_t start = pts.size();
+		if (!glyph_points(arena, glyf, loca, nloca, o.component(k), pts, depth+1)) return false;
+		for (size_t p=start; p<pts.size(); p+=2) {
+			o.transform(k, pts[p], pts[p+1]);
+		}
+		float mx, my;
+		if (o.is_offset(k)) {
+			mx = o.x[k];
+			my = o.y[k];
+			if (o.is_scaled_offset(k)) o.transform(k, mx, my);
+		} else { // a point of the component onto one of the previous ones
+			const size_t a = first + 2*(size_t)o.x[k], b = start + 2*(size_t)o.y[k];
+			if (a >= start || b >= pts.size()) return false;
+			mx = pts[a] - pts[b];
+			my = pts[a+1] - pts[b+1];
+		}
+		for (size_t p=start; p<pts.size(); p+=2) {
+			pts[p] += mx;
+			pts[p+1] += my;
+		}
+	}
+	return true;
+}
+
+
+static uint16_t width_class(float wdth) {
+	// https://docs.microsoft.com/en-us/typography/opentype/spec/os2#uswidthclass, the nearest percentage
+	static const float percent[9] = {50.0f, 62.5f, 75.0f, 87.5f, 100.0f, 112.5f, 125.0f, 150.0f, 200.0f};
+	unsigned c = 0;
+	for (unsigned i=1; i<9; ++i) {
+		if (fabsf(wdth - percent[i]) < fabsf(wdth - percent[c])) c = i;
+	}
+	return c + 1;
+}
+
+
+typedef struct {
+	uint32_t tag;
+	const char* table;
+	unsigned offset;
+	bool is_signed;
+} mvar_field_t;
+
+static const mvar_field_t mvar_fields[] = { // https://docs.microsoft.com/en-us/typography/opentype/spec/mvar#value-tags
+	{0x68617363u, "OS/2", 68, true}, // 'hasc' sTypoAscender
+	{0x68647363u, "OS/2", 70, true}, // 'hdsc' sTypoDescender
+	{0x686c6770u, "OS/2", 72, true}, // 'hlgp' sTypoLineGap
+	{0x68636c61u, "OS/2", 74, false}, // 'hcla' usWinAscent
+	{0x68636c64u, "OS/2", 76, false}, // 'hcld' usWinDescent
+	{0x78686774u, "OS/2", 86, true}, // 'xhgt' sxHeight
+	{0x63706874u, "OS/2", 88, true}, // 'cpht' sCapHeight
+	{0x73627873u, "OS/2", 10, true}, // 'sbxs' ySubscriptXSize
+	{0x73627973u, "OS/2", 12, true}, // 'sbys' ySubscriptYSize
+	{0x7362786fu, "OS/2", 14, true}, // 'sbxo' ySubscriptXOffset
+	{0x7362796fu, "OS/2", 16, true}, // 'sbyo' ySubscriptYOffset
+	{0x73707873u, "OS/2", 18, true}, // 'spxs' ySuperscriptXSize
+	{0x73707973u, "OS/2", 20, true}, // 'spys' ySuperscriptYSize
+	{0x7370786fu, "OS/2", 22, true}, // 'spxo' ySuperscriptXOffset
+	{0x7370796fu, "OS/2", 24, true}, // 'spyo' ySuperscriptYOffset
+	{0x73747273u, "OS/2", 26, true}, // 'strs' yStrikeoutSize
+	{0x7374726fu, "OS/2", 28, true}, // 'stro' yStrikeoutPosition
+	{0x68637273u, "hhea", 18, true}, // 'hcrs' caretSlopeRise
+	{0x6863726eu, "hhea", 20, true}, // 'hcrn' caretSlopeRun
+	{0x68636f66u, "hhea", 22, true}, // 'hcof' caretOffset
+	{0x76617363u, "vhea", 4, true}, // 'vasc' ascent
+	{0x76647363u, "vhea", 6, true}, // 'vdsc' descent
+	{0x766c6770u, "vhea", 8, true}, // 'vlgp' lineGap
+	{0x76637273u, "vhea", 18, true}, // 'vcrs' caretSlopeRise
+	{0x7663726eu, "vhea", 20, true}, // 'vcrn' caretSlopeRun
+	{0x76636f66u, "vhea", 22, true}, // 'vcof' caretOffset
+	{0x756e646fu, "post", 8, true}, // 'undo' underlinePosition
+	{0x756e6473u, "post", 10, true}, // 'unds' underlineThickness
+};
+#define MVAR_FIELDS (sizeof(mvar_fields)/sizeof(*mvar_fields))
+
+
+bool Woff::instance_mvar(const Instancer& inst) {
+	// font-wide metrics, hhea ascender, descender and line gap along with the OS/2 typo ones if they were the same, as by fontTools
+	char* mvarbuf = NULL;
+	WoffTableDirectoryEntry* mvar = get_table("MVAR", &mvarbuf);
+	if (!mvar) return false;
+	const View v(mvarbuf, w2uint32(mvar->origLength));
+	const wuint16_t* h = v.get<wuint16_t>(0, 6);
+	if (!h || w2uint16(h[0]) != 1 || w2uint16(h[3]) < 8) {
+		LOG("unsupported 'MVAR'");
+		return false;
+	}
+	const unsigned record_size = w2uint16(h[3]), nrecords = w2uint16(h[4]);
+	const View store = v.sub(w2uint16(h[5]));
+
+	char* hheabuf = NULL;
+	char* os2buf = NULL;
+	WoffTableDirectoryEntry* hhea = get_table("hhea", &hheabuf);
+	WoffTableDirectoryEntry* os2 = (get_table_index("OS/2") >= 0)? get_table("OS/2", &os2buf): NULL;
+	if (!hhea) return false;
+	const bool synced = os2 && w2uint32(os2->origLength) >= 74 && w2uint32(hhea->origLength) >= 10 && !memcmp(os2buf + 68, hheabuf + 4, 6);
+
+	std::vector<const char*> changed;
+	for (unsigned r=0; r<nrecords; ++r) {
+		const wuint32_t* tag = v.get<wuint32_t>(12 + r*record_size);
+		const wuint16_t* idx = v.get<wuint16_t>(12 + r*record_size + 4, 2);
+		float d;
+		if (!tag || !idx || !inst.item_delta(store, w2uint16(idx[0]), w2uint16(idx[1]), d)) {
+			LOG("invalid 'MVAR'");
+			return false;
+		}
+		const int32_t delta = (int32_t)floorf(d + 0.5f);
+		const mvar_field_t* f = mvar_fields;
+		while (f < mvar_fields + MVAR_FIELDS && f->tag != w2uint32(*tag)) ++f;
+		if (!delta || f == mvar_fields + MVAR_FIELDS || get_table_index(f->table) < 0) continue; // also gasp ranges, which are not changed
+		char* buf = NULL;
+		WoffTableDirectoryEntry* t = get_table(f->table, &buf);
+		if (!t || w2uint32(t->origLength) < f->offset + 2) continue;
+		wuint16_t* w = (wuint16_t*)(buf + f->offset);
+		if (f->is_signed) {
+			*(wint16_t*)w = int2w16(clamp16(w2int16(*(wint16_t*)w) + delta));
+		} else {
+			*w = uint2w16((uint16_t)MAX(0, MIN(65535, (int32_t)w2uint16(*w) + delta)));
+		}
+		LOG_INFO("'%s' %s at %u by %d", w2str32(*tag), f->table, f->offset, delta);
+		if (std::find(changed.begin(), changed.end(), f->table) == changed.end()) changed.push_back(f->table);
+	}
+	if (synced && memcmp(os2buf + 68, hheabuf + 4, 6)) {
+		memcpy(hheabuf + 4, os2buf + 68, 6);
+		if (std::find(changed.begin(), changed.end(), "hhea") == changed.end()) changed.push_back("hhea");
+	}
+	for (std::vector<const char*>::const_iterator it=changed.begin(); it!=changed.end(); ++it) {
+		char* buf = NULL;
+		WoffTableDirectoryEntry* t = get_table(*it, &buf);
+		if (!t || !set_table(*it, buf, w2uint32(t->origLength))) return false;
+	}
+	return true;
+}
+
+
+bool Woff::instance_cvt(Instancer& inst) {
+	char* cvarbuf = NULL;
+	char* cvtbuf = NULL;
+	WoffTableDirectoryEntry* cvar = get_table("cvar", &cvarbuf);
+	WoffTableDirectoryEntry* cvt = (get_table_index("cvt ") >= 0)? get_table("cvt ", &cvtbuf): NULL;
+	if (!cvar) return false;
+	if (!cvt) return true; // nothing to vary
+	const unsigned n = w2uint32(cvt->origLength) / sizeof(wint16_t);
+	float* d = (float*)arena.alloc(MAX(n, 1) * sizeof(float));
+	if (!inst.apply_cvt(View(cvarbuf, w2uint32(cvar->origLength)), n, d)) {
+		LOG("invalid 'cvar'");
+		arena.free(d);
+		return false;
+	}
+	wint16_t* v = (wint16_t*)cvtbuf;
+	for (unsigned i=0; i<n; ++i) {
+		v[i] = int2w16(clamp16(w2int16(v[i]) + (int32_t)floorf(d[i] + 0.5f)));
+	}
+	arena.free(d);
+	LOG_INFO("instanced %u cvt values", n);
+	return set_table("cvt ", cvtbuf, w2uint32(cvt->origLength));
+}
+
+
+bool Woff::instance(const std::vector<axis_pin_t>& pins, const std::vector<char_range_t>& deleted) {
+	// all glyphs in a single pass into a new glyf, as offsets, bounds and metrics change, composite bounds after their components
+	if (cff) {
+		LOG("instancing CFF2 outlines is not supported");
+		return false;
+	}
+	assert(loca && !glyph_ops);
+	char* fvarbuf = NULL;
+	char* gvarbuf = NULL;
+	char* avarbuf = NULL;
+	WoffTableDirectoryEntry* fvar = get_table("fvar", &fvarbuf);
+	WoffTableDirectoryEntry* gvar = fvar? get_table("gvar", &gvarbuf): NULL;
+	if (!fvar || !gvar) return false;
+	WoffTableDirectoryEntry* avar = NULL;
+	if (get_table_index("avar") >= 0 && !(avar = get_table("avar", &avarbuf))) return false;
+	Instancer inst(arena);
+	if (!inst.init(View(fvarbuf, w2uint32(fvar->origLength)), View(avarbuf, avar? w2uint32(avar->origLength): 0), View(gvarbuf, w2uint32(gvar->origLength)), pins)) return false;
+
+	char* glyfbuf = NULL;
+	char* hheabuf = NULL;
+	char* hmtxbuf = NULL;
+	char* headbuf = NULL;
+	WoffTableDirectoryEntry* glyf = get_table("glyf", &glyfbuf);
+	WoffTableDirectoryEntry* hhea = get_table("hhea", &hheabuf);
+	WoffTableDirectoryEntry* hmtx = get_table("hmtx", &hmtxbuf);
+	if (!glyf || !hhea || !hmtx || !get_table("head", &headbuf)) return false;
+	const size_t glyflen = w2uint32(glyf->origLength);
+	WoffTableHhea* hh = (WoffTableHhea*)hheabuf;
+	if (w2uint32(hhea->origLength) < sizeof(WoffTableHhea)) {
+		LOG("invalid 'hhea'");
+		return false;
+	}
+	hh->print("  ", "hhea table");
+	const unsigned nhm = MIN(w2uint16(hh->numberOfHMetrics), nloca);
+	const wuint16_t* mtx = View(hmtxbuf, w2uint32(hmtx->origLength)).get<wuint16_t>(0, 2*nhm + (nloca - nhm));
+	if (!nhm || !mtx) {
+		LOG("invalid 'hmtx'");
+		return false;
+	}
+
+	uint8_t* drop = (uint8_t*)arena.calloc(nloca, sizeof(uint8_t)); // glyphs of deleted chars, only their header is written
+	for (std::vector<char_range_t>::const_iterator it=deleted.begin(); it!=deleted.end(); ++it) {
+		for (char_t c=it->from; c<=it->to; ++c) {
+			const index_t i = cmaps.find(c);
+			if (i && i+1 < nloca && !(keep && keep[i])) drop[i] = 1;
+		}
+	}
+
+	uint16_t* adv = (uint16_t*)arena.alloc(nloca * sizeof(uint16_t));
+	int16_t* lsb = (int16_t*)arena.alloc(nloca * sizeof(int16_t));
+	int16_t* ncont = (int16_t*)arena.alloc(nloca * sizeof(int16_t));
+	int16_t* box = (int16_t*)arena.alloc(4 * nloca * sizeof(int16_t));
+	float* ppl = (float*)arena.alloc(nloca * sizeof(float)); // left phantom point, lsb and advance are relative to it
+	uint32_t* newloca = (uint32_t*)arena.alloc((nloca+1) * sizeof(uint32_t));
+	size_t cap = glyflen + glyflen/4 + 64, outlen = 0;
+	char* out = (char*)arena.alloc(cap);
+	unsigned dcap = 0, nadv = 0;
+	uint64_t sumadv = 0; // of the nonzero advances, for the OS/2 xAvgCharWidth
+	float* dx = NULL;
+	float* dy = NULL;
+
+	GlyphOutline o(arena);
+	for (index_t i=0; i<nloca; ++i) {
+		newloca[i] = outlen;
+		adv[i] = w2uint16(mtx[2 * MIN(i, nhm-1)]);
+		lsb[i] = (int16_t)w2uint16((i < nhm)? mtx[2*i + 1]: mtx[2*nhm + (i-nhm)]);
+		if (loca[i] > loca[i+1] || loca[i+1] > glyflen || !o.decode(glyfbuf + loca[i], loca[i+1] - loca[i])) {
+			LOG("invalid glyph #%u", i);
+			return false;
+		}
+		memcpy(box + 4*i, o.bbox, sizeof(o.bbox));
+		ncont[i] = drop[i]? 0: o.ncontours;
+		ppl[i] = o.bbox[0] - lsb[i];
+		if (cap < outlen + o.max_size() + 1) {
+			cap = 2*cap + o.max_size();
+			out = (char*)arena.realloc(out, cap);
+		}
+		if (drop[i]) { // as by delete_glyph()
+			if (loca[i+1] - loca[i] >= sizeof(WoffGlyph)) {
+				WoffGlyph* g = (WoffGlyph*)memcpy(out + outlen, glyfbuf + loca[i], sizeof(WoffGlyph));
+				g->numberOfContours = uint2w16(0);
+				outlen += sizeof(WoffGlyph);
+			}
+			continue;
+		}
+
+		const unsigned n = o.n; // followed by the phantom points
+		o.x[n] = (int32_t)ppl[i];
+		o.x[n+1] = o.x[n] + adv[i];
+		o.x[n+2] = o.x[n+3] = 0;
+		o.y[n] = o.y[n+1] = o.y[n+2] = o.y[n+3] = 0;
+		if (dcap < n + 4) {
+			dcap = MAX(n + 4, 2*dcap);
+			dx = (float*)arena.realloc(dx, dcap * sizeof(float));
+			dy = (float*)arena.realloc(dy, dcap * sizeof(float));
+		}
+		if (!inst.apply(i, n + 4, o.x, o.y, (o.ncontours > 0)? o.ends: NULL, MAX(o.ncontours, 0), dx, dy)) {
+			LOG("invalid variations for glyph #%u", i);
+			return false;
+		}
+		for (unsigned k=0; k<n; ++k) {
+			if (o.ncontours < 0 && !o.is_offset(k)) continue; // point numbers
+			o.x[k] += (int32_t)floorf(dx[k] + 0.5f);
+			o.y[k] += (int32_t)floorf(dy[k] + 0.5f);
+		}
+		ppl[i] = o.x[n] + dx[n];
+		const float ppr = o.x[n+1] + dx[n+1];
+		adv[i] = (uint16_t)MAX(0.0f, MIN(65535.0f, floorf(ppr - ppl[i] + 0.5f)));
+		if (adv[i]) { // of the kept ones only
+			sumadv += adv[i];
+			++nadv;
+		}
+		if (o.ncontours > 0) o.bounds(box + 4*i);
+		if (loca[i] == loca[i+1]) continue; // only the metrics
+		o.set_overlap();
+		outlen += o.encode(out + outlen, box + 4*i);
+		if (outlen % 2) out[outlen++] = '\0';
+	}
+	newloca[nloca] = outlen;
+	arena.free(dx);
+	arena.free(dy);
+
+	// composites once all their components are done, by the union of their bounds, or of their points if transformed or matched
+	std::vector<index_t, ArenaAllocator<index_t> > pending((ArenaAllocator<index_t>(arena)));
+	points_t pts((ArenaAllocator<float>(arena)));
+	for (index_t i=0; i<nloca; ++i) {
+		if (ncont[i] < 0) pending.push_back(i);
+		else drop[i] = 1; // reused as done
+	}
+	for (bool progress=true; progress && !pending.empty(); ) {
+		progress = false;
+		size_t left = 0;
+		for (size_t p=0; p<pending.size(); ++p) {
+			const index_t i = pending[p];
+			if (!o.decode(out + newloca[i], newloca[i+1] - newloca[i])) return false;
+			bool ready = true;
+			for (unsigned k=0; k<o.n && ready; ++k) {
+				ready = o.component(k) < nloca && drop[o.component(k)];
+			}
+			if (!ready) {
+				pending[left++] = i;
+				continue;
+			}
+
+			int32_t r[4] = {INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN};
+			bool flat = true;
+			for (unsigned k=0; k<o.n && flat; ++k) {
+				const int16_t* b = box + 4*o.component(k);
+				flat = o.is_offset(k) && !o.is_transformed(k);
+				if (!flat || !ncont[o.component(k)]) continue;
+				r[0] = MIN(r[0], b[0] + o.x[k]);
+				r[1] = MIN(r[1], b[1] + o.y[k]);
+				r[2] = MAX(r[2], b[2] + o.x[k]);
+				r[3] = MAX(r[3], b[3] + o.y[k]);
+			}
+			if (!flat) { // by all points then
+				pts.clear();
+				if (!glyph_points(arena, out, newloca, nloca, i, pts, 0)) {
+					LOG("invalid composite glyph #%u", i);
+					return false;
+				}
+				float f[4] = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+				for (size_t p=0; p<pts.size(); p+=2) {
+					f[0] = MIN(f[0], pts[p]);
+					f[1] = MIN(f[1], pts[p+1]);
+					f[2] = MAX(f[2], pts[p]);
+					f[3] = MAX(f[3], pts[p+1]);
+				}
+				for (unsigned c=0; c<4; ++c) {
+					r[c] = pts.empty()? 0: clamp16(f[c]);
+				}
+			}
+			for (unsigned c=0; c<4; ++c) {
+				box[4*i + c] = (r[0] > r[2])? 0: clamp16(r[c]);
+			}
+			WoffGlyph* g = (WoffGlyph*)(out + newloca[i]);
+			g->xMin = int2w16(box[4*i]);
+			g->yMin = int2w16(box[4*i + 1]);
+			g->xMax = int2w16(box[4*i + 2]);
+			g->yMax = int2w16(box[4*i + 3]);
+			drop[i] = 1;
+			progress = true;
+		}
+		pending.resize(left);
+	}
+	arena.free(drop);
+	if (!pending.empty()) {
+		LOG("circular composite glyph #%u", pending[0]);
+		return false;
+	}
+
+	// metrics by the phantom points, then recalculated as by the glyphs with contours
+	WoffTableHead* head = (WoffTableHead*)headbuf;
+	int32_t lmin = INT32_MAX, rmin = INT32_MAX, xext = INT32_MIN, bb[4] = {INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN};
+	unsigned amax = 0;
+	unsigned nh = nloca;
+	while (nh > 1 && adv[nh-1] == adv[nh-2]) --nh;
+	const size_t mlen = 4*nh + 2*(nloca - nh);
+	uint8_t* m = (uint8_t*)arena.alloc(mlen);
+	for (index_t i=0; i<nloca; ++i) {
+		const int16_t* b = box + 4*i;
+		lsb[i] = clamp16(b[0] - ppl[i]); // unchanged for dropped ones
+		amax = MAX(amax, adv[i]);
+		if (i < nh) {
+			((wuint16_t*)m)[2*i] = uint2w16(adv[i]);
+			((wint16_t*)m)[2*i + 1] = int2w16(lsb[i]);
+		} else {
+			((wint16_t*)m)[2*nh + (i-nh)] = int2w16(lsb[i]);
+		}
+		if (!ncont[i]) continue;
+		const int32_t w = b[2] - b[0];
+		lmin = MIN(lmin, lsb[i]);
+		rmin = MIN(rmin, adv[i] - lsb[i] - w);
+		xext = MAX(xext, lsb[i] + w);
+		for (unsigned c=0; c<2; ++c) {
+			bb[c] = MIN(bb[c], b[c]);
+			bb[c+2] = MAX(bb[c+2], b[c+2]);
+		}
+	}
+	if (xext == INT32_MIN) {
+		lmin = rmin = xext = 0;
+		memset(bb, 0, sizeof(bb));
+	}
+	hh->advanceWidthMax = uint2w16(amax);
+	hh->minLeftSideBearing = int2w16(clamp16(lmin));
+	hh->minRightSideBearing = int2w16(clamp16(rmin));
+	hh->xMaxExtent = int2w16(clamp16(xext));
+	hh->numberOfHMetrics = uint2w16(nh);
+	head->xMin = int2w16(bb[0]);
+	head->yMin = int2w16(bb[1]);
+	head->xMax = int2w16(bb[2]);
+	head->yMax = int2w16(bb[3]);
+	LOG_INFO("instanced %u glyphs, 'glyf' %zu -> %zu bytes, %u -> %u horizontal metrics", nloca, glyflen, outlen, w2uint16(((const WoffTableHhea*)hheabuf)->numberOfHMetrics), nh);
+	hh->print("  ", "instanced hhea table");
+	bool rv = set_table("hmtx", (const char*)m, mlen) && set_table("hhea", hheabuf, w2uint32(hhea->origLength));
+	arena.free(m);
+	arena.free(adv);
+	arena.free(lsb);
+	arena.free(ncont);
+	arena.free(box);
+	arena.free(ppl);
+
+	// loca in the original format if it still fits
+	unsigned format = indexToLocFormat;
+	if (!format && outlen > 2*0xFFFFu) {
+		format = 1;
+		LOG_INFO("long 'loca' offsets for %zu bytes of 'glyf'", outlen);
+	}
+	const size_t localen = (nloca+1) * (format? sizeof(wuint32_t): sizeof(wuint16_t));
+	char* locabuf = (char*)arena.alloc(localen);
+	for (unsigned i=0; i<nloca+1; ++i) {
+		if (format) ((wuint32_t*)locabuf)[i] = uint2w32(newloca[i]);
+		else ((wuint16_t*)locabuf)[i] = uint2w16(newloca[i] / 2);
+	}
+	head->indexToLocFormat = uint2w16(format);
+	rv = rv && set_table("glyf", out, outlen) && set_table("loca", locabuf, localen) && set_table("head", headbuf, sizeof(WoffTableHead));
+	arena.free(out);
+	arena.free(locabuf);
+	if (!index || loca != index->getLoca()) arena.free(loca);
+	loca = newloca;
+	indexToLocFormat = format;
+	glyf_sum.clear();
+	if (!rv) return false;
+
+	char* os2buf = NULL;
+	WoffTableDirectoryEntry* os2 = (get_table_index("OS/2") >= 0)? get_table("OS/2", &os2buf): NULL;
+	if (os2 && w2uint32(os2->origLength) >= 8) { // xAvgCharWidth by the new advances, usWeightClass and usWidthClass by the pinned axes
+		((wint16_t*)os2buf)[1] = int2w16(nadv? (int16_t)MIN((uint64_t)INT16_MAX, (2*sumadv + nadv) / (2*nadv)): 0); // rounded, as by fontTools
+		for (std::vector<axis_pin_t>::const_iterator it=pins.begin(); it!=pins.end(); ++it) {
+			if (it->tag == 0x77676874u) { // 'wght'
+				((wuint16_t*)os2buf)[2] = uint2w16((uint16_t)MAX(1.0f, MIN(1000.0f, floorf(it->value + 0.5f))));
+			} else if (it->tag == 0x77647468u) { // 'wdth'
+				((wuint16_t*)os2buf)[3] = uint2w16(width_class(it->value));
+			}
+		}
+		if (!set_table("OS/2", os2buf, w2uint32(os2->origLength))) return false;
+	}
+	if (get_table_index("MVAR") >= 0 && !instance_mvar(inst)) return false;
+	if (get_table_index("cvar") >= 0 && !instance_cvt(inst)) return false;
+
+	static const char* const variations[] = {"fvar", "gvar", "avar", "cvar", "HVAR", "VVAR", "MVAR", "STAT"};
+	for (unsigned t=0; t<sizeof(variations)/sizeof(*variations); ++t) {
+		drop_table(variations[t]);
+	}
+	return true;
+}
+
+
+static const wuint16_t* hmtx_view(const char* hheabuf, size_t hhealen, const char* hmtxbuf, size_t hmtxlen, unsigned nglyphs, unsigned& nhm) {
+	// advance and lsb pairs, then lsb only, as by the number of metrics in hhea
+	if (hhealen < sizeof(WoffTableHhea) || !nglyphs) return NULL;
+	nhm = MIN(w2uint16(((const WoffTableHhea*)hheabuf)->numberOfHMetrics), nglyphs);
+	return nhm? View(hmtxbuf, hmtxlen).get<wuint16_t>(0, 2*nhm + (nglyphs - nhm)): NULL;
+}
+
+
+bool Woff::merge(Woff& other, const std::vector<char_range_t>& chars) {
+	// glyphs appended after the own ones with new numbers, scaled to the own unitsPerEm, without hinting, and the own mapping wins
+	if (cff || other.cff) {
+		LOG("merging CFF outlines is not supported");
+		return false;
+	}
+	assert(loca && other.loca && other.depidx && !glyph_ops);
+	char* headbuf = NULL;
+	char* hheabuf = NULL;
+	char* hmtxbuf = NULL;
+	char* glyfbuf = NULL;
+	char* maxpbuf = NULL;
+	char* cmapbuf = NULL;
+	char* oheadbuf = NULL;
+	char* ohheabuf = NULL;
+	char* ohmtxbuf = NULL;
+	char* oglyfbuf = NULL;
+	char* omaxpbuf = NULL;
+	WoffTableDirectoryEntry* hhea = get_table("hhea", &hheabuf);
+	WoffTableDirectoryEntry* hmtx = get_table("hmtx", &hmtxbuf);
+	WoffTableDirectoryEntry* glyf = get_table("glyf", &glyfbuf);
+	WoffTableDirectoryEntry* maxp = get_table("maxp", &maxpbuf);
+	WoffTableDirectoryEntry* cmap = get_table("cmap", &cmapbuf);
+	WoffTableDirectoryEntry* ohhea = other.get_table("hhea", &ohheabuf);
+	WoffTableDirectoryEntry* ohmtx = other.get_table("hmtx", &ohmtxbuf);
+	WoffTableDirectoryEntry* oglyf = other.get_table("glyf", &oglyfbuf);
+	WoffTableDirectoryEntry* omaxp = other.get_table("maxp", &omaxpbuf);
+	if (!hhea || !hmtx || !glyf || !maxp || !cmap || !get_table("head", &headbuf)) return false;
+	if (!ohhea || !ohmtx || !oglyf || !omaxp || !other.get_table("head", &oheadbuf)) return false;
+	WoffTableHead* head = (WoffTableHead*)headbuf;
+	WoffTableHhea* hh = (WoffTableHhea*)hheabuf;
+	const size_t glyflen = w2uint32(glyf->origLength), oglyflen = w2uint32(oglyf->origLength), maxplen = w2uint32(maxp->origLength);
+	unsigned nhm, onhm;
+	const wuint16_t* mtx = hmtx_view(hheabuf, w2uint32(hhea->origLength), hmtxbuf, w2uint32(hmtx->origLength), nloca, nhm);
+	const wuint16_t* omtx = hmtx_view(ohheabuf, w2uint32(ohhea->origLength), ohmtxbuf, w2uint32(ohmtx->origLength), other.nloca, onhm);
+	if (!mtx || !omtx) {
+		LOG("invalid 'hmtx'");
+		return false;
+	}
+	const unsigned upem = w2uint16(head->unitsPerEm), oupem = w2uint16(((const WoffTableHead*)oheadbuf)->unitsPerEm);
+	if (upem < 16 || oupem < 16 || maxplen < 6 || w2uint32(omaxp->origLength) < 6 || loca[nloca] > glyflen) {
+		LOG("invalid 'head', 'maxp' or 'loca'");
+		return false;
+	}
+	const float s = (float)upem / oupem;
+
+	// glyphs of the chars that are still free here, with their components
+	uint8_t* need = (uint8_t*)arena.calloc(other.nloca, sizeof(uint8_t));
+	std::vector<cmap_run_t, ArenaAllocator<cmap_run_t> > added((ArenaAllocator<cmap_run_t>(arena)));
+	std::vector<index_t, ArenaAllocator<index_t> > stack((ArenaAllocator<index_t>(arena)));
+	size_t conflicts = 0;
+	for (std::vector<char_range_t>::const_iterator it=chars.begin(); it!=chars.end(); ++it) {
+		for (char_t c=it->from; c<=it->to; ++c) {
+			const index_t g = other.cmaps.find(c);
+			if (!g || g >= other.nloca) continue;
+			if (cmaps.find(c)) {
+				LOG_INFO("char %04x is mapped already, not merged", c);
+				++conflicts;
+				continue;
+			}
+			added.push_back((cmap_run_t){c, c, g, 0});
+			if (!need[g]) {
+				need[g] = 1;
+				stack.push_back(g);
+			}
+		}
+	}
+	while (!stack.empty()) {
+		const index_t i = stack.back();
+		stack.pop_back();
+		for (uint32_t d=other.depidx[i]; d<other.depidx[i+1]; ++d) {
+			if (other.deps[d] < other.nloca && !need[other.deps[d]]) {
+				need[other.deps[d]] = 1;
+				stack.push_back(other.deps[d]);
+			}
+		}
+	}
+	index_t* ids = (index_t*)arena.calloc(other.nloca, sizeof(index_t));
+	unsigned n = nloca;
+	for (index_t g=1; g<other.nloca; ++g) {
+		if (need[g]) ids[g] = n++;
+	}
+	arena.free(need);
+	if (conflicts) LOG("%zu chars are mapped already and not merged", conflicts);
+	if (n == nloca) {
+		LOG("no glyphs to merge");
+		arena.free(ids);
+		return true;
+	}
+	if (n > 0xFFFFu) {
+		LOG("too many glyphs to merge: %u", n);
+		arena.free(ids);
+		return false;
+	}
+
+	// the own glyph data as is, then the others re-encoded
+	uint32_t* newloca = (uint32_t*)arena.alloc((n+1) * sizeof(uint32_t));
+	uint16_t* adv = (uint16_t*)arena.alloc(n * sizeof(uint16_t));
+	int16_t* lsb = (int16_t*)arena.alloc(n * sizeof(int16_t));
+	memcpy(newloca, loca, nloca * sizeof(uint32_t));
+	size_t outlen = loca[nloca], cap = outlen + (oglyflen + oglyflen/4) * MAX(s, 1.0f) + 64;
+	char* out = (char*)arena.alloc(cap);
+	memcpy(out, glyfbuf, outlen);
+	if (outlen % 2) out[outlen++] = '\0';
+	for (index_t i=0; i<nloca; ++i) {
+		adv[i] = w2uint16(mtx[2 * MIN(i, nhm-1)]);
+		lsb[i] = (int16_t)w2uint16((i < nhm)? mtx[2*i + 1]: mtx[2*nhm + (i-nhm)]);
+	}
+	int32_t lmin = w2int16(hh->minLeftSideBearing), rmin = w2int16(hh->minRightSideBearing), xext = w2int16(hh->xMaxExtent);
+	int32_t bb[4] = {w2int16(head->xMin), w2int16(head->yMin), w2int16(head->xMax), w2int16(head->yMax)};
+	unsigned amax = w2uint16(hh->advanceWidthMax);
+	bool rv = true;
+	GlyphOutline o(arena);
+	for (index_t g=1, i=nloca; g<other.nloca && rv; ++g) {
+		if (!ids[g]) continue;
+		newloca[i] = outlen;
+		adv[i] = (uint16_t)MIN(65535.0f, floorf(w2uint16(omtx[2 * MIN(g, onhm-1)]) * s + 0.5f));
+		lsb[i] = clamp16((int16_t)w2uint16((g < onhm)? omtx[2*g + 1]: omtx[2*onhm + (g-onhm)]) * s);
+		amax = MAX(amax, adv[i]);
+		const uint32_t from = other.loca[g], to = other.loca[g+1];
+		if (from > to || to > oglyflen || !o.decode(oglyfbuf + from, to - from)) {
+			LOG("invalid glyph #%u", g);
+			rv = false;
+			break;
+		}
+		for (unsigned k=0; o.ncontours < 0 && k<o.n; ++k) {
+			if (o.component(k) >= other.nloca || !ids[o.component(k)]) {
+				LOG("invalid composite glyph #%u", g);
+				rv = false;
+			} else {
+				o.set_component(k, ids[o.component(k)]);
+			}
+		}
+		++i;
+		if (from == to || !rv) continue;
+		o.drop_instructions(); // as the programs of the other font are not merged
+		if (s != 1.0f) o.scale(s);
+		int16_t b[4];
+		if (o.ncontours > 0) o.bounds(b);
+		else memcpy(b, o.bbox, sizeof(b));
+		if (cap < outlen + o.max_size() + 1) {
+			cap = 2*cap + o.max_size();
+			out = (char*)arena.realloc(out, cap);
+		}
+		outlen += o.encode(out + outlen, b);
+		if (outlen % 2) out[outlen++] = '\0';
+		if (!o.ncontours) continue;
+		const int32_t w = b[2] - b[0];
+		lmin = MIN(lmin, lsb[i-1]);
+		rmin = MIN(rmin, adv[i-1] - lsb[i-1] - w);
+		xext = MAX(xext, lsb[i-1] + w);
+		for (unsigned c=0; c<2; ++c) {
+			bb[c] = MIN(bb[c], b[c]);
+			bb[c+2] = MAX(bb[c+2], b[c+2]);
+		}
+	}
+	newloca[n] = outlen;
+	for (std::vector<cmap_run_t, ArenaAllocator<cmap_run_t> >::iterator it=added.begin(); it!=added.end(); ++it) {
+		it->glyph = ids[it->glyph];
+	}
+	arena.free(ids);
+	if (!rv) {
+		arena.free(out);
+		arena.free(newloca);
+		arena.free(adv);
+		arena.free(lsb);
+		return false;
+	}
+
+	// metrics, as long ones up to the trailing run of the same advance
+	unsigned nh = n;
+	while (nh > 1 && adv[nh-1] == adv[nh-2]) --nh;
+	const size_t mlen = 4*nh + 2*(n - nh);
+	uint8_t* m = (uint8_t*)arena.alloc(mlen);
+	for (index_t i=0; i<n; ++i) {
+		if (i < nh) {
+			((wuint16_t*)m)[2*i] = uint2w16(adv[i]);
+			((wint16_t*)m)[2*i + 1] = int2w16(lsb[i]);
+		} else {
+			((wint16_t*)m)[2*nh + (i-nh)] = int2w16(lsb[i]);
+		}
+	}
+	arena.free(adv);
+	arena.free(lsb);
+	hh->advanceWidthMax = uint2w16(amax);
+	hh->minLeftSideBearing = int2w16(clamp16(lmin));
+	hh->minRightSideBearing = int2w16(clamp16(rmin));
+	hh->xMaxExtent = int2w16(clamp16(xext));
+	hh->numberOfHMetrics = uint2w16(nh);
+	head->xMin = int2w16(bb[0]);
+	head->yMin = int2w16(bb[1]);
+	head->xMax = int2w16(bb[2]);
+	head->yMax = int2w16(bb[3]);
+	rv = set_table("hmtx", (const char*)m, mlen) && set_table("hhea", hheabuf, w2uint32(hhea->origLength));
+	arena.free(m);
+
+	// maxp by the larger outline limits, the instruction ones are still the own
+	wuint16_t* mp = (wuint16_t*)maxpbuf;
+	mp[2] = uint2w16(n);
+	if (maxplen >= 32 && w2uint32(omaxp->origLength) >= 32) {
+		static const unsigned limits[] = {3, 4, 5, 6, 14, 15}; // maxPoints, maxContours, maxCompositePoints, maxCompositeContours, maxComponentElements, maxComponentDepth
+		for (unsigned k=0; k<sizeof(limits)/sizeof(*limits); ++k) {
+			mp[limits[k]] = uint2w16(MAX(w2uint16(mp[limits[k]]), w2uint16(((const wuint16_t*)omaxpbuf)[limits[k]])));
+		}
+	}
+	rv = rv && set_table("maxp", maxpbuf, maxplen);
+
+	unsigned format = indexToLocFormat;
+	if (!format && outlen > 2*0xFFFFu) {
+		format = 1;
+		LOG_INFO("long 'loca' offsets for %zu bytes of 'glyf'", outlen);
+	}
+	const size_t localen = (n+1) * (format? sizeof(wuint32_t): sizeof(wuint16_t));
+	char* locabuf = (char*)arena.alloc(localen);
+	for (unsigned i=0; i<n+1; ++i) {
+		if (format) ((wuint32_t*)locabuf)[i] = uint2w32(newloca[i]);
+		else ((wuint16_t*)locabuf)[i] = uint2w16(newloca[i] / 2);
+	}
+	head->indexToLocFormat = uint2w16(format);
+	LOG("merged %u glyphs of %zu chars, 'glyf' %zu -> %zu bytes", n - nloca, added.size(), glyflen, outlen);
+	rv = rv && set_table("glyf", out, outlen) && set_table("loca", locabuf, localen) && set_table("head", headbuf, sizeof(WoffTableHead));
+	arena.free(out);
+	arena.free(locabuf);
+
+	// per-glyph state for the new glyphs, which have no components left to select and are never dropped
+	if (!index || loca != index->getLoca()) arena.free(loca);
+	loca = newloca;
+	indexToLocFormat = format;
+	if (index && depidx == index->getDepIndex()) { // read-only from the index, keep and dropped are always our own
+		depidx = (uint32_t*)memcpy(arena.alloc((n+1) * sizeof(uint32_t)), depidx, (nloca+1) * sizeof(uint32_t));
+	} else {
+		depidx = (uint32_t*)arena.realloc(depidx, (n+1) * sizeof(uint32_t));
+	}
+	for (unsigned i=nloca+1; i<=n; ++i) depidx[i] = depidx[nloca];
+	if (keep) {
+		keep = (uint8_t*)arena.realloc(keep, n);
+		memset(keep + nloca, 1, n - nloca);
+	}
+	if (dropped) {
+		dropped = (uint8_t*)arena.realloc(dropped, n);
+		memset(dropped + nloca, 0, n - nloca);
+	}
+	nloca = n;
+	glyf_sum.clear();
+
+	cmaps.insert(added.empty()? NULL: &added[0], added.size());
+	size_t cmaplen;
+	char* enc = cmaps.encode(cmapbuf, w2uint32(cmap->origLength), cmaplen);
+	if (!enc) {
+		LOG("cannot encode character map");
+		return false;
+	}
+	rv = rv && set_table("cmap", enc, cmaplen);
+	arena.free(enc);
+
+	char* postbuf = NULL;
+	WoffTableDirectoryEntry* post = (get_table_index("post") >= 0)? get_table("post", &postbuf): NULL;
+	if (rv && post && w2uint32(post->origLength) >= 32 && w2uint32(*(const wuint32_t*)postbuf) != 0x00030000u) { // without glyph names, as they would be by number
+		*(wuint32_t*)postbuf = uint2w32(0x00030000u);
+		rv = set_table("post", postbuf, 32);
+	}
+
+	// tables by glyph that the new ones are missing from, variations at the default instance then
+	static const char* const per_glyph[] = {"hdmx", "LTSH", "vhea", "vmtx", "fvar", "gvar", "avar", "cvar", "HVAR", "VVAR", "MVAR", "STAT"};
+	for (unsigned t=0; t<sizeof(per_glyph)/sizeof(*per_glyph); ++t) {
+		drop_table(per_glyph[t]);
+	}
+	return rv;
+}
+
+
+bool Woff::deleteCharIndex(index_t index) {
+	assert(nloca && (loca || cff));
+	if (!index) return true; // seems to mess up some things?
+	if (index >= nloca) return false;
+	if (!(keep && keep[index]) && (cff || index != nloca-1)) {
+		if (!dropped) dropped = (uint8_t*)arena.calloc(nloca, sizeof(uint8_t));
+		dropped[index] = 1; // even if already stripped, its char is gone now
+	}
+	if (cff) {
+		if (keep && keep[index]) {
+			LOG_INFO("kept character #%u, still in use", index);
+		} else if (!cff->drop(index)) {
+			LOG_INFO("kept character #%u, is already stripped?", index);
+		} else {
+			LOG_INFO("replaced character #%u with dummy value", index);
+		}
+		return true;
+	}
+	if (index == nloca-1) return true; // keep last one as loca/glyf end marker
+
+	if (loca[index] == loca[index+1]) {
+		return true; // already nothing here
+	}
+	if (keep && keep[index]) {
+		LOG_INFO("kept character #%u, still in use", index);
+		return true;
+	}
+	if (config.glyf_window) { // applied when streaming, with loca
+		if (loca[index+1] - loca[index] <= sizeof(WoffGlyph)) {
+			LOG_INFO("kept character #%u, is already stripped?", index);
+			return true;
+		}
+		if (!glyph_ops) glyph_ops = (uint8_t*)arena.calloc(nloca, sizeof(uint8_t));
+		glyph_ops[index] |= GLYPH_DELETE;
+		LOG_INFO("replacing character #%u with dummy value", index);
+		return true;
+	}
+	size_t dellen;
+	if (!delete_glyph(index, dellen)) return false; // e.g. glyf cannot be decoded
+	if (!dellen) {
+		LOG_INFO("kept character #%u, is already stripped?", index);
+		return true;
+	}
+
+	char* locabuf = NULL;
+	WoffTableDirectoryEntry* l = get_table("loca", &locabuf);
+	if (!l) return false;
+	const uint32_t localen = w2uint32(l->origLength);
+	for (unsigned i=index+1; i<nloca+1; ++i) {
+		loca[i] -= dellen;
+	}
+	uint32_t csum = known_checksum(l - tables);
+	if (indexToLocFormat) {
+		be32_sub((wuint32_t*)locabuf + index+1, nloca-index, dellen); // ascending and/or != 0 seems to be expected
+		csum -= (nloca-index) * (uint32_t)dellen; // a word each
+	} else {
+		assert(dellen % 2 == 0);
+		be16_sub((wuint16_t*)locabuf + index+1, nloca-index, dellen/2);
+		const uint32_t high = nloca/2 - index/2; // even entries in index+1..nloca are the upper half of a word
+		csum -= (dellen/2) * (high * 0x10000u + (nloca-index - high));
+	}
+
+	if (!set_table_sum("loca", locabuf, localen, csum)) {
 		return false;
 	}
-	free(locabuf);
 
 	LOG_INFO("replaced character #%u with dummy value", index);
 	return true;
 }
 
 
-char* Woff::toBuf(size_t& len) {
-	len = (size_t)w2uint32(header->length);
-	char* buf = (char*)memset(malloc(len), 0, len);
+bool Woff::updateCharMap(const std::vector<char_range_t>& deleted) {
+	if (deleted.empty()) return true;
+	char* buf = NULL;
+	WoffTableDirectoryEntry* cmap = get_table("cmap", &buf);
+	if (!cmap) return false;
+
+	cmaps.remove(deleted);
+	size_t len;
+	char* enc = cmaps.encode(buf, w2uint32(cmap->origLength), len);
+	if (!enc) {
+		LOG("cannot encode character map, keeping the original one");
+		return true;
+	}
+	LOG_INFO("encoded character map: %u -> %zu bytes", w2uint32(cmap->origLength), len);
+	bool rv = set_table("cmap", enc, len);
+	arena.free(enc);
+	return rv;
+}
+
+
+static size_t xml_minify(char* s, size_t len) {
+	// whitespace-only text between markup and around the document, any other text content is kept
+	size_t o = 0;
+	for (size_t i=0; i<len; ) {
+		if (isspace((unsigned char)s[i]) && (!o || s[o-1] == '>')) {
+			size_t j = i;
+			while (j < len && isspace((unsigned char)s[j])) ++j;
+			if (j == len || s[j] == '<') {
+				i = j;
+				continue;
+			}
+		}
+		s[o++] = s[i++];
+	}
+	return o;
+}
+
+
+bool Woff::updateMetadata(unsigned mode) {
+	if (!meta || mode == META_KEEP) return true;
+	if (mode == META_DROP) {
+		LOG_INFO("dropping metadata");
+		meta = NULL;
+		meta_len = meta_orig_len = 0;
+		return true;
+	}
+
+	char* xml = NULL;
+	if (!decompress(meta, meta_len, xml, meta_orig_len, arena, false)) { // always compressed, regardless of the length
+		LOG("cannot decompress metadata");
+		return false;
+	}
+	const size_t len = xml_minify(xml, meta_orig_len);
+	if (!len) {
+		LOG_INFO("dropping empty metadata");
+		meta = NULL;
+		meta_len = meta_orig_len = 0;
+		return true;
+	}
+	char* cdata;
+	size_t clen;
+	if (!docompress(xml, len, cdata, &clen, arena, false)) return false;
+	LOG_INFO("minified metadata: %zu -> %zu bytes, compressed %zu -> %zu", meta_orig_len, len, meta_len, clen);
+	arena.free(xml);
+	meta = cdata;
+	meta_len = clen;
+	meta_orig_len = len;
+	return true;
+}
+
+
+static void iov_push(std::vector<struct iovec>& v, const void* p, size_t l, size_t padded=0) {
+	static const char zeros[4] = {};
+	if (l) v.push_back((struct iovec){(void*)p, l}); // const-cast
+	if (padded > l) {
+		assert(padded - l <= sizeof(zeros));
+		v.push_back((struct iovec){(void*)zeros, padded - l});
+	}
+}
+
+
+size_t Woff::toIov(std::vector<struct iovec>& iov) {
+	if (sfnt_out) return toSfntIov(iov);
 
-	memcpy(buf, header, sizeof(WoffHeader));
-	assert(sizeof(WoffTableDirectoryEntry) % 4 == 0);
-	memcpy(buf + PAD4(sizeof(WoffHeader)), tables, ntables * sizeof(WoffTableDirectoryEntry));
+	assert(sizeof(WoffHeader) % 4 == 0 && sizeof(WoffTableDirectoryEntry) % 4 == 0);
+	const unsigned n = out_tables();
+	size_t len = sizeof(WoffHeader) + n * sizeof(WoffTableDirectoryEntry);
+	iov_push(iov, header, sizeof(WoffHeader));
+	if (n == ntables) {
+		iov_push(iov, tables, ntables * sizeof(WoffTableDirectoryEntry));
+	} else { // a compacted copy
+		WoffTableDirectoryEntry* dir = (WoffTableDirectoryEntry*)arena.alloc(MAX(n, 1) * sizeof(WoffTableDirectoryEntry));
+		for (unsigned i=0, j=0; i<ntables; ++i) {
+			if (!(table_state[i] & TABLE_DROPPED)) dir[j++] = tables[i];
+		}
+		iov_push(iov, dir, n * sizeof(WoffTableDirectoryEntry));
+	}
 	for (unsigned i=0; i<ntables; ++i) {
-		assert(w2uint32(tables[i].offset) % 4 == 0);
-		memcpy(buf + w2uint32(tables[i].offset), table_data[i], w2uint32(tables[i].compLength));
+		if (table_state[i] & TABLE_DROPPED) continue;
+		assert(w2uint32(tables[i].offset) == len);
+		const size_t l = w2uint32(tables[i].compLength);
+		iov_push(iov, table_data[i], l, PAD4(l));
+		len += PAD4(l);
+	}
+	if (meta) {
+		iov_push(iov, meta, meta_len);
+		len += meta_len;
+	}
+	if (priv) {
+		iov_push(iov, NULL, 0, PAD4(len) - len);
+		iov_push(iov, priv, priv_len);
+		len = PAD4(len) + priv_len;
+	}
+
+	assert(len == w2uint32(header->length));
+	return len;
+}
+
+
+size_t Woff::toSfntIov(std::vector<struct iovec>& iov) {
+	const size_t dirlen = PAD4(sizeof(SfntHeader)) + out_tables() * sizeof(SfntTableDirectoryEntry);
+	char* dir = (char*)arena.calloc(1, dirlen);
+	SfntTableDirectoryEntry* entries = (SfntTableDirectoryEntry*)(dir + PAD4(sizeof(SfntHeader)));
+	sfnt_directory(*(SfntHeader*)dir, entries);
+
+	size_t len = dirlen;
+	iov_push(iov, dir, dirlen);
+	for (unsigned i=0, j=0; i<ntables; ++i) {
+		if (table_state[i] & TABLE_DROPPED) continue;
+		assert(table_plain[i]);
+		assert(w2uint32(entries[j].offset) == len);
+		const size_t l = w2uint32(entries[j].length);
+		iov_push(iov, table_plain[i], l, PAD4(l));
+		len += PAD4(l);
+		++j;
+	}
+
+	assert(len == w2uint32(header->totalSfntSize));
+	return len;
+}
+
+
+bool Woff::dump(Dump& out, unsigned sections) {
+	if (sections & DUMP_HEADER) {
+		out.begin("header");
+		out.str("signature", w2str32(header->signature));
+		out.hex("flavor", w2uint32(header->flavor), 8);
+		out.num("length", w2uint32(header->length));
+		out.num("numTables", w2uint16(header->numTables));
+		out.num("totalSfntSize", w2uint32(header->totalSfntSize));
+		out.num("majorVersion", w2uint16(header->majorVersion));
+		out.num("minorVersion", w2uint16(header->minorVersion));
+		out.num("metaOffset", w2uint32(header->metaOffset));
+		out.num("metaLength", w2uint32(header->metaLength));
+		out.num("metaOrigLength", w2uint32(header->metaOrigLength));
+		out.num("privOffset", w2uint32(header->privOffset));
+		out.num("privLength", w2uint32(header->privLength));
+		out.end();
+	}
+
+	if (sections & DUMP_TABLES) {
+		for (unsigned i=0; i<ntables; ++i) {
+			if (table_state[i] & TABLE_DROPPED) continue;
+			out.begin("table");
+			out.str("tag", w2str32(tables[i].tag));
+			out.num("offset", w2uint32(tables[i].offset));
+			out.num("compLength", w2uint32(tables[i].compLength));
+			out.num("origLength", w2uint32(tables[i].origLength));
+			out.hex("origChecksum", w2uint32(tables[i].origChecksum), 8);
+			out.end();
+		}
+	}
+
+	unsigned locFormat = 0;
+	if (sections & (DUMP_HEAD|DUMP_LOCA)) {
+		char* buf = NULL;
+		if (!get_table("head", &buf)) return false;
+		const WoffTableHead* head = (const WoffTableHead*)buf;
+		locFormat = w2uint16(head->indexToLocFormat);
+		if (sections & DUMP_HEAD) {
+			out.begin("head");
+			out.hex("checkSumAdjustment", w2uint32(head->checkSumAdjustment), 8);
+			out.hex("flags", w2uint16(head->flags));
+			out.inum("xMin", w2int16(head->xMin));
+			out.inum("yMin", w2int16(head->yMin));
+			out.inum("xMax", w2int16(head->xMax));
+			out.inum("yMax", w2int16(head->yMax));
+			out.num("indexToLocFormat", locFormat);
+			out.end();
+		}
+	}
+
+	if (sections & DUMP_CMAP) {
+		char* buf = NULL;
+		WoffTableDirectoryEntry* cmap = get_table("cmap", &buf);
+		if (!cmap) return false;
+		bool rv = Cmaps::dump(buf, w2uint32(cmap->origLength), out);
+		if (!rv) return false;
+	}
+
+	if ((sections & DUMP_LOCA) && get_table_index("loca") >= 0) { // none for CFF
+		char* buf = NULL;
+		WoffTableDirectoryEntry* l = get_table("loca", &buf);
+		if (!l) return false;
+		const size_t n = w2uint32(l->origLength) / (locFormat? sizeof(wuint32_t): sizeof(wuint16_t));
+		out.begin("loca");
+		out.num("format", locFormat);
+		out.num("glyphs", n? n-1: 0);
+		out.array("offsets");
+		for (size_t i=0; i<n; ++i) {
+			out.elem(locFormat? w2uint32(((wuint32_t*)buf)[i]): w2uint16(((wuint16_t*)buf)[i]) * 2u);
+		}
+		out.array_end();
+		out.end();
 	}
 
-	return buf;
+	return out.flush();
 }
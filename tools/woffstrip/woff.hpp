@@ -1,55 +1,145 @@
 #pragma once
 #include "main.hpp"
 #include "cmaps.hpp"
+#include "dump.hpp"
+#include "index.hpp"
+#include "arena.hpp"
+#include "chunked.hpp"
+#include "tablecache.hpp"
+#include "glyfstream.hpp"
+#include "checksum.hpp"
+#include "instance.hpp"
+#include "cff.hpp"
+#include "layout.hpp"
+#include "estimate.hpp"
 #include <vector>
+#include <sys/uio.h>
+
+
+// handling of the extended metadata block
+#define META_KEEP   0 // as is, still compressed
+#define META_MINIFY 1 // without insignificant whitespace, recompressed
+#define META_DROP   2
+
+#define GLYF_CHUNK (64*1024) // minimum size of glyf chunks that are deflated on their own
 
 
 class Woff {
 	private:
+		mutable Arena arena; // owns all buffers below, released at once
 		const char* const orig_buf;
 		const size_t orig_len;
+		const uint64_t orig_mtime; // of the source file, 0 if unknown
 
 		WoffHeader* header;
 
 		unsigned ntables;
+		const WoffTableDirectoryEntry* orig_tables; // as parsed
 		WoffTableDirectoryEntry* tables;
-		char** table_data;
+		char** table_data; // as in the file, compressed or not
+		char** table_plain; // decoded on demand and changed in-place
+		uint8_t* table_state;
+		bool sfnt_in, sfnt_out;
+
+		const char* meta; // compressed, borrowed from the input or owned
+		size_t meta_len, meta_orig_len;
+		const char* priv; // borrowed from the input
+		size_t priv_len;
 
 		unsigned indexToLocFormat;
 		unsigned nloca;
-		range_t* loca;
+		uint32_t* loca; // glyph offsets, nloca+1
+		Cff* cff; // instead, for CFF or CFF2 outlines
+
+		uint32_t* depidx; // composite glyph components, nloca+1
+		uint32_t* deps;
+		uint8_t* keep; // glyphs still in use by the remaining chars
+		uint8_t* dropped; // glyphs of the deleted chars otherwise, for pruning the layout tables
+		uint8_t* glyph_ops; // pending GLYPH_* when streaming glyf
+		unsigned glyph_align;
+
+		std::vector<index_t> glyf_chunks; // first glyphs, kept when reverting
+		ChunkedDeflate glyf_deflate;
+		SpanChecksum glyf_sum; // by glyph once edited in memory, with leading and trailing data as first and last span
 
+		Cmaps orig_cmaps; // as parsed, the one below borrows from it
 		Cmaps cmaps;
+		FontIndex* index;
+		TableCache* table_cache; // shared, optional
+		uint64_t* plain_hash; // of the tables as decoded from the input, for deterministic output only
 
-		static wuint32_t checksum(const wuint32_t*, size_t, wuint32_t=0);
+		static uint32_t checksum(const void*, size_t, uint32_t=0); // host order sum of big-endian words
+		unsigned out_tables() const; // not dropped
+		void sfnt_directory(SfntHeader&, SfntTableDirectoryEntry*) const;
 		wuint32_t sfnt_checksum() const;
 		bool update_sfnt_checksum();
 		static wuint32_t table_checksum(const char*, const char*, size_t);
+		uint32_t known_checksum(unsigned);
+		bool sum_glyf(const char*, size_t);
 
 		int get_table_index(const char*) const;
-		WoffTableDirectoryEntry* get_table(const char*, char** =NULL);
+		WoffTableDirectoryEntry* get_table(const char*, char** =NULL); // decoded data is owned and cached
+		char* get_plain(unsigned);
 		bool set_table(const char*, const char*, size_t, bool=true);
+		bool set_table_sum(const char*, const char*, size_t, uint32_t); // with a checksum as maintained by the caller
+		void drop_table(const char*);
+		bool compress_tables();
+		bool verify_compressed(const char*, size_t, const char*, size_t);
+		bool compress_glyf(const char*, size_t, char*&, size_t&);
+		void chunk_glyphs();
 
 		WoffGlyph* get_glyph(size_t, size_t, char*&, size_t&);
 		int align_glyph(WoffGlyph*, int);
-		size_t delete_glyph(size_t, size_t);
+		bool delete_glyph(index_t, size_t&); // bytes removed, none if already stripped
+		bool open_glyf(GlyfReader&, size_t&);
+		bool stream_glyf();
+		bool parse_cff();
+		bool update_cff();
+		bool update_layout();
+		bool layout_size(const uint8_t*, bool, size_t&); // as pruned for the given dropped glyphs
+		void index_source(FontIndexHeader&, bool) const; // for checking an index against, optionally with the full hash
+		bool instance_mvar(const Instancer&); // font-wide metrics at the pinned axes
+		bool instance_cvt(Instancer&);
 
 		bool update_offsets();
+		bool parse_blocks();
+		void sort_tables();
+		void load_table(unsigned);
+		void revert_cmaps();
+		bool parseSfntHeader();
+		bool parseSfntTables();
+		bool parseHead();
+		size_t toSfntIov(std::vector<struct iovec>&);
 
 	public:
-		Woff(char* b, size_t l);
+		Woff(char* b, size_t l, uint64_t mtime=0);
 		~Woff();
 
 		bool parseHeader();
 		bool parseTables();
 		bool parseCharMaps();
 		bool parseLoca();
+		bool parseComposites();
+		bool loadIndex(const char*);
+		bool writeIndex(const char*) const;
+		bool revert(); // undo all changes, for another run
+		bool dump(Dump&, unsigned);
 
 		const Cmaps& getCharMap() const { return cmaps; }
+		void selectGlyphs(const std::vector<char_range_t>&);
+		bool buildEstimate(Estimate&, bool=false); // cost model of the output, optionally for raw sfnt
+		bool loadPrevious(Woff&); // glyph data of an earlier output of this font, restoring the selected glyphs
+		bool instance(const std::vector<axis_pin_t>&, const std::vector<char_range_t>&); // static at the pinned axes, without the glyphs of the deleted chars
+		bool merge(Woff&, const std::vector<char_range_t>&); // glyphs of these chars of another font appended, unless mapped here already
 		bool deleteCharIndex(index_t index);
+		bool updateCharMap(const std::vector<char_range_t>&); // without the given deleted chars
 		unsigned getMinAlignment(const std::vector<char_range_t>&, unsigned);
 		bool alignCharIndex(index_t, unsigned);
+		bool updateMetadata(unsigned); // META_*
 
-		bool finalize();
-		char* toBuf(size_t&);
+		void setTableCache(TableCache* c) { table_cache = c; }
+		bool isSfnt() const { return sfnt_in; }
+		bool isCff() const { return cff != NULL; }
+		bool finalize(bool=false); // optionally for raw sfnt output
+		size_t toIov(std::vector<struct iovec>&); // output chunks, referencing data owned until destruction
 };